@@ -32,6 +32,7 @@
 #include <stddef.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 /* opaque types for the user */
 struct fy_token;
@@ -44,6 +45,9 @@ struct fy_node_pair;
 struct fy_anchor;
 struct fy_node_mapping_sort_ctx;
 struct fy_token_iter;
+struct fy_path_query;
+struct fy_scanf_program;
+struct fy_intern;
 
 #ifndef FY_BIT
 #define FY_BIT(x) (1U << (x))
@@ -197,6 +201,13 @@ enum fy_error_module {
  * @FYPCF_DISABLE_MMAP_OPT: Disable mmap optimization
  * @FYPCF_DISABLE_RECYCLING: Disable recycling optimization
  * @FYPCF_PARSE_COMMENTS: Enable parsing of comments (experimental)
+ * @FYPCF_DOCUMENT_ARENA: Allocate document nodes out of an arena that is
+ * 			  released in one go when the document is destroyed
+ * @FYPCF_LAZY_DOCUMENT: Build document collections lazily; their contents are
+ * 			 recorded while parsing and only turned into nodes the
+ * 			 first time they are accessed
+ * @FYPCF_COLLECT_STATS: Collect parser statistics, retrieved with
+ * 			 fy_parser_get_stats()
  */
 enum fy_parse_cfg_flags {
 	FYPCF_QUIET			= FY_BIT(0),
@@ -225,6 +236,9 @@ enum fy_parse_cfg_flags {
 	FYPCF_DISABLE_MMAP_OPT		= FY_BIT(21),
 	FYPCF_DISABLE_RECYCLING		= FY_BIT(22),
 	FYPCF_PARSE_COMMENTS		= FY_BIT(23),
+	FYPCF_DOCUMENT_ARENA		= FY_BIT(24),
+	FYPCF_LAZY_DOCUMENT		= FY_BIT(25),
+	FYPCF_COLLECT_STATS		= FY_BIT(26),
 };
 
 /* Enable diagnostic output by all modules */
@@ -252,11 +266,24 @@ void fy_set_default_parser_cfg_flags(enum fy_parse_cfg_flags pflags);
  * @search_path: Search path when accessing files, seperate with ':'
  * @flags: Configuration flags
  * @userdata: Opaque user data pointer
+ * @stream_window: When non zero, stream inputs (i.e. the ones set by
+ *                 fy_parser_set_input_fp() or files that can't be mmaped)
+ *                 are read in a sliding window of blocks of this size.
+ *                 Blocks that no live token (or event) refers to are
+ *                 released, so that parsing a stream one event at a
+ *                 time runs in constant memory. Documents keep their
+ *                 tokens, so loading a whole document does not benefit.
+ * @intern: When not NULL, the text of the mapping keys of the documents
+ *          built is interned in this table (see fy_intern_create()),
+ *          so that equal keys share a single string, across documents
+ *          and parsers that use the same table.
  */
 struct fy_parse_cfg {
 	const char *search_path;
 	enum fy_parse_cfg_flags flags;
 	void *userdata;
+	size_t stream_window;
+	struct fy_intern *intern;
 };
 
 /**
@@ -449,6 +476,49 @@ const char *fy_library_version(void);
  */
 bool fy_document_event_is_implicit(const struct fy_event *fye);
 
+/**
+ * fy_intern_create() - Create a key intern table
+ *
+ * Creates a table of interned strings, which may be shared by
+ * any number of parsers and documents by setting the @intern member
+ * of their &struct fy_parse_cfg.
+ *
+ * The text of every scalar mapping key added to such a document is
+ * looked up in the table, and the key token then refers to the single
+ * immutable copy of the string there, with its hash precomputed.
+ * Documents with many repeated keys use less memory, and key lookups
+ * by string reduce to a pointer comparison.
+ *
+ * Strings are never removed from the table; it is released when
+ * fy_intern_destroy() has been called and the last document or
+ * parser using it is gone. The table is not locked, so parsers and
+ * documents sharing it must not be modified concurrently.
+ *
+ * Returns:
+ * The created intern table, or NULL on error.
+ */
+struct fy_intern *fy_intern_create(void);
+
+/**
+ * fy_intern_destroy() - Destroy an intern table
+ *
+ * Drops the reference of the creator. Parsers and documents
+ * still using the table keep it alive until they are destroyed.
+ *
+ * @fyin: The intern table to destroy
+ */
+void fy_intern_destroy(struct fy_intern *fyin);
+
+/**
+ * fy_intern_count() - Return the number of strings in the table
+ *
+ * @fyin: The intern table
+ *
+ * Returns:
+ * The number of distinct strings interned so far.
+ */
+unsigned int fy_intern_count(struct fy_intern *fyin);
+
 /**
  * fy_parser_create() - Create a parser.
  *
@@ -472,6 +542,25 @@ struct fy_parser *fy_parser_create(const struct fy_parse_cfg *cfg);
  */
 void fy_parser_destroy(struct fy_parser *fyp);
 
+/**
+ * fy_parser_reset() - Reset a parser for reuse
+ *
+ * @fyp: The parser to reset
+ *
+ * Rewind all the scanner and parser state of @fyp, dropping
+ * any inputs and the collected diagnostics, so that it can be used
+ * to parse a new stream. The configuration is retained, and so are
+ * the pools of recycled objects, which makes parsing many small
+ * documents with one parser cheaper than creating a parser for each.
+ * The inputs are released too, so any documents loaded from the
+ * parser must be destroyed before resetting it.
+ * Statistics (if collected) are cumulative.
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_parser_reset(struct fy_parser *fyp);
+
 /**
  * fy_parser_set_input_file() - Set the parser to process the given file
  *
@@ -517,6 +606,62 @@ int fy_parser_set_string(struct fy_parser *fyp, const char *str, size_t len);
  */
 int fy_parser_set_input_fp(struct fy_parser *fyp, const char *name, FILE *fp);
 
+/**
+ * fy_parser_feed() - Feed input to the parser in push mode
+ *
+ * Append the next chunk of the stream to a parser that has no
+ * other input; the data are copied so @buf may be reused right away.
+ * The first call switches the parser to push mode, where instead of
+ * blocking for more input fy_parser_parse() returns NULL and
+ * fy_parser_need_input() returns true. The parse may then be resumed
+ * by calling fy_parser_parse() after feeding the next chunk.
+ * The end of the stream is marked by passing @last as true (an
+ * empty chunk is fine), after which no more data may be fed.
+ *
+ * On platforms without swapcontext() the parser can not be suspended
+ * mid token, so no events are produced until the last chunk is fed.
+ *
+ * @fyp: The parser
+ * @buf: The chunk of data (may be NULL if @len is 0)
+ * @len: The size of the chunk
+ * @last: True if this is the final chunk of the stream
+ *
+ * Returns:
+ * zero on success, -1 on error
+ */
+int fy_parser_feed(struct fy_parser *fyp, const void *buf, size_t len, bool last);
+
+/**
+ * fy_parser_need_input() - Check whether the parser waits for input
+ *
+ * Tells apart a NULL return of fy_parser_parse() (or a zero return of
+ * fy_parser_parse_into()) that was caused by a push mode parser
+ * running out of fed data, from the end of the stream or an error.
+ *
+ * @fyp: The parser
+ *
+ * Returns:
+ * true if more input must be fed with fy_parser_feed(), false otherwise
+ */
+bool fy_parser_need_input(struct fy_parser *fyp);
+
+/**
+ * fy_parser_validate() - Check that the input is well formed
+ *
+ * Run the parser over the rest of its input without returning
+ * events or building documents; every event is released as soon
+ * as it is produced. Parsing stops at the first error, which is
+ * the only diagnostic reported, and its position is stored in @markp.
+ *
+ * @fyp: The parser
+ * @markp: Pointer to store the mark of the first error (may be NULL)
+ *
+ * Returns:
+ * 0 if the input is well formed, -1 on error, or 1 if a push mode
+ * parser needs more input (call again after fy_parser_feed())
+ */
+int fy_parser_validate(struct fy_parser *fyp, struct fy_mark *markp);
+
 /**
  * fy_parser_parse() - Parse and return the next event.
  *
@@ -542,6 +687,95 @@ struct fy_event *fy_parser_parse(struct fy_parser *fyp);
  */
 void fy_parser_event_free(struct fy_parser *fyp, struct fy_event *fye);
 
+/**
+ * fy_parser_parse_into() - Parse the next event into a caller provided event
+ *
+ * Like fy_parser_parse() but the event is stored in @fye, which is
+ * owned by the caller, so no event needs to be freed afterwards.
+ * The references held by the previous contents of @fye are released
+ * first, so the same event may be reused for the whole stream.
+ * A fresh event must be zeroed (i.e. of type %FYET_NONE) before first
+ * use, and the last one released via fy_parser_event_release().
+ *
+ * @fyp: The parser
+ * @fye: The caller provided event
+ *
+ * Returns:
+ * 1 if an event was stored, 0 at the end of the stream, -1 on error
+ */
+int fy_parser_parse_into(struct fy_parser *fyp, struct fy_event *fye);
+
+/**
+ * fy_parser_event_release() - Release a caller provided event
+ *
+ * Release the references held by an event filled in by
+ * fy_parser_parse_into() or fy_parser_parse_batch(). The event
+ * is left as %FYET_NONE and may be reused.
+ *
+ * @fyp: The parser
+ * @fye: The event to release (may be NULL)
+ */
+void fy_parser_event_release(struct fy_parser *fyp, struct fy_event *fye);
+
+/**
+ * fy_parser_parse_batch() - Parse the next events into caller provided slots
+ *
+ * Fill up to @count events of the caller provided array @fyes.
+ * The slots are reused on every call; what they held from the previous
+ * batch is released, so a fixed array of slots can parse a stream
+ * of any length without allocating. The slots must be zeroed before
+ * the first call and released via fy_parser_events_release() when done.
+ *
+ * @fyp: The parser
+ * @fyes: The array of event slots
+ * @count: The number of slots
+ *
+ * Returns:
+ * The number of events stored, 0 at the end of the stream, -1 on error
+ */
+int fy_parser_parse_batch(struct fy_parser *fyp, struct fy_event *fyes, int count);
+
+/**
+ * fy_parser_events_release() - Release an array of caller provided events
+ *
+ * Release all the events of an array used with fy_parser_parse_batch().
+ *
+ * @fyp: The parser
+ * @fyes: The array of event slots
+ * @count: The number of slots
+ */
+void fy_parser_events_release(struct fy_parser *fyp, struct fy_event *fyes, int count);
+
+/**
+ * typedef fy_parser_event_fn - Event callback
+ *
+ * @fyp: The parser
+ * @fye: The event; it is only valid for the duration of the call
+ * @user: The user pointer passed to fy_parser_parse_callback()
+ *
+ * Returns:
+ * 0 to continue parsing, anything else stops parsing and is
+ * returned by fy_parser_parse_callback()
+ */
+typedef int (*fy_parser_event_fn)(struct fy_parser *fyp, struct fy_event *fye, void *user);
+
+/**
+ * fy_parser_parse_callback() - Parse the stream calling a function on each event
+ *
+ * Push style parsing; @fn is called with each event of the stream
+ * in order. The event is released as soon as the callback returns,
+ * so the callback must copy out anything it needs to keep.
+ *
+ * @fyp: The parser
+ * @fn: The event callback
+ * @user: A user pointer passed to the callback
+ *
+ * Returns:
+ * 0 at the end of the stream, -1 on error, or the non zero value
+ * the callback returned to stop parsing
+ */
+int fy_parser_parse_callback(struct fy_parser *fyp, fy_parser_event_fn fn, void *user);
+
 /**
  * fy_parser_alloc() - Allocate memory using the parser allocator
  *
@@ -577,6 +811,109 @@ void fy_parser_free(struct fy_parser *fyp, void *data);
  */
 bool fy_parser_get_stream_error(struct fy_parser *fyp);
 
+/**
+ * enum fy_parser_stats_fetch - The token fetch methods timed in the statistics
+ *
+ * @FYPSF_STREAM_START: Stream start
+ * @FYPSF_STREAM_END: Stream end
+ * @FYPSF_DIRECTIVE: Version and tag directives
+ * @FYPSF_DOCUMENT_INDICATOR: Document start and end indicators
+ * @FYPSF_FLOW_COLLECTION_START: Flow sequence and mapping starts
+ * @FYPSF_FLOW_COLLECTION_END: Flow sequence and mapping ends
+ * @FYPSF_FLOW_ENTRY: Flow collection entries
+ * @FYPSF_BLOCK_ENTRY: Block sequence entries
+ * @FYPSF_KEY: Complex keys
+ * @FYPSF_VALUE: Values (and the simple keys they complete)
+ * @FYPSF_ANCHOR_OR_ALIAS: Anchors and aliases
+ * @FYPSF_TAG: Tags
+ * @FYPSF_BLOCK_SCALAR: Literal and folded scalars
+ * @FYPSF_FLOW_SCALAR: Single and double quoted scalars
+ * @FYPSF_PLAIN_SCALAR: Plain scalars
+ * @FYPSF_COUNT: The number of fetch methods
+ */
+enum fy_parser_stats_fetch {
+	FYPSF_STREAM_START,
+	FYPSF_STREAM_END,
+	FYPSF_DIRECTIVE,
+	FYPSF_DOCUMENT_INDICATOR,
+	FYPSF_FLOW_COLLECTION_START,
+	FYPSF_FLOW_COLLECTION_END,
+	FYPSF_FLOW_ENTRY,
+	FYPSF_BLOCK_ENTRY,
+	FYPSF_KEY,
+	FYPSF_VALUE,
+	FYPSF_ANCHOR_OR_ALIAS,
+	FYPSF_TAG,
+	FYPSF_BLOCK_SCALAR,
+	FYPSF_FLOW_SCALAR,
+	FYPSF_PLAIN_SCALAR,
+	FYPSF_COUNT
+};
+
+/**
+ * struct fy_parser_stats - Parser statistics
+ *
+ * The statistics are only collected when the parser was created
+ * with %FYPCF_COLLECT_STATS; all times are in nanoseconds.
+ *
+ * @input_pulls: Number of times more input was requested
+ * @input_read_bytes: Bytes read from stream (non mmap'ed) inputs
+ * @tokens: Number of tokens created by the scanner
+ * @recycled: Number of parser objects (events, indents, simple keys,
+ *            flows and states) reused instead of allocated
+ * @talloc_bytes: Bytes allocated through the parser tracked allocator
+ * @simple_key_depth_max: High-water mark of the simple key stack
+ * @indent_depth_max: High-water mark of the indent stack
+ * @flow_level_max: Maximum flow collection nesting level
+ * @documents: Number of documents loaded
+ * @nodes: Number of document nodes created
+ * @document_load_time: Time spent loading documents (including parsing)
+ * @fetch_count: Number of calls of each fetch method,
+ *               indexed by &enum fy_parser_stats_fetch
+ * @fetch_time: Time spent in each fetch method
+ */
+struct fy_parser_stats {
+	uint64_t input_pulls;
+	uint64_t input_read_bytes;
+	uint64_t tokens;
+	uint64_t recycled;
+	uint64_t talloc_bytes;
+	unsigned int simple_key_depth_max;
+	unsigned int indent_depth_max;
+	unsigned int flow_level_max;
+	uint64_t documents;
+	uint64_t nodes;
+	uint64_t document_load_time;
+	uint64_t fetch_count[FYPSF_COUNT];
+	uint64_t fetch_time[FYPSF_COUNT];
+};
+
+/**
+ * fy_parser_get_stats() - Get the statistics of a parser
+ *
+ * Retrieve the statistics collected by the parser so far.
+ * Statistics are only collected when the parser was configured
+ * with %FYPCF_COLLECT_STATS, so that there's no cost otherwise.
+ *
+ * @fyp: The parser
+ * @stats: Pointer to the statistics to fill in
+ *
+ * Returns:
+ * 0 on success, -1 if the parser doesn't collect statistics
+ */
+int fy_parser_get_stats(struct fy_parser *fyp, struct fy_parser_stats *stats);
+
+/**
+ * fy_parser_stats_fetch_name() - Get the name of a token fetch method
+ *
+ * @fetch: The fetch method
+ *
+ * Returns:
+ * The name of the fetch method, i.e. "plain-scalar", or NULL
+ * if out of range
+ */
+const char *fy_parser_stats_fetch_name(enum fy_parser_stats_fetch fetch);
+
 /**
  * fy_token_scalar_style() - Get the style of a scalar token
  *
@@ -650,6 +987,88 @@ const char *fy_token_get_text0(struct fy_token *fyt);
  */
 size_t fy_token_get_text_length(struct fy_token *fyt);
 
+/**
+ * fy_token_text_foreach_chunk() - Iterate over the text of a token in chunks
+ *
+ * Call the given function for each chunk of the text of the token,
+ * without ever creating the text representation of it.
+ * The chunks are either slices of the parser input, or small
+ * fragments holding escapes and line folding; the latter are only
+ * valid for the duration of the call.
+ *
+ * @fyt: The token
+ * @fn: The function to call for each chunk; returning non zero stops the iteration
+ * @user: The user pointer to pass to @fn
+ *
+ * Returns:
+ * 0 when all chunks were processed, the non zero value returned by @fn
+ * when it stopped the iteration, or -1 in case of an error.
+ */
+int fy_token_text_foreach_chunk(struct fy_token *fyt,
+				int (*fn)(const char *str, size_t len, void *user),
+				void *user);
+
+/**
+ * fy_token_text_cmp() - Compare the text of a token with a string
+ *
+ * Compare the text of a token with the given string without
+ * creating the text representation of the token.
+ *
+ * @fyt: The token (NULL is the empty string)
+ * @str: The string to compare with
+ * @len: The length of the string (or -1 if '\0' terminated)
+ *
+ * Returns:
+ * 0 if equal, less than zero if the token text is less than @str,
+ * greater than zero otherwise.
+ */
+int fy_token_text_cmp(struct fy_token *fyt, const char *str, size_t len);
+
+/**
+ * fy_token_text_hash() - Hash the text of a token
+ *
+ * Hash the text of a token without creating the text representation
+ * of it. Tokens with equal text hash to the same value, regardless
+ * of scalar style.
+ *
+ * @fyt: The token
+ *
+ * Returns:
+ * The 32 bit hash of the token's text.
+ */
+uint32_t fy_token_text_hash(struct fy_token *fyt);
+
+/**
+ * fy_token_text_to_int64() - Parse the text of a token as an integer
+ *
+ * Parse the text of a token as an integer according to the YAML 1.2
+ * core schema (decimal, 0o octal or 0x hexadecimal), without creating
+ * the text representation of the token.
+ *
+ * @fyt: The token
+ * @valp: Pointer to store the value
+ *
+ * Returns:
+ * 0 on success, -1 if the text is not an integer or out of range.
+ */
+int fy_token_text_to_int64(struct fy_token *fyt, int64_t *valp);
+
+/**
+ * fy_token_text_to_double() - Parse the text of a token as a floating point number
+ *
+ * Parse the text of a token as a floating point number according to
+ * the YAML 1.2 core schema (including .inf and .nan), without creating
+ * the text representation of the token. A number too large for a double
+ * is stored as an infinity of the same sign.
+ *
+ * @fyt: The token
+ * @valp: Pointer to store the value
+ *
+ * Returns:
+ * 0 on success, -1 if the text is not a number.
+ */
+int fy_token_text_to_double(struct fy_token *fyt, double *valp);
+
 /**
  * struct fy_iter_chunk - An iteration chunk
  *
@@ -881,6 +1300,32 @@ int fy_token_iter_utf8_peek(struct fy_token_iter *iter);
  */
 struct fy_document *fy_parse_load_document(struct fy_parser *fyp);
 
+/**
+ * fy_parse_load_document_path() - Parse the next document keeping only a path
+ *
+ * Like fy_parse_load_document(), but only the node at @path is created;
+ * everything else in the document is skipped over as events without
+ * ever being built. The path uses the same syntax as fy_node_by_path().
+ * The returned document's root is the matched node, or NULL when the
+ * path does not exist in this document.
+ *
+ * A negative sequence index keeps the last items of that sequence
+ * until its end is reached.
+ *
+ * Aliases in the matched node are not resolved, and aliases or merge
+ * keys are not followed while walking the path.
+ *
+ * @fyp: The parser
+ * @path: The path to keep
+ * @len: The path length, (size_t)-1 if '\0' terminated
+ *
+ * Returns:
+ * The next document from the parser stream, or NULL at the end of
+ * the stream or on error.
+ */
+struct fy_document *fy_parse_load_document_path(struct fy_parser *fyp,
+						const char *path, size_t len);
+
 /**
  * fy_parse_document_destroy() - Destroy a document created by fy_parse_load_document()
  *
@@ -1121,12 +1566,21 @@ enum fy_emitter_cfg_flags {
  * @flags: Configuration flags
  * @output: Pointer to the method that will perform output.
  * @userdata: Opaque user data pointer
+ * @output_bulk: Optional pointer to a method that performs batched output.
+ *               When set, output is collected in a buffer and handed
+ *               over in large chunks instead of calling @output for
+ *               every fragment. It returns the number of bytes written.
+ * @output_buffer_size: Size of the output buffer used with @output_bulk,
+ *                      0 selects the default size
  */
 struct fy_emitter_cfg {
 	enum fy_emitter_cfg_flags flags;
 	int (*output)(struct fy_emitter *emit, enum fy_emitter_write_type type,
 		      const char *str, int len, void *userdata);
 	void *userdata;
+	int (*output_bulk)(struct fy_emitter *emit, const struct iovec *iov,
+			   int iovcnt, void *userdata);
+	size_t output_buffer_size;
 };
 
 /**
@@ -1366,6 +1820,12 @@ char *fy_emit_node_to_string(struct fy_node *fyn, enum fy_emitter_cfg_flags flag
  * Note that the copy includes all anchors contained in the subtree of the
  * source, so this call will register them with the document.
  *
+ * When no anchors need to be registered (a copy within the same document,
+ * or a source document without anchors) a collection is not copied
+ * right away; the copy shares the content of the source, and is built
+ * level by level when it's accessed, or when the source is modified
+ * or freed.
+ *
  * @fyd: The document which the resulting node will be associated with
  * @fyn_from: The source node to recursively copy
  *
@@ -1534,9 +1994,11 @@ fy_node_style_from_scalar_style(enum fy_scalar_style sstyle)
  *
  * Compare two nodes for equality.
  * The comparison is 'deep', i.e. it recurses in subnodes,
- * and orders the keys of maps using default libc strcmp
- * ordering. For scalar the comparison is performed after
+ * and matches the pairs of maps by key regardless of their
+ * order. For scalar the comparison is performed after
  * any escaping so it's a true content comparison.
+ * Collections with different hashes (see fy_node_hash())
+ * are rejected without recursing.
  *
  * @fyn1: The first node to use in the comparison
  * @fyn2: The second node to use in the comparison
@@ -1563,6 +2025,66 @@ bool fy_node_compare(struct fy_node *fyn1, struct fy_node *fyn2);
  */
 bool fy_node_compare_string(struct fy_node *fyn, const char *str, size_t len);
 
+/**
+ * fy_node_hash() - Get the structural hash of a node
+ *
+ * Get a hash of the content of a node (and of its subnodes).
+ * Nodes that are equal according to fy_node_compare() have the
+ * same hash, so it can be used to bucket nodes for deduplication,
+ * or as the hash of complex mapping keys. Tags do not participate,
+ * and the order of mapping pairs does not matter.
+ *
+ * The hashes are cached in the nodes; a change invalidates the ones
+ * of the changed node and its ancestors. Lazily loaded collections
+ * are hashed without being built.
+ *
+ * @fyn: The node (NULL hashes the same as an empty scalar)
+ *
+ * Returns:
+ * The 32 bit hash of the node
+ */
+uint32_t fy_node_hash(struct fy_node *fyn);
+
+/**
+ * fy_document_freeze() - Prepare a document for concurrent reading
+ *
+ * Many of the read accessors cache state as they go: the text of
+ * the tokens, their analysis, the key indexes and item vectors of
+ * collections, the node hashes, and the contents of lazily loaded
+ * collections and copies. Freezing computes all of it up front.
+ * Afterwards the read accessors (fy_node_get_*(), fy_node_by_path(),
+ * the sequence and mapping lookups and iterators, fy_node_compare(),
+ * fy_node_hash(), and the anchor lookups) never write to the
+ * document. They may be called from any number of threads at once,
+ * without locking.
+ *
+ * Every scalar gets its zero terminated copy made at this point,
+ * so some memory is traded for it.
+ *
+ * The document stays frozen until it is changed. Changing it (or
+ * copying nodes out of it, which takes references) must not happen
+ * while it is being read concurrently. Cycle and depth errors
+ * while following aliases are not reported on a frozen document;
+ * the lookup just fails.
+ *
+ * @fyd: The document to freeze
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_document_freeze(struct fy_document *fyd);
+
+/**
+ * fy_document_is_frozen() - Check whether a document is frozen
+ *
+ * @fyd: The document to check
+ *
+ * Returns:
+ * true if the document has been frozen via fy_document_freeze()
+ * and has not been changed since.
+ */
+bool fy_document_is_frozen(struct fy_document *fyd);
+
 /**
  * fy_document_create() - Create an empty document
  *
@@ -1614,6 +2136,54 @@ int fy_document_set_parent(struct fy_document *fyd, struct fy_document *fyd_chil
  */
 struct fy_document *fy_document_build_from_string(const struct fy_parse_cfg *cfg, const char *str, size_t len);
 
+/**
+ * fy_document_build_from_string_with_parser() - Create a document using a reusable parser
+ *
+ * Create a document parsing the provided string as a YAML source,
+ * like fy_document_build_from_string() does, but using the given
+ * parser (after resetting it) instead of creating a new one.
+ * The document does not own the parser; it must be destroyed before
+ * the parser is reset, reused or destroyed.
+ *
+ * @fyp: The parser to use
+ * @str: The YAML source to use.
+ * @len: The length of the string (or -1 if '\0' terminated)
+ *
+ * Returns:
+ * The created document, or NULL on error.
+ */
+struct fy_document *fy_document_build_from_string_with_parser(struct fy_parser *fyp,
+							      const char *str, size_t len);
+
+/**
+ * fy_document_reparse() - Update a document after an edit of its source
+ *
+ * Apply an edit of the YAML source a document was built from, without
+ * parsing it all again. The smallest block or flow collection enclosing
+ * the edit, whose indentation context the edit leaves alone, is
+ * re-scanned and the new collection replaces the old one in the tree.
+ * The marks of all the nodes of the document are updated to point to
+ * the new source.
+ *
+ * When the edit can't be handled this way (it touches the top level,
+ * anchors, directives, or the collection changes kind), nothing is
+ * changed and the document must be built again from the new source.
+ * The previous source must still be valid during the call; the new
+ * one becomes the source of the document and must outlive it.
+ *
+ * @fyd: The document to update
+ * @str: The complete new YAML source
+ * @len: The length of the new source (or -1 if '\0' terminated)
+ * @edit_start: The offset of the edit
+ * @edit_old_len: The length of the replaced text on the previous source
+ * @edit_new_len: The length of the replacement text on the new source
+ *
+ * Returns:
+ * 0 if the edit was applied, -1 if the document is unchanged.
+ */
+int fy_document_reparse(struct fy_document *fyd, const char *str, size_t len,
+			size_t edit_start, size_t edit_old_len, size_t edit_new_len);
+
 /**
  * fy_document_build_from_file() - Create a document parsing the given file
  *
@@ -1640,6 +2210,92 @@ struct fy_document *fy_document_build_from_file(const struct fy_parse_cfg *cfg,
  */
 struct fy_document *fy_document_build_from_fp(const struct fy_parse_cfg *cfg, FILE *fp);
 
+/**
+ * fy_document_build_all_from_string() - Create all documents of a YAML stream in parallel
+ *
+ * Split the provided multi-document YAML source at the document
+ * boundaries (``---`` and ``...`` markers at the start of
+ * a line) and parse the segments on a pool of worker threads, each
+ * in its own parser. Directives preceding a document start marker
+ * are kept with the document that follows them, so each document
+ * gets the same document state it would get when parsed serially.
+ *
+ * Note that since each segment is parsed independently, the marks
+ * of the resulting documents are relative to the start of the
+ * document's segment.
+ *
+ * @cfg: The parse configuration to use or NULL for the default.
+ * @str: The YAML source to use.
+ * @len: The length of the string (or -1 if '\0' terminated)
+ * @jobs: The number of worker threads to use, 0 for the number of online CPUs
+ *
+ * Returns:
+ * A NULL terminated array of the created documents in stream order,
+ * or NULL on error. Each document must be destroyed by
+ * fy_document_destroy() and the array released by free().
+ */
+struct fy_document **fy_document_build_all_from_string(const struct fy_parse_cfg *cfg, const char *str, size_t len, int jobs);
+
+/**
+ * fy_document_build_all_from_file() - Create all documents of a file in parallel
+ *
+ * Same as fy_document_build_all_from_string() but the source is
+ * the given file, which is mmap'ed when possible.
+ *
+ * @cfg: The parse configuration to use or NULL for the default.
+ * @file: The name of the file to parse
+ * @jobs: The number of worker threads to use, 0 for the number of online CPUs
+ *
+ * Returns:
+ * A NULL terminated array of the created documents in stream order,
+ * or NULL on error. Each document must be destroyed by
+ * fy_document_destroy() and the array released by free().
+ */
+struct fy_document **fy_document_build_all_from_file(const struct fy_parse_cfg *cfg, const char *file, int jobs);
+
+/**
+ * fy_document_save_snapshot() - Save a document as a binary snapshot
+ *
+ * Writes the document tree (nodes, pairs, anchors, tags and the
+ * scalar text) to the given file in a flat, position independent
+ * binary form that fy_document_load_snapshot() can use in place.
+ * The scalar text is saved as it is returned by fy_node_get_scalar(),
+ * so a document should be resolved before saving if the snapshot
+ * is to be used as a resolved document. Comments and the source
+ * marks are not saved.
+ *
+ * Note that the snapshot format is specific to the byte order
+ * of the host that wrote it.
+ *
+ * @fyd: The document to save
+ * @file: The name of the snapshot file
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_document_save_snapshot(struct fy_document *fyd, const char *file);
+
+/**
+ * fy_document_load_snapshot() - Load a document from a binary snapshot
+ *
+ * Loads a document saved by fy_document_save_snapshot() without
+ * parsing. The snapshot is mmap'ed (when possible) and the scalars
+ * of the document use the text in it directly, while the nodes are
+ * carved out of a single allocation. The returned document is a
+ * regular document and can be accessed and modified with all the
+ * fy_node_* methods.
+ *
+ * Since the document refers to the snapshot contents, nodes of it
+ * copied to another document must not outlive it.
+ *
+ * @cfg: The parse configuration to use or NULL for the default.
+ * @file: The name of the snapshot file
+ *
+ * Returns:
+ * The loaded document, or NULL on error (or on an invalid snapshot)
+ */
+struct fy_document *fy_document_load_snapshot(const struct fy_parse_cfg *cfg, const char *file);
+
 /**
  * fy_document_vbuildf() - Create a document using the provided YAML via vprintf formatting
  *
@@ -1935,6 +2591,65 @@ struct fy_node *fy_node_buildf(struct fy_document *fyd, const char *fmt, ...)
 struct fy_node *fy_node_by_path(struct fy_node *fyn, const char *path, size_t len,
 				enum fy_node_walk_flags flags);
 
+/**
+ * fy_path_query_create() - Compile a path spec for repeated use
+ *
+ * Compiles a path spec of the same form as fy_node_by_path() to a
+ * query object that can be executed against many nodes, without
+ * parsing the path and building the complex keys on every lookup.
+ *
+ * @path: The path spec to compile
+ * @len: The length of the path (or -1 if '\0' terminated)
+ * @flags: The extra path walk flags
+ *
+ * Returns:
+ * The compiled path query, or NULL on error
+ */
+struct fy_path_query *fy_path_query_create(const char *path, size_t len,
+					   enum fy_node_walk_flags flags);
+
+/**
+ * fy_path_query_destroy() - Destroy a compiled path query
+ *
+ * @fypq: The path query to destroy
+ */
+void fy_path_query_destroy(struct fy_path_query *fypq);
+
+/**
+ * fy_path_query_exec() - Execute a compiled path query
+ *
+ * Retrieve a node relative to the given node using the compiled
+ * path; the result is the same as fy_node_by_path() with the
+ * path and flags the query was compiled with.
+ *
+ * @fypq: The compiled path query
+ * @fyn: The node to use as start of the traversal operation
+ *
+ * Returns:
+ * The retrieved node, or NULL if not possible to be found.
+ */
+struct fy_node *fy_path_query_exec(struct fy_path_query *fypq, struct fy_node *fyn);
+
+/**
+ * fy_path_query_exec_batch() - Execute a number of compiled path queries
+ *
+ * Execute a number of compiled path queries against the same node,
+ * storing the results in the @fyns array. The part of the traversal
+ * that a query shares with the one before it is not repeated, so
+ * keeping queries sharing path prefixes together (i.e. sorted) makes
+ * it a single walk of the tree.
+ *
+ * @fypqs: The array of compiled path queries (NULL entries are allowed)
+ * @count: The number of path queries
+ * @fyn: The node to use as start of the traversal operations
+ * @fyns: The array of @count nodes to store the results in
+ *
+ * Returns:
+ * 0 on success, -1 on error
+ */
+int fy_path_query_exec_batch(struct fy_path_query * const *fypqs, int count,
+			     struct fy_node *fyn, struct fy_node **fyns);
+
 /**
  * fy_node_get_path() - Get the path of this node
  *
@@ -1998,6 +2713,48 @@ char *fy_node_get_parent_address(struct fy_node *fyn);
  */
 struct fy_node *fy_node_create_scalar(struct fy_document *fyd, const char *data, size_t size);
 
+/**
+ * enum fy_node_build_data - What happens to data handed to the direct builder
+ *
+ * @FYNBD_REFERENCE: The data are referenced, and must be available while
+ *                   the node is in use (as with fy_node_create_scalar())
+ * @FYNBD_COPY: The data are copied in storage kept by the document
+ * @FYNBD_TAKE: The malloc()ed data are owned by the document from now on,
+ *              and are free()d when no longer in use (even on error)
+ */
+enum fy_node_build_data {
+	FYNBD_REFERENCE,
+	FYNBD_COPY,
+	FYNBD_TAKE,
+};
+
+/**
+ * fy_node_create_scalar_direct() - Create a scalar node from raw content
+ *
+ * Create a scalar node whose content is exactly the given data; no
+ * escapes are processed and nothing gets parsed. Small copied scalars
+ * share storage chunks of the document, so building many of them
+ * costs a memcpy each. The rare text that has to be kept escaped
+ * (i.e. line breaks other than \n) is always copied.
+ *
+ * The style is the one to use on output; FYSS_ANY picks plain when
+ * possible. Any style that would not give back exactly the same
+ * content when parsed again is replaced by double quoted.
+ *
+ * @fyd: The document which the resulting node will be associated with
+ * @data: Pointer to the data area
+ * @size: Size of the data area, or (size_t)-1 for '\0' terminated data.
+ * @style: The output style of the scalar
+ * @mode: Whether the data are referenced, copied or taken over
+ *
+ * Returns:
+ * The created node, or NULL on error.
+ */
+struct fy_node *fy_node_create_scalar_direct(struct fy_document *fyd,
+					     const char *data, size_t size,
+					     enum fy_scalar_style style,
+					     enum fy_node_build_data mode);
+
 /**
  * fy_node_create_sequence() - Create an empty sequence node.
  *
@@ -2105,6 +2862,69 @@ const char *fy_node_get_scalar0(struct fy_node *fyn);
  */
 size_t fy_node_get_scalar_length(struct fy_node *fyn);
 
+/**
+ * fy_node_get_int64() - Get the integer value of a scalar node
+ *
+ * Resolve the scalar with the YAML 1.2 core schema and return its
+ * value if it's an integer (decimal, 0o octal or 0x hexadecimal).
+ * Only plain scalars resolve implicitly; quoted and block scalars
+ * are strings unless tagged with a core schema tag (i.e. !!int).
+ * A scalar tagged !!float is never an integer, even when its text is.
+ * The resolved type and value are cached on the scalar, so repeated
+ * calls don't parse the text again.
+ *
+ * @fyn: The scalar node
+ * @valp: Pointer to store the value
+ *
+ * Returns:
+ * 0 on success, -1 if the node is not an integer that fits.
+ */
+int fy_node_get_int64(struct fy_node *fyn, int64_t *valp);
+
+/**
+ * fy_node_get_double() - Get the floating point value of a scalar node
+ *
+ * Resolve the scalar with the YAML 1.2 core schema and return its
+ * value if it's a floating point number (including .inf and .nan)
+ * or an integer. Resolution and caching are as in fy_node_get_int64().
+ *
+ * @fyn: The scalar node
+ * @valp: Pointer to store the value
+ *
+ * Returns:
+ * 0 on success, -1 if the node is not a number.
+ */
+int fy_node_get_double(struct fy_node *fyn, double *valp);
+
+/**
+ * fy_node_get_bool() - Get the boolean value of a scalar node
+ *
+ * Resolve the scalar with the YAML 1.2 core schema and return its
+ * value if it's a boolean (true, True, TRUE, false, False, FALSE).
+ * Resolution and caching are as in fy_node_get_int64().
+ *
+ * @fyn: The scalar node
+ * @valp: Pointer to store the value
+ *
+ * Returns:
+ * 0 on success, -1 if the node is not a boolean.
+ */
+int fy_node_get_bool(struct fy_node *fyn, bool *valp);
+
+/**
+ * fy_node_is_null() - Check whether a scalar node is null
+ *
+ * Resolve the scalar with the YAML 1.2 core schema and check whether
+ * it's null (empty, ~, null, Null or NULL).
+ * Resolution and caching are as in fy_node_get_int64().
+ *
+ * @fyn: The scalar node
+ *
+ * Returns:
+ * true if the node is a null scalar, false otherwise.
+ */
+bool fy_node_is_null(struct fy_node *fyn);
+
 /**
  * fy_node_sequence_iterate() - Iterate over a sequence node
  *
@@ -2176,6 +2996,21 @@ struct fy_node *fy_node_sequence_get_by_index(struct fy_node *fyn, int index);
  */
 int fy_node_sequence_append(struct fy_node *fyn_seq, struct fy_node *fyn);
 
+/**
+ * fy_node_sequence_append_items() - Append many node items to a sequence
+ *
+ * Append an array of node items to a sequence, in order, making room
+ * for all of them at once.
+ *
+ * @fyn_seq: The sequence node
+ * @items: The node items to append
+ * @count: The number of items
+ *
+ * Returns:
+ * 0 on success, -1 on error (in which case nothing is appended)
+ */
+int fy_node_sequence_append_items(struct fy_node *fyn_seq, struct fy_node **items, int count);
+
 /**
  * fy_node_sequence_prepend() - Append a node item to a sequence
  *
@@ -2412,6 +3247,23 @@ void fy_node_pair_set_value(struct fy_node_pair *fynp, struct fy_node *fyn);
 int fy_node_mapping_append(struct fy_node *fyn_map,
 			   struct fy_node *fyn_key, struct fy_node *fyn_value);
 
+/**
+ * fy_node_mapping_append_pairs() - Append many node pairs to a mapping
+ *
+ * Append an array of key, value node pairs to a mapping, in order.
+ * Room for all of them is made at once and the duplicate key checks
+ * are hashed from the start.
+ *
+ * @fyn_map: The mapping node
+ * @items: The keys and values, as key0, value0, key1, value1...
+ * @count: The number of pairs (half the size of @items)
+ *
+ * Returns:
+ * 0 on success, -1 on error; the pairs before the failing one (i.e.
+ * a duplicate key) remain appended, the rest are still the caller's.
+ */
+int fy_node_mapping_append_pairs(struct fy_node *fyn_map, struct fy_node **items, int count);
+
 /**
  * fy_node_mapping_prepend() - Prepend a node item to a mapping
  *
@@ -2474,6 +3326,10 @@ typedef int (*fy_node_mapping_sort_fn)(const struct fy_node_pair *fynp_a,
  *
  * Recursively sort all mappings of the given node, using the given
  * comparison method (if NULL use the default one).
+ * The sort is stable and reentrant. With the default method the keys
+ * are extracted once, and large trees have their mappings sorted
+ * in parallel; a user supplied method is always called from the
+ * calling thread.
  *
  * @fyn: The node to sort
  * @key_cmp: The comparison method
@@ -2578,6 +3434,60 @@ int fy_document_vscanf(struct fy_document *fyd, const char *fmt, va_list ap);
 int fy_document_scanf(struct fy_document *fyd, const char *fmt, ...)
 		__attribute__((format(scanf, 2, 3)));
 
+/**
+ * fy_scanf_compile() - Compile a scanf format for repeated use
+ *
+ * Splits a format string of the same form as fy_node_scanf() once,
+ * compiling the paths and picking a direct conversion for plain integer
+ * and floating point specifiers (i.e. %d, %lu, %x, %lf). The
+ * program can then be executed against any number of nodes without
+ * parsing the format again; specifiers that can't be converted directly
+ * are handled by vsscanf() as before.
+ *
+ * @fmt: The scanf based format string
+ *
+ * Returns:
+ * The compiled program, or NULL on error
+ */
+struct fy_scanf_program *fy_scanf_compile(const char *fmt);
+
+/**
+ * fy_scanf_program_destroy() - Destroy a compiled scanf program
+ *
+ * @fysp: The program to destroy
+ */
+void fy_scanf_program_destroy(struct fy_scanf_program *fysp);
+
+/**
+ * fy_scanf_program_vexec() - Execute a compiled scanf program
+ *
+ * Equivalent to fy_node_vscanf() with the format the program was
+ * compiled from.
+ *
+ * @fysp: The compiled program
+ * @fyn: The node to use as a pathspec root
+ * @ap: The va_list containing the arguments
+ *
+ * Returns:
+ * The number of scanned arguments, or -1 on error.
+ */
+int fy_scanf_program_vexec(struct fy_scanf_program *fysp, struct fy_node *fyn, va_list ap);
+
+/**
+ * fy_scanf_program_exec() - Execute a compiled scanf program
+ *
+ * Equivalent to fy_node_scanf() with the format the program was
+ * compiled from.
+ *
+ * @fysp: The compiled program
+ * @fyn: The node to use as a pathspec root
+ * @...: The arguments
+ *
+ * Returns:
+ * The number of scanned arguments, or -1 on error.
+ */
+int fy_scanf_program_exec(struct fy_scanf_program *fysp, struct fy_node *fyn, ...);
+
 /**
  * fy_document_tag_directive_iterate() - Iterate over a document's tag directives
  *
@@ -0,0 +1,771 @@
+/*
+ * libfyaml-bench.c - throughput benchmarks of libfyaml (and libyaml)
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <libfyaml.h>
+
+#if defined(HAVE_LIBYAML) && HAVE_LIBYAML
+#include <yaml.h>
+#endif
+
+#include "fy-parse.h"
+
+#include "fy-valgrind.h"
+
+#define SIZE_DEFAULT			4	/* MB */
+#define MIN_TIME_DEFAULT		0.5	/* seconds */
+#define MAX_PASSES_DEFAULT		1000
+
+#define BENCH_MB			(1024.0 * 1024.0)
+
+static struct option lopts[] = {
+	{"size",		required_argument,	0,	's' },
+	{"min-time",		required_argument,	0,	't' },
+	{"corpus",		required_argument,	0,	'c' },
+	{"stage",		required_argument,	0,	'S' },
+	{"help",		no_argument,		0,	'h' },
+	{0,			0,              	0,	 0  },
+};
+
+/*
+ * Count the allocations by interposing the allocator; this works
+ * both for a static and a shared libfyaml.
+ */
+static unsigned long bench_allocs;
+
+#if defined(__GLIBC__)
+#define BENCH_COUNT_ALLOCS	1
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size)
+{
+	bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	bench_allocs++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+#else
+#define BENCH_COUNT_ALLOCS	0
+#endif
+
+struct bench_corpus {
+	const char *name;
+	char *data;
+	size_t size;
+	size_t alloc;
+};
+
+struct bench_timer {
+	struct timespec start;
+	unsigned long allocs;
+	double secs;
+	unsigned long total_allocs;
+};
+
+static void bench_timer_start(struct bench_timer *bt)
+{
+	bt->allocs = bench_allocs;
+	clock_gettime(CLOCK_MONOTONIC, &bt->start);
+}
+
+static void bench_timer_stop(struct bench_timer *bt)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	bt->secs += (double)(end.tv_sec - bt->start.tv_sec) +
+		    (double)(end.tv_nsec - bt->start.tv_nsec) * 1e-9;
+	bt->total_allocs += bench_allocs - bt->allocs;
+}
+
+struct bench_stage {
+	const char *name;
+	int (*run)(const struct bench_corpus *bc, struct bench_timer *bt);
+};
+
+static const struct fy_parse_cfg bench_cfg = {
+	.flags = FYPCF_QUIET,
+};
+
+static struct fy_parser *bench_parser_create(const struct bench_corpus *bc)
+{
+	struct fy_parser *fyp;
+
+	fyp = fy_parser_create(&bench_cfg);
+	if (!fyp)
+		return NULL;
+
+	if (fy_parser_set_string(fyp, bc->data, bc->size)) {
+		fy_parser_destroy(fyp);
+		return NULL;
+	}
+
+	return fyp;
+}
+
+static int bench_fy_scan(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	struct fy_parser *fyp;
+	struct fy_token *fyt;
+	int rc;
+
+	bench_timer_start(bt);
+	fyp = bench_parser_create(bc);
+	if (!fyp)
+		return -1;
+	while ((fyt = fy_scan(fyp)) != NULL)
+		fy_token_unref(fyt);
+	rc = fy_parser_get_stream_error(fyp) ? -1 : 0;
+	fy_parser_destroy(fyp);
+	bench_timer_stop(bt);
+
+	return rc;
+}
+
+static int bench_fy_parse(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	struct fy_parser *fyp;
+	struct fy_event *fyev;
+	int rc;
+
+	bench_timer_start(bt);
+	fyp = bench_parser_create(bc);
+	if (!fyp)
+		return -1;
+	while ((fyev = fy_parser_parse(fyp)) != NULL)
+		fy_parser_event_free(fyp, fyev);
+	rc = fy_parser_get_stream_error(fyp) ? -1 : 0;
+	fy_parser_destroy(fyp);
+	bench_timer_stop(bt);
+
+	return rc;
+}
+
+static int bench_fy_load(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	int rc;
+
+	bench_timer_start(bt);
+	fyp = bench_parser_create(bc);
+	if (!fyp)
+		return -1;
+	while ((fyd = fy_parse_load_document(fyp)) != NULL)
+		fy_parse_document_destroy(fyp, fyd);
+	rc = fy_parser_get_stream_error(fyp) ? -1 : 0;
+	fy_parser_destroy(fyp);
+	bench_timer_stop(bt);
+
+	return rc;
+}
+
+/* load all the documents of the corpus, untimed */
+static struct fy_document **bench_fy_load_all(const struct bench_corpus *bc,
+					      struct fy_parser **fypp)
+{
+	struct fy_parser *fyp;
+	struct fy_document *fyd, **fyds = NULL, **newfyds;
+	size_t count = 0, alloc = 0;
+
+	fyp = bench_parser_create(bc);
+	if (!fyp)
+		return NULL;
+
+	while ((fyd = fy_parse_load_document(fyp)) != NULL) {
+		if (count + 1 >= alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			newfyds = realloc(fyds, alloc * sizeof(*fyds));
+			if (!newfyds) {
+				fy_parse_document_destroy(fyp, fyd);
+				goto err_out;
+			}
+			fyds = newfyds;
+		}
+		fyds[count++] = fyd;
+	}
+	if (fy_parser_get_stream_error(fyp) || !fyds)
+		goto err_out;
+	fyds[count] = NULL;
+
+	*fypp = fyp;
+	return fyds;
+
+err_out:
+	while (count > 0)
+		fy_parse_document_destroy(fyp, fyds[--count]);
+	free(fyds);
+	fy_parser_destroy(fyp);
+	return NULL;
+}
+
+static void bench_fy_destroy_all(struct fy_parser *fyp, struct fy_document **fyds)
+{
+	struct fy_document **fydp;
+
+	for (fydp = fyds; *fydp; fydp++)
+		fy_parse_document_destroy(fyp, *fydp);
+	free(fyds);
+	fy_parser_destroy(fyp);
+}
+
+static int bench_fy_resolve(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	struct fy_parser *fyp;
+	struct fy_document **fyds, **fydp;
+	int rc = 0;
+
+	fyds = bench_fy_load_all(bc, &fyp);
+	if (!fyds)
+		return -1;
+
+	bench_timer_start(bt);
+	for (fydp = fyds; *fydp && !rc; fydp++)
+		rc = fy_document_resolve(*fydp);
+	bench_timer_stop(bt);
+
+	bench_fy_destroy_all(fyp, fyds);
+
+	return rc;
+}
+
+static int bench_null_output(struct fy_emitter *emit, enum fy_emitter_write_type type,
+			     const char *str, int len, void *userdata)
+{
+	return len;
+}
+
+static int bench_fy_emit(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	struct fy_emitter_cfg ecfg;
+	struct fy_emitter *emit;
+	struct fy_parser *fyp;
+	struct fy_document **fyds, **fydp;
+	int rc = 0;
+
+	fyds = bench_fy_load_all(bc, &fyp);
+	if (!fyds)
+		return -1;
+
+	memset(&ecfg, 0, sizeof(ecfg));
+	ecfg.flags = FYECF_DEFAULT;
+	ecfg.output = bench_null_output;
+
+	bench_timer_start(bt);
+	emit = fy_emitter_create(&ecfg);
+	if (emit) {
+		for (fydp = fyds; *fydp && !rc; fydp++)
+			rc = fy_emit_document(emit, *fydp);
+		fy_emitter_destroy(emit);
+	} else
+		rc = -1;
+	bench_timer_stop(bt);
+
+	bench_fy_destroy_all(fyp, fyds);
+
+	return rc;
+}
+
+#if defined(HAVE_LIBYAML) && HAVE_LIBYAML
+
+static int bench_libyaml_scan(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	yaml_parser_t parser;
+	yaml_token_t token;
+	bool done = false;
+	int rc = 0;
+
+	bench_timer_start(bt);
+	if (!yaml_parser_initialize(&parser))
+		return -1;
+	yaml_parser_set_input_string(&parser, (const unsigned char *)bc->data, bc->size);
+	while (!done) {
+		if (!yaml_parser_scan(&parser, &token)) {
+			rc = -1;
+			break;
+		}
+		done = token.type == YAML_STREAM_END_TOKEN;
+		yaml_token_delete(&token);
+	}
+	yaml_parser_delete(&parser);
+	bench_timer_stop(bt);
+
+	return rc;
+}
+
+static int bench_libyaml_parse(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	yaml_parser_t parser;
+	yaml_event_t event;
+	bool done = false;
+	int rc = 0;
+
+	bench_timer_start(bt);
+	if (!yaml_parser_initialize(&parser))
+		return -1;
+	yaml_parser_set_input_string(&parser, (const unsigned char *)bc->data, bc->size);
+	while (!done) {
+		if (!yaml_parser_parse(&parser, &event)) {
+			rc = -1;
+			break;
+		}
+		done = event.type == YAML_STREAM_END_EVENT;
+		yaml_event_delete(&event);
+	}
+	yaml_parser_delete(&parser);
+	bench_timer_stop(bt);
+
+	return rc;
+}
+
+static int bench_libyaml_load(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	yaml_parser_t parser;
+	yaml_document_t document;
+	bool done = false;
+	int rc = 0;
+
+	bench_timer_start(bt);
+	if (!yaml_parser_initialize(&parser))
+		return -1;
+	yaml_parser_set_input_string(&parser, (const unsigned char *)bc->data, bc->size);
+	while (!done) {
+		if (!yaml_parser_load(&parser, &document)) {
+			rc = -1;
+			break;
+		}
+		done = !yaml_document_get_root_node(&document);
+		yaml_document_delete(&document);
+	}
+	yaml_parser_delete(&parser);
+	bench_timer_stop(bt);
+
+	return rc;
+}
+
+static int bench_libyaml_null_output(void *data, unsigned char *buffer, size_t size)
+{
+	return 1;
+}
+
+static int bench_libyaml_emit(const struct bench_corpus *bc, struct bench_timer *bt)
+{
+	yaml_parser_t parser;
+	yaml_emitter_t emitter;
+	yaml_document_t *documents = NULL, *newdocuments;
+	size_t i, first = 0, count = 0, alloc = 0;
+	int rc = -1;
+
+	/* load all the documents, untimed */
+	if (!yaml_parser_initialize(&parser))
+		return -1;
+	yaml_parser_set_input_string(&parser, (const unsigned char *)bc->data, bc->size);
+	for (;;) {
+		if (count >= alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			newdocuments = realloc(documents, alloc * sizeof(*documents));
+			if (!newdocuments)
+				goto out;
+			documents = newdocuments;
+		}
+		if (!yaml_parser_load(&parser, &documents[count]))
+			goto out;
+		if (!yaml_document_get_root_node(&documents[count])) {
+			yaml_document_delete(&documents[count]);
+			break;
+		}
+		count++;
+	}
+
+	bench_timer_start(bt);
+	if (yaml_emitter_initialize(&emitter)) {
+		yaml_emitter_set_output(&emitter, bench_libyaml_null_output, NULL);
+		rc = yaml_emitter_open(&emitter) ? 0 : -1;
+		/* dumping a document deletes it */
+		for (; !rc && first < count; first++)
+			rc = yaml_emitter_dump(&emitter, &documents[first]) ? 0 : -1;
+		if (!rc)
+			rc = yaml_emitter_close(&emitter) ? 0 : -1;
+		yaml_emitter_delete(&emitter);
+	}
+	bench_timer_stop(bt);
+out:
+	for (i = first; i < count; i++)
+		yaml_document_delete(&documents[i]);
+	free(documents);
+	yaml_parser_delete(&parser);
+
+	return rc;
+}
+
+#endif
+
+static const struct bench_stage fy_stages[] = {
+	{ .name = "scan",	.run = bench_fy_scan },
+	{ .name = "parse",	.run = bench_fy_parse },
+	{ .name = "load",	.run = bench_fy_load },
+	{ .name = "resolve",	.run = bench_fy_resolve },
+	{ .name = "emit",	.run = bench_fy_emit },
+};
+
+#if defined(HAVE_LIBYAML) && HAVE_LIBYAML
+static const struct bench_stage libyaml_stages[] = {
+	{ .name = "scan",	.run = bench_libyaml_scan },
+	{ .name = "parse",	.run = bench_libyaml_parse },
+	{ .name = "load",	.run = bench_libyaml_load },
+	{ .name = "emit",	.run = bench_libyaml_emit },
+};
+#endif
+
+/* corpus generators */
+
+static int bench_corpus_printf(struct bench_corpus *bc, const char *fmt, ...)
+	__attribute__((format(printf, 2, 3)));
+
+static int bench_corpus_printf(struct bench_corpus *bc, const char *fmt, ...)
+{
+	va_list ap;
+	char *newdata;
+	size_t alloc;
+	int len;
+
+	for (;;) {
+		va_start(ap, fmt);
+		len = vsnprintf(bc->data + bc->size, bc->alloc - bc->size, fmt, ap);
+		va_end(ap);
+		if (len < 0)
+			return -1;
+		if (bc->size + len < bc->alloc)
+			break;
+
+		alloc = bc->alloc ? bc->alloc * 2 : 65536;
+		while (alloc <= bc->size + len)
+			alloc *= 2;
+		newdata = realloc(bc->data, alloc);
+		if (!newdata)
+			return -1;
+		bc->data = newdata;
+		bc->alloc = alloc;
+	}
+	bc->size += len;
+
+	return 0;
+}
+
+/* one big mapping of simple key/value pairs */
+static int bench_gen_flat_map(struct bench_corpus *bc, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; bc->size < size; i++) {
+		if (bench_corpus_printf(bc, "key-%u: value number %u\n", i, i * 7))
+			return -1;
+	}
+	return 0;
+}
+
+/* chains of nested block mappings ending in nested flow sequences */
+static int bench_gen_deep_nesting(struct bench_corpus *bc, size_t size)
+{
+	const int depth = 32;
+	unsigned int i;
+	int j;
+
+	for (i = 0; bc->size < size; i++) {
+		if (bench_corpus_printf(bc, "nest-%u:\n", i))
+			return -1;
+		for (j = 1; j <= depth; j++) {
+			if (bench_corpus_printf(bc, "%*slevel-%d:\n", j * 2, "", j))
+				return -1;
+		}
+		if (bench_corpus_printf(bc, "%*s", (depth + 1) * 2, ""))
+			return -1;
+		for (j = 0; j < depth; j++) {
+			if (bench_corpus_printf(bc, "[ %d, ", j))
+				return -1;
+		}
+		if (bench_corpus_printf(bc, "leaf"))
+			return -1;
+		for (j = 0; j < depth; j++) {
+			if (bench_corpus_printf(bc, " ]"))
+				return -1;
+		}
+		if (bench_corpus_printf(bc, "\n"))
+			return -1;
+	}
+	return 0;
+}
+
+/* long literal and folded block scalars */
+static int bench_gen_block_scalars(struct bench_corpus *bc, size_t size)
+{
+	unsigned int i;
+	int j;
+
+	for (i = 0; bc->size < size; i++) {
+		if (bench_corpus_printf(bc, "text-%u: %s\n", i, (i & 1) ? ">" : "|"))
+			return -1;
+		for (j = 0; j < 64; j++) {
+			if (bench_corpus_printf(bc, "  line %d of block %u, some words to fill"
+						    " the line up to a typical width\n", j, i))
+				return -1;
+		}
+	}
+	return 0;
+}
+
+/* anchored mappings, referred to by aliases and merge keys */
+static int bench_gen_anchors(struct bench_corpus *bc, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; bc->size < size; i++) {
+		if (bench_corpus_printf(bc, "base-%u: &b%u { x: %u, y: %u, z: [ a, b, c ] }\n"
+					    "ref-%u:\n"
+					    "  <<: *b%u\n"
+					    "  w: *b%u\n"
+					    "  v: value %u\n",
+					    i, i, i, i + 1, i, i, i, i))
+			return -1;
+	}
+	return 0;
+}
+
+/* a stream of many small documents */
+static int bench_gen_small_docs(struct bench_corpus *bc, size_t size)
+{
+	unsigned int i;
+
+	for (i = 0; bc->size < size; i++) {
+		if (bench_corpus_printf(bc, "---\n"
+					    "id: %u\n"
+					    "name: document %u\n"
+					    "tags: [ small, doc ]\n", i, i))
+			return -1;
+	}
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*gen)(struct bench_corpus *bc, size_t size);
+} bench_generators[] = {
+	{ .name = "flat-map",		.gen = bench_gen_flat_map },
+	{ .name = "deep-nesting",	.gen = bench_gen_deep_nesting },
+	{ .name = "block-scalars",	.gen = bench_gen_block_scalars },
+	{ .name = "anchors",		.gen = bench_gen_anchors },
+	{ .name = "small-docs",		.gen = bench_gen_small_docs },
+};
+
+static int bench_corpus_read_file(struct bench_corpus *bc, const char *file)
+{
+	FILE *fp;
+	char *newdata;
+	size_t nread;
+
+	fp = fopen(file, "rb");
+	if (!fp)
+		return -1;
+
+	do {
+		if (bc->size >= bc->alloc) {
+			bc->alloc = bc->alloc ? bc->alloc * 2 : 65536;
+			newdata = realloc(bc->data, bc->alloc);
+			if (!newdata) {
+				fclose(fp);
+				return -1;
+			}
+			bc->data = newdata;
+		}
+		nread = fread(bc->data + bc->size, 1, bc->alloc - bc->size, fp);
+		bc->size += nread;
+	} while (nread > 0);
+
+	nread = ferror(fp);
+	fclose(fp);
+
+	return nread ? -1 : 0;
+}
+
+static void bench_run_stages(const char *lib, const struct bench_corpus *bc,
+			     const struct bench_stage *stages, unsigned int count,
+			     const char *stage, double min_time)
+{
+	const struct bench_stage *bs;
+	struct bench_timer bt;
+	unsigned int i, passes;
+	double mb;
+	int rc;
+
+	for (i = 0; i < count; i++) {
+		bs = &stages[i];
+		if (stage && strcmp(stage, bs->name))
+			continue;
+
+		memset(&bt, 0, sizeof(bt));
+		rc = 0;
+		for (passes = 0; passes < MAX_PASSES_DEFAULT &&
+				 (passes == 0 || bt.secs < min_time); passes++) {
+			rc = bs->run(bc, &bt);
+			if (rc)
+				break;
+		}
+
+		printf("%-14s %-8s %-8s ", bc->name, lib, bs->name);
+		if (rc) {
+			printf("%12s\n", "failed");
+			continue;
+		}
+
+		mb = (double)bc->size * passes / BENCH_MB;
+		printf("%12.2f", bt.secs > 0 ? mb / bt.secs : 0.0);
+		if (BENCH_COUNT_ALLOCS)
+			printf(" %12.1f", mb > 0 ? (double)bt.total_allocs / mb : 0.0);
+		else
+			printf(" %12s", "-");
+		printf(" %8u\n", passes);
+	}
+}
+
+static void display_usage(FILE *fp, char *progname)
+{
+	unsigned int i;
+
+	fprintf(fp, "Usage: %s [options] [files]\n", progname);
+	fprintf(fp, "\nOptions:\n\n");
+	fprintf(fp, "\t--size, -s <MB>          : Size of each generated corpus"
+						" (default %d)\n",
+						SIZE_DEFAULT);
+	fprintf(fp, "\t--min-time, -t <secs>    : Minimum time to run each stage for"
+						" (default %.1f)\n",
+						MIN_TIME_DEFAULT);
+	fprintf(fp, "\t--corpus, -c <name>      : Only run the given corpus\n");
+	fprintf(fp, "\t--stage, -S <name>       : Only run the given stage"
+						" (scan, parse, load, resolve, emit)\n");
+	fprintf(fp, "\t--help, -h               : Display  help message\n");
+	fprintf(fp, "\nThe generated corpora are:");
+	for (i = 0; i < sizeof(bench_generators)/sizeof(bench_generators[0]); i++)
+		fprintf(fp, " %s", bench_generators[i].name);
+	fprintf(fp, "\nany [files] given are used as additional corpora\n");
+#if defined(HAVE_LIBYAML) && HAVE_LIBYAML
+	fprintf(fp, "Each stage is also run with libyaml, when it has one\n");
+#endif
+	fprintf(fp, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_corpus *corpora = NULL, *bc;
+	unsigned int i, count = 0;
+	size_t size = (size_t)SIZE_DEFAULT * 1024 * 1024;
+	double min_time = MIN_TIME_DEFAULT;
+	const char *corpus = NULL, *stage = NULL;
+	int opt, lidx, exitcode = EXIT_FAILURE;
+
+	fy_valgrind_check(&argc, &argv);
+
+	while ((opt = getopt_long_only(argc, argv, "s:t:c:S:h", lopts, &lidx)) != -1) {
+		switch (opt) {
+		case 's':
+			size = (size_t)(atof(optarg) * 1024 * 1024);
+			break;
+		case 't':
+			min_time = atof(optarg);
+			break;
+		case 'c':
+			corpus = optarg;
+			break;
+		case 'S':
+			stage = optarg;
+			break;
+		case 'h' :
+		default:
+			display_usage(opt == 'h' ? stdout : stderr, argv[0]);
+			return opt == 'h' ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	corpora = calloc(sizeof(bench_generators)/sizeof(bench_generators[0]) +
+			 (argc - optind), sizeof(*corpora));
+	if (!corpora) {
+		fprintf(stderr, "unable to allocate corpora\n");
+		goto cleanup;
+	}
+
+	for (i = 0; i < sizeof(bench_generators)/sizeof(bench_generators[0]); i++) {
+		if (corpus && strcmp(corpus, bench_generators[i].name))
+			continue;
+		bc = &corpora[count++];
+		bc->name = bench_generators[i].name;
+		if (bench_generators[i].gen(bc, size)) {
+			fprintf(stderr, "unable to generate corpus %s\n", bc->name);
+			goto cleanup;
+		}
+	}
+
+	for (; optind < argc; optind++) {
+		bc = &corpora[count++];
+		bc->name = strrchr(argv[optind], '/');
+		bc->name = bc->name ? bc->name + 1 : argv[optind];
+		if (bench_corpus_read_file(bc, argv[optind])) {
+			fprintf(stderr, "unable to read corpus file %s\n", argv[optind]);
+			goto cleanup;
+		}
+	}
+
+	printf("%-14s %-8s %-8s %12s %12s %8s\n",
+	       "corpus", "library", "stage", "MB/s", "allocs/MB", "passes");
+
+	for (i = 0; i < count; i++) {
+		bc = &corpora[i];
+		bench_run_stages("libfyaml", bc, fy_stages,
+				 sizeof(fy_stages)/sizeof(fy_stages[0]),
+				 stage, min_time);
+#if defined(HAVE_LIBYAML) && HAVE_LIBYAML
+		bench_run_stages("libyaml", bc, libyaml_stages,
+				 sizeof(libyaml_stages)/sizeof(libyaml_stages[0]),
+				 stage, min_time);
+#endif
+	}
+
+	exitcode = EXIT_SUCCESS;
+
+cleanup:
+	if (corpora) {
+		for (i = 0; i < count; i++)
+			free(corpora[i].data);
+		free(corpora);
+	}
+
+	return exitcode;
+}
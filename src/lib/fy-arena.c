@@ -0,0 +1,78 @@
+/*
+ * fy-arena.c - arena (bump) allocator
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <stdlib.h>
+
+#include "fy-arena.h"
+
+void fy_arena_init(struct fy_arena *fyar, size_t block_size)
+{
+	fy_arena_block_list_init(&fyar->blocks);
+	fyar->block_size = block_size ? block_size : FY_ARENA_DEFAULT_BLOCK_SIZE;
+}
+
+void fy_arena_cleanup(struct fy_arena *fyar)
+{
+	struct fy_arena_block *fyab;
+
+	while ((fyab = fy_arena_block_list_pop(&fyar->blocks)) != NULL)
+		free(fyab);
+}
+
+static struct fy_arena_block *fy_arena_block_create(size_t size)
+{
+	struct fy_arena_block *fyab;
+
+	fyab = malloc(offsetof(struct fy_arena_block, data) + size);
+	if (!fyab)
+		return NULL;
+
+	fyab->size = size;
+	fyab->used = 0;
+	return fyab;
+}
+
+void *fy_arena_alloc(struct fy_arena *fyar, size_t size)
+{
+	struct fy_arena_block *fyab;
+	void *p;
+
+	/* keep everything aligned as the block data */
+	size = (size + sizeof(fyab->data[0]) - 1) & ~(sizeof(fyab->data[0]) - 1);
+
+	fyab = fy_arena_block_list_head(&fyar->blocks);
+	if (!fyab || fyab->size - fyab->used < size) {
+
+		/* large objects get a block of their own, behind the current */
+		if (size > fyar->block_size / 4) {
+			fyab = fy_arena_block_create(size);
+			if (!fyab)
+				return NULL;
+			fy_arena_block_list_add_tail(&fyar->blocks, fyab);
+			fyab->used = size;
+			return &fyab->data[0];
+		}
+
+		fyab = fy_arena_block_create(fyar->block_size);
+		if (!fyab)
+			return NULL;
+		fy_arena_block_list_add(&fyar->blocks, fyab);
+	}
+
+	p = (char *)&fyab->data[0] + fyab->used;
+	fyab->used += size;
+
+	return p;
+}
@@ -0,0 +1,45 @@
+/*
+ * fy-arena.h - arena (bump) allocator header
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_ARENA_H
+#define FY_ARENA_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "fy-list.h"
+#include "fy-typelist.h"
+
+/* objects are carved out of large blocks, which are only
+ * released all together when the arena is cleaned up
+ */
+
+#define FY_ARENA_DEFAULT_BLOCK_SIZE	(64 << 10)
+
+FY_TYPE_FWD_DECL_LIST(arena_block);
+struct fy_arena_block {
+	struct list_head node;
+	size_t size;
+	size_t used;
+	uint64_t data[0];
+};
+FY_TYPE_DECL_LIST(arena_block);
+
+struct fy_arena {
+	struct fy_arena_block_list blocks;
+	size_t block_size;
+};
+
+void fy_arena_init(struct fy_arena *fyar, size_t block_size);
+void fy_arena_cleanup(struct fy_arena *fyar);
+void *fy_arena_alloc(struct fy_arena *fyar, size_t size);
+
+#endif
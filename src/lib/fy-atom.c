@@ -1277,3 +1277,114 @@ int fy_atom_cmp(struct fy_atom *atom1, struct fy_atom *atom2)
 
 	return c2 > c1 ? -1 : 1;
 }
+
+bool fy_atom_content_is_direct(const char *str, size_t len, unsigned int aflags)
+{
+	const char *e = str + len;
+
+	/* nothing that would have to be escaped when quoted */
+	if ((aflags & (FYACF_FLOW_PLAIN | FYACF_PRINTABLE | FYACF_LB)) !=
+			(FYACF_FLOW_PLAIN | FYACF_PRINTABLE))
+		return false;
+
+	/* a plain atom drops the whitespace at its ends */
+	if (aflags & (FYACF_STARTS_WITH_WS | FYACF_ENDS_WITH_WS))
+		return false;
+
+	for (; str < e; str++) {
+		if (*str == '\'' || *str == '"' || *str == '\\')
+			return false;
+	}
+	return true;
+}
+
+/*
+ * The text is normally used as is as the content of a literal atom
+ * with no indentation. That can't express line breaks other than \n,
+ * nor leading or trailing whitespace, nor a line of only whitespace
+ * (those are folded into empty lines); such text is escaped.
+ */
+bool fy_atom_content_needs_escape(const char *str, size_t len)
+{
+	const char *s = str, *e = str + len;
+	bool blank_line = false;
+	int c, w;
+
+	if (!len)
+		return false;
+
+	if (fy_is_ws(str[0]) || fy_is_ws(str[len - 1]))
+		return true;
+
+	while (s < e && (c = fy_utf8_get(s, e - s, &w)) >= 0) {
+		s += w;
+		if (c == '\n') {
+			if (blank_line)
+				return true;
+			blank_line = s < e && fy_is_ws(*s);
+		} else if (fy_is_lb(c))
+			return true;
+		else if (!fy_is_ws(c))
+			blank_line = false;
+	}
+	return false;
+}
+
+size_t fy_atom_content_escape(const char *str, size_t len, char *buf)
+{
+	const char *s = str, *e = str + len;
+	char tbuf[16];
+	size_t blen, olen;
+	int c, w;
+
+	olen = 0;
+	while (s < e && (c = fy_utf8_get(s, e - s, &w)) >= 0) {
+		s += w;
+		if (c == '\n' || c == '\r' || c == '\t' || c == '\0' || c == '\b' ||
+		    c == '\\' || c == '"')
+			fy_utf8_format(c, tbuf, fyue_doublequote);
+		else if (!fy_is_print(c) || fy_is_lb(c))
+			snprintf(tbuf, sizeof(tbuf), c <= 0xff ? "\\x%02x" : "\\u%04x", c);
+		else
+			fy_utf8_format(c, tbuf, fyue_none);
+
+		blen = strlen(tbuf);
+		memcpy(buf + olen, tbuf, blen);
+		olen += blen;
+	}
+	return olen;
+}
+
+void fy_atom_content_setup(struct fy_atom *atom, struct fy_input *fyi,
+			   size_t pos, size_t len, unsigned int columns,
+			   unsigned int aflags, bool direct, bool escaped)
+{
+	memset(atom, 0, sizeof(*atom));
+	atom->start_mark.input_pos = pos;
+	atom->end_mark.input_pos = pos + len;
+	atom->end_mark.column = columns;
+	if (direct) {
+		atom->storage_hint = len;
+		atom->direct_output = true;
+		atom->style = FYAS_PLAIN;
+		atom->chomp = FYAC_STRIP;
+	} else if (escaped) {
+		/* a single line of double quoted content */
+		atom->style = FYAS_DOUBLE_QUOTED;
+		atom->chomp = FYAC_STRIP;
+	} else {
+		/* a literal with no indentation has exactly the text as content */
+		atom->style = FYAS_LITERAL;
+		atom->chomp = (aflags & FYACF_ENDS_WITH_LB) ? FYAC_KEEP : FYAC_STRIP;
+	}
+	atom->empty = !!(aflags & FYACF_EMPTY);
+	atom->has_lb = !!(aflags & FYACF_LB);
+	atom->has_ws = !!(aflags & FYACF_WS);
+	atom->starts_with_ws = !!(aflags & FYACF_STARTS_WITH_WS);
+	atom->starts_with_lb = !!(aflags & FYACF_STARTS_WITH_LB);
+	atom->ends_with_ws = !!(aflags & FYACF_ENDS_WITH_WS);
+	atom->ends_with_lb = !!(aflags & FYACF_ENDS_WITH_LB);
+	atom->trailing_lb = !!(aflags & FYACF_TRAILING_LB);
+	atom->size0 = !!(aflags & FYACF_SIZE0);
+	atom->fyi = fyi;
+}
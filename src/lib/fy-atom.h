@@ -189,4 +189,18 @@ int fy_atom_strcmp(struct fy_atom *atom, const char *str);
 bool fy_atom_is_number(struct fy_atom *atom);
 int fy_atom_cmp(struct fy_atom *atom1, struct fy_atom *atom2);
 
+/*
+ * Atoms over text libfyaml stores itself (snapshots, directly built
+ * scalars). Direct text is output as is, escaped text is a single
+ * double quoted line, anything else is a literal with no indentation.
+ */
+bool fy_atom_content_is_direct(const char *str, size_t len, unsigned int aflags);
+bool fy_atom_content_needs_escape(const char *str, size_t len);
+/* buf must hold FY_ATOM_CONTENT_ESCAPE_MAX(len) octets */
+#define FY_ATOM_CONTENT_ESCAPE_MAX(_len)	((_len) * 4)
+size_t fy_atom_content_escape(const char *str, size_t len, char *buf);
+void fy_atom_content_setup(struct fy_atom *atom, struct fy_input *fyi,
+			   size_t pos, size_t len, unsigned int columns,
+			   unsigned int aflags, bool direct, bool escaped);
+
 #endif
@@ -14,6 +14,215 @@
 
 #include "fy-ctype.h"
 
+/*
+ * The vector kernels are selected at compile time; SSE2 and NEON
+ * are part of the x86_64 and aarch64 baselines respectively, so
+ * there's no need for runtime dispatch. Everything else uses the
+ * scalar fallback.
+ */
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define FY_CTYPE_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define FY_CTYPE_NEON
+#endif
+
+#if defined(FY_CTYPE_SSE2)
+
+#define FY_SPAN_BLOCK	16
+
+/* bitmask of octets that are not plain safe; bit n is octet n */
+static inline unsigned int fy_span_block_plain_safe_stop(const uint8_t *s)
+{
+	__m128i v, m;
+
+	v = _mm_loadu_si128((const __m128i *)s);
+	/* signed compare catches both controls/space and non-ascii */
+	m = _mm_cmplt_epi8(v, _mm_set1_epi8(0x21));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(':')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(',')));
+	/* '[' | 0x20 == '{' and ']' | 0x20 == '}' */
+	v = _mm_or_si128(v, _mm_set1_epi8(0x20));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('{')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('}')));
+
+	return (unsigned int)_mm_movemask_epi8(m);
+}
+
+/* bitmask of octets that are not quoted safe; bit n is octet n */
+static inline unsigned int fy_span_block_quoted_safe_stop(const uint8_t *s)
+{
+	__m128i v, m;
+
+	v = _mm_loadu_si128((const __m128i *)s);
+	m = _mm_cmplt_epi8(v, _mm_set1_epi8(0x21));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('"')));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\\')));
+
+	return (unsigned int)_mm_movemask_epi8(m);
+}
+
+/* bitmask of octets that are not spaces */
+static inline unsigned int fy_span_block_space_stop(const uint8_t *s)
+{
+	__m128i v;
+
+	v = _mm_loadu_si128((const __m128i *)s);
+	return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(' '))) ^ 0xffff;
+}
+
+/* bitmask of octets that are not spaces or tabs */
+static inline unsigned int fy_span_block_ws_stop(const uint8_t *s)
+{
+	__m128i v, m;
+
+	v = _mm_loadu_si128((const __m128i *)s);
+	m = _mm_cmpeq_epi8(v, _mm_set1_epi8(' '));
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+
+	return (unsigned int)_mm_movemask_epi8(m) ^ 0xffff;
+}
+
+/* bitmask of octets that are not comment safe */
+static inline unsigned int fy_span_block_comment_safe_stop(const uint8_t *s)
+{
+	__m128i v, m;
+
+	v = _mm_loadu_si128((const __m128i *)s);
+	/* controls and non-ascii, but not tab */
+	m = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+	m = _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\t')), m);
+	m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+
+	return (unsigned int)_mm_movemask_epi8(m);
+}
+
+/* index of the first stop octet of a non zero block mask */
+static inline unsigned int fy_span_block_first(unsigned int mask)
+{
+	return (unsigned int)__builtin_ctz(mask);
+}
+
+#elif defined(FY_CTYPE_NEON)
+
+#define FY_SPAN_BLOCK	16
+
+/* narrow a byte mask to 4 bits per octet */
+static inline uint64_t fy_span_neon_mask(uint8x16_t m)
+{
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+}
+
+static inline uint64_t fy_span_block_plain_safe_stop(const uint8_t *s)
+{
+	uint8x16_t v, m;
+
+	v = vld1q_u8(s);
+	m = vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x21)), vcgtq_u8(v, vdupq_n_u8(0x7e)));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(':')));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8(',')));
+	/* '[' | 0x20 == '{' and ']' | 0x20 == '}' */
+	v = vorrq_u8(v, vdupq_n_u8(0x20));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('{')));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('}')));
+
+	return fy_span_neon_mask(m);
+}
+
+static inline uint64_t fy_span_block_quoted_safe_stop(const uint8_t *s)
+{
+	uint8x16_t v, m;
+
+	v = vld1q_u8(s);
+	m = vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x21)), vcgtq_u8(v, vdupq_n_u8(0x7e)));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\'')));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('"')));
+	m = vorrq_u8(m, vceqq_u8(v, vdupq_n_u8('\\')));
+
+	return fy_span_neon_mask(m);
+}
+
+static inline uint64_t fy_span_block_space_stop(const uint8_t *s)
+{
+	return fy_span_neon_mask(vmvnq_u8(vceqq_u8(vld1q_u8(s), vdupq_n_u8(' '))));
+}
+
+static inline uint64_t fy_span_block_ws_stop(const uint8_t *s)
+{
+	uint8x16_t v, m;
+
+	v = vld1q_u8(s);
+	m = vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t')));
+
+	return fy_span_neon_mask(vmvnq_u8(m));
+}
+
+static inline uint64_t fy_span_block_comment_safe_stop(const uint8_t *s)
+{
+	uint8x16_t v, m;
+
+	v = vld1q_u8(s);
+	/* controls, but not tab */
+	m = vbicq_u8(vcltq_u8(v, vdupq_n_u8(0x20)), vceqq_u8(v, vdupq_n_u8('\t')));
+	m = vorrq_u8(m, vcgtq_u8(v, vdupq_n_u8(0x7e)));
+
+	return fy_span_neon_mask(m);
+}
+
+static inline unsigned int fy_span_block_first(uint64_t mask)
+{
+	return (unsigned int)__builtin_ctzll(mask) >> 2;
+}
+
+#endif
+
+#ifdef FY_SPAN_BLOCK
+
+#define FY_SPAN_BUILDER(_kind) \
+size_t fy_span_ ## _kind (const void *ptr, size_t len) \
+{ \
+	const uint8_t *s = ptr, *e = s + len; \
+	\
+	while ((size_t)(e - s) >= FY_SPAN_BLOCK) { \
+		__typeof__(fy_span_block_ ## _kind ## _stop(s)) mask; \
+		\
+		mask = fy_span_block_ ## _kind ## _stop(s); \
+		if (mask) \
+			return (size_t)(s - (const uint8_t *)ptr) + \
+				fy_span_block_first(mask); \
+		s += FY_SPAN_BLOCK; \
+	} \
+	while (s < e && fy_is_ ## _kind ## _octet(*s)) \
+		s++; \
+	return (size_t)(s - (const uint8_t *)ptr); \
+} \
+struct useless_struct_for_semicolon
+
+#else
+
+#define FY_SPAN_BUILDER(_kind) \
+size_t fy_span_ ## _kind (const void *ptr, size_t len) \
+{ \
+	const uint8_t *s = ptr, *e = s + len; \
+	\
+	while (s < e && fy_is_ ## _kind ## _octet(*s)) \
+		s++; \
+	return (size_t)(s - (const uint8_t *)ptr); \
+} \
+struct useless_struct_for_semicolon
+
+#endif
+
+FY_SPAN_BUILDER(plain_safe);
+FY_SPAN_BUILDER(quoted_safe);
+FY_SPAN_BUILDER(space);
+FY_SPAN_BUILDER(ws);
+FY_SPAN_BUILDER(comment_safe);
+
 const char *fy_uri_esc(const char *s, size_t len, uint8_t *code, int *code_len)
 {
 	const char *e = s + len;
@@ -220,4 +220,54 @@ static inline const void *fy_last_non_ws(const void *ptr, int left)
 
 const char *fy_uri_esc(const char *s, size_t len, uint8_t *code, int *code_len);
 
+/*
+ * Octet span methods used by the scanner fast paths.
+ * They only accept printable ascii octets and tabs, so a span
+ * never contains a line break or a multi byte utf8 character
+ * and the column can be advanced by the span length.
+ */
+
+/* printable non-space ascii, none of : , [ ] { } */
+static inline bool fy_is_plain_safe_octet(uint8_t c)
+{
+	return c > 0x20 && c < 0x7f &&
+	       c != ':' && c != ',' &&
+	       c != '[' && c != ']' &&
+	       c != '{' && c != '}';
+}
+
+/* printable non-space ascii, none of ' " \ */
+static inline bool fy_is_quoted_safe_octet(uint8_t c)
+{
+	return c > 0x20 && c < 0x7f &&
+	       c != '\'' && c != '"' && c != '\\';
+}
+
+static inline bool fy_is_space_octet(uint8_t c)
+{
+	return c == ' ';
+}
+
+static inline bool fy_is_ws_octet(uint8_t c)
+{
+	return c == ' ' || c == '\t';
+}
+
+/* printable ascii or tab; everything but line breaks and utf8 */
+static inline bool fy_is_comment_safe_octet(uint8_t c)
+{
+	return (c >= 0x20 && c < 0x7f) || c == '\t';
+}
+
+/* return the number of leading octets that are plain safe */
+size_t fy_span_plain_safe(const void *ptr, size_t len);
+/* return the number of leading octets that are quoted safe */
+size_t fy_span_quoted_safe(const void *ptr, size_t len);
+/* return the number of leading spaces */
+size_t fy_span_space(const void *ptr, size_t len);
+/* return the number of leading spaces or tabs */
+size_t fy_span_ws(const void *ptr, size_t len);
+/* return the number of leading octets that are comment safe */
+size_t fy_span_comment_safe(const void *ptr, size_t len);
+
 #endif
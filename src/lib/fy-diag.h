@@ -25,7 +25,7 @@ struct fy_parser;
 struct fy_token;
 struct fy_token_list;
 struct fy_simple_key;
-struct fy_simple_key_list;
+struct fy_simple_key_stack;
 struct fy_input_cfg;
 
 /* error flags (above 0x100 is library specific) */
@@ -137,7 +137,7 @@ char *fy_token_list_dump_format(struct fy_token_list *fytl,
 		struct fy_token *fyt_highlight, char *buf, size_t bufsz);
 
 char *fy_simple_key_dump_format(struct fy_parser *fyp, struct fy_simple_key *fysk, char *buf, size_t bufsz);
-char *fy_simple_key_list_dump_format(struct fy_parser *fyp, struct fy_simple_key_list *fyskl,
+char *fy_simple_key_stack_dump_format(struct fy_parser *fyp, struct fy_simple_key_stack *fysks,
 		struct fy_simple_key *fysk_highlight, char *buf, size_t bufsz);
 
 #ifndef NDEBUG
@@ -146,7 +146,7 @@ void fy_debug_dump_token_list(struct fy_parser *fyp, struct fy_token_list *fytl,
 		struct fy_token *fyt_highlight, const char *banner);
 void fy_debug_dump_token(struct fy_parser *fyp, struct fy_token *fyt, const char *banner);
 
-void fy_debug_dump_simple_key_list(struct fy_parser *fyp, struct fy_simple_key_list *fyskl,
+void fy_debug_dump_simple_key_stack(struct fy_parser *fyp, struct fy_simple_key_stack *fysks,
 		struct fy_simple_key *fysk_highlight, const char *banner);
 void fy_debug_dump_simple_key(struct fy_parser *fyp, struct fy_simple_key *fysk, const char *banner);
 
@@ -169,7 +169,7 @@ fy_debug_dump_token(struct fy_parser *fyp, struct fy_token *fyt, const char *ban
 }
 
 static inline void
-fy_debug_dump_simple_key_list(struct fy_parser *fyp, struct fy_simple_key_list *fyskl,
+fy_debug_dump_simple_key_stack(struct fy_parser *fyp, struct fy_simple_key_stack *fysks,
 			      struct fy_simple_key *fysk_highlight, const char *banner)
 {
 	/* nothing */
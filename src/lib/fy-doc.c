@@ -15,6 +15,11 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #include <libfyaml.h>
 
@@ -22,6 +27,7 @@
 #include "fy-doc.h"
 
 #include "fy-utils.h"
+#include "fy-keys.h"
 
 static struct fy_node *
 fy_node_by_path_internal(struct fy_node *fyn,
@@ -159,14 +165,25 @@ void fy_parse_document_state_recycle(struct fy_parser *fyp, struct fy_document_s
 }
 
 static void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_parent);
+static int fy_node_copy_items(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_from,
+			      struct fy_node *fyn_dest);
 int fy_document_state_merge(struct fy_document *fyd, struct fy_document *fydc);
+static struct fy_token *fy_document_tag_create(struct fy_document *fyd, const char *data, size_t len);
+struct fy_path_trail;
+static struct fy_node *
+fy_path_query_walk(const struct fy_path_query *fypq, enum fy_path_region region,
+		   int i, struct fy_node *fyn, struct fy_path_trail *trail);
+static struct fy_input *fy_document_build_input(struct fy_document *fyd,
+						const char *data, size_t size,
+						enum fy_node_build_data mode,
+						size_t *posp);
 
-void fy_anchor_destroy(struct fy_anchor *fya)
+void fy_anchor_destroy(struct fy_document *fyd, struct fy_anchor *fya)
 {
 	if (!fya)
 		return;
 	fy_token_unref(fya->anchor);
-	free(fya);
+	fy_document_obj_free(fyd, fya);
 }
 
 struct fy_anchor *fy_anchor_create(struct fy_document *fyd,
@@ -174,20 +191,182 @@ struct fy_anchor *fy_anchor_create(struct fy_document *fyd,
 {
 	struct fy_anchor *fya = NULL;
 
-	fya = malloc(sizeof(*fya));
+	fya = fy_document_obj_alloc(fyd, sizeof(*fya));
 	fy_error_check(fyd->fyp, fya, err_out,
-			"malloc() failed");
+			"fy_document_obj_alloc() failed");
 
 	fya->fyn = fyn;
 	fya->anchor = anchor;
+	INIT_HLIST_NODE(&fya->hnode_text);
+	INIT_HLIST_NODE(&fya->hnode_node);
+	fya->hash = 0;
+	fya->seq = 0;
 
 	return fya;
 
 err_out:
-	fy_anchor_destroy(fya);
 	return NULL;
 }
 
+/* documents with fewer anchors than this are searched linearly */
+#define FY_ANCHOR_INDEX_MIN	16
+
+static uint32_t fy_anchor_text_hash(struct fy_anchor *fya)
+{
+	const char *text;
+	size_t len;
+
+	text = fy_anchor_get_text(fya, &len);
+	return text ? fy_hash_data(text, len) : 0;
+}
+
+static inline struct hlist_head *
+fy_anchor_index_text_bucket(struct fy_anchor_index *fyai, uint32_t hash)
+{
+	return &fyai->buckets[hash & fyai->mask];
+}
+
+static inline struct hlist_head *
+fy_anchor_index_node_bucket(struct fy_anchor_index *fyai, const struct fy_node *fyn)
+{
+	return &fyai->buckets[fyai->mask + 1 + (fy_hash_data(&fyn, sizeof(fyn)) & fyai->mask)];
+}
+
+static struct fy_anchor_index *fy_anchor_index_alloc(unsigned int count)
+{
+	struct fy_anchor_index *fyai;
+	unsigned int i, nbuckets;
+
+	/* keep the load factor under one */
+	nbuckets = FY_ANCHOR_INDEX_MIN;
+	while (nbuckets < count)
+		nbuckets <<= 1;
+
+	fyai = malloc(sizeof(*fyai) + sizeof(fyai->buckets[0]) * nbuckets * 2);
+	if (!fyai)
+		return NULL;
+
+	fyai->count = 0;
+	fyai->mask = nbuckets - 1;
+	for (i = 0; i < nbuckets * 2; i++)
+		INIT_HLIST_HEAD(&fyai->buckets[i]);
+
+	return fyai;
+}
+
+static void fy_anchor_index_insert(struct fy_anchor_index *fyai, struct fy_anchor *fya)
+{
+	hlist_add_head(&fya->hnode_text, fy_anchor_index_text_bucket(fyai, fya->hash));
+	hlist_add_head(&fya->hnode_node, fy_anchor_index_node_bucket(fyai, fya->fyn));
+	fyai->count++;
+}
+
+static int fy_document_anchor_index_build(struct fy_document *fyd)
+{
+	struct fy_anchor_index *fyai;
+	struct fy_anchor *fya;
+
+	fyai = fy_anchor_index_alloc(fyd->anchor_count);
+	if (!fyai)
+		return -1;
+
+	for (fya = fy_anchor_list_head(&fyd->anchors); fya;
+		fya = fy_anchor_next(&fyd->anchors, fya)) {
+
+		fya->hash = fy_anchor_text_hash(fya);
+		fy_anchor_index_insert(fyai, fya);
+	}
+
+	free(fyd->anchor_index);
+	fyd->anchor_index = fyai;
+
+	return 0;
+}
+
+static void fy_document_anchor_index_free(struct fy_document *fyd)
+{
+	free(fyd->anchor_index);
+	fyd->anchor_index = NULL;
+	fyd->anchor_count = 0;
+}
+
+/*
+ * Add an anchor to the document. The seq of the anchors follows the
+ * order of the list, so that the index can pick the same anchor
+ * as a reverse scan of the list would.
+ */
+static void fy_document_anchor_add(struct fy_document *fyd, struct fy_anchor *fya,
+				   bool at_tail)
+{
+	struct fy_anchor_index *fyai;
+
+	if (at_tail) {
+		fya->seq = ++fyd->anchor_seq_tail;
+		fy_anchor_list_add_tail(&fyd->anchors, fya);
+	} else {
+		fya->seq = fyd->anchor_seq_head--;
+		fy_anchor_list_add(&fyd->anchors, fya);
+	}
+	fyd->anchor_count++;
+
+	/* the anchor text is not prepared yet */
+	fyd->frozen = false;
+
+	fyai = fyd->anchor_index;
+	if (!fyai) {
+		/* on allocation failure just keep on searching linearly */
+		if (fyd->anchor_count >= FY_ANCHOR_INDEX_MIN)
+			fy_document_anchor_index_build(fyd);
+		return;
+	}
+
+	fya->hash = fy_anchor_text_hash(fya);
+	fy_anchor_index_insert(fyai, fya);
+
+	/* grow; on allocation failure just live with longer chains */
+	if (fyai->count > fyai->mask + 1)
+		fy_document_anchor_index_build(fyd);
+}
+
+static void fy_document_anchor_del(struct fy_document *fyd, struct fy_anchor *fya)
+{
+	fy_anchor_list_del(&fyd->anchors, fya);
+	fyd->anchor_count--;
+
+	if (!fyd->anchor_index || hlist_unhashed(&fya->hnode_text))
+		return;
+
+	hlist_del_init(&fya->hnode_text);
+	hlist_del_init(&fya->hnode_node);
+	fyd->anchor_index->count--;
+}
+
+/* remove (and destroy) all the anchors located on the node */
+static void fy_document_remove_node_anchors(struct fy_document *fyd, struct fy_node *fyn)
+{
+	struct fy_anchor *fya, *fyan;
+	struct hlist_node *pos, *n;
+
+	if (fyd->anchor_index) {
+		hlist_for_each_entry_safe(fya, pos, n,
+				fy_anchor_index_node_bucket(fyd->anchor_index, fyn), hnode_node) {
+			if (fya->fyn != fyn)
+				continue;
+			fy_document_anchor_del(fyd, fya);
+			fy_anchor_destroy(fyd, fya);
+		}
+		return;
+	}
+
+	for (fya = fy_anchor_list_head(&fyd->anchors); fya; fya = fyan) {
+		fyan = fy_anchor_next(&fyd->anchors, fya);
+		if (fya->fyn == fyn) {
+			fy_document_anchor_del(fyd, fya);
+			fy_anchor_destroy(fyd, fya);
+		}
+	}
+}
+
 struct fy_anchor *fy_document_anchor_iterate(struct fy_document *fyd, void **prevp)
 {
 	struct fy_anchor_list *fyal;
@@ -228,11 +407,11 @@ int fy_document_set_anchor(struct fy_document *fyd, struct fy_node *fyn, const c
 	if (!fya)
 		goto err_out;
 
-	fy_anchor_list_add(&fyd->anchors, fya);
+	fy_document_anchor_add(fyd, fya, false);
 
 	return 0;
 err_out:
-	fy_anchor_destroy(fya);
+	fy_anchor_destroy(fyd, fya);
 	fy_token_unref(fyt);
 	fy_input_unref(fyi);
 	return -1;
@@ -247,7 +426,12 @@ int fy_node_set_anchor(struct fy_node *fyn, const char *text, size_t len)
 
 int fy_node_remove_anchor(struct fy_node *fyn)
 {
-	return fy_node_set_anchor(fyn, NULL, 0);
+	if (!fyn)
+		return -1;
+
+	fy_document_remove_node_anchors(fyn->fyd, fyn);
+
+	return 0;
 }
 
 struct fy_anchor *fy_node_get_anchor(struct fy_node *fyn)
@@ -274,17 +458,25 @@ void fy_parse_document_destroy(struct fy_parser *fyp, struct fy_document *fyd)
 
 	fy_node_free(fyd->root);
 
+	fy_input_unref(fyd->build_fyi);
+
 	/* remove all anchors */
 	for (fya = fy_anchor_list_head(&fyd->anchors); fya; fya = fyan) {
 		fyan = fy_anchor_next(&fyd->anchors, fya);
-		fy_anchor_destroy(fya);
+		fy_anchor_destroy(fyd, fya);
 	}
+	fy_document_anchor_index_free(fyd);
 
 	fy_document_state_unref(fyd->fyds);
 
+	fy_intern_unref(fyd->intern);
+
 	/* and release all the remaining tracked memory */
 	fy_tfree_all(&fyd->tallocs);
 
+	if (fyd->use_arena)
+		fy_arena_cleanup(&fyd->arena);
+
 	fy_parse_free(fyp, fyd);
 }
 
@@ -335,6 +527,14 @@ struct fy_document *fy_parse_document_create(struct fy_parser *fyp, struct fy_ev
 	fyd->fyp = fyp;
 	fy_talloc_list_init(&fyd->tallocs);
 
+	fyd->use_arena = !!(fyp->cfg.flags & FYPCF_DOCUMENT_ARENA);
+	if (fyd->use_arena)
+		fy_arena_init(&fyd->arena, 0);
+
+	fyd->lazy = !!(fyp->cfg.flags & FYPCF_LAZY_DOCUMENT);
+
+	fyd->intern = fy_intern_ref(fyp->cfg.intern);
+
 	fy_anchor_list_init(&fyd->anchors);
 	fyd->root = NULL;
 
@@ -371,10 +571,13 @@ err_stream_start:
 struct fy_anchor *
 fy_document_lookup_anchor(struct fy_document *fyd, const char *anchor, size_t len)
 {
-	struct fy_anchor *fya;
+	struct fy_anchor *fya, *fya_found;
 	struct fy_anchor_list *fyal;
+	struct fy_anchor_index *fyai;
+	struct hlist_node *pos;
 	const char *text;
 	size_t text_len;
+	uint32_t hash;
 
 	if (!fyd || !anchor)
 		return NULL;
@@ -382,6 +585,21 @@ fy_document_lookup_anchor(struct fy_document *fyd, const char *anchor, size_t le
 	if (len == (size_t)-1)
 		len = strlen(anchor);
 
+	/* the most recent is the one with the highest seq */
+	fyai = fyd->anchor_index;
+	if (fyai) {
+		hash = fy_hash_data(anchor, len);
+		fya_found = NULL;
+		hlist_for_each_entry(fya, pos, fy_anchor_index_text_bucket(fyai, hash), hnode_text) {
+			if (fya->hash != hash || (fya_found && fya->seq < fya_found->seq))
+				continue;
+			text = fy_anchor_get_text(fya, &text_len);
+			if (text && len == text_len && !memcmp(anchor, text, len))
+				fya_found = fya;
+		}
+		return fya_found;
+	}
+
 	/* note that we're performing the lookup in reverse creation order
 	 * so that we pick the most recent
 	 */
@@ -398,14 +616,46 @@ fy_document_lookup_anchor(struct fy_document *fyd, const char *anchor, size_t le
 	return NULL;
 }
 
+/*
+ * Of multiple anchors with the same text pick the most recent one that
+ * is before the requesting token on the same input, or the most recent
+ * one if there's none. We don't try to cover the case where the label
+ * is referenced by other constructed documents.
+ */
+static void fy_anchor_match_token(struct fy_anchor *fya, struct fy_token *anchor,
+				  const char *anchor_text, size_t anchor_len,
+				  struct fy_anchor **fya_foundp, struct fy_anchor **fya_found2p,
+				  int *countp)
+{
+	const char *text;
+	size_t text_len;
+
+	text = fy_anchor_get_text(fya, &text_len);
+	if (!text || anchor_len != text_len || memcmp(anchor_text, text, anchor_len))
+		return;
+
+	(*countp)++;
+
+	if (!*fya_foundp || fya->seq > (*fya_foundp)->seq)
+		*fya_foundp = fya;
+
+	if (fy_token_get_input(fya->anchor) == fy_token_get_input(anchor) &&
+	    fy_token_start_pos(fya->anchor) < fy_token_start_pos(anchor) &&
+	    (!*fya_found2p || fya->seq > (*fya_found2p)->seq))
+		*fya_found2p = fya;
+}
+
 struct fy_anchor *
 fy_document_lookup_anchor_by_token(struct fy_document *fyd,
 				   struct fy_token *anchor)
 {
 	struct fy_anchor *fya, *fya_found, *fya_found2;
 	struct fy_anchor_list *fyal;
-	const char *anchor_text, *text;
-	size_t anchor_len, text_len;
+	struct fy_anchor_index *fyai;
+	struct hlist_node *pos;
+	const char *anchor_text;
+	size_t anchor_len;
+	uint32_t hash;
 	int count;
 
 	if (!fyd || !anchor)
@@ -415,20 +665,23 @@ fy_document_lookup_anchor_by_token(struct fy_document *fyd,
 	if (!anchor_text)
 		return NULL;
 
-	fyal = &fyd->anchors;
-
-	/* first pass, try with a single match */
 	count = 0;
 	fya_found = NULL;
-	for (fya = fy_anchor_list_head(fyal); fya; fya = fy_anchor_next(fyal, fya)) {
-		text = fy_anchor_get_text(fya, &text_len);
-		if (!text)
-			return NULL;
+	fya_found2 = NULL;
 
-		if (anchor_len == text_len && !memcmp(anchor_text, text, anchor_len)) {
-			count++;
-			fya_found = fya;
+	fyai = fyd->anchor_index;
+	if (fyai) {
+		hash = fy_hash_data(anchor_text, anchor_len);
+		hlist_for_each_entry(fya, pos, fy_anchor_index_text_bucket(fyai, hash), hnode_text) {
+			if (fya->hash == hash)
+				fy_anchor_match_token(fya, anchor, anchor_text, anchor_len,
+						      &fya_found, &fya_found2, &count);
 		}
+	} else {
+		fyal = &fyd->anchors;
+		for (fya = fy_anchor_list_head(fyal); fya; fya = fy_anchor_next(fyal, fya))
+			fy_anchor_match_token(fya, anchor, anchor_text, anchor_len,
+					      &fya_found, &fya_found2, &count);
 	}
 
 	/* not found */
@@ -439,47 +692,31 @@ fy_document_lookup_anchor_by_token(struct fy_document *fyd,
 	if (count == 1)
 		return fya_found;
 
-	/* multiple ones, must pick the one that's the last one before
-	 * the requesting token */
 	fy_notice(NULL, "multiple anchors for %.*s", (int)anchor_len, anchor_text);
 
-	/* only try the ones on the same input
-	 * we don't try to cover the case where the label is referenced
-	 * by other constructed documents
-	 */
-	fya_found2 = NULL;
-	for (fya = fy_anchor_list_head(fyal); fya; fya = fy_anchor_next(fyal, fya)) {
-
-		/* only on the same input */
-		if (fy_token_get_input(fya->anchor) != fy_token_get_input(anchor))
-			continue;
-
-		text = fy_anchor_get_text(fya, &text_len);
-		if (!text)
-			return NULL;
-
-		if (anchor_len == text_len && !memcmp(anchor_text, text, anchor_len) &&
-		    fy_token_start_pos(fya->anchor) < fy_token_start_pos(anchor)) {
-			fya_found2 = fya;
-		}
-	}
-
-	/* just return the one find earlier */
-	if (!fya_found2)
-		return fya_found;
-
-	/* return the one that was the latest */
-	return fya_found2;
+	return fya_found2 ? fya_found2 : fya_found;
 }
 
 struct fy_anchor *fy_document_lookup_anchor_by_node(struct fy_document *fyd, struct fy_node *fyn)
 {
-	struct fy_anchor *fya;
+	struct fy_anchor *fya, *fya_found;
 	struct fy_anchor_list *fyal;
+	struct hlist_node *pos;
 
 	if (!fyd || !fyn)
 		return NULL;
 
+	/* the first one on the list is the one with the lowest seq */
+	if (fyd->anchor_index) {
+		fya_found = NULL;
+		hlist_for_each_entry(fya, pos,
+				fy_anchor_index_node_bucket(fyd->anchor_index, fyn), hnode_node) {
+			if (fya->fyn == fyn && (!fya_found || fya->seq < fya_found->seq))
+				fya_found = fya;
+		}
+		return fya_found;
+	}
+
 	fyal = &fyd->anchors;
 	for (fya = fy_anchor_list_head(fyal); fya; fya = fy_anchor_next(fyal, fya)) {
 		if (fya->fyn == fyn)
@@ -511,7 +748,7 @@ void fy_node_pair_free(struct fy_node_pair *fynp)
 	fy_node_free(fynp->key);
 	fy_node_free(fynp->value);
 
-	free(fynp);
+	fy_document_obj_free(fynp->fyd, fynp);
 }
 
 struct fy_node_pair *fy_node_pair_alloc(struct fy_document *fyd)
@@ -519,25 +756,200 @@ struct fy_node_pair *fy_node_pair_alloc(struct fy_document *fyd)
 	struct fy_parser *fyp = fyd->fyp;
 	struct fy_node_pair *fynp = NULL;
 
-	fynp = malloc(sizeof(*fynp));
+	fynp = fy_document_obj_alloc(fyd, sizeof(*fynp));
 	fy_error_check(fyp, fynp, err_out,
-			"malloc() failed");
+			"fy_document_obj_alloc() failed");
 
 	fynp->key = NULL;
 	fynp->value = NULL;
 	fynp->fyd = fyd;
+	fynp->parent = NULL;
+	INIT_HLIST_NODE(&fynp->hnode);
+	fynp->hash = 0;
 	return fynp;
 
 err_out:
 	return NULL;
 }
 
+/*
+ * Copy on write
+ *
+ * A copy of a collection starts out as a lazy node that shares the
+ * content of its source. It is expanded (one level at a time, the
+ * children being lazy copies themselves) when it's accessed, or when
+ * the source is about to change or go away.
+ */
+static void fy_node_cow_link(struct fy_node *fyn, struct fy_node *fyn_src)
+{
+	fy_eventp_list_init(&fyn->lazy_events);
+	fyn->lazy = true;
+	fyn->cow_src = fyn_src;
+	list_add_tail(&fyn->cow_node, &fyn_src->cow_copies);
+	fyn_src->fyd->cow_shared++;
+}
+
+static void fy_node_cow_unlink(struct fy_node *fyn)
+{
+	assert(fyn->cow_src);
+	fyn->cow_src->fyd->cow_shared--;
+	list_del_init(&fyn->cow_node);
+	fyn->cow_src = NULL;
+	fyn->lazy = false;
+}
+
+static int fy_node_cow_expand(struct fy_node *fyn)
+{
+	struct fy_node *fyn_src = fyn->cow_src;
+
+	fy_node_cow_unlink(fyn);
+
+	return fy_node_copy_items(fyn->fyd, fyn, fyn_src, NULL);
+}
+
+/* the content is about to change; the copies can't share it anymore */
+static int fy_node_cow_detach(struct fy_node *fyn)
+{
+	struct fy_node *fync;
+
+	if (!fyn || !fyn->fyd->cow_shared)
+		return 0;
+
+	while (!list_empty(&fyn->cow_copies)) {
+		fync = list_first_entry(&fyn->cow_copies, struct fy_node, cow_node);
+		if (fy_node_cow_expand(fync))
+			return -1;
+	}
+
+	return 0;
+}
+
+/* the pair a key belongs to; they don't point back to it, so look for it */
+static struct fy_node_pair *fy_node_find_key_pair(struct fy_node *fyn, struct fy_node *fyn_key)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp, *fynp_found;
+
+	/* nothing is in there until expanded */
+	if (!fyn || fyn->lazy)
+		return NULL;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
+
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+			fynp_found = fy_node_find_key_pair(fyni, fyn_key);
+			if (fynp_found)
+				return fynp_found;
+		}
+		break;
+
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			if (fynp->key == fyn_key)
+				return fynp;
+			fynp_found = fy_node_find_key_pair(fynp->key, fyn_key);
+			if (!fynp_found)
+				fynp_found = fy_node_find_key_pair(fynp->value, fyn_key);
+			if (fynp_found)
+				return fynp_found;
+		}
+		break;
+	}
+
+	return NULL;
+}
+
+/* the collection a node is in; keys have no parent, but are in one too */
+static struct fy_node *fy_node_owner(struct fy_node *fyn)
+{
+	struct fy_node_pair *fynp;
+
+	if (fyn->parent || fyn == fyn->fyd->root)
+		return fyn->parent;
+
+	fynp = fy_node_find_key_pair(fyn->fyd->root, fyn);
+	return fynp ? fynp->parent : NULL;
+}
+
+/* the copies of the ancestors share the node too, detach from the top */
+static int fy_node_cow_detach_path(struct fy_node *fyn)
+{
+	if (!fyn || !fyn->fyd->cow_shared)
+		return 0;
+
+	if (fy_node_cow_detach_path(fy_node_owner(fyn)))
+		return -1;
+
+	return fy_node_cow_detach(fyn);
+}
+
+/* a node (or one of its children) is about to be modified */
+static int fy_node_prepare_change(struct fy_node *fyn)
+{
+	if (fy_node_lazy_expand(fyn))
+		return -1;
+
+	return fy_node_cow_detach_path(fyn);
+}
+
+/*
+ * The node is going away; the last copy in the same document
+ * takes over the content instead of copying it.
+ */
+static void fy_node_cow_release(struct fy_node *fyn)
+{
+	struct fy_node *fync, *fyni;
+	struct fy_node_pair *fynp;
+
+	if (!fyn->fyd->cow_shared)
+		return;
+
+	while (!list_empty(&fyn->cow_copies)) {
+		fync = list_first_entry(&fyn->cow_copies, struct fy_node, cow_node);
+
+		/* on failure the copy is left empty */
+		if (!list_is_singular(&fyn->cow_copies) || fync->fyd != fyn->fyd) {
+			fy_node_cow_expand(fync);
+			continue;
+		}
+
+		fy_node_cow_unlink(fync);
+
+		fync->items = fyn->items;
+		fync->items_count = fyn->items_count;
+		fync->items_alloc = fyn->items_alloc;
+		fyn->items = NULL;
+		fyn->items_count = 0;
+		fyn->items_alloc = 0;
+
+		if (fyn->type == FYNT_SEQUENCE) {
+			while ((fyni = fy_node_list_pop(&fyn->sequence)) != NULL) {
+				fyni->parent = fync;
+				fy_node_list_add_tail(&fync->sequence, fyni);
+			}
+		} else {
+			while ((fynp = fy_node_pair_list_pop(&fyn->mapping)) != NULL) {
+				fynp->parent = fync;
+				if (fynp->value)
+					fynp->value->parent = fync;
+				fy_node_pair_list_add_tail(&fync->mapping, fynp);
+			}
+			fync->mapping_index = fyn->mapping_index;
+			fyn->mapping_index = NULL;
+		}
+	}
+}
+
 void fy_node_free(struct fy_node *fyn)
 {
 	struct fy_document *fyd;
 	struct fy_node *fyni;
 	struct fy_node_pair *fynp;
-	struct fy_anchor *fya, *fyan;
 
 	if (!fyn)
 		return;
@@ -545,24 +957,31 @@ void fy_node_free(struct fy_node *fyn)
 	fyd = fyn->fyd;
 	assert(fyd);
 
-	/* remove anchors that are located on this node */
-	for (fya = fy_anchor_list_head(&fyd->anchors); fya; fya = fyan) {
-		fyan = fy_anchor_next(&fyd->anchors, fya);
-		if (fya->fyn == fyn) {
-			fy_anchor_list_del(&fyd->anchors, fya);
-			fy_anchor_destroy(fya);
-		}
-	}
+	/* hand over the content to any copies still sharing it */
+	fy_node_cow_release(fyn);
 
+	/* remove anchors that are located on this node */
+	fy_document_remove_node_anchors(fyd, fyn);
 
 	fy_token_unref(fyn->tag);
 	fyn->tag = NULL;
+
+	/* never expanded, just drop the recorded events */
+	if (fyn->lazy) {
+		if (fyn->cow_src)
+			fy_node_cow_unlink(fyn);
+		fy_parse_eventp_list_recycle_all(fyd->fyp, &fyn->lazy_events);
+		fyn->lazy = false;
+	}
+
 	switch (fyn->type) {
 	case FYNT_SCALAR:
 		fy_token_unref(fyn->scalar);
 		fyn->scalar = NULL;
 		break;
 	case FYNT_SEQUENCE:
+		free(fyn->items);
+		fyn->items = NULL;
 		while ((fyni = fy_node_list_pop(&fyn->sequence)) != NULL)
 			fy_node_free(fyni);
 		fy_token_unref(fyn->sequence_start);
@@ -571,6 +990,10 @@ void fy_node_free(struct fy_node *fyn)
 		fyn->sequence_end = NULL;
 		break;
 	case FYNT_MAPPING:
+		free(fyn->items);
+		fyn->items = NULL;
+		free(fyn->mapping_index);
+		fyn->mapping_index = NULL;
 		while ((fynp = fy_node_pair_list_pop(&fyn->mapping)) != NULL)
 			fy_node_pair_free(fynp);
 		fy_token_unref(fyn->mapping_start);
@@ -580,7 +1003,7 @@ void fy_node_free(struct fy_node *fyn)
 		break;
 	}
 
-	free(fyn);
+	fy_document_obj_free(fyd, fyn);
 }
 
 struct fy_node *fy_node_alloc(struct fy_document *fyd, enum fy_node_type type)
@@ -588,14 +1011,19 @@ struct fy_node *fy_node_alloc(struct fy_document *fyd, enum fy_node_type type)
 	struct fy_parser *fyp = fyd->fyp;
 	struct fy_node *fyn = NULL;
 
-	fyn = malloc(sizeof(*fyn));
+	fyn = fy_document_obj_alloc(fyd, sizeof(*fyn));
 	fy_error_check(fyp, fyn, err_out,
-			"malloc() failed");
+			"fy_document_obj_alloc() failed");
 	memset(fyn, 0, sizeof(*fyn));
+
+	if (fyp && fyp->collect_stats)
+		fyp->stats.nodes++;
 	fyn->type = type;
 	fyn->style = FYNS_ANY;
 	fyn->fyd = fyd;
 	fyn->marks = 0;
+	INIT_LIST_HEAD(&fyn->cow_node);
+	INIT_LIST_HEAD(&fyn->cow_copies);
 
 	switch (fyn->type) {
 	case FYNT_SCALAR:
@@ -610,6 +1038,7 @@ struct fy_node *fy_node_alloc(struct fy_document *fyd, enum fy_node_type type)
 		fy_node_pair_list_init(&fyn->mapping);
 		fyn->mapping_start = NULL;
 		fyn->mapping_end = NULL;
+		fyn->mapping_index = NULL;
 		break;
 	}
 	return fyn;
@@ -619,30 +1048,138 @@ err_out:
 	return NULL;
 }
 
-const struct fy_mark *fy_node_get_start_mark(struct fy_node *fyn)
+static void fy_node_items_invalidate(struct fy_node *fyn)
 {
-	const struct fy_mark *fym = NULL;
-	struct fy_node_pair *fynp;
+	fyn->items_count = -1;
+	fy_node_hash_invalidate(fyn);
+}
 
-	if (!fyn)
-		return NULL;
+/* item has just been added at the tail of the collection */
+static void fy_node_items_push(struct fy_node *fyn, void *item)
+{
+	void **items;
+	int alloc;
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		fym = fy_token_start_mark(fyn->scalar);
-		break;
+	fy_node_hash_invalidate(fyn);
 
-	case FYNT_SEQUENCE:
-		fym = fy_token_start_mark(fyn->sequence_start);
-		/* no explicit sequence start, use the start mark of the first item */
-		if (!fym)
-			fym = fy_node_get_start_mark(fy_node_list_head(&fyn->sequence));
-		break;
+	if (fyn->items_count < 0)
+		return;
 
-	case FYNT_MAPPING:
+	if (fyn->items_count >= fyn->items_alloc) {
+		alloc = fyn->items_alloc ? fyn->items_alloc * 2 : 8;
+		items = realloc(fyn->items, sizeof(*items) * alloc);
+		if (!items) {
+			fy_node_items_invalidate(fyn);
+			return;
+		}
+		fyn->items = items;
+		fyn->items_alloc = alloc;
+	}
+
+	if (fyn->type == FYNT_MAPPING)
+		((struct fy_node_pair *)item)->idx = fyn->items_count;
+
+	fyn->items[fyn->items_count++] = item;
+}
+
+/* make room for count more items to be pushed */
+static void fy_node_items_reserve(struct fy_node *fyn, int count)
+{
+	void **items;
+	int alloc;
+
+	if (fyn->items_count < 0 || fyn->items_count + count <= fyn->items_alloc)
+		return;
+
+	alloc = fyn->items_alloc ? fyn->items_alloc : 8;
+	while (alloc < fyn->items_count + count)
+		alloc *= 2;
+
+	/* on failure fy_node_items_push() deals with it */
+	items = realloc(fyn->items, sizeof(*items) * alloc);
+	if (!items)
+		return;
+	fyn->items = items;
+	fyn->items_alloc = alloc;
+}
+
+/* item is about to be removed from the collection */
+static void fy_node_items_remove(struct fy_node *fyn, void *item)
+{
+	fy_node_hash_invalidate(fyn);
+
+	if (fyn->items_count > 0 && fyn->items[fyn->items_count - 1] == item)
+		fyn->items_count--;
+	else
+		fy_node_items_invalidate(fyn);
+}
+
+/* sequence item replaced at the same position */
+static void fy_node_items_replace(struct fy_node *fyn, void *item, void *item_new)
+{
+	int i;
+
+	fy_node_hash_invalidate(fyn);
+
+	for (i = fyn->items_count - 1; i >= 0; i--) {
+		if (fyn->items[i] == item) {
+			fyn->items[i] = item_new;
+			return;
+		}
+	}
+	fy_node_items_invalidate(fyn);
+}
+
+/* rebuild the item vector if stale */
+static int fy_node_items_update(struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynpi;
+
+	if (fy_node_lazy_expand(fyn))
+		return -1;
+
+	if (fyn->items_count >= 0)
+		return 0;
+
+	fyn->items_count = 0;
+	if (fyn->type == FYNT_SEQUENCE) {
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni && fyn->items_count >= 0;
+				fyni = fy_node_next(&fyn->sequence, fyni))
+			fy_node_items_push(fyn, fyni);
+	} else {
+		for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi && fyn->items_count >= 0;
+				fynpi = fy_node_pair_next(&fyn->mapping, fynpi))
+			fy_node_items_push(fyn, fynpi);
+	}
+
+	return fyn->items_count >= 0 ? 0 : -1;
+}
+
+const struct fy_mark *fy_node_get_start_mark(struct fy_node *fyn)
+{
+	const struct fy_mark *fym = NULL;
+	struct fy_node_pair *fynp;
+
+	if (!fyn)
+		return NULL;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		fym = fy_token_start_mark(fyn->scalar);
+		break;
+
+	case FYNT_SEQUENCE:
+		fym = fy_token_start_mark(fyn->sequence_start);
+		/* no explicit sequence start, use the start mark of the first item */
+		if (!fym && !fy_node_lazy_expand(fyn))
+			fym = fy_node_get_start_mark(fy_node_list_head(&fyn->sequence));
+		break;
+
+	case FYNT_MAPPING:
 		fym = fy_token_start_mark(fyn->mapping_start);
 		/* no explicit mapping start, use the start mark of the first key */
-		if (!fym) {
+		if (!fym && !fy_node_lazy_expand(fyn)) {
 			fynp = fy_node_pair_list_head(&fyn->mapping);
 			if (fynp)
 				fym = fy_node_get_start_mark(fynp->key);
@@ -672,14 +1209,14 @@ const struct fy_mark *fy_node_get_end_mark(struct fy_node *fyn)
 	case FYNT_SEQUENCE:
 		fym = fy_token_end_mark(fyn->sequence_end);
 		/* no explicit sequence end, use the end mark of the last item */
-		if (!fym)
+		if (!fym && !fy_node_lazy_expand(fyn))
 			fym = fy_node_get_end_mark(fy_node_list_tail(&fyn->sequence));
 		break;
 
 	case FYNT_MAPPING:
 		fym = fy_token_end_mark(fyn->mapping_end);
 		/* no explicit mapping end, use the end mark of the last value */
-		if (!fym) {
+		if (!fym && !fy_node_lazy_expand(fyn)) {
 			fynp = fy_node_pair_list_tail(&fyn->mapping);
 			if (fynp)
 				fym = fy_node_get_end_mark(fynp->value);
@@ -709,14 +1246,14 @@ struct fy_input *fy_node_get_input(struct fy_node *fyn)
 	case FYNT_SEQUENCE:
 		fyi = fy_token_get_input(fyn->sequence_start);
 		/* no explicit sequence start, use the start mark of the first item */
-		if (!fyi)
+		if (!fyi && !fy_node_lazy_expand(fyn))
 			fyi = fy_node_get_input(fy_node_list_head(&fyn->sequence));
 		break;
 
 	case FYNT_MAPPING:
 		fyi = fy_token_get_input(fyn->mapping_start);
 		/* no explicit mapping start, use the start mark of the first key */
-		if (!fyi) {
+		if (!fyi && !fy_node_lazy_expand(fyn)) {
 			fynp = fy_node_pair_list_head(&fyn->mapping);
 			if (fynp)
 				fyi = fy_node_get_input(fynp->key);
@@ -739,7 +1276,7 @@ int fy_parse_document_register_anchor(struct fy_parser *fyp, struct fy_document
 	fy_error_check(fyp, fya, err_out,
 			"fy_anchor_create() failed");
 
-	fy_anchor_list_add_tail(&fyd->anchors, fya);
+	fy_document_anchor_add(fyd, fya, true);
 
 	return 0;
 
@@ -747,15 +1284,166 @@ err_out:
 	return -1;
 }
 
+/*
+ * The content of a node changed; drop the cached hash of it and of
+ * its ancestors. Hashing a node caches the hashes of everything under
+ * it, so the walk stops at the first node without one.
+ */
+void fy_node_hash_invalidate(struct fy_node *fyn)
+{
+	if (!fyn)
+		return;
+
+	/* any change thaws the document */
+	fyn->fyd->frozen = false;
+
+	while (fyn && fyn->hash_valid) {
+		fyn->hash_valid = false;
+		fyn = fy_node_owner(fyn);
+	}
+}
+
+static uint32_t fy_node_events_hash_items(struct fy_eventp_list *list,
+					  struct fy_eventp **fyepp, enum fy_node_type type);
+
+/* hash the node the events starting at *fyepp build, and move past them */
+static uint32_t fy_node_events_hash(struct fy_eventp_list *list, struct fy_eventp **fyepp)
+{
+	struct fy_event *fye = &(*fyepp)->e;
+	uint32_t hash;
+
+	*fyepp = fy_eventp_next(list, *fyepp);
+
+	switch (fye->type) {
+	case FYET_SEQUENCE_START:
+		return fy_node_events_hash_items(list, fyepp, FYNT_SEQUENCE);
+
+	case FYET_MAPPING_START:
+		return fy_node_events_hash_items(list, fyepp, FYNT_MAPPING);
+
+	case FYET_ALIAS:
+		hash = fy_hash_update(fy_token_text_hash(fye->alias.anchor), "*", 1);
+		break;
+
+	case FYET_SCALAR:
+	default:
+		hash = fy_token_text_hash(fye->scalar.value);
+		break;
+	}
+
+	return hash;
+}
+
+/*
+ * Hash the content events recorded for a lazy collection (up to and
+ * including the end event) exactly like the nodes built from them
+ * would hash, see fy_node_hash().
+ */
+static uint32_t fy_node_events_hash_items(struct fy_eventp_list *list,
+					  struct fy_eventp **fyepp, enum fy_node_type type)
+{
+	struct fy_eventp *fyep;
+	uint32_t hash, sum = 0, pair[2];
+
+	hash = fy_hash_data(type == FYNT_SEQUENCE ? "[" : "{", 1);
+
+	while ((fyep = *fyepp) != NULL &&
+	       fyep->e.type != FYET_SEQUENCE_END && fyep->e.type != FYET_MAPPING_END) {
+		pair[0] = fy_node_events_hash(list, fyepp);
+		if (type == FYNT_SEQUENCE) {
+			hash = fy_hash_update(hash, &pair[0], sizeof(pair[0]));
+			continue;
+		}
+		pair[1] = *fyepp ? fy_node_events_hash(list, fyepp) : fy_token_text_hash(NULL);
+		sum += fy_hash_data(pair, sizeof(pair));
+	}
+
+	if (fyep)
+		*fyepp = fy_eventp_next(list, fyep);
+
+	if (type == FYNT_MAPPING)
+		hash = fy_hash_update(hash, &sum, sizeof(sum));
+
+	return hash;
+}
+
+/*
+ * Structural hash; nodes that fy_node_compare() finds equal hash
+ * the same. Tags are not part of it, mapping pairs are combined
+ * in an order independent way. Collections that are not expanded
+ * yet are hashed from their recorded events instead of being built.
+ */
+uint32_t fy_node_hash(struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	struct fy_eventp *fyep;
+	uint32_t hash, sum, pair[2];
+
+	/* null nodes compare equal to empty scalars */
+	if (!fyn)
+		return fy_token_text_hash(NULL);
+
+	if (fyn->hash_valid)
+		return fyn->hash;
+
+	if (fyn->cow_src) {
+		/* copies not expanded yet hash the same as their source */
+		hash = fy_node_hash(fyn->cow_src);
+	} else if (fyn->lazy) {
+		fyep = fy_eventp_list_head(&fyn->lazy_events);
+		hash = fy_node_events_hash_items(&fyn->lazy_events, &fyep, fyn->type);
+	} else switch (fyn->type) {
+	case FYNT_SCALAR:
+	default:
+		hash = fy_token_text_hash(fyn->scalar);
+
+		/* aliases never match plain scalars */
+		if (fy_node_is_alias(fyn))
+			hash = fy_hash_update(hash, "*", 1);
+		break;
+
+	case FYNT_SEQUENCE:
+		hash = fy_hash_data("[", 1);
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+			pair[0] = fy_node_hash(fyni);
+			hash = fy_hash_update(hash, &pair[0], sizeof(pair[0]));
+		}
+		break;
+
+	case FYNT_MAPPING:
+		sum = 0;
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			pair[0] = fy_node_hash(fynp->key);
+			pair[1] = fy_node_hash(fynp->value);
+			sum += fy_hash_data(pair, sizeof(pair));
+		}
+		hash = fy_hash_update(fy_hash_data("{", 1), &sum, sizeof(sum));
+		break;
+	}
+
+	fyn->hash = hash;
+	fyn->hash_valid = true;
+
+	return hash;
+}
+
 bool fy_node_compare(struct fy_node *fyn1, struct fy_node *fyn2)
 {
 	struct fy_node *fyni1, *fyni2;
 	struct fy_node_pair *fynp1, *fynp2;
 	bool ret, null1, null2;
-	struct fy_node_pair **fynpp1, **fynpp2;
-	int i, count1, count2;
+	int count1, count2;
 	bool alias1, alias2;
 
+	/* copies not expanded yet have the content of their source */
+	if (fyn1 && fyn1->cow_src)
+		fyn1 = fyn1->cow_src;
+	if (fyn2 && fyn2->cow_src)
+		fyn2 = fyn2->cow_src;
+
 	/* equal pointers? */
 	if (fyn1 == fyn2)
 		return true;
@@ -775,6 +1463,13 @@ bool fy_node_compare(struct fy_node *fyn1, struct fy_node *fyn2)
 	if (fyn1->type != fyn2->type)
 		return false;
 
+	if (fy_node_lazy_expand(fyn1) || fy_node_lazy_expand(fyn2))
+		return false;
+
+	/* cheap rejection of collections; the hashes are cached */
+	if (fyn1->type != FYNT_SCALAR && fy_node_hash(fyn1) != fy_node_hash(fyn2))
+		return false;
+
 	ret = true;
 
 	switch (fyn1->type) {
@@ -805,27 +1500,16 @@ bool fy_node_compare(struct fy_node *fyn1, struct fy_node *fyn2)
 			break;
 		}
 
-		fynpp1 = alloca(sizeof(*fynpp1) * (count1 + 1));
-		fynpp2 = alloca(sizeof(*fynpp2) * (count2 + 1));
-
-		fy_node_mapping_perform_sort(fyn1, NULL, NULL, fynpp1, count1);
-		fy_node_mapping_perform_sort(fyn2, NULL, NULL, fynpp2, count2);
-
-		for (i = 0; i < count1; i++) {
-			fynp1 = fynpp1[i];
-			fynp2 = fynpp2[i];
+		/* keys are unique, so every pair must have its match */
+		for (fynp1 = fy_node_pair_list_head(&fyn1->mapping); fynp1;
+				fynp1 = fy_node_pair_next(&fyn1->mapping, fynp1)) {
 
-			ret = fy_node_compare(fynp1->key, fynp2->key);
-			if (!ret)
-				break;
-
-			ret = fy_node_compare(fynp1->value, fynp2->value);
-			if (!ret)
+			fynp2 = fy_node_mapping_lookup_pair(fyn2, fynp1->key);
+			if (!fynp2 || !fy_node_compare(fynp1->value, fynp2->value)) {
+				ret = false;
 				break;
+			}
 		}
-		if (i >= count1)
-			ret = true;
-
 		break;
 
 	case FYNT_SCALAR:
@@ -836,6 +1520,13 @@ bool fy_node_compare(struct fy_node *fyn1, struct fy_node *fyn2)
 		if (alias1 != alias2)
 			return false;
 
+		/* strings interned in the same table are equal only when shared */
+		if (fyn1->scalar->istr && fyn2->scalar->istr &&
+		    fyn1->scalar->istr->fyin == fyn2->scalar->istr->fyin) {
+			ret = fyn1->scalar->istr == fyn2->scalar->istr;
+			break;
+		}
+
 		ret = !fy_token_cmp(fyn1->scalar, fyn2->scalar);
 		break;
 	}
@@ -859,25 +1550,216 @@ bool fy_node_compare_string(struct fy_node *fyn, const char *str, size_t len)
 	return ret;
 }
 
-struct fy_node_pair *fy_node_mapping_lookup_pair(struct fy_node *fyn, struct fy_node *fyn_key)
+/* mappings smaller than this are searched linearly */
+#define FY_NODE_MAPPING_INDEX_MIN	16
+
+/* share the text of a scalar key via the intern table of the document */
+static int fy_node_key_intern(struct fy_document *fyd, struct fy_node *fyn_key)
+{
+	if (!fyd || !fyd->intern || !fyn_key || fyn_key->type != FYNT_SCALAR ||
+	    fy_node_is_alias(fyn_key))
+		return 0;
+
+	return fy_token_intern(fyn_key->scalar, fyd->intern);
+}
+
+/*
+ * Interned strings of a table are unique, so a key interned in fyin
+ * matches only when it's the very string the lookup found (or none).
+ */
+static inline bool fy_node_key_text_match(struct fy_token *fyt, struct fy_intern *fyin,
+					  const struct fy_intern_str *fyis,
+					  const char *key, size_t len)
+{
+	if (fyin && fyt->istr && fyt->istr->fyin == fyin)
+		return fyt->istr == fyis;
+
+	return !fy_token_memcmp(fyt, key, len);
+}
+
+/* key hash, must agree with fy_node_compare() */
+static uint32_t fy_node_key_hash(struct fy_node *fyn)
+{
+	return fy_node_hash(fyn);
+}
+
+static struct fy_node_mapping_index *
+fy_node_mapping_index_alloc(unsigned int count)
+{
+	struct fy_node_mapping_index *fynmi;
+	unsigned int i, nbuckets;
+
+	/* keep the load factor under one */
+	nbuckets = FY_NODE_MAPPING_INDEX_MIN;
+	while (nbuckets < count)
+		nbuckets <<= 1;
+
+	fynmi = malloc(sizeof(*fynmi) + sizeof(fynmi->buckets[0]) * nbuckets);
+	if (!fynmi)
+		return NULL;
+
+	fynmi->count = 0;
+	fynmi->complex = 0;
+	fynmi->mask = nbuckets - 1;
+	for (i = 0; i < nbuckets; i++)
+		INIT_HLIST_HEAD(&fynmi->buckets[i]);
+
+	return fynmi;
+}
+
+static void fy_node_mapping_index_insert(struct fy_node_mapping_index *fynmi,
+					 struct fy_node_pair *fynp)
+{
+	if (!fy_node_is_scalar(fynp->key)) {
+		fynmi->complex++;
+		return;
+	}
+
+	hlist_add_head(&fynp->hnode, &fynmi->buckets[fynp->hash & fynmi->mask]);
+	fynmi->count++;
+}
+
+static int fy_node_mapping_index_build(struct fy_node *fyn)
 {
+	struct fy_node_mapping_index *fynmi;
 	struct fy_node_pair *fynpi;
 
+	fynmi = fy_node_mapping_index_alloc(fy_node_mapping_item_count(fyn));
+	if (!fynmi)
+		return -1;
+
 	for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
 		fynpi = fy_node_pair_next(&fyn->mapping, fynpi)) {
 
-		if (fy_node_compare(fynpi->key, fyn_key))
+		if (fy_node_is_scalar(fynpi->key))
+			fynpi->hash = fy_node_key_hash(fynpi->key);
+		fy_node_mapping_index_insert(fynmi, fynpi);
+	}
+
+	free(fyn->mapping_index);
+	fyn->mapping_index = fynmi;
+
+	return 0;
+}
+
+/* pair must already be on the mapping list */
+static void fy_node_mapping_index_add(struct fy_node *fyn, struct fy_node_pair *fynp)
+{
+	struct fy_node_mapping_index *fynmi, *fynmi_new;
+	struct fy_node_pair *fynpi;
+
+	fynmi = fyn->mapping_index;
+	if (!fynmi)
+		return;
+
+	if (fy_node_is_scalar(fynp->key))
+		fynp->hash = fy_node_key_hash(fynp->key);
+	fy_node_mapping_index_insert(fynmi, fynp);
+
+	if (fynmi->count <= fynmi->mask + 1)
+		return;
+
+	/* grow; on allocation failure just live with longer chains */
+	fynmi_new = fy_node_mapping_index_alloc(fynmi->count * 2);
+	if (!fynmi_new)
+		return;
+
+	for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
+		fynpi = fy_node_pair_next(&fyn->mapping, fynpi))
+		fy_node_mapping_index_insert(fynmi_new, fynpi);
+
+	free(fynmi);
+	fyn->mapping_index = fynmi_new;
+}
+
+static void fy_node_mapping_index_del(struct fy_node *fyn, struct fy_node_pair *fynp)
+{
+	if (!fyn->mapping_index)
+		return;
+
+	if (hlist_unhashed(&fynp->hnode)) {
+		if (!fy_node_is_scalar(fynp->key) && fyn->mapping_index->complex)
+			fyn->mapping_index->complex--;
+		return;
+	}
+
+	hlist_del_init(&fynp->hnode);
+	fyn->mapping_index->count--;
+}
+
+static struct fy_node_pair *
+fy_node_mapping_lookup_pair_skip(struct fy_node *fyn, struct fy_node *fyn_key,
+				 struct fy_node_pair *fynp_skip)
+{
+	struct fy_node_mapping_index *fynmi;
+	struct fy_node_pair *fynpi;
+	struct hlist_node *pos;
+	uint32_t hash;
+	int count;
+
+	if (fy_node_lazy_expand(fyn))
+		return NULL;
+
+	fynmi = fyn->mapping_index;
+	if (fynmi && fy_node_is_scalar(fyn_key)) {
+		hash = fy_node_key_hash(fyn_key);
+		hlist_for_each_entry(fynpi, pos, &fynmi->buckets[hash & fynmi->mask], hnode) {
+			if (fynpi != fynp_skip && fynpi->hash == hash &&
+			    fy_node_compare(fynpi->key, fyn_key))
+				return fynpi;
+		}
+		return NULL;
+	}
+
+	/* collection keys are only compared to the ones left out */
+	if (fynmi) {
+		if (!fynmi->complex)
+			return NULL;
+
+		for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
+			fynpi = fy_node_pair_next(&fyn->mapping, fynpi)) {
+
+			if (fynpi != fynp_skip && !fy_node_is_scalar(fynpi->key) &&
+			    fy_node_compare(fynpi->key, fyn_key))
+				return fynpi;
+		}
+		return NULL;
+	}
+
+	for (count = 0, fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
+		fynpi = fy_node_pair_next(&fyn->mapping, fynpi), count++) {
+
+		if (fynpi != fynp_skip && fy_node_compare(fynpi->key, fyn_key))
 			return fynpi;
 	}
 
+	/* missed on a large mapping, index it for the next lookup */
+	if (count >= FY_NODE_MAPPING_INDEX_MIN)
+		fy_node_mapping_index_build(fyn);
+
 	return NULL;
 }
 
+struct fy_node_pair *fy_node_mapping_lookup_pair(struct fy_node *fyn, struct fy_node *fyn_key)
+{
+	return fy_node_mapping_lookup_pair_skip(fyn, fyn_key, NULL);
+}
+
 int fy_node_mapping_get_pair_index(struct fy_node *fyn, const struct fy_node_pair *fynp)
 {
 	struct fy_node_pair *fynpi;
 	int i;
 
+	if (!fyn || fyn->type != FYNT_MAPPING || fy_node_lazy_expand(fyn))
+		return -1;
+
+	if (!fy_node_items_update(fyn)) {
+		if (!fynp || fynp->idx < 0 || fynp->idx >= fyn->items_count ||
+		    fyn->items[fynp->idx] != fynp)
+			return -1;
+		return fynp->idx;
+	}
+
 	for (i = 0, fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
 		fynpi = fy_node_pair_next(&fyn->mapping, fynpi), i++) {
 
@@ -974,19 +1856,166 @@ err_stream_end:
 	goto err_out;
 }
 
-int fy_parse_document_load_sequence(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
+static struct fy_eventp *fy_parse_document_next_event(struct fy_parser *fyp, struct fy_document *fyd)
+{
+	/* when expanding a lazy collection replay its recorded events */
+	if (fyd->lazy_replay)
+		return fy_eventp_list_pop(fyd->lazy_replay);
+
+	return fy_parse_private(fyp);
+}
+
+/*
+ * Record the content events of a collection (up to and including its
+ * end event) instead of building the child nodes.
+ * Collections containing anchors are expanded at once, so that the
+ * anchors are registered with the document before any alias lookup.
+ */
+static int fy_parse_document_lazy_record(struct fy_parser *fyp, struct fy_document *fyd, struct fy_node *fyn)
 {
-	struct fy_node *fyn = NULL, *fyn_item = NULL;
+	struct fy_eventp *fyep;
 	struct fy_event *fye = NULL;
-	struct fy_token *fyt_ss = NULL;
 	struct fy_error_ctx ec;
-	int rc;
-
-	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
-			"no event to process");
+	struct fy_key_check fykc;
+	struct fy_key_check_dup dup;
+	bool has_anchors = false, check;
+	int depth = 0, rc;
+
+	fy_eventp_list_init(&fyn->lazy_events);
+	fyn->lazy = true;
+
+	/* when replaying the keys were checked while recording */
+	check = !fyd->lazy_replay;
+	fy_key_check_setup(&fykc);
+	if (check) {
+		rc = fy_key_check_push(&fykc, fyn->type == FYNT_MAPPING,
+				fyn->type == FYNT_MAPPING ? fyn->mapping_start : NULL);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_key_check_push() failed");
+	}
 
-	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-			fyep, err_stream_end);
+	while ((fyep = fy_parse_document_next_event(fyp, fyd)) != NULL) {
+		fy_eventp_list_add_tail(&fyn->lazy_events, fyep);
+		fye = &fyep->e;
+
+		if (check) {
+			rc = fy_key_check_event(&fykc, fye, &dup);
+			fy_error_check(fyp, rc >= 0, err_out,
+					"fy_key_check_event() failed");
+			if (rc)
+				goto err_duplicate_key;
+		}
+
+		switch (fye->type) {
+		case FYET_SCALAR:
+			if (fye->scalar.anchor)
+				has_anchors = true;
+			break;
+		case FYET_SEQUENCE_START:
+			if (fye->sequence_start.anchor)
+				has_anchors = true;
+			depth++;
+			break;
+		case FYET_MAPPING_START:
+			if (fye->mapping_start.anchor)
+				has_anchors = true;
+			depth++;
+			break;
+		case FYET_SEQUENCE_END:
+		case FYET_MAPPING_END:
+			depth--;
+			break;
+		default:
+			break;
+		}
+
+		if (depth < 0)
+			break;
+	}
+
+	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
+			"fy_parse_private() failed");
+
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fyep, err_stream_end);
+
+	/* the end token is needed for the marks, take it now */
+	if (fyn->type == FYNT_SEQUENCE)
+		fyn->sequence_end = fy_token_ref(fye->sequence_end.sequence_end);
+	else
+		fyn->mapping_end = fy_token_ref(fye->mapping_end.mapping_end);
+
+	fy_key_check_cleanup(&fykc);
+
+	return has_anchors ? fy_node_lazy_expand(fyn) : 0;
+
+err_out:
+	fy_key_check_cleanup(&fykc);
+	return -1;
+
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	goto err_out;
+
+err_duplicate_key:
+	fy_key_check_report(fyp, &dup);
+	goto err_out;
+}
+
+static int fy_parse_document_load_sequence_items(struct fy_parser *fyp, struct fy_document *fyd,
+						 struct fy_node *fyn, struct fy_eventp **fyep_endp)
+{
+	struct fy_node *fyn_item = NULL;
+	struct fy_eventp *fyep;
+	struct fy_error_ctx ec;
+	int rc;
+
+	*fyep_endp = NULL;
+
+	while ((fyep = fy_parse_document_next_event(fyp, fyd)) != NULL) {
+		if (fyep->e.type == FYET_SEQUENCE_END) {
+			*fyep_endp = fyep;
+			return 0;
+		}
+
+		rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn_item);
+		fy_error_check(fyp, !rc, err_out_rc,
+				"fy_parse_document_load_node() failed");
+
+		fy_node_list_add_tail(&fyn->sequence, fyn_item);
+		fy_node_items_push(fyn, fyn_item);
+		fyn_item = NULL;
+	}
+
+	fy_error_check(fyp, !fyp->stream_error, err_out,
+			"fy_parse_private() failed");
+
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fyep, err_stream_end);
+
+err_out:
+	rc = -1;
+err_out_rc:
+	return rc;
+
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	goto err_out;
+}
+
+int fy_parse_document_load_sequence(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
+{
+	struct fy_node *fyn = NULL;
+	struct fy_event *fye = NULL;
+	struct fy_token *fyt_ss = NULL;
+	struct fy_error_ctx ec;
+	int rc;
+
+	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
+			"no event to process");
+
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fyep, err_stream_end);
 
 	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
 
@@ -1023,20 +2052,19 @@ int fy_parse_document_load_sequence(struct fy_parser *fyp, struct fy_document *f
 	fy_parse_eventp_recycle(fyp, fyep);
 	fyep = NULL;
 
-	while ((fyep = fy_parse_private(fyp)) != NULL) {
-		fye = &fyep->e;
-		if (fye->type == FYET_SEQUENCE_END)
-			break;
-
-		rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn_item);
-		fyep = NULL;
+	if (fyd->lazy) {
+		rc = fy_parse_document_lazy_record(fyp, fyd, fyn);
 		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_parse_document_load_node() failed");
-
-		fy_node_list_add_tail(&fyn->sequence, fyn_item);
-		fyn_item = NULL;
+				"fy_parse_document_lazy_record() failed");
+		*fynp = fyn;
+		return 0;
 	}
 
+	rc = fy_parse_document_load_sequence_items(fyp, fyd, fyn, &fyep);
+	fy_error_check(fyp, !rc, err_out_rc,
+			"fy_parse_document_load_sequence_items() failed");
+
+	fye = &fyep->e;
 	if (fye->sequence_end.sequence_end) {
 		fyn->sequence_end = fye->sequence_end.sequence_end;
 		fye->sequence_end.sequence_end = NULL;
@@ -1054,7 +2082,6 @@ err_out:
 	rc = -1;
 err_out_rc:
 	fy_parse_eventp_recycle(fyp, fyep);
-	fy_node_free(fyn_item);
 	fy_node_free(fyn);
 	return rc;
 err_stream_end:
@@ -1062,60 +2089,23 @@ err_stream_end:
 	goto err_out;
 }
 
-int fy_parse_document_load_mapping(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
+static int fy_parse_document_load_mapping_items(struct fy_parser *fyp, struct fy_document *fyd,
+						struct fy_node *fyn, struct fy_eventp **fyep_endp)
 {
-	struct fy_node *fyn = NULL, *fyn_key = NULL, *fyn_value = NULL;
+	struct fy_node *fyn_key = NULL, *fyn_value = NULL;
 	struct fy_node_pair *fynp_item = NULL;
-	struct fy_event *fye = NULL;
-	struct fy_token *fyt_ms = NULL;
+	struct fy_eventp *fyep = NULL;
 	struct fy_error_ctx ec;
 	bool duplicate;
 	int rc;
 
-	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
-			"no event to process");
-
-	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-			fyep, err_stream_end);
-
-	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
-
-	*fynp = NULL;
-
-	fye = &fyep->e;
-
-	fyt_ms = fye->mapping_start.mapping_start;
-
-	/* we don't free nodes that often, so no need for recycling */
-	fyn = fy_node_alloc(fyd, FYNT_MAPPING);
-	fy_error_check(fyp, fyn, err_out,
-			"fy_node_alloc() failed");
-
-	fyn->style = fyt_ms && fyt_ms->type == FYTT_FLOW_MAPPING_START ? FYNS_FLOW : FYNS_BLOCK;
-
-	fyn->tag = fye->mapping_start.tag;
-	fye->mapping_start.tag = NULL;
-
-	if (fye->mapping_start.anchor) {
-		rc = fy_parse_document_register_anchor(fyp, fyd, fyn, fye->mapping_start.anchor);
-		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_parse_document_register_anchor() failed");
-		fye->mapping_start.anchor = NULL;
-	}
-
-	if (fye->mapping_start.mapping_start) {
-		fyn->mapping_start = fye->mapping_start.mapping_start;
-		fye->mapping_start.mapping_start = NULL;
-	}
-
-	/* done with this */
-	fy_parse_eventp_recycle(fyp, fyep);
-	fyep = NULL;
+	*fyep_endp = NULL;
 
-	while ((fyep = fy_parse_private(fyp)) != NULL) {
-		fye = &fyep->e;
-		if (fye->type == FYET_MAPPING_END)
-			break;
+	while ((fyep = fy_parse_document_next_event(fyp, fyd)) != NULL) {
+		if (fyep->e.type == FYET_MAPPING_END) {
+			*fyep_endp = fyep;
+			return 0;
+		}
 
 		fynp_item = fy_node_pair_alloc(fyd);
 		fy_error_check(fyp, fynp_item, err_out,
@@ -1138,7 +2128,7 @@ int fy_parse_document_load_mapping(struct fy_parser *fyp, struct fy_document *fy
 		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
 				!duplicate, err_duplicate_key);
 
-		fyep = fy_parse_private(fyp);
+		fyep = fy_parse_document_next_event(fyp, fyd);
 
 		fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
 				"fy_parse_private() failed");
@@ -1146,8 +2136,6 @@ int fy_parse_document_load_mapping(struct fy_parser *fyp, struct fy_document *fy
 		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
 				fyep, err_missing_mapping_value);
 
-		fye = &fyep->e;
-
 		rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn_value);
 		fyep = NULL;
 		fy_error_check(fyp, !rc, err_out_rc,
@@ -1155,25 +2143,26 @@ int fy_parse_document_load_mapping(struct fy_parser *fyp, struct fy_document *fy
 
 		assert(fyn_value);
 
+		rc = fy_node_key_intern(fyd, fyn_key);
+		fy_error_check(fyp, !rc, err_out_rc,
+				"fy_node_key_intern() failed");
+
 		fynp_item->key = fyn_key;
 		fynp_item->value = fyn_value;
+		fynp_item->parent = fyn;
 		fy_node_pair_list_add_tail(&fyn->mapping, fynp_item);
+		fy_node_items_push(fyn, fynp_item);
+		fy_node_mapping_index_add(fyn, fynp_item);
 		fynp_item = NULL;
 		fyn_key = NULL;
 		fyn_value = NULL;
 	}
 
-	if (fye->mapping_end.mapping_end) {
-		fyn->mapping_end = fye->mapping_end.mapping_end;
-		fye->mapping_end.mapping_end = NULL;
-	}
-
-	*fynp = fyn;
-	fyn = NULL;
-
-	fy_parse_eventp_recycle(fyp, fyep);
+	fy_error_check(fyp, !fyp->stream_error, err_out,
+			"fy_parse_private() failed");
 
-	return 0;
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fyep, err_stream_end);
 
 err_out:
 	rc = -1;
@@ -1182,13 +2171,23 @@ err_out_rc:
 	fy_node_pair_free(fynp_item);
 	fy_node_free(fyn_key);
 	fy_node_free(fyn_value);
-	fy_node_free(fyn);
 	return rc;
 
 err_duplicate_key:
-	ec.start_mark = *fy_node_get_start_mark(fyn_key);
-	ec.end_mark = *fy_node_get_end_mark(fyn_key);
-	ec.fyi = fy_node_get_input(fyn_key);
+	/* an empty key has no position of its own, point at the mapping */
+	if (fyn_key->type == FYNT_SCALAR && !fyn_key->scalar) {
+		if (!fyn->mapping_start) {
+			fy_error(fyp, "duplicate key");
+			goto err_out;
+		}
+		ec.start_mark = *fy_token_start_mark(fyn->mapping_start);
+		ec.end_mark = *fy_token_end_mark(fyn->mapping_start);
+		ec.fyi = fy_token_get_input(fyn->mapping_start);
+	} else {
+		ec.start_mark = *fy_node_get_start_mark(fyn_key);
+		ec.end_mark = *fy_node_get_end_mark(fyn_key);
+		ec.fyi = fy_node_get_input(fyn_key);
+	}
 	fy_error_report(fyp, &ec, "duplicate key");
 	goto err_out;
 
@@ -1200,13 +2199,13 @@ err_stream_end:
 	goto err_out;
 }
 
-int fy_parse_document_load_node(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
+int fy_parse_document_load_mapping(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
 {
-	struct fy_event *fye;
-	enum fy_event_type type;
+	struct fy_node *fyn = NULL;
+	struct fy_event *fye = NULL;
+	struct fy_token *fyt_ms = NULL;
 	struct fy_error_ctx ec;
-
-	*fynp = NULL;
+	int rc;
 
 	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
 			"no event to process");
@@ -1216,86 +2215,323 @@ int fy_parse_document_load_node(struct fy_parser *fyp, struct fy_document *fyd,
 
 	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
 
-	fye = &fyep->e;
+	*fynp = NULL;
 
-	type = fye->type;
+	fye = &fyep->e;
 
-	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
-			type == FYET_ALIAS || type == FYET_SCALAR ||
-			type == FYET_SEQUENCE_START || type == FYET_MAPPING_START,
-			err_bad_event);
+	fyt_ms = fye->mapping_start.mapping_start;
 
-	switch (type) {
+	/* we don't free nodes that often, so no need for recycling */
+	fyn = fy_node_alloc(fyd, FYNT_MAPPING);
+	fy_error_check(fyp, fyn, err_out,
+			"fy_node_alloc() failed");
 
-	case FYET_ALIAS:
-	case FYET_SCALAR:
-		return fy_parse_document_load_scalar(fyp, fyd, fyep, fynp);
+	fyn->style = fyt_ms && fyt_ms->type == FYTT_FLOW_MAPPING_START ? FYNS_FLOW : FYNS_BLOCK;
 
-	case FYET_SEQUENCE_START:
-		return fy_parse_document_load_sequence(fyp, fyd, fyep, fynp);
+	fyn->tag = fye->mapping_start.tag;
+	fye->mapping_start.tag = NULL;
 
-	case FYET_MAPPING_START:
-		return fy_parse_document_load_mapping(fyp, fyd, fyep, fynp);
+	if (fye->mapping_start.anchor) {
+		rc = fy_parse_document_register_anchor(fyp, fyd, fyn, fye->mapping_start.anchor);
+		fy_error_check(fyp, !rc, err_out_rc,
+				"fy_parse_document_register_anchor() failed");
+		fye->mapping_start.anchor = NULL;
+	}
 
-	default:
-		break;
+	if (fye->mapping_start.mapping_start) {
+		fyn->mapping_start = fye->mapping_start.mapping_start;
+		fye->mapping_start.mapping_start = NULL;
 	}
 
-err_out:
+	/* done with this */
 	fy_parse_eventp_recycle(fyp, fyep);
-	return -1;
-
-err_bad_event:
-	fy_error_report(fyp, &ec, "bad event");
-	goto err_out;
-
-err_stream_end:
-	fy_error_report(fyp, &ec, "premature end of event stream");
-	goto err_out;
-}
-
-int fy_parse_document_load_end(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep)
-{
-	struct fy_event *fye;
-	struct fy_error_ctx ec;
-	int rc;
-
-	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
-			"no event to process");
+	fyep = NULL;
 
-	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-			fyep, err_stream_end);
+	if (fyd->lazy) {
+		rc = fy_parse_document_lazy_record(fyp, fyd, fyn);
+		fy_error_check(fyp, !rc, err_out_rc,
+				"fy_parse_document_lazy_record() failed");
+		*fynp = fyn;
+		return 0;
+	}
 
-	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
+	rc = fy_parse_document_load_mapping_items(fyp, fyd, fyn, &fyep);
+	fy_error_check(fyp, !rc, err_out_rc,
+			"fy_parse_document_load_mapping_items() failed");
 
 	fye = &fyep->e;
+	if (fye->mapping_end.mapping_end) {
+		fyn->mapping_end = fye->mapping_end.mapping_end;
+		fye->mapping_end.mapping_end = NULL;
+	}
 
-	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
-			fye->type == FYET_DOCUMENT_END,
-			err_bad_event);
+	*fynp = fyn;
+	fyn = NULL;
+
+	fy_parse_eventp_recycle(fyp, fyep);
 
 	return 0;
+
 err_out:
 	rc = -1;
+err_out_rc:
 	fy_parse_eventp_recycle(fyp, fyep);
+	fy_node_free(fyn);
 	return rc;
 
-err_bad_event:
-	fy_error_report(fyp, &ec, "bad event");
-	goto err_out;
-
 err_stream_end:
 	fy_error_report(fyp, &ec, "premature end of event stream");
 	goto err_out;
 }
 
-struct fy_document *fy_parse_load_document(struct fy_parser *fyp)
+int fy_node_lazy_expand_internal(struct fy_node *fyn)
 {
-	struct fy_document *fyd = NULL;
-	struct fy_eventp *fyep = NULL;
-	struct fy_event *fye = NULL;
-	struct fy_error_ctx ec;
-	int rc;
+	struct fy_document *fyd;
+	struct fy_parser *fyp;
+	struct fy_eventp_list events, *saved_replay;
+	struct fy_eventp *fyep_end = NULL;
+	int rc;
+
+	if (!fyn || !fyn->lazy)
+		return 0;
+
+	if (fyn->cow_src)
+		return fy_node_cow_expand(fyn);
+
+	fyd = fyn->fyd;
+	fyp = fyd->fyp;
+
+	/* take over the recorded events; nested collections record their own */
+	fy_eventp_list_init(&events);
+	fy_eventp_lists_splice(&events, &fyn->lazy_events);
+	fyn->lazy = false;
+
+	saved_replay = fyd->lazy_replay;
+	fyd->lazy_replay = &events;
+
+	if (fyn->type == FYNT_SEQUENCE)
+		rc = fy_parse_document_load_sequence_items(fyp, fyd, fyn, &fyep_end);
+	else
+		rc = fy_parse_document_load_mapping_items(fyp, fyd, fyn, &fyep_end);
+
+	fyd->lazy_replay = saved_replay;
+
+	/* the end token was taken when recording */
+	fy_parse_eventp_recycle(fyp, fyep_end);
+
+	/* link the new children */
+	fy_resolve_parent_node(fyd, fyn, fyn->parent);
+
+	/* anything left over on error */
+	fy_parse_eventp_list_recycle_all(fyp, &events);
+
+	return rc;
+}
+
+int fy_node_lazy_expand_all(struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+
+	/* nothing can be lazy without a lazy document; copies share theirs */
+	if (!fyn || !fyn->fyd->lazy || fyn->type == FYNT_SCALAR || fyn->cow_src)
+		return 0;
+
+	if (fy_node_lazy_expand(fyn))
+		return -1;
+
+	if (fyn->type == FYNT_SEQUENCE) {
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+			if (fy_node_lazy_expand_all(fyni))
+				return -1;
+		}
+	} else {
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			if (fy_node_lazy_expand_all(fynp->key) ||
+			    fy_node_lazy_expand_all(fynp->value))
+				return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* compute (once) everything a read accessor would otherwise cache lazily */
+static int fy_node_freeze(struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+
+	if (!fyn)
+		return 0;
+
+	/* lazy collections are built, copies get content of their own */
+	if (fy_node_lazy_expand(fyn) || fy_token_freeze(fyn->tag))
+		return -1;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		return fy_token_freeze(fyn->scalar);
+
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+			if (fy_node_freeze(fyni))
+				return -1;
+		}
+		break;
+
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			if (fy_node_freeze(fynp->key) || fy_node_freeze(fynp->value))
+				return -1;
+		}
+
+		/* a lookup miss would build the index */
+		if (!fyn->mapping_index &&
+		    fy_node_mapping_item_count(fyn) >= FY_NODE_MAPPING_INDEX_MIN &&
+		    fy_node_mapping_index_build(fyn))
+			return -1;
+		break;
+	}
+
+	return fy_node_items_update(fyn);
+}
+
+int fy_document_freeze(struct fy_document *fyd)
+{
+	struct fy_anchor *fya;
+
+	if (!fyd)
+		return -1;
+
+	if (fyd->frozen)
+		return 0;
+
+	if (fy_node_freeze(fyd->root))
+		return -1;
+
+	for (fya = fy_anchor_list_head(&fyd->anchors); fya;
+			fya = fy_anchor_next(&fyd->anchors, fya)) {
+		if (fy_token_freeze(fya->anchor))
+			return -1;
+	}
+
+	/* last, expanding the lazy nodes above drops the cached hashes */
+	fy_node_hash(fyd->root);
+
+	fyd->frozen = true;
+
+	return 0;
+}
+
+bool fy_document_is_frozen(struct fy_document *fyd)
+{
+	return fyd && fyd->frozen;
+}
+
+int fy_parse_document_load_node(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep, struct fy_node **fynp)
+{
+	struct fy_event *fye;
+	enum fy_event_type type;
+	struct fy_error_ctx ec;
+
+	*fynp = NULL;
+
+	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
+			"no event to process");
+
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fyep, err_stream_end);
+
+	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
+
+	fye = &fyep->e;
+
+	type = fye->type;
+
+	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+			type == FYET_ALIAS || type == FYET_SCALAR ||
+			type == FYET_SEQUENCE_START || type == FYET_MAPPING_START,
+			err_bad_event);
+
+	switch (type) {
+
+	case FYET_ALIAS:
+	case FYET_SCALAR:
+		return fy_parse_document_load_scalar(fyp, fyd, fyep, fynp);
+
+	case FYET_SEQUENCE_START:
+		return fy_parse_document_load_sequence(fyp, fyd, fyep, fynp);
+
+	case FYET_MAPPING_START:
+		return fy_parse_document_load_mapping(fyp, fyd, fyep, fynp);
+
+	default:
+		break;
+	}
+
+err_out:
+	fy_parse_eventp_recycle(fyp, fyep);
+	return -1;
+
+err_bad_event:
+	fy_error_report(fyp, &ec, "bad event");
+	goto err_out;
+
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	goto err_out;
+}
+
+int fy_parse_document_load_end(struct fy_parser *fyp, struct fy_document *fyd, struct fy_eventp *fyep)
+{
+	struct fy_event *fye;
+	struct fy_error_ctx ec;
+	int rc;
+
+	fy_error_check(fyp, fyep || !fyp->stream_error, err_out,
+			"no event to process");
+
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fyep, err_stream_end);
+
+	fy_doc_debug(fyp, "in %s [%s]", __func__, fy_event_type_txt[fyep->e.type]);
+
+	fye = &fyep->e;
+
+	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+			fye->type == FYET_DOCUMENT_END,
+			err_bad_event);
+
+	/* done with the event */
+	fy_parse_eventp_recycle(fyp, fyep);
+
+	return 0;
+err_out:
+	rc = -1;
+	fy_parse_eventp_recycle(fyp, fyep);
+	return rc;
+
+err_bad_event:
+	fy_error_report(fyp, &ec, "bad event");
+	goto err_out;
+
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	goto err_out;
+}
+
+/* skip to the start of the next document, and create it */
+static struct fy_document *fy_parse_load_document_start(struct fy_parser *fyp)
+{
+	struct fy_document *fyd = NULL;
+	struct fy_eventp *fyep = NULL;
+	struct fy_event *fye = NULL;
+	struct fy_error_ctx ec;
 	bool was_stream_start;
 
 again:
@@ -1336,11 +2572,29 @@ again:
 			err_bad_event);
 
 	fyd = fy_parse_document_create(fyp, fyep);
-	fyep = NULL;
-
 	fy_error_check(fyp, fyd, err_out,
 			"fy_parse_document_create() failed");
 
+	return fyd;
+
+err_out:
+	return NULL;
+
+err_bad_event:
+	fy_error_report(fyp, &ec, "bad event");
+	fy_parse_eventp_recycle(fyp, fyep);
+	return NULL;
+}
+
+static struct fy_document *fy_parse_load_document_internal(struct fy_parser *fyp)
+{
+	struct fy_document *fyd;
+	int rc;
+
+	fyd = fy_parse_load_document_start(fyp);
+	if (!fyd)
+		return NULL;
+
 	fy_doc_debug(fyp, "calling load_node() for root");
 	rc = fy_parse_document_load_node(fyp, fyd, fy_parse_private(fyp), &fyd->root);
 	fy_error_check(fyp, !rc, err_out,
@@ -1362,341 +2616,352 @@ again:
 	return fyd;
 
 err_out:
-	fy_parse_eventp_recycle(fyp, fyep);
 	fy_parse_document_destroy(fyp, fyd);
 	return NULL;
-
-err_bad_event:
-	fy_error_report(fyp, &ec, "bad event");
-	goto err_out;
-
 }
 
-struct fy_node *fy_node_copy(struct fy_document *fyd, struct fy_node *fyn_from)
+struct fy_document *fy_parse_load_document(struct fy_parser *fyp)
 {
-	struct fy_parser *fyp;
-	struct fy_document *fyd_from;
-	struct fy_node *fyn, *fyni, *fynit;
-	struct fy_node_pair *fynp, *fynpt;
-	struct fy_anchor *fya, *fya_from;
-	const char *anchor;
-	size_t anchor_len;
-	int rc;
+	struct fy_document *fyd;
+	uint64_t start;
 
-	if (!fyd || !fyn_from || !fyn_from->fyd)
-		return NULL;
+	if (!fyp || !fyp->collect_stats)
+		return fy_parse_load_document_internal(fyp);
 
-	fyp = fyd->fyp;
+	start = fy_parse_stats_clock();
+	fyd = fy_parse_load_document_internal(fyp);
+	fyp->stats.document_load_time += fy_parse_stats_clock() - start;
+	if (fyd)
+		fyp->stats.documents++;
 
-	fyd_from = fyn_from->fyd;
+	return fyd;
+}
 
-	fyn = fy_node_alloc(fyd, fyn_from->type);
-	fy_error_check(fyd->fyp, fyn, err_out,
-			"fy_node_alloc() failed");
+/* consume a node's events without creating anything */
+static int fy_parse_document_skip_node(struct fy_parser *fyp, struct fy_eventp *fyep)
+{
+	struct fy_error_ctx ec;
+	int depth = 0;
 
-	fyn->tag = fy_token_ref(fyn_from->tag);
-	fyn->style = fyn_from->style;
+	do {
+		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+				fyep, err_stream_end);
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		fyn->scalar = fy_token_ref(fyn_from->scalar);
-		break;
+		switch (fyep->e.type) {
+		case FYET_SEQUENCE_START:
+		case FYET_MAPPING_START:
+			depth++;
+			break;
+		case FYET_SEQUENCE_END:
+		case FYET_MAPPING_END:
+			depth--;
+			break;
+		default:
+			break;
+		}
+		fy_parse_eventp_recycle(fyp, fyep);
 
-	case FYNT_SEQUENCE:
-		for (fyni = fy_node_list_head(&fyn_from->sequence); fyni;
-				fyni = fy_node_next(&fyn_from->sequence, fyni)) {
+	} while (depth > 0 && (fyep = fy_parse_private(fyp)) != NULL);
 
-			fynit = fy_node_copy(fyd, fyni);
-			fy_error_check(fyp, fynit, err_out,
-					"fy_node_copy() failed");
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			depth <= 0, err_stream_end);
 
-			fy_node_list_add_tail(&fyn->sequence, fynit);
-		}
+	return 0;
 
-		break;
-	case FYNT_MAPPING:
-		for (fynp = fy_node_pair_list_head(&fyn_from->mapping); fynp;
-				fynp = fy_node_pair_next(&fyn_from->mapping, fynp)) {
-
-			fynpt = fy_node_pair_alloc(fyd);
-			fy_error_check(fyp, fynpt, err_out,
-					"fy_node_pair_alloc() failed");
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	return -1;
+}
 
-			fynpt->key = fy_node_copy(fyd, fynp->key);
-			fynpt->value = fy_node_copy(fyd, fynp->value);
+/* consume a mapping key, and check whether it matches the path step */
+static int fy_parse_document_match_key(struct fy_parser *fyp, struct fy_document *fyd,
+				       struct fy_eventp *fyep,
+				       const struct fy_path_step *st, bool *matchp)
+{
+	struct fy_node *fyn_key = NULL;
+	int rc;
 
-			fy_node_pair_list_add_tail(&fyn->mapping, fynpt);
-		}
-		break;
-	}
+	*matchp = false;
 
-	/* drop an anchor to the copy */
-	for (fya_from = fy_anchor_list_head(&fyd_from->anchors); fya_from;
-			fya_from = fy_anchor_next(&fyd_from->anchors, fya_from)) {
-		if (fyn_from == fya_from->fyn)
-			break;
+	/* the common case; a plain text key */
+	if (st->key_simple && fyep->e.type == FYET_SCALAR) {
+		*matchp = !fy_token_memcmp(fyep->e.scalar.value, st->key, st->key_len);
+		fy_parse_eventp_recycle(fyp, fyep);
+		return 0;
 	}
 
-	/* source node has an anchor */
-	if (fya_from) {
-		fya = fy_document_lookup_anchor_by_token(fyd, fya_from->anchor);
-		if (!fya) {
-			/* update the new anchor position */
-			rc = fy_parse_document_register_anchor(fyp, fyd, fyn, fya_from->anchor);
-			fy_error_check(fyp, !rc, err_out,
-					"fy_parse_document_register_anchor() failed");
+	if (!st->fyd_key)
+		return fy_parse_document_skip_node(fyp, fyep);
 
-			fy_anchor_list_add(&fyd->anchors, fya);
-		} else {
-			anchor = fy_anchor_get_text(fya, &anchor_len);
-			fy_error_check(fyp, anchor, err_out,
-					"fy_anchor_get_text() failed");
-			fy_doc_debug(fyp, "not overwritting anchor %.*s", (int)anchor_len, anchor);
-		}
-	}
+	rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn_key);
+	if (rc)
+		return rc;
 
-	return fyn;
+	*matchp = fy_node_compare(fyn_key, fy_document_root(st->fyd_key));
+	fy_node_free(fyn_key);
 
-err_out:
-	return NULL;
+	return 0;
 }
 
-int fy_node_copy_to_scalar(struct fy_document *fyd, struct fy_node *fyn_to, struct fy_node *fyn_from)
+/*
+ * A negative index counts from the end, which is not known until the
+ * sequence ends; keep only the last items loaded and walk the rest of
+ * the path on the one picked.
+ */
+static int fy_parse_document_load_path_tail(struct fy_parser *fyp, struct fy_document *fyd,
+					    const struct fy_path_query *fypq,
+					    const struct fy_path_step *st,
+					    struct fy_node **fynp)
 {
-	struct fy_node *fyn, *fyni;
-	struct fy_node_pair *fynp;
+	struct fy_node_list items;
+	struct fy_node *fyn, *fyn_match;
+	struct fy_eventp *fyep;
+	struct fy_error_ctx ec;
+	unsigned int keep, count;
+	int rc;
 
-	fyn = fy_node_copy(fyd, fyn_from);
-	if (!fyn)
-		return -1;
+	fy_node_list_init(&items);
+	keep = 0U - (unsigned int)st->idx;
+	count = 0;
 
-	/* the node is guaranteed to be a scalar */
-	fy_token_unref(fyn_to->tag);
-	fyn_to->tag = NULL;
-	fy_token_unref(fyn_to->scalar);
-	fyn_to->scalar = NULL;
+	for (;;) {
+		fyep = fy_parse_private(fyp);
+		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+				fyep, err_stream_end);
 
-	fyn_to->type = fyn->type;
-	fyn_to->tag = fy_token_ref(fyn->tag);
-	fyn_to->style = fyn->style;
+		if (fyep->e.type == FYET_SEQUENCE_END) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			break;
+		}
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		fyn_to->scalar = fyn->scalar;
-		fyn->scalar = NULL;
-		break;
-	case FYNT_SEQUENCE:
-		fy_node_list_init(&fyn_to->sequence);
-		while ((fyni = fy_node_list_pop(&fyn->sequence)) != NULL)
-			fy_node_list_add_tail(&fyn_to->sequence, fyni);
-		break;
-	case FYNT_MAPPING:
-		fy_node_pair_list_init(&fyn_to->mapping);
-		while ((fynp = fy_node_pair_list_pop(&fyn->mapping)) != NULL)
-			fy_node_pair_list_add_tail(&fyn_to->mapping, fynp);
-		break;
+		rc = fy_parse_document_load_node(fyp, fyd, fyep, &fyn);
+		if (rc)
+			goto err_out;
+
+		fy_node_list_add_tail(&items, fyn);
+		if (count < keep)
+			count++;
+		else
+			fy_node_free(fy_node_list_pop(&items));
 	}
 
-	/* and free */
+	fyn = count == keep ? fy_node_list_pop(&items) : NULL;
+	while ((fyn_match = fy_node_list_pop(&items)) != NULL)
+		fy_node_free(fyn_match);
+
+	if (!fyn)
+		return 0;
+
+	fyn_match = fy_path_query_walk(fypq, fypr_path, st->seq_next, fyn, NULL);
+	if (fyn_match == fyn) {
+		*fynp = fyn;
+		return 0;
+	}
+
+	if (fyn_match) {
+		*fynp = fy_node_copy(fyd, fyn_match);
+		fy_error_check(fyp, *fynp, err_copy,
+				"fy_node_copy() failed");
+	}
 	fy_node_free(fyn);
 
 	return 0;
+
+err_copy:
+	fy_node_free(fyn);
+	return -1;
+
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	rc = -1;
+err_out:
+	while ((fyn = fy_node_list_pop(&items)) != NULL)
+		fy_node_free(fyn);
+	return rc;
 }
 
-int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
+/* load the node at the path step below the node starting with this event */
+static int fy_parse_document_load_path(struct fy_parser *fyp, struct fy_document *fyd,
+				       struct fy_eventp *fyep,
+				       const struct fy_path_query *fypq, int i,
+				       struct fy_node **fynp)
 {
-	struct fy_document *fyd;
-	struct fy_parser *fyp;
-	struct fy_node *fyn_parent, *fyn_cpy, *fyni, *fyn_prev;
-	struct fy_node_pair *fynp, *fynpi, *fynpj;
-	int rc;
+	const struct fy_path_step *st;
+	enum fy_event_type type, end_type;
+	struct fy_error_ctx ec;
+	bool match;
+	int idx, next, rc;
 
-	if (!fyn_to || !fyn_to->fyd)
-		return -1;
+	*fynp = NULL;
 
-	fyd = fyn_to->fyd;
-	assert(fyd);
-	fyp = fyd->fyp;
-	assert(fyp);
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fyep, err_stream_end);
 
-	fyn_parent = fyn_to->parent;
-	fynp = NULL;
-	if (fyn_parent) {
-		fy_error_check(fyp, fyn_parent->type != FYNT_SCALAR, err_out,
-				    "Illegal scalar parent node type");
+	st = i >= 0 ? &fypq->steps[i] : NULL;
+	if (!st || st->end)
+		return fy_parse_document_load_node(fyp, fyd, fyep, fynp);
 
-		fy_error_check(fyp, fyn_from, err_out,
-				"Illegal NULL source node");
+	type = fyep->e.type;
 
-		if (fyn_parent->type == FYNT_MAPPING) {
-			/* find mapping pair that contains the `to` node */
-			for (fynp = fy_node_pair_list_head(&fyn_parent->mapping); fynp;
-					fynp = fy_node_pair_next(&fyn_parent->mapping, fynp)) {
-				if (fynp->value == fyn_to)
-					break;
-			}
-		}
-	}
+	/* nothing below it that the step can match */
+	if (!(type == FYET_SEQUENCE_START && st->seq_valid) &&
+	    !(type == FYET_MAPPING_START && st->map_valid))
+		return fy_parse_document_skip_node(fyp, fyep);
 
-	/* verify no funkiness on root */
-	assert(fyn_parent || fyn_to == fyd->root);
+	fy_parse_eventp_recycle(fyp, fyep);
 
-	/* deleting target */
-	if (!fyn_from) {
-		fyn_to->parent = NULL;
+	if (type == FYET_SEQUENCE_START && st->idx < 0)
+		return fy_parse_document_load_path_tail(fyp, fyd, fypq, st, fynp);
 
-		if (!fyn_parent) {
-			fy_doc_debug(fyp, "Deleting root node");
-			fy_node_free(fyn_to);
-			fyd->root = NULL;
-		} else if (fyn_parent->type == FYNT_SEQUENCE) {
-			fy_doc_debug(fyp, "Deleting sequence node");
-			fy_node_list_del(&fyn_parent->sequence, fyn_to);
-			fy_node_free(fyn_to);
-		} else {
-			fy_doc_debug(fyp, "Deleting mapping node");
-			/* should never happen, it's checked right above, but play safe */
-			assert(fyn_parent->type == FYNT_MAPPING);
+	end_type = type == FYET_SEQUENCE_START ? FYET_SEQUENCE_END : FYET_MAPPING_END;
+	next = type == FYET_SEQUENCE_START ? st->seq_next : st->map_next;
 
-			fy_error_check(fyp, fynp, err_out,
-					"Illegal mapping node found");
+	for (idx = 0; ; idx++) {
+		fyep = fy_parse_private(fyp);
+		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+				fyep, err_stream_end);
 
-			fy_node_pair_list_del(&fyn_parent->mapping, fynp);
-			/* this will also delete fyn_to */
-			fy_node_pair_free(fynp);
+		if (fyep->e.type == end_type) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			break;
 		}
-		return 0;
-	}
 
-	/*
-	 * from: scalar
-	 *
-	 * to: another-scalar -> scalar
-	 * to: { key: value } -> scalar
-	 * to: [ seq0, seq1 ] -> scalar
-	 *
-	 * from: [ seq2 ]
-	 * to: scalar -> [ seq2 ]
-	 * to: { key: value } -> [ seq2 ]
-	 * to: [ seq0, seq1 ] -> [ seq0, seq1, sec2 ]
-	 *
-	 * from: { another-key: another-value }
-	 * to: scalar -> { another-key: another-value }
-	 * to: { key: value } -> { key: value, another-key: another-value }
-	 * to: [ seq0, seq1 ] -> { another-key: another-value }
-	 *
-	 * from: { key: another-value }
-	 * to: scalar -> { key: another-value }
-	 * to: { key: value } -> { key: another-value }
-	 * to: [ seq0, seq1 ] -> { key: another-value }
-	 *
-	 */
+		if (type == FYET_SEQUENCE_START) {
+			match = idx == st->idx;
+		} else if (*fynp) {
+			/* only the first match counts */
+			rc = fy_parse_document_skip_node(fyp, fyep);
+			if (rc)
+				return rc;
+			match = false;
+		} else {
+			rc = fy_parse_document_match_key(fyp, fyd, fyep, st, &match);
+			if (rc)
+				return rc;
+		}
 
-	/* if types of `from` and `to` differ (or it's a scalar), it's a replace */
-	if (fyn_from->type != fyn_to->type || fyn_from->type == FYNT_SCALAR) {
+		if (type == FYET_MAPPING_START)
+			fyep = fy_parse_private(fyp);
 
-		fyn_cpy = fy_node_copy(fyd, fyn_from);
-		fy_error_check(fyp, fyn_cpy, err_out,
-				"fy_node_copy() failed");
+		if (match && !*fynp)
+			rc = fy_parse_document_load_path(fyp, fyd, fyep,
+							 fypq, next, fynp);
+		else
+			rc = fy_parse_document_skip_node(fyp, fyep);
+		if (rc)
+			return rc;
+	}
 
-		if (!fyn_parent) {
-			fy_doc_debug(fyp, "Replacing root node");
-			fy_node_free(fyd->root);
-			fyd->root = fyn_cpy;
-		} else if (fyn_parent->type == FYNT_SEQUENCE) {
-			fy_doc_debug(fyp, "Replacing sequence node");
+	return 0;
 
-			/* get previous */
-			fyn_prev = fy_node_prev(&fyn_parent->sequence, fyn_to);
+err_stream_end:
+	fy_error_report(fyp, &ec, "premature end of event stream");
+	return -1;
+}
 
-			/* delete */
-			fy_node_list_del(&fyn_parent->sequence, fyn_to);
-			fy_node_free(fyn_to);
+struct fy_document *fy_parse_load_document_path(struct fy_parser *fyp,
+						const char *path, size_t len)
+{
+	struct fy_path_query *fypq;
+	struct fy_document *fyd = NULL;
+	uint64_t start = 0;
+	int rc;
 
-			/* if there's no previous insert to head */
-			if (!fyn_prev)
-				fy_node_list_add(&fyn_parent->sequence, fyn_cpy);
-			else
-				fy_node_list_insert_after(&fyn_parent->sequence, fyn_prev, fyn_cpy);
-		} else {
-			fy_doc_debug(fyp, "Replacing mapping node value");
-			/* should never happen, it's checked right above, but play safe */
-			assert(fyn_parent->type == FYNT_MAPPING);
-			fy_error_check(fyp, fynp, err_out,
-					"Illegal mapping node found");
+	if (!fyp || !path)
+		return NULL;
 
-			if (fynp->value)
-				fy_node_free(fynp->value);
-			fynp->value = fyn_cpy;
-		}
+	if (len == (size_t)-1)
+		len = strlen(path);
 
-		return 0;
-	}
+	/* aliases are never followed while streaming */
+	fypq = fy_path_query_create(path, len, FYNWF_DONT_FOLLOW);
+	if (!fypq)
+		return NULL;
 
-	/* types match, if it's a sequence append */
-	if (fyn_to->type == FYNT_SEQUENCE) {
+	if (fyp->collect_stats)
+		start = fy_parse_stats_clock();
 
-		fy_doc_debug(fyp, "Appending to sequence node");
+	fyd = fy_parse_load_document_start(fyp);
+	if (!fyd)
+		goto out;
 
-		for (fyni = fy_node_list_head(&fyn_from->sequence); fyni;
-				fyni = fy_node_next(&fyn_from->sequence, fyni)) {
+	rc = fy_parse_document_load_path(fyp, fyd, fy_parse_private(fyp),
+					 fypq, fypq->start[fypr_path], &fyd->root);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_parse_document_load_path() failed");
 
-			fyn_cpy = fy_node_copy(fyd, fyni);
-			fy_error_check(fyp, fyn_cpy, err_out,
-					"fy_node_copy() failed");
+	rc = fy_parse_document_load_end(fyp, fyd, fy_parse_private(fyp));
+	fy_error_check(fyp, !rc, err_out,
+			"fy_parse_document_load_end() failed");
 
-			fy_node_list_add_tail(&fyn_to->sequence, fyn_cpy);
-		}
-	} else {
-		/* only mapping is possible here */
+	fy_resolve_parent_node(fyd, fyd->root, NULL);
 
-		/* iterate over all the keys in the `from` */
-		for (fynpi = fy_node_pair_list_head(&fyn_from->mapping); fynpi;
-			fynpi = fy_node_pair_next(&fyn_from->mapping, fynpi)) {
+	if (fyp->collect_stats) {
+		fyp->stats.document_load_time += fy_parse_stats_clock() - start;
+		fyp->stats.documents++;
+	}
 
-			/* find whether the key already exists */
-			for (fynpj = fy_node_pair_list_head(&fyn_to->mapping); fynpj;
-				fynpj = fy_node_pair_next(&fyn_to->mapping, fynpj)) {
+out:
+	fy_path_query_destroy(fypq);
 
-				if (fy_node_compare(fynpi->key, fynpj->key))
-					break;
-			}
+	return fyd;
 
-			if (!fynpj) {
-				fy_doc_debug(fyp, "Appending to mapping node");
+err_out:
+	fy_parse_document_destroy(fyp, fyd);
+	fyd = NULL;
+	goto out;
+}
 
-				/* not found? append it */
-				fynpj = fy_node_pair_alloc(fyd);
-				fy_error_check(fyp, fynpj, err_out,
-						"fy_node_pair_alloc() failed");
+static struct fy_node *fy_node_copy_to(struct fy_document *fyd, struct fy_node *fyn_from,
+				       struct fy_node *fyn_dest);
 
-				fynpj->key = fy_node_copy(fyd, fynpi->key);
-				fy_error_check(fyp, !fynpi->key || fynpj->key, err_out,
-						"fy_node_copy() failed");
-				fynpj->value = fy_node_copy(fyd, fynpi->value);
-				fy_error_check(fyp, !fynpi->value || fynpj->value, err_out,
-						"fy_node_copy() failed");
+/* copy the children of a collection (to go under fyn_dest), collections are lazy copies */
+static int fy_node_copy_items(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_from,
+			      struct fy_node *fyn_dest)
+{
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_node *fyni, *fynit;
+	struct fy_node_pair *fynp, *fynpt;
 
-				fy_node_pair_list_add_tail(&fyn_to->mapping, fynpj);
+	fy_error_check(fyp, !fy_node_lazy_expand(fyn_from), err_out,
+			"fy_node_lazy_expand() failed");
 
-			} else {
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
 
-				fy_doc_debug(fyp, "Updating mapping node value");
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn_from->sequence); fyni;
+				fyni = fy_node_next(&fyn_from->sequence, fyni)) {
 
-				/* found? replace value */
-				fy_node_free(fynpj->value);
-				fynpj->value = fy_node_copy(fyd, fynpi->value);
-				fy_error_check(fyp, !fynpi->value || fynpj->value, err_out,
-						"fy_node_copy() failed");
-			}
+			fynit = fy_node_copy_to(fyd, fyni, fyn_dest);
+			fy_error_check(fyp, fynit, err_out,
+					"fy_node_copy() failed");
+			fynit->parent = fyn;
+
+			fy_node_list_add_tail(&fyn->sequence, fynit);
+			fy_node_items_push(fyn, fynit);
 		}
-	}
 
-	/* if the documents differ, merge their states */
-	if (fyn_to->fyd != fyn_from->fyd) {
-		rc = fy_document_state_merge(fyn_to->fyd, fyn_from->fyd);
-		if (rc)
-			return rc;
+		break;
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn_from->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn_from->mapping, fynp)) {
+
+			fynpt = fy_node_pair_alloc(fyd);
+			fy_error_check(fyp, fynpt, err_out,
+					"fy_node_pair_alloc() failed");
+
+			fynpt->key = fy_node_copy_to(fyd, fynp->key, fyn_dest);
+			fynpt->value = fy_node_copy_to(fyd, fynp->value, fyn_dest);
+			fynpt->parent = fyn;
+			if (fynpt->value)
+				fynpt->value->parent = fyn;
+
+			fy_node_pair_list_add_tail(&fyn->mapping, fynpt);
+			fy_node_items_push(fyn, fynpt);
+		}
+		break;
 	}
 
 	return 0;
@@ -1705,489 +2970,620 @@ err_out:
 	return -1;
 }
 
-int fy_document_insert_at(struct fy_document *fyd,
-			  const char *path, size_t pathlen,
-			  struct fy_node *fyn)
+static bool fy_node_is_within(struct fy_node *fyn, struct fy_node *fyn_top)
 {
-	int rc;
-	struct fy_node *fyn2;
-
-	fyn2 = fy_node_by_path(fy_document_root(fyd), path, pathlen, FYNWF_DONT_FOLLOW);
-	rc = fy_node_insert(fyn2, fyn);
-
-	fy_node_free(fyn);
-
-	return rc;
+	for (; fyn; fyn = fy_node_owner(fyn)) {
+		if (fyn == fyn_top)
+			return true;
+	}
+	return false;
 }
 
-static int fy_document_node_update_tags(struct fy_document *fyd, struct fy_node *fyn)
+/*
+ * The content of a collection can be shared when no anchors would
+ * be copied along; either it's the same document (where the anchors
+ * are never duplicated) or the source document has none. A copy
+ * going inside its own source can't share it, it would contain itself.
+ * Nor can a frozen document be shared, other threads may be reading it.
+ */
+static bool fy_node_copy_can_share(struct fy_document *fyd, struct fy_node *fyn_src,
+				   struct fy_node *fyn_dest)
 {
-	struct fy_parser *fyp;
-	struct fy_node *fyni;
-	struct fy_node_pair *fynp, *fynpi;
-	struct fy_token *fyt_td;
-	const char *handle;
-	size_t handle_size;
-	int rc;
-
-	if (!fyd || !fyn || !fyd->fyp)
-		return 0;
-
-	fyp = fyd->fyp;
+	return fyn_src->type != FYNT_SCALAR && !fyn_src->fyd->frozen &&
+	       (fyn_src->fyd == fyd || !fyn_src->fyd->anchor_count) &&
+	       !(fyn_dest && fyn_dest->fyd == fyn_src->fyd && fy_node_is_within(fyn_dest, fyn_src));
+}
 
-	/* replace tag reference with the one that the document contains */
-	if (fyn->tag) {
-		fy_error_check(fyp, fyn->tag->type == FYTT_TAG, err_out,
-				"bad node tag");
+/* a copy of the text, kept with the document */
+static const char *fy_document_text_copy(struct fy_document *fyd, const char *text, size_t len)
+{
+	struct fy_input *fyi;
+	size_t pos;
 
-		handle = fy_tag_directive_token_handle(fyn->tag->tag.fyt_td, &handle_size);
-		fy_error_check(fyp, handle, err_out,
-				"bad tag directive token");
+	fyi = fy_document_build_input(fyd, text, len, FYNBD_COPY, &pos);
+	if (!fyi)
+		return NULL;
 
-		fyt_td = fy_document_state_lookup_tag_directive(fyd->fyds, handle, handle_size);
-		fy_error_check(fyp, fyt_td, err_out,
-				"Missing tag directive with handle=%.*s", (int)handle_size, handle);
+	return (const char *)fy_input_start(fyi) + pos;
+}
 
-		/* need to replace this */
-		if (fyt_td != fyn->tag->tag.fyt_td) {
-			fy_token_unref(fyn->tag->tag.fyt_td);
-			fyn->tag->tag.fyt_td = fy_token_ref(fyt_td);
+/*
+ * Readers in other threads may be going through a frozen document, so
+ * a copy of it can't even take a reference to its tokens; it gets new
+ * ones. The tag is kept in its short form when the handle means the
+ * same in the destination, in verbatim form otherwise.
+ */
+static int fy_node_copy_frozen_tokens(struct fy_document *fyd, struct fy_node *fyn,
+				      struct fy_node *fyn_from)
+{
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_node *fyn_tmp;
+	struct fy_token *fyt_td, *fyt_td_to;
+	const char *text, *handle, *prefix, *prefix_to;
+	size_t len, handle_size, prefix_size, prefix_to_size;
+	char *buf;
 
+	if (fyn_from->tag) {
+		fyt_td = fyn_from->tag->tag.fyt_td;
+		handle = fy_tag_directive_token_handle(fyt_td, &handle_size);
+		prefix = fy_tag_directive_token_prefix(fyt_td, &prefix_size);
+		fyt_td_to = handle ? fy_document_state_lookup_tag_directive(fyd->fyds,
+						handle, handle_size) : NULL;
+		prefix_to = fy_tag_directive_token_prefix(fyt_td_to, &prefix_to_size);
+
+		if (prefix && prefix_to && prefix_size == prefix_to_size &&
+		    !memcmp(prefix, prefix_to, prefix_size)) {
+			text = fy_document_text_copy(fyd, fy_atom_data(&fyn_from->tag->handle),
+						     fy_atom_size(&fyn_from->tag->handle));
+			len = fy_atom_size(&fyn_from->tag->handle);
+		} else {
+			text = fy_node_get_tag(fyn_from, &len);
+			fy_error_check(fyp, text, err_out,
+					"fy_node_get_tag() failed");
+			buf = malloc(len + 3);
+			fy_error_check(fyp, buf, err_out,
+					"malloc() failed");
+			buf[0] = '!';
+			buf[1] = '<';
+			memcpy(buf + 2, text, len);
+			buf[len + 2] = '>';
+			len += 3;
+			text = fy_document_text_copy(fyd, buf, len);
+			free(buf);
 		}
+		fy_error_check(fyp, text, err_out,
+				"fy_document_text_copy() failed");
+
+		fyn->tag = fy_document_tag_create(fyd, text, len);
+		fy_error_check(fyp, fyn->tag, err_out,
+				"fy_document_tag_create() failed");
 	}
 
+	if (fyn_from->type != FYNT_SCALAR || !fyn_from->scalar)
+		return 0;
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		break;
+	text = fy_token_get_text(fyn_from->scalar, &len);
+	fy_error_check(fyp, text, err_out,
+			"fy_token_get_text() failed");
 
-	case FYNT_SEQUENCE:
-		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
-				fyni = fy_node_next(&fyn->sequence, fyni)) {
+	if (fyn_from->style == FYNS_ALIAS) {
+		text = fy_document_text_copy(fyd, text, len);
+		fyn_tmp = text ? fy_node_create_alias(fyd, text, len) : NULL;
+	} else
+		fyn_tmp = fy_node_create_scalar_direct(fyd, text, len,
+						       fyn_from->scalar->scalar.style, FYNBD_COPY);
+	fy_error_check(fyp, fyn_tmp, err_out,
+			"fy_node_create_scalar_direct() failed");
 
-			rc = fy_document_node_update_tags(fyd, fyni);
-			if (rc)
-				goto err_out_rc;
-		}
-		break;
+	fyn->scalar = fyn_tmp->scalar;
+	fyn->style = fyn_tmp->style;
+	fyn_tmp->scalar = NULL;
+	fy_node_free(fyn_tmp);
 
-	case FYNT_MAPPING:
-		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
+	return 0;
 
-			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
+err_out:
+	return -1;
+}
 
-			/* the parent of the key is always NULL */
-			rc = fy_document_node_update_tags(fyd, fynp->key);
-			if (rc)
-				goto err_out_rc;
+/* a new anchor token with the text of the one of a frozen document */
+static struct fy_token *fy_document_anchor_token_copy(struct fy_document *fyd,
+						      struct fy_anchor *fya_from)
+{
+	struct fy_input *fyi;
+	struct fy_atom handle;
+	const char *text;
+	size_t len;
 
-			rc = fy_document_node_update_tags(fyd, fynp->value);
-			if (rc)
-				goto err_out_rc;
-		}
-		break;
-	}
+	text = fy_anchor_get_text(fya_from, &len);
+	if (text)
+		text = fy_document_text_copy(fyd, text, len);
+	if (!text)
+		return NULL;
 
-	return 0;
+	fyi = fy_parse_input_from_data(fyd->fyp, text, len, &handle, true);
+	if (!fyi)
+		return NULL;
 
-err_out:
-	rc = -1;
-err_out_rc:
-	return rc;
+	return fy_token_create(fyd->fyp, FYTT_ANCHOR, &handle);
 }
 
-void fy_document_dump_tag_directives(struct fy_document *fyd, const char *banner)
+struct fy_node *fy_node_copy(struct fy_document *fyd, struct fy_node *fyn_from)
 {
-	struct fy_document_state *fyds;
+	return fy_node_copy_to(fyd, fyn_from, NULL);
+}
+
+/* a copy that is to be placed at (or under) fyn_dest */
+static struct fy_node *fy_node_copy_to(struct fy_document *fyd, struct fy_node *fyn_from,
+				       struct fy_node *fyn_dest)
+{
+	struct fy_parser *fyp;
+	struct fy_document *fyd_from;
+	struct fy_node *fyn, *fyn_src;
+	struct fy_anchor *fya, *fya_from;
 	struct fy_token *fyt;
-	const char *handle, *prefix;
-	size_t handle_size, prefix_size;
+	const char *anchor;
+	size_t anchor_len;
+	int rc;
 
-	if (!fyd || !fyd->fyds)
-		return;
+	if (!fyd || !fyn_from || !fyn_from->fyd)
+		return NULL;
 
-	fyds = fyd->fyds;
+	fyp = fyd->fyp;
 
-	for (fyt = fy_token_list_first(&fyds->fyt_td); fyt; fyt = fy_token_next(&fyds->fyt_td, fyt)) {
+	fyd_from = fyn_from->fyd;
 
-		handle = fy_tag_directive_token_handle(fyt, &handle_size);
-		assert(handle);
+	/* a copy of a copy shares the same source */
+	fyn_src = fyn_from;
+	if (fyn_src->cow_src && fy_node_copy_can_share(fyd, fyn_src->cow_src, fyn_dest))
+		fyn_src = fyn_src->cow_src;
 
-		prefix = fy_tag_directive_token_prefix(fyt, &prefix_size);
-		assert(prefix);
+	fyn = fy_node_alloc(fyd, fyn_from->type);
+	fy_error_check(fyd->fyp, fyn, err_out,
+			"fy_node_alloc() failed");
 
-		fy_notice(fyd->fyp, "%s tag directive \"%.*s\" \"%.*s\"", banner,
-				(int)handle_size, handle,
-				(int)prefix_size, prefix);
+	fyn->style = fyn_from->style;
+
+	if (fyd_from->frozen) {
+		rc = fy_node_copy_frozen_tokens(fyd, fyn, fyn_from);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_node_copy_frozen_tokens() failed");
+	} else {
+		fyn->tag = fy_token_ref(fyn_from->tag);
+		if (fyn->type == FYNT_SCALAR)
+			fyn->scalar = fy_token_ref(fyn_from->scalar);
 	}
-}
 
-struct fy_token *fy_document_tag_directive_iterate(struct fy_document *fyd, void **prevp)
-{
-	struct fy_token_list *fytl;
+	if (fyn->type == FYNT_SCALAR)
+		goto do_anchor;
 
-	if (!fyd || !fyd->fyds || !prevp)
-		return NULL;
+	if (fyn_src != fyn_from || fy_node_copy_can_share(fyd, fyn_src, fyn_dest)) {
+		/* the source must be complete before anyone shares it */
+		fy_error_check(fyp, !fy_node_lazy_expand(fyn_src), err_out,
+				"fy_node_lazy_expand() failed");
+		fy_node_cow_link(fyn, fyn_src);
+	} else {
+		rc = fy_node_copy_items(fyd, fyn, fyn_src, fyn_dest);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_node_copy_items() failed");
+	}
 
-	fytl = &fyd->fyds->fyt_td;
+do_anchor:
+	/* drop an anchor to the copy */
+	fya_from = fy_document_lookup_anchor_by_node(fyd_from, fyn_from);
 
-	return *prevp = *prevp ? fy_token_next(fytl, *prevp) : fy_token_list_head(fytl);
-}
+	/* source node has an anchor */
+	if (fya_from) {
+		fya = fy_document_lookup_anchor_by_token(fyd, fya_from->anchor);
+		if (!fya) {
+			/* the new anchor holds a reference of its own */
+			if (!fyd_from->frozen)
+				fyt = fy_token_ref(fya_from->anchor);
+			else
+				fyt = fy_document_anchor_token_copy(fyd, fya_from);
+			fy_error_check(fyp, fyt, err_out,
+					"anchor token copy failed");
 
-struct fy_token *fy_document_tag_directive_lookup(struct fy_document *fyd, const char *handle)
-{
-	struct fy_token *fyt;
-	void *iter;
-	const char *h;
-	size_t h_size, len;
+			/* update the new anchor position */
+			rc = fy_parse_document_register_anchor(fyp, fyd, fyn, fyt);
+			if (rc)
+				fy_token_unref(fyt);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_parse_document_register_anchor() failed");
+		} else {
+			anchor = fy_anchor_get_text(fya, &anchor_len);
+			fy_error_check(fyp, anchor, err_out,
+					"fy_anchor_get_text() failed");
+			fy_doc_debug(fyp, "not overwritting anchor %.*s", (int)anchor_len, anchor);
+		}
+	}
 
-	if (!fyd || !handle)
-		return NULL;
-	len = strlen(handle);
+	return fyn;
 
-	iter = NULL;
-	while ((fyt = fy_document_tag_directive_iterate(fyd, &iter)) != NULL) {
-		h = fy_tag_directive_token_handle(fyt, &h_size);
-		if (!h)
-			continue;
-		if (h_size == len && !memcmp(h, handle, len))
-			return fyt;
-	}
+err_out:
 	return NULL;
 }
 
-int fy_document_tag_directive_add(struct fy_document *fyd, const char *handle, const char *prefix)
+int fy_node_copy_to_scalar(struct fy_document *fyd, struct fy_node *fyn_to, struct fy_node *fyn_from)
 {
-	struct fy_token *fyt;
+	struct fy_node *fyn, *fyni, *fyn_src;
+	struct fy_node_pair *fynp;
 
-	if (!fyd || !fyd->fyds || !handle || !prefix)
+	if (fy_node_cow_detach_path(fyn_to))
 		return -1;
 
-	/* it must not exist */
-	fyt = fy_document_tag_directive_lookup(fyd, handle);
-	if (fyt)
+	fyn = fy_node_copy_to(fyd, fyn_from, fyn_to);
+	if (!fyn)
 		return -1;
 
-	return fy_append_tag_directive(fyd->fyp, fyd->fyds, handle, prefix);
-}
+	fy_node_hash_invalidate(fyn_to);
 
-int fy_document_tag_directive_remove(struct fy_document *fyd, const char *handle)
-{
-	struct fy_token *fyt;
+	/* the node is guaranteed to be a scalar */
+	fy_token_unref(fyn_to->tag);
+	fyn_to->tag = NULL;
+	fy_token_unref(fyn_to->scalar);
+	fyn_to->scalar = NULL;
 
-	if (!fyd || !fyd->fyds || !handle)
-		return -1;
+	fyn_to->type = fyn->type;
+	fyn_to->tag = fy_token_ref(fyn->tag);
+	fyn_to->style = fyn->style;
 
-	/* it must not exist */
-	fyt = fy_document_tag_directive_lookup(fyd, handle);
-	if (!fyt || fyt->refs != 1)
-		return -1;
+	/* the item vector moves along with the items */
+	fyn_to->items = fyn->items;
+	fyn_to->items_count = fyn->items_count;
+	fyn_to->items_alloc = fyn->items_alloc;
+	fyn->items = NULL;
+	fyn->items_count = 0;
+	fyn->items_alloc = 0;
+
+	/* a lazy copy keeps sharing the source */
+	if (fyn->cow_src) {
+		fyn_src = fyn->cow_src;
+		fy_node_cow_unlink(fyn);
+		fy_node_cow_link(fyn_to, fyn_src);
+	}
 
-	fy_token_list_del(&fyd->fyds->fyt_td, fyt);
-	fy_token_unref(fyt);
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		fyn_to->scalar = fyn->scalar;
+		fyn->scalar = NULL;
+		break;
+	case FYNT_SEQUENCE:
+		fy_node_list_init(&fyn_to->sequence);
+		while ((fyni = fy_node_list_pop(&fyn->sequence)) != NULL) {
+			fyni->parent = fyn_to;
+			fy_node_list_add_tail(&fyn_to->sequence, fyni);
+		}
+		break;
+	case FYNT_MAPPING:
+		fy_node_pair_list_init(&fyn_to->mapping);
+		while ((fynp = fy_node_pair_list_pop(&fyn->mapping)) != NULL) {
+			fynp->parent = fyn_to;
+			if (fynp->value)
+				fynp->value->parent = fyn_to;
+			fy_node_pair_list_add_tail(&fyn_to->mapping, fynp);
+		}
+		/* the key index moves along with the pairs */
+		fyn_to->mapping_index = fyn->mapping_index;
+		fyn->mapping_index = NULL;
+		break;
+	}
+
+	/* and free */
+	fy_node_free(fyn);
 
 	return 0;
 }
 
-int fy_document_state_merge(struct fy_document *fyd, struct fy_document *fydc)
+int fy_node_insert(struct fy_node *fyn_to, struct fy_node *fyn_from)
 {
-	struct fy_parser *fyp = fyd->fyp;
-	struct fy_document_state *fyds, *fydsc;
-	const char *td_prefix, *tdc_handle, *tdc_prefix;
-	size_t td_prefix_size, tdc_handle_size, tdc_prefix_size;
-	struct fy_error_ctx ec;
-	struct fy_token *fyt, *fytc_td, *fyt_td;
+	struct fy_document *fyd;
+	struct fy_parser *fyp;
+	struct fy_node *fyn_parent, *fyn_cpy, *fyni, *fyn_prev;
+	struct fy_node_pair *fynp, *fynpi, *fynpj;
 	int rc;
 
-	/* both the document and the parser object must exist */
-	if (!fyd || !fydc)
-		return 0;
-
-	fyds = fyd->fyds;
-	assert(fyds);
-
-	fydsc = fydc->fyds;
-	assert(fydsc);
+	if (!fyn_to || !fyn_to->fyd)
+		return -1;
 
-	/* check if there's a duplicate handle (which differs */
-	for (fytc_td = fy_token_list_first(&fydsc->fyt_td); fytc_td; fytc_td = fy_token_next(&fydsc->fyt_td, fytc_td)) {
+	fyd = fyn_to->fyd;
+	assert(fyd);
+	fyp = fyd->fyp;
+	assert(fyp);
 
-		tdc_handle = fy_tag_directive_token_handle(fytc_td, &tdc_handle_size);
-		assert(tdc_handle);
+	/* copies of the target (or of its ancestors) can't share it anymore */
+	fy_error_check(fyp, !fy_node_cow_detach_path(fyn_to), err_out,
+			"fy_node_cow_detach_path() failed");
 
-		tdc_prefix = fy_tag_directive_token_prefix(fytc_td, &tdc_prefix_size);
-		assert(tdc_prefix);
+	fyn_parent = fyn_to->parent;
+	fynp = NULL;
+	if (fyn_parent) {
+		fy_error_check(fyp, fyn_parent->type != FYNT_SCALAR, err_out,
+				    "Illegal scalar parent node type");
 
-		fyt_td = fy_document_state_lookup_tag_directive(fyds, tdc_handle, tdc_handle_size);
-		if (fyt_td) {
-			/* exists, must check whether the prefixes match */
-			td_prefix = fy_tag_directive_token_prefix(fyt_td, &td_prefix_size);
-			assert(td_prefix);
+		fy_error_check(fyp, fyn_from, err_out,
+				"Illegal NULL source node");
 
-			/* match? do nothing */
-			if (tdc_prefix_size == td_prefix_size &&
-			    !memcmp(tdc_prefix, td_prefix, td_prefix_size)) {
-				fy_notice(fyp, "matching tag directive \"%.*s\" \"%.*s\"",
-						(int)tdc_handle_size, tdc_handle,
-						(int)tdc_prefix_size, tdc_prefix);
-				continue;
+		if (fyn_parent->type == FYNT_MAPPING) {
+			/* find mapping pair that contains the `to` node */
+			for (fynp = fy_node_pair_list_head(&fyn_parent->mapping); fynp;
+					fynp = fy_node_pair_next(&fyn_parent->mapping, fynp)) {
+				if (fynp->value == fyn_to)
+					break;
 			}
+		}
+	}
 
-			/* the tag directive must be overridable */
-			FY_ERROR_CHECK(fyp, fytc_td, &ec, FYEM_DOC,
-					fy_token_tag_directive_is_overridable(fyt_td),
-					err_dup_diff_tag);
+	/* verify no funkiness on root */
+	assert(fyn_parent || fyn_to == fyd->root);
 
-			/* override tag directive */
-			fy_token_list_del(&fyds->fyt_td, fyt_td);
-			fy_token_unref(fyt_td);
+	/* deleting target */
+	if (!fyn_from) {
+		fyn_to->parent = NULL;
 
-			fy_notice(fyp, "overriding tag directive \"%.*s\" \":%.*s\"",
-					(int)tdc_handle_size, tdc_handle,
-					(int)tdc_prefix_size, tdc_prefix);
+		if (!fyn_parent) {
+			fy_doc_debug(fyp, "Deleting root node");
+			fy_node_free(fyn_to);
+			fyd->root = NULL;
+		} else if (fyn_parent->type == FYNT_SEQUENCE) {
+			fy_doc_debug(fyp, "Deleting sequence node");
+			fy_node_items_remove(fyn_parent, fyn_to);
+			fy_node_list_del(&fyn_parent->sequence, fyn_to);
+			fy_node_free(fyn_to);
 		} else {
-			fy_notice(fyp, "appending tag directive \"%.*s\" \"%.*s\"",
-					(int)tdc_handle_size, tdc_handle,
-					(int)tdc_prefix_size, tdc_prefix);
-		}
+			fy_doc_debug(fyp, "Deleting mapping node");
+			/* should never happen, it's checked right above, but play safe */
+			assert(fyn_parent->type == FYNT_MAPPING);
 
-		fyt = fy_token_create(fyp, FYTT_TAG_DIRECTIVE,
-				&fytc_td->handle,
-				fytc_td->tag_directive.tag_length,
-				fytc_td->tag_directive.uri_length);
-		fy_error_check(fyp, fyt, err_out,
-				"fy_token_create() failed");
+			fy_error_check(fyp, fynp, err_out,
+					"Illegal mapping node found");
 
-		fy_token_list_add_tail(&fyds->fyt_td, fyt);
+			fy_node_items_remove(fyn_parent, fynp);
+			fy_node_mapping_index_del(fyn_parent, fynp);
+			fy_node_pair_list_del(&fyn_parent->mapping, fynp);
+			/* this will also delete fyn_to */
+			fy_node_pair_free(fynp);
+		}
+		return 0;
 	}
 
-	rc = fy_document_node_update_tags(fyd, fy_document_root(fyd));
-	fy_error_check(fyp, !rc, err_out_rc,
-			"fy_document_node_update_tags() failed");
+	/*
+	 * from: scalar
+	 *
+	 * to: another-scalar -> scalar
+	 * to: { key: value } -> scalar
+	 * to: [ seq0, seq1 ] -> scalar
+	 *
+	 * from: [ seq2 ]
+	 * to: scalar -> [ seq2 ]
+	 * to: { key: value } -> [ seq2 ]
+	 * to: [ seq0, seq1 ] -> [ seq0, seq1, sec2 ]
+	 *
+	 * from: { another-key: another-value }
+	 * to: scalar -> { another-key: another-value }
+	 * to: { key: value } -> { key: value, another-key: another-value }
+	 * to: [ seq0, seq1 ] -> { another-key: another-value }
+	 *
+	 * from: { key: another-value }
+	 * to: scalar -> { key: another-value }
+	 * to: { key: value } -> { key: another-value }
+	 * to: [ seq0, seq1 ] -> { key: another-value }
+	 *
+	 */
 
-	/* merge other document state */
-	fyd->fyds->version_explicit |= fydc->fyds->version_explicit;
-	fyd->fyds->tags_explicit |= fydc->fyds->tags_explicit;
+	fy_error_check(fyp, !fy_node_lazy_expand(fyn_to) && !fy_node_lazy_expand(fyn_from), err_out,
+			"fy_node_lazy_expand() failed");
 
-	if (fyd->fyds->version.major < fydc->fyds->version.major ||
-	    (fyd->fyds->version.major == fydc->fyds->version.major &&
-		fyd->fyds->version.minor < fydc->fyds->version.minor))
-		fyd->fyds->version = fydc->fyds->version;
+	/* if types of `from` and `to` differ (or it's a scalar), it's a replace */
+	if (fyn_from->type != fyn_to->type || fyn_from->type == FYNT_SCALAR) {
 
-	return 0;
+		fyn_cpy = fy_node_copy_to(fyd, fyn_from, fyn_to);
+		fy_error_check(fyp, fyn_cpy, err_out,
+				"fy_node_copy() failed");
+		fyn_cpy->parent = fyn_parent;
 
-err_out:
-	rc = -1;
-err_out_rc:
-	return rc;
+		if (!fyn_parent) {
+			fy_doc_debug(fyp, "Replacing root node");
+			fy_node_free(fyd->root);
+			fyd->root = fyn_cpy;
+			/* any change thaws the document */
+			fyd->frozen = false;
+		} else if (fyn_parent->type == FYNT_SEQUENCE) {
+			fy_doc_debug(fyp, "Replacing sequence node");
 
-err_dup_diff_tag:
-	fy_error_report(fyp, &ec, "duplicate differing tag declaration");
-	goto err_out;
-}
+			/* get previous */
+			fyn_prev = fy_node_prev(&fyn_parent->sequence, fyn_to);
 
-static int fy_resolve_alias(struct fy_document *fyd, struct fy_node *fyn)
-{
-	struct fy_parser *fyp = fyd->fyp;
-	struct fy_error_ctx ec;
-	struct fy_anchor *fya;
-	int rc;
+			/* delete */
+			fy_node_list_del(&fyn_parent->sequence, fyn_to);
 
-	fya = fy_document_lookup_anchor_by_token(fyd, fyn->scalar);
+			/* if there's no previous insert to head */
+			if (!fyn_prev)
+				fy_node_list_add(&fyn_parent->sequence, fyn_cpy);
+			else
+				fy_node_list_insert_after(&fyn_parent->sequence, fyn_prev, fyn_cpy);
 
-	FY_ERROR_CHECK(fyp, fyn->scalar, &ec, FYEM_DOC,
-			fya,
-			err_bad_alias);
+			/* same position, patch the item vector in place */
+			fy_node_items_replace(fyn_parent, fyn_to, fyn_cpy);
+			fy_node_free(fyn_to);
+		} else {
+			fy_doc_debug(fyp, "Replacing mapping node value");
+			/* should never happen, it's checked right above, but play safe */
+			assert(fyn_parent->type == FYNT_MAPPING);
+			fy_error_check(fyp, fynp, err_out,
+					"Illegal mapping node found");
 
-	rc = fy_node_copy_to_scalar(fyd, fyn, fya->fyn);
-	fy_error_check(fyp, !rc, err_out,
-			"fy_node_copy_to_scalar() failed");
+			if (fynp->value)
+				fy_node_free(fynp->value);
+			fynp->value = fyn_cpy;
+			fy_node_hash_invalidate(fyn_parent);
+		}
 
-	return 0;
+		return 0;
+	}
 
-err_out:
-	return -1;
+	/* types match, if it's a sequence append */
+	if (fyn_to->type == FYNT_SEQUENCE) {
 
-err_bad_alias:
-	fy_error_report(fyp, &ec, "invalid alias");
-	goto err_out;
-}
+		fy_doc_debug(fyp, "Appending to sequence node");
 
-static struct fy_node *
-fy_node_follow_alias(struct fy_node *fyn, enum fy_node_walk_flags flags)
-{
-	struct fy_anchor *fya;
-	const char *anchor_text, *s, *e;
-	size_t anchor_len;
-	unsigned int marker;
+		for (fyni = fy_node_list_head(&fyn_from->sequence); fyni;
+				fyni = fy_node_next(&fyn_from->sequence, fyni)) {
 
-	if (!fyn || !fy_node_is_alias(fyn))
-		return NULL;
+			fyn_cpy = fy_node_copy_to(fyd, fyni, fyn_to);
+			fy_error_check(fyp, fyn_cpy, err_out,
+					"fy_node_copy() failed");
+			fyn_cpy->parent = fyn_to;
 
-	/* try regular label target */
-	fya = fy_document_lookup_anchor_by_token(fyn->fyd, fyn->scalar);
-	if (fya)
-		return fya->fyn;
-
-	anchor_text = fy_token_get_text(fyn->scalar, &anchor_len);
-	if (!anchor_text)
-		return NULL;
-
-	s = anchor_text;
-	e = s + anchor_len;
+			fy_node_list_add_tail(&fyn_to->sequence, fyn_cpy);
+			fy_node_items_push(fyn_to, fyn_cpy);
+		}
+	} else {
+		/* only mapping is possible here */
 
-	/* minimum is </> */
-	if ((e - s) < 3 || s[0] != '<' || s[1] != '/' || e[-1] != '>')
-		return NULL;
+		/* iterate over all the keys in the `from` */
+		for (fynpi = fy_node_pair_list_head(&fyn_from->mapping); fynpi;
+			fynpi = fy_node_pair_next(&fyn_from->mapping, fynpi)) {
 
-	s++;
-	e--;
+			/* find whether the key already exists */
+			fynpj = fy_node_mapping_lookup_pair(fyn_to, fynpi->key);
 
-	marker = fy_node_walk_marker_from_flags(flags);
-	if (marker >= 30)
-		return NULL;
+			if (!fynpj) {
+				fy_doc_debug(fyp, "Appending to mapping node");
 
-	/* use the next marker */
-	flags &= ~FYNWF_MARKER(FYNWF_MARKER_MASK);
-	flags |= FYNWF_MARKER(marker + 1);
+				/* not found? append it */
+				fynpj = fy_node_pair_alloc(fyd);
+				fy_error_check(fyp, fynpj, err_out,
+						"fy_node_pair_alloc() failed");
 
-	return fy_node_by_path_internal(fyn->fyd->root, s, (size_t)(e - s), flags);
-}
+				fynpj->key = fy_node_copy_to(fyd, fynpi->key, fyn_to);
+				fy_error_check(fyp, !fynpi->key || fynpj->key, err_out,
+						"fy_node_copy() failed");
+				fynpj->value = fy_node_copy_to(fyd, fynpi->value, fyn_to);
+				fy_error_check(fyp, !fynpi->value || fynpj->value, err_out,
+						"fy_node_copy() failed");
+				fynpj->parent = fyn_to;
+				if (fynpj->value)
+					fynpj->value->parent = fyn_to;
 
-static bool fy_node_pair_is_merge_key(struct fy_node_pair *fynp)
-{
-	struct fy_node *fyn = fynp->key;
+				fy_node_pair_list_add_tail(&fyn_to->mapping, fynpj);
+				fy_node_items_push(fyn_to, fynpj);
+				fy_node_mapping_index_add(fyn_to, fynpj);
 
-	return fyn && fyn->type == FYNT_SCALAR && fyn->style == FYNS_PLAIN &&
-	       fy_plain_atom_streq(fy_token_atom(fyn->scalar), "<<");
-}
+			} else {
 
-static struct fy_node *fy_alias_get_merge_mapping(struct fy_document *fyd, struct fy_node *fyn)
-{
-	struct fy_anchor *fya;
+				fy_doc_debug(fyp, "Updating mapping node value");
 
-	/* must be an alias */
-	if (!fy_node_is_alias(fyn))
-		return NULL;
+				/* found? replace value */
+				fy_node_free(fynpj->value);
+				fynpj->value = fy_node_copy_to(fyd, fynpi->value, fyn_to);
+				fy_node_hash_invalidate(fyn_to);
+				fy_error_check(fyp, !fynpi->value || fynpj->value, err_out,
+						"fy_node_copy() failed");
+				if (fynpj->value)
+					fynpj->value->parent = fyn_to;
+			}
+		}
+	}
 
-	/* anchor must exist */
-	fya = fy_document_lookup_anchor_by_token(fyd, fyn->scalar);
-	if (!fya)
-		return NULL;
+	/* if the documents differ, merge their states */
+	if (fyn_to->fyd != fyn_from->fyd) {
+		rc = fy_document_state_merge(fyn_to->fyd, fyn_from->fyd);
+		if (rc)
+			return rc;
+	}
 
-	/* and it must be a mapping */
-	if (fya->fyn->type != FYNT_MAPPING)
-		return NULL;
+	return 0;
 
-	return fya->fyn;
+err_out:
+	return -1;
 }
 
-static bool fy_node_pair_is_valid_merge_key(struct fy_document *fyd, struct fy_node_pair *fynp)
+int fy_document_insert_at(struct fy_document *fyd,
+			  const char *path, size_t pathlen,
+			  struct fy_node *fyn)
 {
-	struct fy_node *fyn, *fyni, *fynm;
-
-	fyn = fynp->value;
-
-	/* value must exist */
-	if (!fyn)
-		return false;
-
-	/* scalar alias */
-	fynm = fy_alias_get_merge_mapping(fyd, fyn);
-	if (fynm)
-		return true;
-
-	/* it must be a sequence then */
-	if (fyn->type != FYNT_SEQUENCE)
-		return false;
-
-	/* the sequence must only contain valid aliases for mapping */
-	for (fyni = fy_node_list_head(&fyn->sequence); fyni;
-			fyni = fy_node_next(&fyn->sequence, fyni)) {
+	int rc;
+	struct fy_node *fyn2;
 
-		/* sequence of aliases only! */
-		fynm = fy_alias_get_merge_mapping(fyd, fyni);
-		if (!fynm)
-			return false;
+	fyn2 = fy_node_by_path(fy_document_root(fyd), path, pathlen, FYNWF_DONT_FOLLOW);
+	rc = fy_node_insert(fyn2, fyn);
 
-	}
+	fy_node_free(fyn);
 
-	return true;
+	return rc;
 }
 
-static int fy_resolve_merge_key_populate(struct fy_document *fyd, struct fy_node *fyn,
-					  struct fy_node_pair *fynp, struct fy_node *fynm)
+static int fy_document_node_update_tags(struct fy_document *fyd, struct fy_node *fyn)
 {
-	struct fy_node_pair *fynpi, *fynpn;
+	struct fy_parser *fyp;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp, *fynpi;
+	struct fy_token *fyt_td;
+	const char *handle;
+	size_t handle_size;
+	int rc;
 
-	if (!fyd)
-		return -1;
+	if (!fyd || !fyn || !fyd->fyp)
+		return 0;
 
-	fy_error_check(fyd->fyp,
-			fyn && fynp && fynm && fyn->type == FYNT_MAPPING && fynm->type == FYNT_MAPPING,
-			err_out, "bad inputs to %s", __func__);
+	fyp = fyd->fyp;
 
-	for (fynpi = fy_node_pair_list_head(&fynm->mapping); fynpi;
-		fynpi = fy_node_pair_next(&fynm->mapping, fynpi)) {
+	rc = fy_node_lazy_expand(fyn);
+	fy_error_check(fyp, !rc, err_out_rc,
+			"fy_node_lazy_expand() failed");
 
-		/* make sure we don't override an already existing key */
-		if (fy_node_mapping_key_is_duplicate(fyn, fynpi->key))
-			continue;
+	/* replace tag reference with the one that the document contains */
+	if (fyn->tag) {
+		fy_error_check(fyp, fyn->tag->type == FYTT_TAG, err_out,
+				"bad node tag");
 
-		fynpn = fy_node_pair_alloc(fyd);
-		fy_error_check(fyd->fyp, fynpn, err_out,
-				"fy_node_pair_alloc() failed");
+		handle = fy_tag_directive_token_handle(fyn->tag->tag.fyt_td, &handle_size);
+		fy_error_check(fyp, handle, err_out,
+				"bad tag directive token");
 
-		fynpn->key = fy_node_copy(fyd, fynpi->key);
-		fynpn->value = fy_node_copy(fyd, fynpi->value);
+		fyt_td = fy_document_state_lookup_tag_directive(fyd->fyds, handle, handle_size);
+		fy_error_check(fyp, fyt_td, err_out,
+				"Missing tag directive with handle=%.*s", (int)handle_size, handle);
 
+		/* need to replace this */
+		if (fyt_td != fyn->tag->tag.fyt_td) {
+			fy_token_unref(fyn->tag->tag.fyt_td);
+			fyn->tag->tag.fyt_td = fy_token_ref(fyt_td);
 
-		fy_node_pair_list_insert_after(&fyn->mapping, fynp, fynpn);
+		}
 	}
 
-	return 0;
-
-err_out:
-	return -1;
-}
-
-static int fy_resolve_merge_key(struct fy_document *fyd, struct fy_node *fyn, struct fy_node_pair *fynp)
-{
-	struct fy_parser *fyp = fyd->fyp;
-	struct fy_node *fynv, *fyni, *fynm;
-	struct fy_error_ctx ec;
-	int rc;
 
-	/* it must be a valid merge key value */
-	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
-			fy_node_pair_is_valid_merge_key(fyd, fynp),
-			err_invalid_merge_key);
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
 
-	fynv = fynp->value;
-	fynm = fy_alias_get_merge_mapping(fyd, fynv);
-	if (fynm) {
-		rc = fy_resolve_merge_key_populate(fyd, fyn, fynp, fynm);
-		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_resolve_merge_key_populate() failed");
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
 
-		return 0;
-	}
+			rc = fy_document_node_update_tags(fyd, fyni);
+			if (rc)
+				goto err_out_rc;
+		}
+		break;
 
-	/* it must be a sequence then */
-	fy_error_check(fyp, fynv->type == FYNT_SEQUENCE, err_out,
-			"invalid node type to use for merge key");
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
 
-	/* the sequence must only contain valid aliases for mapping */
-	for (fyni = fy_node_list_head(&fynv->sequence); fyni;
-			fyni = fy_node_next(&fynv->sequence, fyni)) {
+			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
 
-		fynm = fy_alias_get_merge_mapping(fyd, fyni);
-		fy_error_check(fyp, fynm, err_out,
-				"invalid merge key sequence item (not an alias)");
+			/* the parent of the key is always NULL */
+			rc = fy_document_node_update_tags(fyd, fynp->key);
+			if (rc)
+				goto err_out_rc;
 
-		rc = fy_resolve_merge_key_populate(fyd, fyn, fynp, fynm);
-		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_resolve_merge_key_populate() failed");
+			rc = fy_document_node_update_tags(fyd, fynp->value);
+			if (rc)
+				goto err_out_rc;
+		}
+		break;
 	}
 
 	return 0;
@@ -2196,1549 +3592,3407 @@ err_out:
 	rc = -1;
 err_out_rc:
 	return rc;
-
-err_invalid_merge_key:
-	ec.start_mark = *fy_node_get_start_mark(fynp->value);
-	ec.end_mark = *fy_node_get_end_mark(fynp->value);
-	ec.fyi = fy_node_get_input(fynp->value);
-	fy_error_report(fyp, &ec, "invalid merge key value");
-	goto err_out;
 }
 
-/* the anchors are scalars that have the FYNS_ALIAS style */
-static int fy_resolve_anchor_node(struct fy_document *fyd, struct fy_node *fyn)
+void fy_document_dump_tag_directives(struct fy_document *fyd, const char *banner)
 {
-	struct fy_parser *fyp = fyd->fyp;
-	struct fy_node *fyni;
-	struct fy_node_pair *fynp, *fynpi, *fynpit;
-	int rc, ret_rc = 0;
-	struct fy_error_ctx ec;
+	struct fy_document_state *fyds;
 	struct fy_token *fyt;
+	const char *handle, *prefix;
+	size_t handle_size, prefix_size;
 
-	if (!fyn)
-		return 0;
+	if (!fyd || !fyd->fyds)
+		return;
 
-	if (fy_node_is_alias(fyn))
-		return fy_resolve_alias(fyd, fyn);
+	fyds = fyd->fyds;
 
-	if (fyn->type == FYNT_SEQUENCE) {
+	for (fyt = fy_token_list_first(&fyds->fyt_td); fyt; fyt = fy_token_next(&fyds->fyt_td, fyt)) {
 
-		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
-				fyni = fy_node_next(&fyn->sequence, fyni)) {
+		handle = fy_tag_directive_token_handle(fyt, &handle_size);
+		assert(handle);
 
-			rc = fy_resolve_anchor_node(fyd, fyni);
-			if (rc && !ret_rc)
-				ret_rc = rc;
-		}
+		prefix = fy_tag_directive_token_prefix(fyt, &prefix_size);
+		assert(prefix);
 
-	} else if (fyn->type == FYNT_MAPPING) {
-
-		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
-
-			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
-
-			if (fy_node_pair_is_merge_key(fynp)) {
-				rc = fy_resolve_merge_key(fyd, fyn, fynp);
-				if (rc && !ret_rc)
-					ret_rc = rc;
-
-				/* remove this node pair */
-				if (!rc) {
-					fy_node_pair_list_del(&fyn->mapping, fynp);
-					fy_node_pair_free(fynp);
-				}
+		fy_notice(fyd->fyp, "%s tag directive \"%.*s\" \"%.*s\"", banner,
+				(int)handle_size, handle,
+				(int)prefix_size, prefix);
+	}
+}
 
-			} else {
+struct fy_token *fy_document_tag_directive_iterate(struct fy_document *fyd, void **prevp)
+{
+	struct fy_token_list *fytl;
 
-				rc = fy_resolve_anchor_node(fyd, fynp->key);
+	if (!fyd || !fyd->fyds || !prevp)
+		return NULL;
 
-				if (!rc) {
+	fytl = &fyd->fyds->fyt_td;
 
-					/* check whether the keys are duplicate */
-					for (fynpit = fy_node_pair_list_head(&fyn->mapping); fynpit;
-						fynpit = fy_node_pair_next(&fyn->mapping, fynpit)) {
+	return *prevp = *prevp ? fy_token_next(fytl, *prevp) : fy_token_list_head(fytl);
+}
 
-						/* skip this node pair */
-						if (fynpit == fynp)
-							continue;
+struct fy_token *fy_document_tag_directive_lookup(struct fy_document *fyd, const char *handle)
+{
+	struct fy_token *fyt;
+	void *iter;
+	const char *h;
+	size_t h_size, len;
 
-						if (!fy_node_compare(fynpit->key, fynp->key))
-							continue;
+	if (!fyd || !handle)
+		return NULL;
+	len = strlen(handle);
 
-						/* whoops, duplicate key after resolution */
-						fyt = NULL;
-						switch (fyn->type) {
-						case FYNT_SCALAR:
-							fyt = fyn->scalar;
-							break;
-						case FYNT_SEQUENCE:
-							fyt = fyn->sequence_start;
-							break;
-						case FYNT_MAPPING:
-							fyt = fyn->mapping_start;
-							break;
-						}
+	iter = NULL;
+	while ((fyt = fy_document_tag_directive_iterate(fyd, &iter)) != NULL) {
+		h = fy_tag_directive_token_handle(fyt, &h_size);
+		if (!h)
+			continue;
+		if (h_size == len && !memcmp(h, handle, len))
+			return fyt;
+	}
+	return NULL;
+}
 
-						FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_DOC,
-								false,
-								err_duplicate_key);
+int fy_document_tag_directive_add(struct fy_document *fyd, const char *handle, const char *prefix)
+{
+	struct fy_token *fyt;
 
-					}
+	if (!fyd || !fyd->fyds || !handle || !prefix)
+		return -1;
 
-				}
+	/* it must not exist */
+	fyt = fy_document_tag_directive_lookup(fyd, handle);
+	if (fyt)
+		return -1;
 
-				if (rc && !ret_rc)
-					ret_rc = rc;
+	return fy_append_tag_directive(fyd->fyp, fyd->fyds, handle, prefix);
+}
 
-				rc = fy_resolve_anchor_node(fyd, fynp->value);
-				if (rc && !ret_rc)
-					ret_rc = rc;
+int fy_document_tag_directive_remove(struct fy_document *fyd, const char *handle)
+{
+	struct fy_token *fyt;
 
-			}
-		}
-	}
+	if (!fyd || !fyd->fyds || !handle)
+		return -1;
 
-	return ret_rc;
+	/* it must not exist */
+	fyt = fy_document_tag_directive_lookup(fyd, handle);
+	if (!fyt || fyt->refs != 1)
+		return -1;
 
-err_out:
-	return -1;
+	fy_token_list_del(&fyd->fyds->fyt_td, fyt);
+	fy_token_unref(fyt);
 
-err_duplicate_key:
-	fy_error_report(fyp, &ec, "duplicate key after resolving");
-	goto err_out;
+	return 0;
 }
 
-static void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_parent)
+int fy_document_state_merge(struct fy_document *fyd, struct fy_document *fydc)
 {
-	struct fy_node *fyni;
-	struct fy_node_pair *fynp, *fynpi;
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_document_state *fyds, *fydsc;
+	const char *td_prefix, *tdc_handle, *tdc_prefix;
+	size_t td_prefix_size, tdc_handle_size, tdc_prefix_size;
+	struct fy_error_ctx ec;
+	struct fy_token *fyt, *fytc_td, *fyt_td;
+	bool changed = false;
+	int rc;
 
-	if (!fyn)
-		return;
+	/* both the document and the parser object must exist */
+	if (!fyd || !fydc)
+		return 0;
 
-	fyn->parent = fyn_parent;
+	fyds = fyd->fyds;
+	assert(fyds);
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		break;
+	fydsc = fydc->fyds;
+	assert(fydsc);
 
-	case FYNT_SEQUENCE:
-		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
-				fyni = fy_node_next(&fyn->sequence, fyni)) {
+	/* check if there's a duplicate handle (which differs */
+	for (fytc_td = fy_token_list_first(&fydsc->fyt_td); fytc_td; fytc_td = fy_token_next(&fydsc->fyt_td, fytc_td)) {
 
-			fy_resolve_parent_node(fyd, fyni, fyn);
-		}
-		break;
+		tdc_handle = fy_tag_directive_token_handle(fytc_td, &tdc_handle_size);
+		assert(tdc_handle);
 
-	case FYNT_MAPPING:
-		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
+		tdc_prefix = fy_tag_directive_token_prefix(fytc_td, &tdc_prefix_size);
+		assert(tdc_prefix);
 
-			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
+		fyt_td = fy_document_state_lookup_tag_directive(fyds, tdc_handle, tdc_handle_size);
+		if (fyt_td) {
+			/* exists, must check whether the prefixes match */
+			td_prefix = fy_tag_directive_token_prefix(fyt_td, &td_prefix_size);
+			assert(td_prefix);
 
-			/* the parent of the key is always NULL */
-			fy_resolve_parent_node(fyd, fynp->key, NULL);
-			fy_resolve_parent_node(fyd, fynp->value, fyn);
-			fynp->parent = fyn;
-		}
-		break;
-	}
-}
+			/* match? do nothing */
+			if (tdc_prefix_size == td_prefix_size &&
+			    !memcmp(tdc_prefix, td_prefix, td_prefix_size)) {
+				fy_notice(fyp, "matching tag directive \"%.*s\" \"%.*s\"",
+						(int)tdc_handle_size, tdc_handle,
+						(int)tdc_prefix_size, tdc_prefix);
+				continue;
+			}
 
-typedef void (*fy_node_applyf)(struct fy_node *fyn);
+			/* the tag directive must be overridable */
+			FY_ERROR_CHECK(fyp, fytc_td, &ec, FYEM_DOC,
+					fy_token_tag_directive_is_overridable(fyt_td),
+					err_dup_diff_tag);
 
-void fy_node_apply(struct fy_node *fyn, fy_node_applyf func)
-{
-	struct fy_node *fyni;
-	struct fy_node_pair *fynp;
+			/* override tag directive */
+			fy_token_list_del(&fyds->fyt_td, fyt_td);
+			fy_token_unref(fyt_td);
 
-	if (!fyn || !func)
-		return;
+			fy_notice(fyp, "overriding tag directive \"%.*s\" \":%.*s\"",
+					(int)tdc_handle_size, tdc_handle,
+					(int)tdc_prefix_size, tdc_prefix);
+		} else {
+			fy_notice(fyp, "appending tag directive \"%.*s\" \"%.*s\"",
+					(int)tdc_handle_size, tdc_handle,
+					(int)tdc_prefix_size, tdc_prefix);
+		}
 
-	(*func)(fyn);
+		fyt = fy_token_create(fyp, FYTT_TAG_DIRECTIVE,
+				&fytc_td->handle,
+				fytc_td->tag_directive.tag_length,
+				fytc_td->tag_directive.uri_length);
+		fy_error_check(fyp, fyt, err_out,
+				"fy_token_create() failed");
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		break;
+		fy_token_list_add_tail(&fyds->fyt_td, fyt);
+		changed = true;
+	}
 
-	case FYNT_SEQUENCE:
-		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
-				fyni = fy_node_next(&fyn->sequence, fyni))
-			fy_node_apply(fyni, func);
-		break;
+	/* matching tag directives need no update (nor a walk of the tree) */
+	if (changed) {
+		rc = fy_document_node_update_tags(fyd, fy_document_root(fyd));
+		fy_error_check(fyp, !rc, err_out_rc,
+				"fy_document_node_update_tags() failed");
+	}
 
-	case FYNT_MAPPING:
-		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
-				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+	/* merge other document state */
+	fyd->fyds->version_explicit |= fydc->fyds->version_explicit;
+	fyd->fyds->tags_explicit |= fydc->fyds->tags_explicit;
 
-			fy_node_apply(fynp->key, func);
-			fy_node_apply(fynp->value, func);
-		}
-		break;
-	}
-}
+	if (fyd->fyds->version.major < fydc->fyds->version.major ||
+	    (fyd->fyds->version.major == fydc->fyds->version.major &&
+		fyd->fyds->version.minor < fydc->fyds->version.minor))
+		fyd->fyds->version = fydc->fyds->version;
 
-static void clear_marks(struct fy_node *fyn)
-{
-	fyn->marks = 0;
-}
+	return 0;
 
-/* clear all the markers */
-void fy_node_clear_marks(struct fy_node *fyn)
-{
-	fy_node_apply(fyn, clear_marks);
+err_out:
+	rc = -1;
+err_out_rc:
+	return rc;
+
+err_dup_diff_tag:
+	fy_error_report(fyp, &ec, "duplicate differing tag declaration");
+	goto err_out;
 }
 
-int fy_document_resolve(struct fy_document *fyd)
+static int fy_resolve_alias(struct fy_document *fyd, struct fy_node *fyn)
 {
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_error_ctx ec;
+	struct fy_anchor *fya;
 	int rc;
-	bool ret;
 
-	if (!fyd)
-		return 0;
+	fya = fy_document_lookup_anchor_by_token(fyd, fyn->scalar);
 
-	fy_node_clear_marks(fyd->root);
+	FY_ERROR_CHECK(fyp, fyn->scalar, &ec, FYEM_DOC,
+			fya,
+			err_bad_alias);
 
-	/* for resolution to work, no reference loops should exist */
-	ret = fy_check_ref_loop(fyd, fyd->root,
-			FYNWF_MAXDEPTH_DEFAULT | FYNWF_FOLLOW, NULL);
-
-	fy_node_clear_marks(fyd->root);
-
-	if (ret)
-		return -1;
+	rc = fy_node_copy_to_scalar(fyd, fyn, fya->fyn);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_node_copy_to_scalar() failed");
 
-	/* now resolve any anchor nodes */
-	rc = fy_resolve_anchor_node(fyd, fyd->root);
+	return 0;
 
-	/* redo parent resolution */
-	fy_resolve_parent_node(fyd, fyd->root, NULL);
+err_out:
+	return -1;
 
-	return rc;
+err_bad_alias:
+	fy_error_report(fyp, &ec, "invalid alias");
+	goto err_out;
 }
 
-void fy_document_free_nodes(struct fy_document *fyd)
+static struct fy_node *
+fy_node_follow_alias(struct fy_node *fyn, enum fy_node_walk_flags flags)
 {
-	struct fy_document *fyd_child;
+	struct fy_anchor *fya;
+	const char *anchor_text, *s, *e;
+	size_t anchor_len;
+	unsigned int marker;
 
-	for (fyd_child = fy_document_list_first(&fyd->children); fyd_child; fyd_child = fy_document_next(&fyd->children, fyd_child)) {
-		fy_document_free_nodes(fyd_child);
-	}
+	if (!fyn || !fy_node_is_alias(fyn))
+		return NULL;
 
-	fy_node_free(fyd->root);
-	fyd->root = NULL;
-}
+	/* try regular label target */
+	fya = fy_document_lookup_anchor_by_token(fyn->fyd, fyn->scalar);
+	if (fya)
+		return fya->fyn;
 
-void fy_document_destroy(struct fy_document *fyd)
-{
-	struct fy_document *fyd_child;
-	struct fy_parser *fyp;
-	bool owns_parser;
+	anchor_text = fy_token_get_text(fyn->scalar, &anchor_len);
+	if (!anchor_text)
+		return NULL;
 
-	/* both the document and the parser object must exist */
-	if (!fyd || !fyd->fyp)
-		return;
+	s = anchor_text;
+	e = s + anchor_len;
 
-	/* we have to free the nodes first */
-	fy_document_free_nodes(fyd);
+	/* minimum is </> */
+	if ((e - s) < 3 || s[0] != '<' || s[1] != '/' || e[-1] != '>')
+		return NULL;
 
-	/* recursively delete children */
-	while ((fyd_child = fy_document_list_pop(&fyd->children)) != NULL) {
-		fyd_child->parent = NULL;
-		fy_document_destroy(fyd_child);
-	}
+	s++;
+	e--;
 
-	fyp = fyd->fyp;
-	owns_parser = fyd->owns_parser;
+	marker = fy_node_walk_marker_from_flags(flags);
+	if (marker >= 30)
+		return NULL;
 
-	fy_parse_document_destroy(fyp, fyd);
+	/* use the next marker */
+	flags &= ~FYNWF_MARKER(FYNWF_MARKER_MASK);
+	flags |= FYNWF_MARKER(marker + 1);
 
-	if (owns_parser)
-		fy_parser_destroy(fyp);
+	return fy_node_by_path_internal(fyn->fyd->root, s, (size_t)(e - s), flags);
 }
 
-int fy_document_set_parent(struct fy_document *fyd, struct fy_document *fyd_child)
+static bool fy_node_pair_is_merge_key(struct fy_node_pair *fynp)
 {
+	struct fy_node *fyn = fynp->key;
 
-	if (!fyd || !fyd_child || fyd_child->parent)
-		return -1;
-
-	fyd_child->parent = fyd;
-	fy_document_list_add_tail(&fyd->children, fyd_child);
-
-	return 0;
+	return fyn && fyn->type == FYNT_SCALAR && fyn->style == FYNS_PLAIN &&
+	       fy_plain_atom_streq(fy_token_atom(fyn->scalar), "<<");
 }
 
-static const struct fy_parse_cfg doc_parse_default_cfg = {
-	.search_path = "",
-	.flags = FYPCF_QUIET | FYPCF_DEBUG_LEVEL_WARNING |
-		 FYPCF_DEBUG_DIAG_TYPE | FYPCF_COLOR_NONE,
-};
-
-struct fy_document *fy_document_create(const struct fy_parse_cfg *cfg)
+static struct fy_node *fy_alias_get_merge_mapping(struct fy_document *fyd, struct fy_node *fyn)
 {
-	struct fy_parser *fyp = NULL;
-	struct fy_document *fyd = NULL;
-
-	if (!cfg)
-		cfg = &doc_parse_default_cfg;
+	struct fy_anchor *fya;
 
-	fyp = fy_parser_create(cfg);
-	if (!fyp)
+	/* must be an alias */
+	if (!fy_node_is_alias(fyn))
 		return NULL;
 
-	fyd = fy_parse_alloc(fyp, sizeof(*fyd));
-	fy_error_check(fyp, fyd, err_out,
-		"fy_parse_alloc() failed");
-	memset(fyd, 0, sizeof(*fyd));
-
-	fyd->fyp = fyp;
-	fy_talloc_list_init(&fyd->tallocs);
-
-	fy_anchor_list_init(&fyd->anchors);
-	fyd->root = NULL;
-
-	fyd->fyds = fy_document_state_ref(fyp->current_document_state);
-	fy_error_check(fyp, fyd->fyds, err_out,
-			"fy_document_state_ref() failed");
-	fyp->external_document_state = true;	/* parser will not update state */
+	/* anchor must exist */
+	fya = fy_document_lookup_anchor_by_token(fyd, fyn->scalar);
+	if (!fya)
+		return NULL;
 
-	fyd->owns_parser = true;
+	/* and it must be a mapping */
+	if (fya->fyn->type != FYNT_MAPPING)
+		return NULL;
 
-	fyd->errfp = NULL;
-	fyd->errbuf = NULL;
-	fyd->errsz = 0;
+	return fya->fyn;
+}
 
-	fy_document_list_init(&fyd->children);
+static bool fy_node_pair_is_valid_merge_key(struct fy_document *fyd, struct fy_node_pair *fynp)
+{
+	struct fy_node *fyn, *fyni, *fynm;
 
-	return fyd;
+	fyn = fynp->value;
 
-err_out:
-	fy_parse_document_destroy(fyp, fyd);
-	fy_parser_destroy(fyp);
-	return NULL;
-}
+	/* value must exist */
+	if (!fyn)
+		return false;
 
-struct fy_document_build_string_ctx {
-	const char *str;
-	size_t len;
-};
+	/* scalar alias */
+	fynm = fy_alias_get_merge_mapping(fyd, fyn);
+	if (fynm)
+		return true;
 
-static int parser_setup_from_string(struct fy_parser *fyp, void *user)
-{
-	struct fy_document_build_string_ctx *ctx = user;
+	/* it must be a sequence then */
+	if (fyn->type != FYNT_SEQUENCE)
+		return false;
 
-	return fy_parser_set_string(fyp, ctx->str, ctx->len);
-}
+	/* the sequence must only contain valid aliases for mapping */
+	for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+			fyni = fy_node_next(&fyn->sequence, fyni)) {
 
-struct fy_document_build_file_ctx {
-	const char *file;
-};
+		/* sequence of aliases only! */
+		fynm = fy_alias_get_merge_mapping(fyd, fyni);
+		if (!fynm)
+			return false;
 
-static int parser_setup_from_file(struct fy_parser *fyp, void *user)
-{
-	struct fy_document_build_file_ctx *ctx = user;
+	}
 
-	return fy_parser_set_input_file(fyp, ctx->file);
+	return true;
 }
 
-struct fy_document_build_fp_ctx {
-	const char *name;
-	FILE *fp;
-};
-
-static int parser_setup_from_fp(struct fy_parser *fyp, void *user)
+static int fy_resolve_merge_key_populate(struct fy_document *fyd, struct fy_node *fyn,
+					  struct fy_node_pair *fynp, struct fy_node *fynm)
 {
-	struct fy_document_build_fp_ctx *ctx = user;
+	struct fy_node_pair *fynpi, *fynpn;
 
-	return fy_parser_set_input_fp(fyp, ctx->name, ctx->fp);
-}
+	if (!fyd)
+		return -1;
 
-struct fy_document_vbuildf_ctx {
-	const char *fmt;
-	va_list ap;
-};
+	fy_error_check(fyd->fyp,
+			fyn && fynp && fynm && fyn->type == FYNT_MAPPING && fynm->type == FYNT_MAPPING,
+			err_out, "bad inputs to %s", __func__);
 
-static int parser_setup_from_fmt_ap(struct fy_parser *fyp, void *user)
-{
-	struct fy_document_vbuildf_ctx *vctx = user;
-	va_list ap, ap_orig;
-	int size, sizew;
-	char *buf;
+	fy_error_check(fyd->fyp, !fy_node_cow_detach_path(fyn), err_out,
+			"fy_node_cow_detach_path() failed");
 
-	/* first try without allocating */
-	va_copy(ap_orig, vctx->ap);
-	size = vsnprintf(NULL, 0, vctx->fmt, ap_orig);
-	va_end(ap_orig);
+	for (fynpi = fy_node_pair_list_head(&fynm->mapping); fynpi;
+		fynpi = fy_node_pair_next(&fynm->mapping, fynpi)) {
 
-	fy_error_check(fyp, size >= 0, err_out,
-			"vsnprintf() failed");
+		/* make sure we don't override an already existing key */
+		if (fy_node_mapping_key_is_duplicate(fyn, fynpi->key))
+			continue;
 
-	/* the buffer will stick around until the parser is destroyed */
-	buf = fy_parser_alloc(fyp, size + 1);
-	fy_error_check(fyp, buf, err_out,
-			"fy_parser_alloc() failed");
+		fynpn = fy_node_pair_alloc(fyd);
+		fy_error_check(fyd->fyp, fynpn, err_out,
+				"fy_node_pair_alloc() failed");
 
-	va_copy(ap, vctx->ap);
-	sizew = vsnprintf(buf, size + 1, vctx->fmt, ap);
-	fy_error_check(fyp, sizew == size, err_out,
-			"vsnprintf() failed");
-	va_end(ap);
+		fynpn->key = fy_node_copy_to(fyd, fynpi->key, fyn);
+		fynpn->value = fy_node_copy_to(fyd, fynpi->value, fyn);
+		fynpn->parent = fyn;
+		if (fynpn->value)
+			fynpn->value->parent = fyn;
 
-	buf[size] = '\0';
+		fy_node_pair_list_insert_after(&fyn->mapping, fynp, fynpn);
+		fy_node_items_invalidate(fyn);
+		fy_node_mapping_index_add(fyn, fynpn);
+	}
 
-	return fy_parser_set_string(fyp, buf, size);
+	return 0;
 
 err_out:
 	return -1;
 }
 
-static struct fy_document *fy_document_build_internal(const struct fy_parse_cfg *cfg,
-		int (*parser_setup)(struct fy_parser *fyp, void *user),
-		void *user)
+static int fy_resolve_merge_key(struct fy_document *fyd, struct fy_node *fyn, struct fy_node_pair *fynp)
 {
-	struct fy_parser *fyp = NULL;
-	struct fy_document *fyd = NULL;
-	struct fy_eventp *fyep;
-	bool got_stream_end;
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_node *fynv, *fyni, *fynm;
+	struct fy_error_ctx ec;
 	int rc;
 
-	if (!parser_setup)
-		return NULL;
-
-	if (!cfg)
-		cfg = &doc_parse_default_cfg;
+	/* it must be a valid merge key value */
+	FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_DOC,
+			fy_node_pair_is_valid_merge_key(fyd, fynp),
+			err_invalid_merge_key);
 
-	fyp = fy_parser_create(cfg);
-	if (!fyp)
-		return NULL;
-
-	/* no more updating of the document state */
-	fyp->external_document_state = true;
-
-	rc = (*parser_setup)(fyp, user);
-	fy_error_check(fyp, !rc, err_out,
-			"parser_setup() failed");
-
-	fyd = fy_parse_load_document(fyp);
-
-	/* we're going to handle stream errors from now */
-	if (!fyd)
-		fyp->stream_error = false;
-
-	/* if we collect diagnostics, we can continue */
-	fy_error_check(fyp, fyd || (fyp->cfg.flags & FYPCF_COLLECT_DIAG), err_out,
-			"fy_parse_load_document() failed");
-
-	/* no document, but we're collecting diagnostics */
-	if (!fyd) {
-
-		if (!fyp->stream_error)
-			fy_error(fyp, "fy_parse_load_document() failed");
-		else
-			fy_notice(fyp, "fy_parse_load_document() failed");
-
-		fyp->stream_error = false;
-		fyd = fy_parse_document_create(fyp, NULL);
-		fy_error_check(fyp, fyd, err_out,
-				"fy_parse_document_create() failed");
-		fyd->owns_parser = true;
-		fyd->parse_error = true;
-
-		fy_parser_move_log_to_document(fyp, fyd);
+	fynv = fynp->value;
+	fynm = fy_alias_get_merge_mapping(fyd, fynv);
+	if (fynm) {
+		rc = fy_resolve_merge_key_populate(fyd, fyn, fynp, fynm);
+		fy_error_check(fyp, !rc, err_out_rc,
+				"fy_resolve_merge_key_populate() failed");
 
-		return fyd;
+		return 0;
 	}
 
-	/* move ownership of the parser to the document */
-	fyd->owns_parser = true;
+	/* it must be a sequence then */
+	fy_error_check(fyp, fynv->type == FYNT_SEQUENCE, err_out,
+			"invalid node type to use for merge key");
 
-	got_stream_end = false;
-	while (!got_stream_end && (fyep = fy_parse_private(fyp)) != NULL) {
-		if (fyep->e.type == FYET_STREAM_END)
-			got_stream_end = true;
-		fy_parse_eventp_recycle(fyp, fyep);
-	}
+	/* the sequence must only contain valid aliases for mapping */
+	for (fyni = fy_node_list_head(&fynv->sequence); fyni;
+			fyni = fy_node_next(&fynv->sequence, fyni)) {
 
-	if (got_stream_end) {
-		fyep = fy_parse_private(fyp);
-		fy_error_check(fyp, !fyep, err_out,
-				"more events after stream end");
-		fy_parse_eventp_recycle(fyp, fyep);
+		fynm = fy_alias_get_merge_mapping(fyd, fyni);
+		fy_error_check(fyp, fynm, err_out,
+				"invalid merge key sequence item (not an alias)");
+
+		rc = fy_resolve_merge_key_populate(fyd, fyn, fynp, fynm);
+		fy_error_check(fyp, !rc, err_out_rc,
+				"fy_resolve_merge_key_populate() failed");
 	}
 
-	return fyd;
+	return 0;
 
 err_out:
-	fy_document_destroy(fyd);
-	fy_parser_destroy(fyp);
-	return NULL;
+	rc = -1;
+err_out_rc:
+	return rc;
+
+err_invalid_merge_key:
+	ec.start_mark = *fy_node_get_start_mark(fynp->value);
+	ec.end_mark = *fy_node_get_end_mark(fynp->value);
+	ec.fyi = fy_node_get_input(fynp->value);
+	fy_error_report(fyp, &ec, "invalid merge key value");
+	goto err_out;
 }
 
-struct fy_document *fy_document_build_from_string(const struct fy_parse_cfg *cfg,
-						  const char *str, size_t len)
+/* the anchors are scalars that have the FYNS_ALIAS style */
+static int fy_resolve_anchor_node(struct fy_document *fyd, struct fy_node *fyn)
 {
-	struct fy_document_build_string_ctx ctx = {
-		.str = str,
-		.len = len,
-	};
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp, *fynpi, *fynpit;
+	int rc, ret_rc = 0;
+	struct fy_error_ctx ec;
+	struct fy_token *fyt;
+	bool rehash;
 
-	return fy_document_build_internal(cfg, parser_setup_from_string, &ctx);
-}
+	if (!fyn)
+		return 0;
 
-struct fy_document *fy_document_build_from_file(const struct fy_parse_cfg *cfg,
-						const char *file)
-{
-	struct fy_document_build_file_ctx ctx = {
-		.file = file,
-	};
+	if (fy_node_is_alias(fyn))
+		return fy_resolve_alias(fyd, fyn);
 
-	return fy_document_build_internal(cfg, parser_setup_from_file, &ctx);
-}
+	/* copies made before resolving get their aliases resolved too */
+	if (fy_node_lazy_expand(fyn))
+		return -1;
 
-struct fy_document *fy_document_build_from_fp(const struct fy_parse_cfg *cfg,
-					      FILE *fp)
-{
-	struct fy_document_build_fp_ctx ctx = {
-		.name = NULL,
-		.fp = fp,
-	};
+	if (fyn->type == FYNT_SEQUENCE) {
 
-	return fy_document_build_internal(cfg, parser_setup_from_fp, &ctx);
-}
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
 
-enum fy_node_type fy_node_get_type(struct fy_node *fyn)
-{
-	/* a NULL is a plain scalar node */
-	return fyn ? fyn->type : FYNT_SCALAR;
-}
+			rc = fy_resolve_anchor_node(fyd, fyni);
+			if (rc && !ret_rc)
+				ret_rc = rc;
+		}
 
-enum fy_node_style fy_node_get_style(struct fy_node *fyn)
-{
-	/* a NULL is a plain scalar node */
-	return fyn ? fyn->style : FYNS_PLAIN;
-}
+	} else if (fyn->type == FYNT_MAPPING) {
 
-struct fy_node *fy_node_get_parent(struct fy_node *fyn)
-{
-	return fyn ? fyn->parent : NULL;
-}
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
 
-struct fy_token *fy_node_get_tag_token(struct fy_node *fyn)
-{
-	return fyn ? fyn->tag : NULL;
-}
+			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
 
-struct fy_token *fy_node_get_scalar_token(struct fy_node *fyn)
-{
-	return fyn && fyn->type == FYNT_SCALAR ? fyn->scalar : NULL;
-}
+			if (fy_node_pair_is_merge_key(fynp)) {
+				rc = fy_resolve_merge_key(fyd, fyn, fynp);
+				if (rc && !ret_rc)
+					ret_rc = rc;
 
-struct fy_node *fy_node_pair_key(struct fy_node_pair *fynp)
-{
-	return fynp ? fynp->key : NULL;
-}
+				/* remove this node pair */
+				if (!rc && !fy_node_cow_detach_path(fyn)) {
+					fy_node_items_remove(fyn, fynp);
+					fy_node_mapping_index_del(fyn, fynp);
+					fy_node_pair_list_del(&fyn->mapping, fynp);
+					fy_node_pair_free(fynp);
+				}
 
-struct fy_node *fy_node_pair_value(struct fy_node_pair *fynp)
-{
-	return fynp ? fynp->value : NULL;
-}
+			} else {
 
-void fy_node_pair_set_key(struct fy_node_pair *fynp, struct fy_node *fyn)
-{
-	if (!fynp)
-		return;
-	if (fynp->key)
-		fy_node_free(fynp->key);
-	fynp->key = fyn;
-}
+				/* resolving an alias key changes its hash */
+				rehash = fy_node_is_alias(fynp->key) &&
+					 !hlist_unhashed(&fynp->hnode);
+				if (rehash)
+					fy_node_mapping_index_del(fyn, fynp);
 
-void fy_node_pair_set_value(struct fy_node_pair *fynp, struct fy_node *fyn)
-{
-	if (!fynp)
-		return;
-	if (fynp->value)
-		fy_node_free(fynp->value);
-	fynp->value = fyn;
-}
+				rc = fy_resolve_anchor_node(fyd, fynp->key);
 
-struct fy_node *fy_document_root(struct fy_document *fyd)
-{
-	return fyd->root;
-}
+				if (rehash)
+					fy_node_mapping_index_add(fyn, fynp);
 
-const char *fy_node_get_tag(struct fy_node *fyn, size_t *lenp)
-{
-	size_t tmplen;
+				if (!rc) {
 
-	if (!lenp)
-		lenp = &tmplen;
+					/* check whether the keys are duplicate */
+					fynpit = fy_node_mapping_lookup_pair_skip(fyn, fynp->key, fynp);
+					if (fynpit) {
 
-	if (!fyn || !fyn->tag) {
-		*lenp = 0;
-		return NULL;
-	}
+						/* whoops, duplicate key after resolution */
+						fyt = NULL;
+						switch (fyn->type) {
+						case FYNT_SCALAR:
+							fyt = fyn->scalar;
+							break;
+						case FYNT_SEQUENCE:
+							fyt = fyn->sequence_start;
+							break;
+						case FYNT_MAPPING:
+							fyt = fyn->mapping_start;
+							break;
+						}
 
-	return fy_token_get_text(fyn->tag, lenp);
+						FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_DOC,
+								false,
+								err_duplicate_key);
 
-}
+					}
 
-const char *fy_node_get_scalar(struct fy_node *fyn, size_t *lenp)
-{
-	size_t tmplen;
+				}
 
-	if (!lenp)
-		lenp = &tmplen;
+				if (rc && !ret_rc)
+					ret_rc = rc;
 
-	if (!fyn || fyn->type != FYNT_SCALAR) {
-		*lenp = 0;
-		return NULL;
+				rc = fy_resolve_anchor_node(fyd, fynp->value);
+				if (rc && !ret_rc)
+					ret_rc = rc;
+
+			}
+		}
 	}
 
-	return fy_token_get_text(fyn->scalar, lenp);
-}
+	return ret_rc;
 
-const char *fy_node_get_scalar0(struct fy_node *fyn)
-{
-	if (!fyn || fyn->type != FYNT_SCALAR)
-		return NULL;
+err_out:
+	return -1;
 
-	return fy_token_get_text0(fyn->scalar);
+err_duplicate_key:
+	fy_error_report(fyp, &ec, "duplicate key after resolving");
+	goto err_out;
 }
 
-size_t fy_node_get_scalar_length(struct fy_node *fyn)
+static void fy_resolve_parent_node(struct fy_document *fyd, struct fy_node *fyn, struct fy_node *fyn_parent)
 {
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp, *fynpi;
 
-	if (!fyn || fyn->type != FYNT_SCALAR)
-		return 0;
+	if (!fyn)
+		return;
 
-	return fy_token_get_text_length(fyn->scalar);
-}
+	fyn->parent = fyn_parent;
 
-struct fy_node *fy_node_sequence_iterate(struct fy_node *fyn, void **prevp)
-{
-	if (!fyn || fyn->type != FYNT_SEQUENCE || !prevp)
-		return NULL;
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
 
-	return *prevp = *prevp ? fy_node_next(&fyn->sequence, *prevp) : fy_node_list_head(&fyn->sequence);
-}
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
 
-struct fy_node *fy_node_sequence_reverse_iterate(struct fy_node *fyn, void **prevp)
-{
-	if (!fyn || fyn->type != FYNT_SEQUENCE || !prevp)
-		return NULL;
+			fy_resolve_parent_node(fyd, fyni, fyn);
+		}
+		break;
 
-	return *prevp = *prevp ? fy_node_prev(&fyn->sequence, *prevp) : fy_node_list_tail(&fyn->sequence);
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
+
+			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
+
+			/* the parent of the key is always NULL */
+			fy_resolve_parent_node(fyd, fynp->key, NULL);
+			fy_resolve_parent_node(fyd, fynp->value, fyn);
+			fynp->parent = fyn;
+		}
+		break;
+	}
 }
 
-int fy_node_sequence_item_count(struct fy_node *fyn)
+typedef void (*fy_node_applyf)(struct fy_node *fyn);
+
+void fy_node_apply(struct fy_node *fyn, fy_node_applyf func)
 {
 	struct fy_node *fyni;
-	int count;
+	struct fy_node_pair *fynp;
 
-	if (!fyn || fyn->type != FYNT_SEQUENCE)
-		return 0;
+	if (!fyn || !func)
+		return;
 
-	count = 0;
-	for (fyni = fy_node_list_head(&fyn->sequence); fyni; fyni = fy_node_next(&fyn->sequence, fyni))
-		count++;
-	return count;
-}
+	(*func)(fyn);
 
-struct fy_node *fy_node_sequence_get_by_index(struct fy_node *fyn, int index)
-{
-	struct fy_node *fyni;
-	void *iterp = NULL;
+	if (fy_node_lazy_expand(fyn))
+		return;
 
-	if (!fyn || fyn->type != FYNT_SEQUENCE)
-		return NULL;
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
 
-	if (index >= 0) {
-		do {
-			fyni = fy_node_sequence_iterate(fyn, &iterp);
-		} while (fyni && --index >= 0);
-	} else {
-		do {
-			fyni = fy_node_sequence_reverse_iterate(fyn, &iterp);
-		} while (fyni && ++index < 0);
-	}
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni))
+			fy_node_apply(fyni, func);
+		break;
 
-	return fyni;
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+
+			fy_node_apply(fynp->key, func);
+			fy_node_apply(fynp->value, func);
+		}
+		break;
+	}
 }
 
-struct fy_node_pair *fy_node_mapping_iterate(struct fy_node *fyn, void **prevp)
+static void clear_marks(struct fy_node *fyn)
 {
-	if (!fyn || fyn->type != FYNT_MAPPING || !prevp)
-		return NULL;
-
-	return *prevp = *prevp ? fy_node_pair_next(&fyn->mapping, *prevp) : fy_node_pair_list_head(&fyn->mapping);
+	fyn->marks = 0;
 }
 
-struct fy_node_pair *fy_node_mapping_reverse_iterate(struct fy_node *fyn, void **prevp)
+/* clear all the markers */
+void fy_node_clear_marks(struct fy_node *fyn)
 {
-	if (!fyn || fyn->type != FYNT_MAPPING || !prevp)
-		return NULL;
-
-	return *prevp = *prevp ? fy_node_pair_prev(&fyn->mapping, *prevp) : fy_node_pair_list_tail(&fyn->mapping);
+	fy_node_apply(fyn, clear_marks);
 }
 
-int fy_node_mapping_item_count(struct fy_node *fyn)
+int fy_document_resolve(struct fy_document *fyd)
 {
-	struct fy_node_pair *fynpi;
-	int count;
+	int rc;
+	bool ret;
 
-	if (!fyn || fyn->type != FYNT_MAPPING)
+	if (!fyd)
+		return 0;
+
+	/* resolution needs the complete tree */
+	rc = fy_node_lazy_expand_all(fyd->root);
+	if (rc)
+		return rc;
+
+	fy_node_clear_marks(fyd->root);
+
+	/* for resolution to work, no reference loops should exist */
+	ret = fy_check_ref_loop(fyd, fyd->root,
+			FYNWF_MAXDEPTH_DEFAULT | FYNWF_FOLLOW, NULL);
+
+	fy_node_clear_marks(fyd->root);
+
+	if (ret)
 		return -1;
 
-	count = 0;
-	for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi; fynpi = fy_node_pair_next(&fyn->mapping, fynpi))
-		count++;
-	return count;
+	/* now resolve any anchor nodes */
+	rc = fy_resolve_anchor_node(fyd, fyd->root);
+
+	/* redo parent resolution */
+	fy_resolve_parent_node(fyd, fyd->root, NULL);
+
+	return rc;
 }
 
-struct fy_node_pair *fy_node_mapping_get_by_index(struct fy_node *fyn, int index)
+void fy_document_free_nodes(struct fy_document *fyd)
 {
-	struct fy_node_pair *fynpi;
-	void *iterp = NULL;
-
-	if (!fyn || fyn->type != FYNT_MAPPING)
-		return NULL;
+	struct fy_document *fyd_child;
+	struct fy_anchor *fya;
 
-	if (index >= 0) {
-		do {
-			fynpi = fy_node_mapping_iterate(fyn, &iterp);
-		} while (fynpi && --index >= 0);
-	} else {
-		do {
-			fynpi = fy_node_mapping_reverse_iterate(fyn, &iterp);
-		} while (fynpi && ++index < 0);
+	for (fyd_child = fy_document_list_first(&fyd->children); fyd_child; fyd_child = fy_document_next(&fyd->children, fyd_child)) {
+		fy_document_free_nodes(fyd_child);
 	}
 
-	return fynpi;
+	/* drop the anchors first, so that freeing each node doesn't scan them */
+	while ((fya = fy_anchor_list_pop(&fyd->anchors)) != NULL)
+		fy_anchor_destroy(fyd, fya);
+	fy_document_anchor_index_free(fyd);
+
+	fy_node_free(fyd->root);
+	fyd->root = NULL;
 }
 
-static struct fy_node *
-fy_node_mapping_lookup_value_by_simple_key(struct fy_node *fyn,
-					   const char *key, size_t len)
+void fy_document_destroy(struct fy_document *fyd)
 {
-	struct fy_node_pair *fynpi;
-
-	if (!fyn || fyn->type != FYNT_MAPPING || !key)
-		return NULL;
+	struct fy_document *fyd_child;
+	struct fy_parser *fyp;
+	bool owns_parser;
 
-	if (len == (size_t)-1)
-		len = strlen(key);
+	/* both the document and the parser object must exist */
+	if (!fyd || !fyd->fyp)
+		return;
 
-	if (!is_simple_key(key, len))
-		return NULL;
+	/* we have to free the nodes first */
+	fy_document_free_nodes(fyd);
 
-	for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
-		fynpi = fy_node_pair_next(&fyn->mapping, fynpi)) {
+	/* recursively delete children */
+	while ((fyd_child = fy_document_list_pop(&fyd->children)) != NULL) {
+		fyd_child->parent = NULL;
+		fy_document_destroy(fyd_child);
+	}
 
-		if (!fy_node_is_scalar(fynpi->key) || fy_node_is_alias(fynpi->key))
-			continue;
+	fyp = fyd->fyp;
+	owns_parser = fyd->owns_parser;
 
-		if (!fy_token_memcmp(fynpi->key->scalar, key, len))
-			return fynpi->value;
-	}
+	fy_parse_document_destroy(fyp, fyd);
 
-	return NULL;
+	if (owns_parser)
+		fy_parser_destroy(fyp);
 }
 
-struct fy_node *fy_node_mapping_lookup_value_by_key(struct fy_node *fyn, struct fy_node *fyn_key)
+int fy_document_set_parent(struct fy_document *fyd, struct fy_document *fyd_child)
 {
-	struct fy_node_pair *fynpi;
-
-	if (!fyn || fyn->type != FYNT_MAPPING)
-		return NULL;
 
-	for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
-		fynpi = fy_node_pair_next(&fyn->mapping, fynpi)) {
+	if (!fyd || !fyd_child || fyd_child->parent)
+		return -1;
 
-		if (fy_node_compare(fynpi->key, fyn_key))
-			return fynpi->value;
-	}
+	fyd_child->parent = fyd;
+	fy_document_list_add_tail(&fyd->children, fyd_child);
 
-	return NULL;
+	return 0;
 }
 
-struct fy_node *
-fy_node_mapping_lookup_by_string(struct fy_node *fyn,
-				 const char *key, size_t len)
+const struct fy_parse_cfg doc_parse_default_cfg = {
+	.search_path = "",
+	.flags = FYPCF_QUIET | FYPCF_DEBUG_LEVEL_WARNING |
+		 FYPCF_DEBUG_DIAG_TYPE | FYPCF_COLOR_NONE,
+};
+
+struct fy_document *fy_document_create(const struct fy_parse_cfg *cfg)
 {
-	struct fy_document *fyd;
-	struct fy_node *fyn_value;
+	struct fy_parser *fyp = NULL;
+	struct fy_document *fyd = NULL;
 
-	/* try quick and dirty simple scan */
-	fyn_value = fy_node_mapping_lookup_value_by_simple_key(fyn, key, len);
-	if (fyn_value)
-		return fyn_value;
+	if (!cfg)
+		cfg = &doc_parse_default_cfg;
 
-	fyd = fy_document_build_from_string(NULL, key, len);
-	if (!fyd)
+	fyp = fy_parser_create(cfg);
+	if (!fyp)
 		return NULL;
 
-	fyn_value = fy_node_mapping_lookup_value_by_key(fyn, fy_document_root(fyd));
+	fyd = fy_parse_alloc(fyp, sizeof(*fyd));
+	fy_error_check(fyp, fyd, err_out,
+		"fy_parse_alloc() failed");
+	memset(fyd, 0, sizeof(*fyd));
 
-	fy_document_destroy(fyd);
+	fyd->fyp = fyp;
+	fy_talloc_list_init(&fyd->tallocs);
 
-	return fyn_value;
-}
+	fyd->use_arena = !!(cfg->flags & FYPCF_DOCUMENT_ARENA);
+	if (fyd->use_arena)
+		fy_arena_init(&fyd->arena, 0);
 
-#define fy_node_walk_ctx_create_a(_max_depth, _mark) \
-	({ \
-		unsigned int __max_depth = (_max_depth); \
-		struct fy_node_walk_ctx *_ctx; \
-		\
-		_ctx = alloca(sizeof(*_ctx) + sizeof(struct fy_node *) * __max_depth); \
-		_ctx->max_depth = _max_depth; \
-		_ctx->next_slot = 0; \
-		_ctx->mark = (_mark); \
-		_ctx; \
-	})
+	fyd->intern = fy_intern_ref(cfg->intern);
 
-static inline void fy_node_walk_mark_start(struct fy_node_walk_ctx *ctx)
-{
-	ctx->next_slot = 0;
-}
+	fy_anchor_list_init(&fyd->anchors);
+	fyd->root = NULL;
 
-static inline void fy_node_walk_mark_end(struct fy_node_walk_ctx *ctx)
-{
-	struct fy_node *fyn;
+	fyd->fyds = fy_document_state_ref(fyp->current_document_state);
+	fy_error_check(fyp, fyd->fyds, err_out,
+			"fy_document_state_ref() failed");
+	fyp->external_document_state = true;	/* parser will not update state */
 
-	while (ctx->next_slot > 0) {
-		fyn = ctx->marked[--ctx->next_slot];
-		fyn->marks &= ~ctx->mark;
-	}
+	fyd->owns_parser = true;
+
+	fyd->errfp = NULL;
+	fyd->errbuf = NULL;
+	fyd->errsz = 0;
+
+	fy_document_list_init(&fyd->children);
+
+	return fyd;
+
+err_out:
+	fy_parse_document_destroy(fyp, fyd);
+	fy_parser_destroy(fyp);
+	return NULL;
 }
 
-/* fyn is guaranteed to be non NULL and an alias */
-static inline bool fy_node_walk_mark(struct fy_node_walk_ctx *ctx, struct fy_node *fyn)
+struct fy_document_build_string_ctx {
+	const char *str;
+	size_t len;
+};
+
+static int parser_setup_from_string(struct fy_parser *fyp, void *user)
 {
-	struct fy_document *fyd = fyn->fyd;
-	struct fy_parser *fyp = fyd->fyp;
-	struct fy_error_ctx ec;
-	struct fy_token *fyt = NULL;
+	struct fy_document_build_string_ctx *ctx = user;
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		fyt = fyn->scalar;
-		break;
-	case FYNT_SEQUENCE:
-		fyt = fyn->sequence_start;
-		break;
-	case FYNT_MAPPING:
-		fyt = fyn->mapping_start;
-		break;
-	}
+	return fy_parser_set_string(fyp, ctx->str, ctx->len);
+}
 
-	/* depth error */
-	FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_DOC,
-		ctx->next_slot < ctx->max_depth,
-		err_too_deep);
+struct fy_document_build_file_ctx {
+	const char *file;
+};
 
-	/* mark found, loop */
-	FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_DOC,
-		!(fyn->marks & ctx->mark),
-		err_cycle_detected);
+static int parser_setup_from_file(struct fy_parser *fyp, void *user)
+{
+	struct fy_document_build_file_ctx *ctx = user;
 
-	fyn->marks |= ctx->mark;
-	ctx->marked[ctx->next_slot++] = fyn;
+	return fy_parser_set_input_file(fyp, ctx->file);
+}
 
-	return true;
+struct fy_document_build_fp_ctx {
+	const char *name;
+	FILE *fp;
+};
 
-err_too_deep:
-	fy_error_report(fyp, &ec, "max recursion depth exceeded (%u)", ctx->max_depth);
-	return false;
+static int parser_setup_from_fp(struct fy_parser *fyp, void *user)
+{
+	struct fy_document_build_fp_ctx *ctx = user;
 
-err_cycle_detected:
-	fy_error_report(fyp, &ec, "cyclic reference detected");
-	return false;
+	return fy_parser_set_input_fp(fyp, ctx->name, ctx->fp);
 }
 
-static struct fy_node *
-fy_node_follow_aliases(struct fy_node *fyn, enum fy_node_walk_flags flags)
+struct fy_document_vbuildf_ctx {
+	const char *fmt;
+	va_list ap;
+};
+
+static int parser_setup_from_fmt_ap(struct fy_parser *fyp, void *user)
 {
-	struct fy_node_walk_ctx *ctx;
-	unsigned int marker;
+	struct fy_document_vbuildf_ctx *vctx = user;
+	va_list ap, ap_orig;
+	int size, sizew;
+	char *buf;
 
-	if (!fyn || !fy_node_is_alias(fyn) || !(flags & FYNWF_FOLLOW))
-		return fyn;
+	/* first try without allocating */
+	va_copy(ap_orig, vctx->ap);
+	size = vsnprintf(NULL, 0, vctx->fmt, ap_orig);
+	va_end(ap_orig);
 
-	marker = fy_node_walk_marker_from_flags(flags);
-	if (marker >= 30)	/* maximum marker */
-		return fyn;
+	fy_error_check(fyp, size >= 0, err_out,
+			"vsnprintf() failed");
 
-	ctx = fy_node_walk_ctx_create_a(fy_node_walk_max_depth_from_flags(flags), FY_BIT(marker));
+	/* the buffer will stick around until the parser is destroyed */
+	buf = fy_parser_alloc(fyp, size + 1);
+	fy_error_check(fyp, buf, err_out,
+			"fy_parser_alloc() failed");
 
-	fy_node_walk_mark_start(ctx);
-	while (fyn && fy_node_is_alias(fyn)) {
+	va_copy(ap, vctx->ap);
+	sizew = vsnprintf(buf, size + 1, vctx->fmt, ap);
+	fy_error_check(fyp, sizew == size, err_out,
+			"vsnprintf() failed");
+	va_end(ap);
 
-		if (!fy_node_walk_mark(ctx, fyn)) {
-			fyn = NULL;
-			break;
-		}
+	buf[size] = '\0';
 
-		fyn = fy_node_follow_alias(fyn, flags);
-	}
-	fy_node_walk_mark_end(ctx);
+	return fy_parser_set_string(fyp, buf, size);
 
-	return fyn;
+err_out:
+	return -1;
 }
 
-struct fy_node *fy_node_resolve_alias(struct fy_node *fyn)
+/* load a single document; the parser is not owned by the document */
+static struct fy_document *fy_document_build_parse(struct fy_parser *fyp,
+		int (*parser_setup)(struct fy_parser *fyp, void *user),
+		void *user)
 {
-	return fy_node_follow_aliases(fyn,
-			FYNWF_FOLLOW | FYNWF_MAXDEPTH_DEFAULT |
-			FYNWF_MARKER_DEFAULT);
-}
+	struct fy_document *fyd = NULL;
+	struct fy_eventp *fyep;
+	bool got_stream_end;
+	int rc;
 
-static struct fy_node *
-fy_node_by_path_internal(struct fy_node *fyn,
-			 const char *path, size_t pathlen,
-		         enum fy_node_walk_flags flags)
-{
-	struct fy_node *fynt, *fyni;
-	const char *s, *e;
-	char *end_idx;
-	char c;
-	int idx;
-	size_t len;
+	/* no more updating of the document state */
+	fyp->external_document_state = true;
 
-	if (!fyn || !path)
-		return NULL;
+	rc = (*parser_setup)(fyp, user);
+	fy_error_check(fyp, !rc, err_out,
+			"parser_setup() failed");
 
-	s = path;
-	if (pathlen == (size_t)-1)
-		pathlen = strlen(path);
-	e = s + pathlen;
+	fyd = fy_parse_load_document(fyp);
 
-	/* and continue on path lookup with the rest */
+	/* we're going to handle stream errors from now */
+	if (!fyd)
+		fyp->stream_error = false;
 
-	/* fy_notice(NULL, "%s: path='%.*s'", __func__, (int)pathlen, path); */
+	/* if we collect diagnostics, we can continue */
+	fy_error_check(fyp, fyd || (fyp->cfg.flags & FYPCF_COLLECT_DIAG), err_out,
+			"fy_parse_load_document() failed");
 
-	/* skip all prefixed / */
-	while (s < e && *s == '/')
-		s++;
+	/* no document, but we're collecting diagnostics */
+	if (!fyd) {
 
-	/* for a last component / always match this one */
-	if (s >= e)
-		goto out;
+		if (!fyp->stream_error)
+			fy_error(fyp, "fy_parse_load_document() failed");
+		else
+			fy_notice(fyp, "fy_parse_load_document() failed");
 
-	fyn = fy_node_follow_aliases(fyn, flags);
+		fyp->stream_error = false;
+		fyd = fy_parse_document_create(fyp, NULL);
+		fy_error_check(fyp, fyd, err_out,
+				"fy_parse_document_create() failed");
+		fyd->parse_error = true;
 
-	/* scalar can't match (it has no key) */
-	if (fy_node_is_scalar(fyn)) {
-		fyn = NULL;
-		goto out;
+		fy_parser_move_log_to_document(fyp, fyd);
+
+		return fyd;
 	}
 
-	/* for a sequence the only allowed key is [n] where n is the index to follow */
-	if (fy_node_is_sequence(fyn)) {
+	got_stream_end = false;
+	while (!got_stream_end && (fyep = fy_parse_private(fyp)) != NULL) {
+		if (fyep->e.type == FYET_STREAM_END)
+			got_stream_end = true;
+		fy_parse_eventp_recycle(fyp, fyep);
+	}
 
-		while (s < e && isspace(*s))
-			s++;
+	if (got_stream_end) {
+		fyep = fy_parse_private(fyp);
+		fy_error_check(fyp, !fyep, err_out,
+				"more events after stream end");
+		fy_parse_eventp_recycle(fyp, fyep);
+	}
 
-		c = *s;
-		if (c == '[')
-			s++;
-		else if (!isdigit(c) && c != '-')
-			return NULL;
+	return fyd;
 
-		idx = (int)strtol(s, &end_idx, 10);
-		s = end_idx;
-		while (s < e && isspace(*s))
-			s++;
+err_out:
+	fy_document_destroy(fyd);
+	return NULL;
+}
 
-		if (c == '[' && *s++ != ']')
-			return NULL;
+static struct fy_document *fy_document_build_internal(const struct fy_parse_cfg *cfg,
+		int (*parser_setup)(struct fy_parser *fyp, void *user),
+		void *user)
+{
+	struct fy_parser *fyp = NULL;
+	struct fy_document *fyd = NULL;
 
-		while (s < e && isspace(*s))
-			s++;
+	if (!parser_setup)
+		return NULL;
 
-		/* fy_notice(NULL, "%s: seq: idx=%d", __func__, idx); */
+	if (!cfg)
+		cfg = &doc_parse_default_cfg;
 
-		len = e - s;
+	fyp = fy_parser_create(cfg);
+	if (!fyp)
+		return NULL;
 
-		fyn = fy_node_sequence_get_by_index(fyn, idx);
-		fyn = fy_node_follow_aliases(fyn, flags);
-		fyn = fy_node_by_path_internal(fyn, s, len, flags);
-		goto out;
+	fyd = fy_document_build_parse(fyp, parser_setup, user);
+	if (!fyd) {
+		fy_parser_destroy(fyp);
+		return NULL;
 	}
 
-	/* be a little bit paranoid */
+	/* move ownership of the parser to the document */
+	fyd->owns_parser = true;
+
+	return fyd;
+}
+
+struct fy_document *fy_document_build_from_string(const struct fy_parse_cfg *cfg,
+						  const char *str, size_t len)
+{
+	struct fy_document_build_string_ctx ctx = {
+		.str = str,
+		.len = len,
+	};
+
+	return fy_document_build_internal(cfg, parser_setup_from_string, &ctx);
+}
+
+struct fy_document *fy_document_build_from_string_with_parser(struct fy_parser *fyp,
+							      const char *str, size_t len)
+{
+	struct fy_document_build_string_ctx ctx = {
+		.str = str,
+		.len = len,
+	};
+	struct fy_document *fyd;
+	bool external_document_state;
+
+	if (!fyp || fy_parser_reset(fyp))
+		return NULL;
+
+	/* the parser is the caller's, leave it as it was found */
+	external_document_state = fyp->external_document_state;
+	fyd = fy_document_build_parse(fyp, parser_setup_from_string, &ctx);
+	fyp->external_document_state = external_document_state;
+
+	return fyd;
+}
+
+struct fy_document *fy_document_build_from_file(const struct fy_parse_cfg *cfg,
+						const char *file)
+{
+	struct fy_document_build_file_ctx ctx = {
+		.file = file,
+	};
+
+	return fy_document_build_internal(cfg, parser_setup_from_file, &ctx);
+}
+
+struct fy_document *fy_document_build_from_fp(const struct fy_parse_cfg *cfg,
+					      FILE *fp)
+{
+	struct fy_document_build_fp_ctx ctx = {
+		.name = NULL,
+		.fp = fp,
+	};
+
+	return fy_document_build_internal(cfg, parser_setup_from_fp, &ctx);
+}
+
+enum fy_node_type fy_node_get_type(struct fy_node *fyn)
+{
+	/* a NULL is a plain scalar node */
+	return fyn ? fyn->type : FYNT_SCALAR;
+}
+
+enum fy_node_style fy_node_get_style(struct fy_node *fyn)
+{
+	/* a NULL is a plain scalar node */
+	return fyn ? fyn->style : FYNS_PLAIN;
+}
+
+struct fy_node *fy_node_get_parent(struct fy_node *fyn)
+{
+	return fyn ? fyn->parent : NULL;
+}
+
+struct fy_token *fy_node_get_tag_token(struct fy_node *fyn)
+{
+	return fyn ? fyn->tag : NULL;
+}
+
+struct fy_token *fy_node_get_scalar_token(struct fy_node *fyn)
+{
+	return fyn && fyn->type == FYNT_SCALAR ? fyn->scalar : NULL;
+}
+
+struct fy_node *fy_node_pair_key(struct fy_node_pair *fynp)
+{
+	return fynp ? fynp->key : NULL;
+}
+
+struct fy_node *fy_node_pair_value(struct fy_node_pair *fynp)
+{
+	return fynp ? fynp->value : NULL;
+}
+
+void fy_node_pair_set_key(struct fy_node_pair *fynp, struct fy_node *fyn)
+{
+	struct fy_node *fyn_map;
+	bool rehash;
+
+	if (!fynp)
+		return;
+
+	fyn_map = fynp->parent;
+	fy_node_cow_detach_path(fyn_map);
+	rehash = fyn_map && fyn_map->mapping_index;
+	if (rehash)
+		fy_node_mapping_index_del(fyn_map, fynp);
+
+	if (fynp->key)
+		fy_node_free(fynp->key);
+	fynp->key = fyn;
+	/* the parent of the key is always NULL */
+	if (fyn)
+		fyn->parent = NULL;
+	fy_node_hash_invalidate(fyn_map);
+
+	if (rehash)
+		fy_node_mapping_index_add(fyn_map, fynp);
+}
+
+void fy_node_pair_set_value(struct fy_node_pair *fynp, struct fy_node *fyn)
+{
+	if (!fynp)
+		return;
+	fy_node_cow_detach_path(fynp->parent);
+	if (fynp->value)
+		fy_node_free(fynp->value);
+	fynp->value = fyn;
+	if (fyn)
+		fyn->parent = fynp->parent;
+	fy_node_hash_invalidate(fynp->parent);
+}
+
+struct fy_node *fy_document_root(struct fy_document *fyd)
+{
+	return fyd->root;
+}
+
+const char *fy_node_get_tag(struct fy_node *fyn, size_t *lenp)
+{
+	size_t tmplen;
+
+	if (!lenp)
+		lenp = &tmplen;
+
+	if (!fyn || !fyn->tag) {
+		*lenp = 0;
+		return NULL;
+	}
+
+	return fy_token_get_text(fyn->tag, lenp);
+
+}
+
+const char *fy_node_get_scalar(struct fy_node *fyn, size_t *lenp)
+{
+	size_t tmplen;
+
+	if (!lenp)
+		lenp = &tmplen;
+
+	if (!fyn || fyn->type != FYNT_SCALAR) {
+		*lenp = 0;
+		return NULL;
+	}
+
+	return fy_token_get_text(fyn->scalar, lenp);
+}
+
+const char *fy_node_get_scalar0(struct fy_node *fyn)
+{
+	if (!fyn || fyn->type != FYNT_SCALAR)
+		return NULL;
+
+	return fy_token_get_text0(fyn->scalar);
+}
+
+size_t fy_node_get_scalar_length(struct fy_node *fyn)
+{
+
+	if (!fyn || fyn->type != FYNT_SCALAR)
+		return 0;
+
+	return fy_token_get_text_length(fyn->scalar);
+}
+
+/*
+ * The core schema type of a scalar node. Plain scalars resolve by their
+ * text, any other style is a string. The core schema tags force their
+ * type, as long as the text matches it; every other tag is a string.
+ * A !!float integer is a float whose value is still in the token's ival.
+ * The accessors below rely on a resolved number or boolean having a token.
+ */
+static enum fy_token_scalar_type fy_node_scalar_type(struct fy_node *fyn)
+{
+	static const char core_prefix[] = "tag:yaml.org,2002:";
+	static const struct {
+		const char *name;
+		enum fy_token_scalar_type type;
+	} core_tags[] = {
+		{ "null",	FYTST_NULL },
+		{ "bool",	FYTST_BOOL },
+		{ "int",	FYTST_INT },
+		{ "float",	FYTST_FLOAT },
+	};
+	enum fy_token_scalar_type type;
+	const char *tag;
+	size_t len, plen = sizeof(core_prefix) - 1;
+	unsigned int i;
+
+	if (!fyn || fyn->type != FYNT_SCALAR)
+		return FYTST_UNRESOLVED;
+
+	/* no token at all is empty */
+	if (!fyn->scalar)
+		type = FYTST_NULL;
+	else if (fyn->scalar->scalar.style == FYSS_ANY ||
+		 fyn->scalar->scalar.style == FYSS_PLAIN)
+		type = fy_token_scalar_resolve(fyn->scalar);
+	else
+		type = FYTST_STR;
+
+	if (!fyn->tag)
+		return type;
+
+	tag = fy_token_get_text(fyn->tag, &len);
+	if (!tag || len <= plen || memcmp(tag, core_prefix, plen))
+		return FYTST_STR;
+
+	for (i = 0; i < sizeof(core_tags)/sizeof(core_tags[0]); i++) {
+		if (len - plen == strlen(core_tags[i].name) &&
+		    !memcmp(tag + plen, core_tags[i].name, len - plen))
+			break;
+	}
+	if (i >= sizeof(core_tags)/sizeof(core_tags[0]))
+		return FYTST_STR;
+
+	if (fyn->scalar)
+		type = fy_token_scalar_resolve(fyn->scalar);
+	if (type == core_tags[i].type)
+		return type;
+
+	/* an integer is a fine float */
+	if (core_tags[i].type == FYTST_FLOAT && type == FYTST_INT)
+		return FYTST_FLOAT;
+
+	return FYTST_STR;
+}
+
+int fy_node_get_int64(struct fy_node *fyn, int64_t *valp)
+{
+	if (!valp || fy_node_scalar_type(fyn) != FYTST_INT)
+		return -1;
+
+	*valp = fyn->scalar->scalar.ival;
+	return 0;
+}
+
+int fy_node_get_double(struct fy_node *fyn, double *valp)
+{
+	if (!valp)
+		return -1;
+
+	switch (fy_node_scalar_type(fyn)) {
+	case FYTST_FLOAT:
+		/* the text may still be an integer, when tagged !!float */
+		if (fyn->scalar->scalar.type == FYTST_INT)
+			*valp = (double)fyn->scalar->scalar.ival;
+		else
+			*valp = fyn->scalar->scalar.dval;
+		return 0;
+	case FYTST_INT:
+		*valp = (double)fyn->scalar->scalar.ival;
+		return 0;
+	default:
+		break;
+	}
+
+	return -1;
+}
+
+int fy_node_get_bool(struct fy_node *fyn, bool *valp)
+{
+	if (!valp || fy_node_scalar_type(fyn) != FYTST_BOOL)
+		return -1;
+
+	*valp = fyn->scalar->scalar.bval;
+	return 0;
+}
+
+bool fy_node_is_null(struct fy_node *fyn)
+{
+	return fy_node_scalar_type(fyn) == FYTST_NULL;
+}
+
+struct fy_node *fy_node_sequence_iterate(struct fy_node *fyn, void **prevp)
+{
+	if (!fyn || fyn->type != FYNT_SEQUENCE || !prevp || fy_node_lazy_expand(fyn))
+		return NULL;
+
+	return *prevp = *prevp ? fy_node_next(&fyn->sequence, *prevp) : fy_node_list_head(&fyn->sequence);
+}
+
+struct fy_node *fy_node_sequence_reverse_iterate(struct fy_node *fyn, void **prevp)
+{
+	if (!fyn || fyn->type != FYNT_SEQUENCE || !prevp || fy_node_lazy_expand(fyn))
+		return NULL;
+
+	return *prevp = *prevp ? fy_node_prev(&fyn->sequence, *prevp) : fy_node_list_tail(&fyn->sequence);
+}
+
+int fy_node_sequence_item_count(struct fy_node *fyn)
+{
+	struct fy_node *fyni;
+	int count;
+
+	if (!fyn || fyn->type != FYNT_SEQUENCE)
+		return 0;
+
+	if (!fy_node_items_update(fyn))
+		return fyn->items_count;
+
+	count = 0;
+	for (fyni = fy_node_list_head(&fyn->sequence); fyni; fyni = fy_node_next(&fyn->sequence, fyni))
+		count++;
+	return count;
+}
+
+struct fy_node *fy_node_sequence_get_by_index(struct fy_node *fyn, int index)
+{
+	struct fy_node *fyni;
+	void *iterp = NULL;
+
+	if (!fyn || fyn->type != FYNT_SEQUENCE)
+		return NULL;
+
+	if (!fy_node_items_update(fyn)) {
+		if (index < 0)
+			index += fyn->items_count;
+		if (index < 0 || index >= fyn->items_count)
+			return NULL;
+		return fyn->items[index];
+	}
+
+	if (index >= 0) {
+		do {
+			fyni = fy_node_sequence_iterate(fyn, &iterp);
+		} while (fyni && --index >= 0);
+	} else {
+		do {
+			fyni = fy_node_sequence_reverse_iterate(fyn, &iterp);
+		} while (fyni && ++index < 0);
+	}
+
+	return fyni;
+}
+
+struct fy_node_pair *fy_node_mapping_iterate(struct fy_node *fyn, void **prevp)
+{
+	if (!fyn || fyn->type != FYNT_MAPPING || !prevp || fy_node_lazy_expand(fyn))
+		return NULL;
+
+	return *prevp = *prevp ? fy_node_pair_next(&fyn->mapping, *prevp) : fy_node_pair_list_head(&fyn->mapping);
+}
+
+struct fy_node_pair *fy_node_mapping_reverse_iterate(struct fy_node *fyn, void **prevp)
+{
+	if (!fyn || fyn->type != FYNT_MAPPING || !prevp || fy_node_lazy_expand(fyn))
+		return NULL;
+
+	return *prevp = *prevp ? fy_node_pair_prev(&fyn->mapping, *prevp) : fy_node_pair_list_tail(&fyn->mapping);
+}
+
+int fy_node_mapping_item_count(struct fy_node *fyn)
+{
+	struct fy_node_pair *fynpi;
+	int count;
+
+	if (!fyn || fyn->type != FYNT_MAPPING)
+		return -1;
+
+	if (!fy_node_items_update(fyn))
+		return fyn->items_count;
+
+	count = 0;
+	for (fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi; fynpi = fy_node_pair_next(&fyn->mapping, fynpi))
+		count++;
+	return count;
+}
+
+struct fy_node_pair *fy_node_mapping_get_by_index(struct fy_node *fyn, int index)
+{
+	struct fy_node_pair *fynpi;
+	void *iterp = NULL;
+
+	if (!fyn || fyn->type != FYNT_MAPPING)
+		return NULL;
+
+	if (!fy_node_items_update(fyn)) {
+		if (index < 0)
+			index += fyn->items_count;
+		if (index < 0 || index >= fyn->items_count)
+			return NULL;
+		return fyn->items[index];
+	}
+
+	if (index >= 0) {
+		do {
+			fynpi = fy_node_mapping_iterate(fyn, &iterp);
+		} while (fynpi && --index >= 0);
+	} else {
+		do {
+			fynpi = fy_node_mapping_reverse_iterate(fyn, &iterp);
+		} while (fynpi && ++index < 0);
+	}
+
+	return fynpi;
+}
+
+/* key is known to be simple; hashp is the precomputed hash of the key or NULL */
+static struct fy_node *
+fy_node_mapping_lookup_value_by_simple_key_hash(struct fy_node *fyn,
+						const char *key, size_t len,
+						const uint32_t *hashp)
+{
+	struct fy_node_mapping_index *fynmi;
+	struct fy_node_pair *fynpi;
+	struct hlist_node *pos;
+	struct fy_intern *fyin;
+	const struct fy_intern_str *fyis;
+	uint32_t hash;
+	int count;
+
+	if (!fyn || fyn->type != FYNT_MAPPING || fy_node_lazy_expand(fyn))
+		return NULL;
+
+	/*
+	 * With an intern table the keys are mostly compared by pointer.
+	 * Not on frozen documents; the table may be growing under the
+	 * feet of the readers.
+	 */
+	fyin = !fyn->fyd->frozen ? fyn->fyd->intern : NULL;
+	fyis = NULL;
+	if (fyin || fyn->mapping_index) {
+		hash = hashp ? *hashp : fy_hash_data(key, len);
+		fyis = fy_intern_lookup(fyin, key, len, hash);
+	}
+
+	fynmi = fyn->mapping_index;
+	if (fynmi) {
+		hlist_for_each_entry(fynpi, pos, &fynmi->buckets[hash & fynmi->mask], hnode) {
+			if (fynpi->hash != hash ||
+			    !fy_node_is_scalar(fynpi->key) || fy_node_is_alias(fynpi->key))
+				continue;
+
+			if (fy_node_key_text_match(fynpi->key->scalar, fyin, fyis, key, len))
+				return fynpi->value;
+		}
+		return NULL;
+	}
+
+	for (count = 0, fynpi = fy_node_pair_list_head(&fyn->mapping); fynpi;
+		fynpi = fy_node_pair_next(&fyn->mapping, fynpi), count++) {
+
+		if (!fy_node_is_scalar(fynpi->key) || fy_node_is_alias(fynpi->key))
+			continue;
+
+		if (fy_node_key_text_match(fynpi->key->scalar, fyin, fyis, key, len))
+			return fynpi->value;
+	}
+
+	if (count >= FY_NODE_MAPPING_INDEX_MIN)
+		fy_node_mapping_index_build(fyn);
+
+	return NULL;
+}
+
+static struct fy_node *
+fy_node_mapping_lookup_value_by_simple_key(struct fy_node *fyn,
+					   const char *key, size_t len)
+{
+	if (!fyn || fyn->type != FYNT_MAPPING || !key)
+		return NULL;
+
+	if (len == (size_t)-1)
+		len = strlen(key);
+
+	if (!is_simple_key(key, len))
+		return NULL;
+
+	return fy_node_mapping_lookup_value_by_simple_key_hash(fyn, key, len, NULL);
+}
+
+struct fy_node *fy_node_mapping_lookup_value_by_key(struct fy_node *fyn, struct fy_node *fyn_key)
+{
+	struct fy_node_pair *fynpi;
+
+	if (!fyn || fyn->type != FYNT_MAPPING)
+		return NULL;
+
+	fynpi = fy_node_mapping_lookup_pair(fyn, fyn_key);
+
+	return fynpi ? fynpi->value : NULL;
+}
+
+struct fy_node *
+fy_node_mapping_lookup_by_string(struct fy_node *fyn,
+				 const char *key, size_t len)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn_value;
+
+	/* try quick and dirty simple scan */
+	fyn_value = fy_node_mapping_lookup_value_by_simple_key(fyn, key, len);
+	if (fyn_value)
+		return fyn_value;
+
+	fyd = fy_document_build_from_string(NULL, key, len);
+	if (!fyd)
+		return NULL;
+
+	fyn_value = fy_node_mapping_lookup_value_by_key(fyn, fy_document_root(fyd));
+
+	fy_document_destroy(fyd);
+
+	return fyn_value;
+}
+
+#define fy_node_walk_ctx_create_a(_max_depth, _mark) \
+	({ \
+		unsigned int __max_depth = (_max_depth); \
+		struct fy_node_walk_ctx *_ctx; \
+		\
+		_ctx = alloca(sizeof(*_ctx) + sizeof(struct fy_node *) * __max_depth); \
+		_ctx->max_depth = _max_depth; \
+		_ctx->next_slot = 0; \
+		_ctx->mark = (_mark); \
+		_ctx; \
+	})
+
+static inline void fy_node_walk_mark_start(struct fy_node_walk_ctx *ctx)
+{
+	ctx->next_slot = 0;
+}
+
+static inline void fy_node_walk_mark_end(struct fy_node_walk_ctx *ctx)
+{
+	struct fy_node *fyn;
+
+	while (ctx->next_slot > 0) {
+		fyn = ctx->marked[--ctx->next_slot];
+		if (!fyn->fyd->frozen)
+			fyn->marks &= ~ctx->mark;
+	}
+}
+
+/* frozen documents are shared by readers; look for the loop on the trail */
+static bool fy_node_walk_mark_frozen(struct fy_node_walk_ctx *ctx, struct fy_node *fyn)
+{
+	unsigned int i;
+
+	/* no diagnostics either, they would go through the parser */
+	if (ctx->next_slot >= ctx->max_depth)
+		return false;
+
+	for (i = 0; i < ctx->next_slot; i++) {
+		if (ctx->marked[i] == fyn)
+			return false;
+	}
+
+	ctx->marked[ctx->next_slot++] = fyn;
+
+	return true;
+}
+
+/* fyn is guaranteed to be non NULL and an alias */
+static inline bool fy_node_walk_mark(struct fy_node_walk_ctx *ctx, struct fy_node *fyn)
+{
+	struct fy_document *fyd = fyn->fyd;
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_error_ctx ec;
+	struct fy_token *fyt = NULL;
+
+	if (fyd->frozen)
+		return fy_node_walk_mark_frozen(ctx, fyn);
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		fyt = fyn->scalar;
+		break;
+	case FYNT_SEQUENCE:
+		fyt = fyn->sequence_start;
+		break;
+	case FYNT_MAPPING:
+		fyt = fyn->mapping_start;
+		break;
+	}
+
+	/* depth error */
+	FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_DOC,
+		ctx->next_slot < ctx->max_depth,
+		err_too_deep);
+
+	/* mark found, loop */
+	FY_ERROR_CHECK(fyp, fyt, &ec, FYEM_DOC,
+		!(fyn->marks & ctx->mark),
+		err_cycle_detected);
+
+	fyn->marks |= ctx->mark;
+	ctx->marked[ctx->next_slot++] = fyn;
+
+	return true;
+
+err_too_deep:
+	fy_error_report(fyp, &ec, "max recursion depth exceeded (%u)", ctx->max_depth);
+	return false;
+
+err_cycle_detected:
+	fy_error_report(fyp, &ec, "cyclic reference detected");
+	return false;
+}
+
+static struct fy_node *
+fy_node_follow_aliases(struct fy_node *fyn, enum fy_node_walk_flags flags)
+{
+	struct fy_node_walk_ctx *ctx;
+	unsigned int marker;
+
+	if (!fyn || !fy_node_is_alias(fyn) || !(flags & FYNWF_FOLLOW))
+		return fyn;
+
+	marker = fy_node_walk_marker_from_flags(flags);
+	if (marker >= 30)	/* maximum marker */
+		return fyn;
+
+	ctx = fy_node_walk_ctx_create_a(fy_node_walk_max_depth_from_flags(flags), FY_BIT(marker));
+
+	fy_node_walk_mark_start(ctx);
+	while (fyn && fy_node_is_alias(fyn)) {
+
+		if (!fy_node_walk_mark(ctx, fyn)) {
+			fyn = NULL;
+			break;
+		}
+
+		fyn = fy_node_follow_alias(fyn, flags);
+	}
+	fy_node_walk_mark_end(ctx);
+
+	return fyn;
+}
+
+struct fy_node *fy_node_resolve_alias(struct fy_node *fyn)
+{
+	return fy_node_follow_aliases(fyn,
+			FYNWF_FOLLOW | FYNWF_MAXDEPTH_DEFAULT |
+			FYNWF_MARKER_DEFAULT);
+}
+
+static struct fy_node *
+fy_node_by_path_internal(struct fy_node *fyn,
+			 const char *path, size_t pathlen,
+		         enum fy_node_walk_flags flags)
+{
+	struct fy_node *fynt, *fyni;
+	const char *s, *e;
+	char *end_idx;
+	char c;
+	int idx;
+	size_t len;
+
+	if (!fyn || !path)
+		return NULL;
+
+	s = path;
+	if (pathlen == (size_t)-1)
+		pathlen = strlen(path);
+	e = s + pathlen;
+
+	/* and continue on path lookup with the rest */
+
+	/* fy_notice(NULL, "%s: path='%.*s'", __func__, (int)pathlen, path); */
+
+	/* skip all prefixed / */
+	while (s < e && *s == '/')
+		s++;
+
+	/* for a last component / always match this one */
+	if (s >= e)
+		goto out;
+
+	fyn = fy_node_follow_aliases(fyn, flags);
+
+	/* scalar can't match (it has no key) */
+	if (fy_node_is_scalar(fyn)) {
+		fyn = NULL;
+		goto out;
+	}
+
+	/* for a sequence the only allowed key is [n] where n is the index to follow */
+	if (fy_node_is_sequence(fyn)) {
+
+		while (s < e && isspace(*s))
+			s++;
+
+		c = *s;
+		if (c == '[')
+			s++;
+		else if (!isdigit(c) && c != '-')
+			return NULL;
+
+		idx = (int)strtol(s, &end_idx, 10);
+		s = end_idx;
+		while (s < e && isspace(*s))
+			s++;
+
+		if (c == '[' && *s++ != ']')
+			return NULL;
+
+		while (s < e && isspace(*s))
+			s++;
+
+		/* fy_notice(NULL, "%s: seq: idx=%d", __func__, idx); */
+
+		len = e - s;
+
+		fyn = fy_node_sequence_get_by_index(fyn, idx);
+		fyn = fy_node_follow_aliases(fyn, flags);
+		fyn = fy_node_by_path_internal(fyn, s, len, flags);
+		goto out;
+	}
+
+	/* be a little bit paranoid */
 	assert(fy_node_is_mapping(fyn));
 
-	/* scan ahead for the end of the path component
-	 * note that we don't do UTF8 here, because all the
-	 * escapes are regular ascii characters, i.e.
-	 * '/', '*', '&', '.', '{', '}', '[', ']' and '\\'
-	 */
+	/* scan ahead for the end of the path component
+	 * note that we don't do UTF8 here, because all the
+	 * escapes are regular ascii characters, i.e.
+	 * '/', '*', '&', '.', '{', '}', '[', ']' and '\\'
+	 */
+
+	path = s;
+	pathlen = (size_t)(e - s);
+
+	/* fy_notice(NULL, "%s: left='%.*s'", __func__, (int)pathlen, path); */
+
+	while (s < e) {
+		c = *s;
+		/* end of path component? */
+		if (c == '/')
+			break;
+		s++;
+
+		if (c == '\\') {
+			/* it must be a valid escape */
+			if (s >= e || !strchr("/*&.{}[]\\", *s))
+				return NULL;
+			s++;
+		} else if (c == '"') {
+			while (s < e && *s != '"') {
+				c = *s++;
+				if (c == '\\' && (s < e && *s == '"'))
+					s++;
+			}
+			/* not a normal double quote end */
+			if (s >= e || *s != '"')
+				return NULL;
+			s++;
+		} else if (c == '\'') {
+			while (s < e && *s != '\'') {
+				c = *s++;
+				if (c == '\'' && (s < e && *s == '\''))
+					s++;
+			}
+			/* not a normal single quote end */
+			if (s >= e || *s != '\'')
+				return NULL;
+			s++;
+		}
+	}
+	len = s - path;
+
+	/* fy_notice(NULL, "%s: lookup='%.*s'", __func__, (int)len, path); */
+
+	fynt = fyn;
+	fyn = fy_node_mapping_lookup_by_string(fyn, path, len);
+
+	/* failed! last ditch attempt, is there a merge key? */
+	if (!fyn && fynt && (flags & FYNWF_FOLLOW)) {
+		fyn = fy_node_mapping_lookup_by_string(fynt, "<<", 2);
+		if (!fyn)
+			goto out;
+
+		/* fy_notice(NULL, "found merge key"); */
+
+		if (fy_node_is_alias(fyn)) {
+
+			/* single alias '<<: *foo' */
+			fyn = fy_node_mapping_lookup_by_string(
+					fy_node_follow_aliases(fyn, flags), path, len);
+
+		} else if (fy_node_is_sequence(fyn)) {
+
+			/* multi aliases '<<: [ *foo, *bar ]' */
+			fynt = fyn;
+			for (fyni = fy_node_list_head(&fynt->sequence); fyni;
+					fyni = fy_node_next(&fynt->sequence, fyni)) {
+				if (!fy_node_is_alias(fyni))
+					continue;
+				fyn = fy_node_mapping_lookup_by_string(
+						fy_node_follow_aliases(fyni, flags),
+						path, len);
+				if (fyn)
+					break;
+			}
+		} else
+			fyn = NULL;
+	}
+
+	len = e - s;
+
+	fyn = fy_node_follow_aliases(fyn, flags);
+	fyn = fy_node_by_path_internal(fyn, s, len, flags);
+
+out:
+	fyn = fy_node_follow_aliases(fyn, flags);
+
+	return fyn;
+}
+
+struct fy_node *fy_node_by_path(struct fy_node *fyn,
+				const char *path, size_t len,
+				enum fy_node_walk_flags flags)
+{
+	struct fy_anchor *fya;
+	const char *s, *ss, *e, *t, *anchor;
+	size_t alen;
+	char c;
+
+	s = path;
+	if (len == (size_t)-1)
+		len = strlen(path);
+	e = s + len;
+
+	/* fy_notice(NULL, "%s: path='%.*s'", __func__, (int)len, path); */
+
+	/* first path component may be an alias */
+	if ((flags & FYNWF_FOLLOW) && fyn && path) {
+		while (s < e && isspace(*s))
+			s++;
+
+		if (s >= e || *s != '*')
+			goto regular_path_lookup;
+
+		s++;
+
+		/* fy_notice(NULL, "%s: alias check: '%.*s'", __func__, (int)(e - s), s); */
+		ss = s;
+
+		c = -1;
+		for (t = s; t < e; t++) {
+			c = *t;
+			/* it ends on anything non alias */
+			if (c == '[' || c == ']' ||
+				c == '{' || c == '}' ||
+				c == ',' || c == ' ' || c == '\t' ||
+				c == '/')
+				break;
+		}
+
+		/* bad alias form for path */
+		if (c == '[' || c == ']' || c == '{' || c == '}' || c == ',')
+			return NULL;
+
+		anchor = s;
+		alen = t - s;
+
+		/* empty '*' */
+		if (!alen)
+			return NULL;
+
+		/* we must be terminated by '/' or space followed by '/' */
+		/* strip until spaces and '/' end */
+		while (t < e && (*t == ' ' || *t == '\t'))
+			t++;
+
+		while (t < e && *t == '/')
+			t++;
+
+		/* update path */
+		path = t;
+		len = e - t;
+
+		/* fy_notice(NULL, "%s: looking up anchor='%.*s'", __func__, (int)alen, anchor); */
+
+		/* lookup anchor */
+		fya = fy_document_lookup_anchor(fyn->fyd, anchor, alen);
+
+		if (fya) {
+			/* nothing more? we're done */
+			if (*path == '\0')
+				return fya->fyn;
+
+			/* anchor found... all good */
+
+			fyn = fya->fyn;
+		} else {
+			/* no anchor found? try for *</path/foo> */
+
+			/* fy_notice(NULL, "anchor not found: %.*s", (int)alen, anchor); */
+
+			s = ss;
+			if ((e - s) < 3 || s[0] != '<' || s[1] != '/' || e[-1] != '>')
+				return NULL;
+
+			path = ss + 1;
+			len = (e - 1) - (ss + 1);
+
+			/* fy_notice(NULL, "direct path: %.*s", (int)len, path); */
+
+		}
+	}
+
+regular_path_lookup:
+	return fy_node_by_path_internal(fyn, path, len, flags);
+}
+
+static int fy_path_query_alloc_step(struct fy_path_query *fypq)
+{
+	struct fy_path_step *steps;
+	int alloc;
+
+	if (fypq->steps_count >= fypq->steps_alloc) {
+		alloc = fypq->steps_alloc ? fypq->steps_alloc * 2 : 8;
+		steps = realloc(fypq->steps, alloc * sizeof(*steps));
+		if (!steps)
+			return -1;
+		fypq->steps = steps;
+		fypq->steps_alloc = alloc;
+	}
+
+	memset(&fypq->steps[fypq->steps_count], 0, sizeof(*steps));
+	fypq->steps[fypq->steps_count].seq_next = -1;
+	fypq->steps[fypq->steps_count].map_next = -1;
+
+	return fypq->steps_count++;
+}
+
+/*
+ * Compile the path component at s the same way fy_node_by_path_internal()
+ * would parse it; returns the step or -1 on error.
+ */
+static int fy_path_query_compile_step(struct fy_path_query *fypq, int *memo,
+				      const char *s, const char *e)
+{
+	struct fy_path_step *st;
+	const char *key, *t;
+	char *end_idx;
+	size_t offset, key_len;
+	int i, idx, next;
+	char c;
+
+	offset = (size_t)(s - fypq->path);
+	if (memo[offset] >= 0)
+		return memo[offset];
+
+	i = fy_path_query_alloc_step(fypq);
+	if (i < 0)
+		return -1;
+	memo[offset] = i;
+	fypq->steps[i].offset = offset;
+
+	/* skip all prefixed / */
+	while (s < e && *s == '/')
+		s++;
+
+	/* for a last component / always match this one */
+	if (s >= e) {
+		fypq->steps[i].end = true;
+		return i;
+	}
+
+	/* as a sequence index, [n] or n */
+	t = s;
+	while (t < e && isspace((unsigned char)*t))
+		t++;
+
+	c = t < e ? *t : '\0';
+	if (c == '[' || isdigit((unsigned char)c) || c == '-') {
+		if (c == '[')
+			t++;
+
+		idx = (int)strtol(t, &end_idx, 10);
+		t = end_idx;
+		while (t < e && isspace((unsigned char)*t))
+			t++;
+
+		if (c != '[' || (t < e && *t++ == ']')) {
+			while (t < e && isspace((unsigned char)*t))
+				t++;
+
+			next = fy_path_query_compile_step(fypq, memo, t, e);
+			if (next < 0)
+				return -1;
+
+			st = &fypq->steps[i];
+			st->seq_valid = true;
+			st->idx = idx;
+			st->seq_next = next;
+		}
+	}
+
+	/* as a mapping key, up to the end of the path component */
+	key = s;
+	for (t = s; t < e; ) {
+		c = *t;
+		if (c == '/')
+			break;
+		t++;
+
+		if (c == '\\') {
+			/* it must be a valid escape */
+			if (t >= e || !strchr("/*&.{}[]\\", *t))
+				return i;
+			t++;
+		} else if (c == '"') {
+			while (t < e && *t != '"') {
+				c = *t++;
+				if (c == '\\' && (t < e && *t == '"'))
+					t++;
+			}
+			/* not a normal double quote end */
+			if (t >= e || *t != '"')
+				return i;
+			t++;
+		} else if (c == '\'') {
+			while (t < e && *t != '\'') {
+				c = *t++;
+				if (c == '\'' && (t < e && *t == '\''))
+					t++;
+			}
+			/* not a normal single quote end */
+			if (t >= e || *t != '\'')
+				return i;
+			t++;
+		}
+	}
+	key_len = (size_t)(t - key);
+
+	next = fy_path_query_compile_step(fypq, memo, t, e);
+	if (next < 0)
+		return -1;
+
+	st = &fypq->steps[i];
+	st->map_valid = true;
+	st->key = key;
+	st->key_len = key_len;
+	st->map_next = next;
+
+	/* simple keys are looked up by hash, the key node is the fallback */
+	st->key_simple = is_simple_key(key, key_len);
+	if (st->key_simple)
+		st->key_hash = fy_hash_data(key, key_len);
+	st->fyd_key = fy_document_build_from_string(NULL, key, key_len);
+
+	return i;
+}
+
+static int fy_path_query_compile_region(struct fy_path_query *fypq,
+					enum fy_path_region region,
+					const char *s, const char *e)
+{
+	size_t i;
+
+	fypq->memo[region] = malloc((fypq->len + 1) * sizeof(int));
+	if (!fypq->memo[region])
+		return -1;
+
+	for (i = 0; i <= fypq->len; i++)
+		fypq->memo[region][i] = -1;
+
+	fypq->start[region] = fy_path_query_compile_step(fypq, fypq->memo[region], s, e);
+
+	return fypq->start[region] >= 0 ? 0 : -1;
+}
+
+static int fy_path_query_compile(struct fy_path_query *fypq)
+{
+	const char *s, *ss, *e, *t;
+	char c;
+
+	s = fypq->path;
+	e = s + fypq->len;
+
+	/* first path component may be an alias */
+	if (fypq->flags & FYNWF_FOLLOW) {
+		while (s < e && isspace((unsigned char)*s))
+			s++;
+
+		if (s >= e || *s != '*')
+			goto regular_path;
+
+		s++;
+		ss = s;
+
+		c = -1;
+		for (t = s; t < e; t++) {
+			c = *t;
+			/* it ends on anything non alias */
+			if (c == '[' || c == ']' ||
+				c == '{' || c == '}' ||
+				c == ',' || c == ' ' || c == '\t' ||
+				c == '/')
+				break;
+		}
+
+		/* bad alias form for path, or empty '*' */
+		if (c == '[' || c == ']' || c == '{' || c == '}' || c == ',' || t == s) {
+			fypq->invalid = true;
+			return 0;
+		}
+
+		fypq->has_anchor = true;
+		fypq->anchor = s;
+		fypq->anchor_len = (size_t)(t - s);
+
+		/* strip until spaces and '/' end */
+		while (t < e && (*t == ' ' || *t == '\t'))
+			t++;
+
+		while (t < e && *t == '/')
+			t++;
+
+		/* the rest of the path is walked from the anchor */
+		if (fy_path_query_compile_region(fypq, fypr_path, t, e))
+			return -1;
+
+		/* no anchor found? then it's *</path/foo> */
+		if ((e - ss) >= 3 && ss[0] == '<' && ss[1] == '/' && e[-1] == '>' &&
+		    fy_path_query_compile_region(fypq, fypr_alt, ss + 1, e - 1))
+			return -1;
+
+		return 0;
+	}
+
+regular_path:
+	return fy_path_query_compile_region(fypq, fypr_path, fypq->path, e);
+}
+
+struct fy_path_query *fy_path_query_create(const char *path, size_t len,
+					   enum fy_node_walk_flags flags)
+{
+	struct fy_path_query *fypq;
+
+	if (!path)
+		return NULL;
+
+	if (len == (size_t)-1)
+		len = strlen(path);
+
+	fypq = malloc(sizeof(*fypq));
+	if (!fypq)
+		return NULL;
+	memset(fypq, 0, sizeof(*fypq));
+
+	fypq->flags = flags;
+	fypq->start[fypr_path] = -1;
+	fypq->start[fypr_alt] = -1;
+
+	/* keep a zero terminated copy; the steps point into it */
+	fypq->path = malloc(len + 1);
+	if (!fypq->path)
+		goto err_out;
+	memcpy(fypq->path, path, len);
+	fypq->path[len] = '\0';
+	fypq->len = len;
+
+	if (fy_path_query_compile(fypq))
+		goto err_out;
+
+	return fypq;
+
+err_out:
+	fy_path_query_destroy(fypq);
+	return NULL;
+}
+
+void fy_path_query_destroy(struct fy_path_query *fypq)
+{
+	int i;
+
+	if (!fypq)
+		return;
+
+	for (i = 0; i < fypq->steps_count; i++)
+		fy_document_destroy(fypq->steps[i].fyd_key);
+
+	free(fypq->steps);
+	free(fypq->memo[fypr_path]);
+	free(fypq->memo[fypr_alt]);
+	free(fypq->path);
+	free(fypq);
+}
+
+struct fy_path_trail_entry {
+	enum fy_path_region region;
+	size_t offset;
+	struct fy_node *fyn;
+};
+
+/* the nodes a query walked through, for reuse by the next one */
+struct fy_path_trail {
+	struct fy_path_trail_entry *entries;
+	int count;
+	int alloc;
+	bool error;
+};
+
+static void fy_path_trail_add(struct fy_path_trail *trail, enum fy_path_region region,
+			      size_t offset, struct fy_node *fyn)
+{
+	struct fy_path_trail_entry *entries;
+	int alloc;
+
+	if (trail->error)
+		return;
+
+	if (trail->count >= trail->alloc) {
+		alloc = trail->alloc ? trail->alloc * 2 : 16;
+		entries = realloc(trail->entries, alloc * sizeof(*entries));
+		if (!entries) {
+			trail->error = true;
+			return;
+		}
+		trail->entries = entries;
+		trail->alloc = alloc;
+	}
+
+	entries = &trail->entries[trail->count++];
+	entries->region = region;
+	entries->offset = offset;
+	entries->fyn = fyn;
+}
+
+static struct fy_node *
+fy_path_step_lookup(const struct fy_path_step *st, struct fy_node *fyn)
+{
+	struct fy_node *fyn_value = NULL;
+
+	if (st->key_simple)
+		fyn_value = fy_node_mapping_lookup_value_by_simple_key_hash(fyn,
+				st->key, st->key_len, &st->key_hash);
+
+	if (!fyn_value && st->fyd_key)
+		fyn_value = fy_node_mapping_lookup_value_by_key(fyn,
+				fy_document_root(st->fyd_key));
+
+	return fyn_value;
+}
+
+/* walk the compiled steps just like fy_node_by_path_internal() */
+static struct fy_node *
+fy_path_query_walk(const struct fy_path_query *fypq, enum fy_path_region region,
+		   int i, struct fy_node *fyn, struct fy_path_trail *trail)
+{
+	enum fy_node_walk_flags flags = fypq->flags;
+	const struct fy_path_step *st;
+	struct fy_node *fynt, *fyni;
+
+	while (fyn && i >= 0) {
+		st = &fypq->steps[i];
+
+		if (trail)
+			fy_path_trail_add(trail, region, st->offset, fyn);
+
+		if (st->end)
+			break;
+
+		fyn = fy_node_follow_aliases(fyn, flags);
+
+		/* scalar can't match (it has no key) */
+		if (!fyn || fy_node_is_scalar(fyn))
+			return NULL;
+
+		if (fy_node_is_sequence(fyn)) {
+			if (!st->seq_valid)
+				return NULL;
+
+			fyn = fy_node_sequence_get_by_index(fyn, st->idx);
+			fyn = fy_node_follow_aliases(fyn, flags);
+			i = st->seq_next;
+			continue;
+		}
+
+		if (!st->map_valid)
+			return NULL;
+
+		fynt = fyn;
+		fyn = fy_path_step_lookup(st, fynt);
+
+		/* failed! last ditch attempt, is there a merge key? */
+		if (!fyn && (flags & FYNWF_FOLLOW)) {
+			fyn = fy_node_mapping_lookup_by_string(fynt, "<<", 2);
+			if (!fyn)
+				return NULL;
+
+			if (fy_node_is_alias(fyn)) {
+				/* single alias '<<: *foo' */
+				fyn = fy_path_step_lookup(st,
+						fy_node_follow_aliases(fyn, flags));
+			} else if (fy_node_is_sequence(fyn)) {
+				/* multi aliases '<<: [ *foo, *bar ]' */
+				fynt = fyn;
+				for (fyni = fy_node_list_head(&fynt->sequence); fyni;
+						fyni = fy_node_next(&fynt->sequence, fyni)) {
+					if (!fy_node_is_alias(fyni))
+						continue;
+					fyn = fy_path_step_lookup(st,
+							fy_node_follow_aliases(fyni, flags));
+					if (fyn)
+						break;
+				}
+			} else
+				fyn = NULL;
+		}
+
+		fyn = fy_node_follow_aliases(fyn, flags);
+		i = st->map_next;
+	}
+
+	return fy_node_follow_aliases(fyn, flags);
+}
+
+static struct fy_node *
+fy_path_query_exec_internal(const struct fy_path_query *fypq, struct fy_node *fyn,
+			    struct fy_path_trail *trail)
+{
+	struct fy_anchor *fya;
+
+	if (!fypq || !fyn || fypq->invalid)
+		return NULL;
+
+	if (!fypq->has_anchor)
+		return fy_path_query_walk(fypq, fypr_path, fypq->start[fypr_path], fyn, trail);
+
+	fya = fy_document_lookup_anchor(fyn->fyd, fypq->anchor, fypq->anchor_len);
+	if (fya)
+		return fy_path_query_walk(fypq, fypr_path, fypq->start[fypr_path], fya->fyn, trail);
+
+	/* no anchor found and not the *</path/foo> form */
+	if (fypq->start[fypr_alt] < 0)
+		return NULL;
+
+	return fy_path_query_walk(fypq, fypr_alt, fypq->start[fypr_alt], fyn, trail);
+}
+
+struct fy_node *fy_path_query_exec(struct fy_path_query *fypq, struct fy_node *fyn)
+{
+	return fy_path_query_exec_internal(fypq, fyn, NULL);
+}
+
+static size_t fy_path_query_common_prefix(const struct fy_path_query *fypq_a,
+					  const struct fy_path_query *fypq_b)
+{
+	size_t i, len;
+
+	len = fypq_a->len < fypq_b->len ? fypq_a->len : fypq_b->len;
+	for (i = 0; i < len && fypq_a->path[i] == fypq_b->path[i]; i++)
+		;
+
+	return i;
+}
+
+int fy_path_query_exec_batch(struct fy_path_query * const *fypqs, int count,
+			     struct fy_node *fyn, struct fy_node **fyns)
+{
+	const struct fy_path_query *fypq_prev = NULL;
+	struct fy_path_query *fypq;
+	struct fy_path_trail trail;
+	struct fy_path_trail_entry te;
+	size_t common;
+	int i, j, step;
+
+	if (!fypqs || count < 0 || !fyns)
+		return -1;
+
+	memset(&trail, 0, sizeof(trail));
+
+	for (i = 0; i < count; i++) {
+		fypq = fypqs[i];
+		if (!fypq) {
+			fyns[i] = NULL;
+			continue;
+		}
+
+		/*
+		 * Walking a path depends only on the text up to (and
+		 * including) the component's first character, so the
+		 * trail of the previous query can be reused for any
+		 * component of this one starting before the paths differ.
+		 */
+		step = -1;
+		if (fypq_prev && !trail.error && fypq->flags == fypq_prev->flags) {
+			common = fy_path_query_common_prefix(fypq_prev, fypq);
+			for (j = trail.count - 1; j >= 0; j--) {
+				te = trail.entries[j];
+				if (te.offset < common && fypq->memo[te.region] &&
+				    (step = fypq->memo[te.region][te.offset]) >= 0)
+					break;
+			}
+		}
+
+		if (step >= 0) {
+			trail.count = j;
+			fyns[i] = fy_path_query_walk(fypq, te.region, step, te.fyn, &trail);
+		} else {
+			trail.count = 0;
+			trail.error = false;
+			fyns[i] = fy_path_query_exec_internal(fypq, fyn, &trail);
+		}
+
+		fypq_prev = fypq;
+	}
+
+	free(trail.entries);
+
+	return 0;
+}
+
+bool fy_check_ref_loop(struct fy_document *fyd, struct fy_node *fyn,
+		       enum fy_node_walk_flags flags,
+		       struct fy_node_walk_ctx *ctx)
+{
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp, *fynpi;
+	struct fy_node_walk_ctx *ctxn;
+	bool ret;
+
+	if (!fyn)
+		return false;
+
+	/* visited? no need to check */
+	if (fyn->marks & FY_BIT(31))
+		return false;
+
+	/* marked node, it's a loop */
+	if (ctx && !fy_node_walk_mark(ctx, fyn))
+		return true;
+
+	/* can't tell without the contents, play safe */
+	if (fy_node_lazy_expand(fyn))
+		return true;
+
+	ret = false;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+
+		/* if it's not an alias, we're done */
+		if (!fy_node_is_alias(fyn))
+			break;
+
+		ctxn = ctx;
+		if (!ctxn)
+			ctxn = fy_node_walk_ctx_create_a(
+				fy_node_walk_max_depth_from_flags(flags), 1);
+
+
+		if (!ctx) {
+			fy_node_walk_mark_start(ctxn);
+
+			/* mark this node */
+			fy_node_walk_mark(ctxn, fyn);
+		}
+
+		fyni = fy_node_follow_alias(fyn, flags);
+
+		ret = fy_check_ref_loop(fyd, fyni, flags, ctxn);
+
+		if (!ctx)
+			fy_node_walk_mark_end(ctxn);
+
+		if (ret)
+			break;
+
+		break;
+
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+
+			ret = fy_check_ref_loop(fyd, fyni, flags, ctx);
+			if (ret)
+				break;
+		}
+		break;
+
+	case FYNT_MAPPING:
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
+
+			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
+
+			ret = fy_check_ref_loop(fyd, fynp->key, flags, ctx);
+			if (ret)
+				break;
+
+			ret = fy_check_ref_loop(fyd, fynp->value, flags, ctx);
+			if (ret)
+				break;
+		}
+		break;
+	}
+
+	/* mark as visited */
+	fyn->marks |= FY_BIT(31);
+
+	return ret;
+}
+
+char *fy_node_get_parent_address(struct fy_node *fyn)
+{
+	struct fy_node *parent, *fyni;
+	struct fy_node_pair *fynp;
+	char *path = NULL;
+	int idx, ret;
 
-	path = s;
-	pathlen = (size_t)(e - s);
+	if (!fyn || !fyn->parent)
+		return NULL;
 
-	/* fy_notice(NULL, "%s: left='%.*s'", __func__, (int)pathlen, path); */
+	parent = fyn->parent;
 
-	while (s < e) {
-		c = *s;
-		/* end of path component? */
-		if (c == '/')
-			break;
-		s++;
+	if (fy_node_is_sequence(parent)) {
+		/* for a sequence, find the index */
+		idx = 0;
+		for (fyni = fy_node_list_head(&parent->sequence); fyni && fyni != fyn;
+				fyni = fy_node_next(&parent->sequence, fyni))
+			idx++;
 
-		if (c == '\\') {
-			/* it must be a valid escape */
-			if (s >= e || !strchr("/*&.{}[]\\", *s))
-				return NULL;
-			s++;
-		} else if (c == '"') {
-			while (s < e && *s != '"') {
-				c = *s++;
-				if (c == '\\' && (s < e && *s == '"'))
-					s++;
-			}
-			/* not a normal double quote end */
-			if (s >= e || *s != '"')
-				return NULL;
-			s++;
-		} else if (c == '\'') {
-			while (s < e && *s != '\'') {
-				c = *s++;
-				if (c == '\'' && (s < e && *s == '\''))
-					s++;
-			}
-			/* not a normal single quote end */
-			if (s >= e || *s != '\'')
-				return NULL;
-			s++;
+		if (fyni) {
+			ret = asprintf(&path, "[%d]", idx);
+			if (ret == -1)
+				path = NULL;
 		}
+
+	} else if (fy_node_is_mapping(parent)) {
+		idx = 0;
+		for (fynp = fy_node_pair_list_head(&parent->mapping); fynp && fynp->value != fyn;
+				fynp = fy_node_pair_next(&parent->mapping, fynp))
+			idx++;
+
+		if (fynp)
+			path = fy_emit_node_to_string(fynp->key, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+
 	}
-	len = s - path;
 
-	/* fy_notice(NULL, "%s: lookup='%.*s'", __func__, (int)len, path); */
+	return path;
+}
 
-	fynt = fyn;
-	fyn = fy_node_mapping_lookup_by_string(fyn, path, len);
+char *fy_node_get_path(struct fy_node *fyn)
+{
+	struct path_track {
+		struct path_track *prev;
+		char *path;
+	};
+	struct path_track *track, *newtrack;
+	char *path, *s, *path_mem;
+	size_t len;
 
-	/* failed! last ditch attempt, is there a merge key? */
-	if (!fyn && fynt && (flags & FYNWF_FOLLOW)) {
-		fyn = fy_node_mapping_lookup_by_string(fynt, "<<", 2);
-		if (!fyn)
-			goto out;
+	if (!fyn)
+		return NULL;
 
-		/* fy_notice(NULL, "found merge key"); */
+	/* easy on the root */
+	if (!fyn->parent)
+		return strdup("/");
 
-		if (fy_node_is_alias(fyn)) {
+	track = NULL;
+	len = 0;
+	while ((path = fy_node_get_parent_address(fyn))) {
+		newtrack = alloca(sizeof(*newtrack));
+		newtrack->prev = track;
+		newtrack->path = path;
 
-			/* single alias '<<: *foo' */
-			fyn = fy_node_mapping_lookup_by_string(
-					fy_node_follow_aliases(fyn, flags), path, len);
+		track = newtrack;
 
-		} else if (fy_node_is_sequence(fyn)) {
+		len += strlen(path) + 1;
 
-			/* multi aliases '<<: [ *foo, *bar ]' */
-			fynt = fyn;
-			for (fyni = fy_node_list_head(&fynt->sequence); fyni;
-					fyni = fy_node_next(&fynt->sequence, fyni)) {
-				if (!fy_node_is_alias(fyni))
-					continue;
-				fyn = fy_node_mapping_lookup_by_string(
-						fy_node_follow_aliases(fyni, flags),
-						path, len);
-				if (fyn)
-					break;
-			}
-		} else
-			fyn = NULL;
+		fyn = fyn->parent;
 	}
+	len += 2;
 
-	len = e - s;
+	path_mem = malloc(len);
 
-	fyn = fy_node_follow_aliases(fyn, flags);
-	fyn = fy_node_by_path_internal(fyn, s, len, flags);
+	s = path_mem;
 
-out:
-	fyn = fy_node_follow_aliases(fyn, flags);
+	while (track) {
+		len = strlen(track->path);
+		if (s) {
+			*s++ = '/';
+			memcpy(s, track->path, len);
+			s += len;
+		}
+		free(track->path);
+		track = track->prev;
+	}
 
-	return fyn;
+	if (s)
+		*s = '\0';
+
+	return path_mem;
 }
 
-struct fy_node *fy_node_by_path(struct fy_node *fyn,
-				const char *path, size_t len,
-				enum fy_node_walk_flags flags)
+struct fy_node *fy_document_load_node(struct fy_document *fyd)
 {
-	struct fy_anchor *fya;
-	const char *s, *ss, *e, *t, *anchor;
-	size_t alen;
-	char c;
-
-	s = path;
-	if (len == (size_t)-1)
-		len = strlen(path);
-	e = s + len;
+	struct fy_parser *fyp;
+	struct fy_eventp *fyep = NULL;
+	struct fy_event *fye = NULL;
+	struct fy_node *fyn = NULL;
+	struct fy_error_ctx ec;
+	int rc;
+	bool was_stream_start;
 
-	/* fy_notice(NULL, "%s: path='%.*s'", __func__, (int)len, path); */
+	if (!fyd || !fyd->fyp)
+		return NULL;
 
-	/* first path component may be an alias */
-	if ((flags & FYNWF_FOLLOW) && fyn && path) {
-		while (s < e && isspace(*s))
-			s++;
+	fyp = fyd->fyp;
 
-		if (s >= e || *s != '*')
-			goto regular_path_lookup;
+again:
+	was_stream_start = false;
+	do {
+		/* get next event */
+		fyep = fy_parse_private(fyp);
 
-		s++;
+		/* no more */
+		if (!fyep)
+			return NULL;
 
-		/* fy_notice(NULL, "%s: alias check: '%.*s'", __func__, (int)(e - s), s); */
-		ss = s;
+		was_stream_start = fyep->e.type == FYET_STREAM_START;
 
-		c = -1;
-		for (t = s; t < e; t++) {
-			c = *t;
-			/* it ends on anything non alias */
-			if (c == '[' || c == ']' ||
-				c == '{' || c == '}' ||
-				c == ',' || c == ' ' || c == '\t' ||
-				c == '/')
-				break;
+		if (was_stream_start) {
+			fy_parse_eventp_recycle(fyp, fyep);
+			fyep = NULL;
 		}
 
-		/* bad alias form for path */
-		if (c == '[' || c == ']' || c == '{' || c == '}' || c == ',')
-			return NULL;
+	} while (was_stream_start);
 
-		anchor = s;
-		alen = t - s;
+	fye = &fyep->e;
 
-		/* empty '*' */
-		if (!alen)
+	/* STREAM_END */
+	if (fye->type == FYET_STREAM_END) {
+		fy_parse_eventp_recycle(fyp, fyep);
+
+		/* final STREAM_END? */
+		if (fyp->state == FYPS_END)
 			return NULL;
 
-		/* we must be terminated by '/' or space followed by '/' */
-		/* strip until spaces and '/' end */
-		while (t < e && (*t == ' ' || *t == '\t'))
-			t++;
+		/* multi-stream */
+		goto again;
+	}
 
-		while (t < e && *t == '/')
-			t++;
+	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
+			fye->type == FYET_DOCUMENT_START,
+			err_bad_event);
 
-		/* update path */
-		path = t;
-		len = e - t;
+	/* done with the document start; drops its reference to the state */
+	fy_parse_eventp_recycle(fyp, fyep);
+	fyep = NULL;
 
-		/* fy_notice(NULL, "%s: looking up anchor='%.*s'", __func__, (int)alen, anchor); */
+	fy_doc_debug(fyp, "calling load_node() for root");
+	rc = fy_parse_document_load_node(fyp, fyd, fy_parse_private(fyp), &fyn);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_parse_document_load_node() failed");
+
+	rc = fy_parse_document_load_end(fyp, fyd, fy_parse_private(fyp));
+	fy_error_check(fyp, !rc, err_out,
+			"fy_parse_document_load_node() failed");
+
+	/* always resolve parents */
+	fy_resolve_parent_node(fyd, fyn, NULL);
+
+	return fyn;
+
+err_out:
+	fy_parse_eventp_recycle(fyp, fyep);
+	return NULL;
+
+err_bad_event:
+	fy_error_report(fyp, &ec, "bad event");
+	goto err_out;
+}
+
+static struct fy_node *
+fy_node_build_internal(struct fy_document *fyd,
+		int (*parser_setup)(struct fy_parser *fyp, void *user),
+		void *user)
+{
+	struct fy_parser *fyp;
+	struct fy_node *fyn;
+	struct fy_eventp *fyep;
+	struct fy_error_ctx ec;
+	int rc;
+	bool got_stream_end;
 
-		/* lookup anchor */
-		fya = fy_document_lookup_anchor(fyn->fyd, anchor, alen);
+	if (!fyd || !fyd->fyp || !parser_setup)
+		return NULL;
 
-		if (fya) {
-			/* nothing more? we're done */
-			if (*path == '\0')
-				return fya->fyn;
+	fyp = fyd->fyp;
 
-			/* anchor found... all good */
+	rc = (*parser_setup)(fyp, user);
+	fy_error_check(fyp, !rc, err_out,
+			"parser_setup() failed");
 
-			fyn = fya->fyn;
-		} else {
-			/* no anchor found? try for *</path/foo> */
+	fyn = fy_document_load_node(fyd);
+	fy_error_check(fyp, fyn, err_out,
+			"fy_document_load_node() failed");
 
-			/* fy_notice(NULL, "anchor not found: %.*s", (int)alen, anchor); */
+	got_stream_end = false;
+	while (!got_stream_end && (fyep = fy_parse_private(fyp)) != NULL) {
+		if (fyep->e.type == FYET_STREAM_END)
+			got_stream_end = true;
+		fy_parse_eventp_recycle(fyp, fyep);
+	}
 
-			s = ss;
-			if ((e - s) < 3 || s[0] != '<' || s[1] != '/' || e[-1] != '>')
-				return NULL;
+	if (got_stream_end) {
+		fyep = fy_parse_private(fyp);
 
-			path = ss + 1;
-			len = (e - 1) - (ss + 1);
+		FY_ERROR_CHECK(fyp, fy_document_event_get_token(&fyep->e), &ec, FYEM_DOC,
+				!fyep,
+				err_trailing_event);
+		fy_parse_eventp_recycle(fyp, fyep);
+	}
 
-			/* fy_notice(NULL, "direct path: %.*s", (int)len, path); */
+	return fyn;
 
-		}
-	}
+err_out:
+	return NULL;
 
-regular_path_lookup:
-	return fy_node_by_path_internal(fyn, path, len, flags);
+err_trailing_event:
+	fy_error_report(fyp, &ec, "trailing events after the last");
+	goto err_out;
 }
 
-bool fy_check_ref_loop(struct fy_document *fyd, struct fy_node *fyn,
-		       enum fy_node_walk_flags flags,
-		       struct fy_node_walk_ctx *ctx)
+struct fy_node *fy_node_build_from_string(struct fy_document *fyd, const char *str, size_t len)
 {
-	struct fy_node *fyni;
-	struct fy_node_pair *fynp, *fynpi;
-	struct fy_node_walk_ctx *ctxn;
-	bool ret;
+	struct fy_document_build_string_ctx ctx = {
+		.str = str,
+		.len = len,
+	};
 
-	if (!fyn)
-		return false;
+	return fy_node_build_internal(fyd, parser_setup_from_string, &ctx);
+}
 
-	/* visited? no need to check */
-	if (fyn->marks & FY_BIT(31))
-		return false;
+struct fy_node *fy_node_build_from_file(struct fy_document *fyd, const char *file)
+{
+	struct fy_document_build_file_ctx ctx = {
+		.file = file,
+	};
 
-	/* marked node, it's a loop */
-	if (ctx && !fy_node_walk_mark(ctx, fyn))
-		return true;
+	return fy_node_build_internal(fyd, parser_setup_from_file, &ctx);
+}
 
-	ret = false;
+struct fy_node *fy_node_build_from_fp(struct fy_document *fyd, FILE *fp)
+{
+	struct fy_document_build_fp_ctx ctx = {
+		.name = NULL,
+		.fp = fp,
+	};
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
+	return fy_node_build_internal(fyd, parser_setup_from_fp, &ctx);
+}
 
-		/* if it's not an alias, we're done */
-		if (!fy_node_is_alias(fyn))
-			break;
+/*
+ * Incremental re-parse; the smallest collection enclosing an edit
+ * is re-scanned on its own and the new node is spliced in its place.
+ * All the tokens of the document are then moved to the new text.
+ */
+struct fy_reparse {
+	struct fy_input *fyi_old;	/* input of the old text */
+	struct fy_input *fyi_tmp;	/* input of the re-scanned region */
+	struct fy_input *fyi_new;	/* input of the new text */
+	struct fy_mark region;		/* start of the region */
+	size_t skip;			/* octets before the region on the re-scan */
+	int lines;			/* lines before the region on the re-scan */
+	struct fy_mark old_end;		/* end of the edit on the old text */
+	struct fy_mark new_end;		/* end of the edit on the new text */
+};
 
-		ctxn = ctx;
-		if (!ctxn)
-			ctxn = fy_node_walk_ctx_create_a(
-				fy_node_walk_max_depth_from_flags(flags), 1);
+/* advance a mark over text up to end, following the scanner's rules */
+static void fy_text_mark_advance(const char *text, size_t end, struct fy_mark *fym)
+{
+	const char *s, *e;
+	int c, w;
 
+	s = text + fym->input_pos;
+	e = text + end;
+	while (s < e) {
+		c = fy_utf8_get(s, e - s, &w);
+		if (c < 0)
+			w = 1;
+		s += w;
+		if (c == '\r' && s < e && *s == '\n')
+			s++;
+		if (c >= 0 && fy_is_lb(c)) {
+			fym->column = 0;
+			fym->line++;
+		} else
+			fym->column++;
+	}
+	fym->input_pos = s - text;
+}
 
-		if (!ctx) {
-			fy_node_walk_mark_start(ctxn);
+static bool fy_node_is_flow_collection(struct fy_node *fyn)
+{
+	if (fyn->type == FYNT_SEQUENCE)
+		return fyn->sequence_start && fyn->sequence_start->type == FYTT_FLOW_SEQUENCE_START;
+	if (fyn->type == FYNT_MAPPING)
+		return fyn->mapping_start && fyn->mapping_start->type == FYTT_FLOW_MAPPING_START;
+	return false;
+}
 
-			/* mark this node */
-			fy_node_walk_mark(ctxn, fyn);
-		}
+/* a collection that starts and ends on the old text, and can be re-scanned alone */
+static bool fy_node_reparse_eligible(struct fy_node *fyn, struct fy_input *fyi,
+				     const char *text, size_t size)
+{
+	const struct fy_mark *sm, *em;
+	size_t i;
+	int c;
 
-		fyni = fy_node_follow_alias(fyn, flags);
+	if (!fyn || fyn->type == FYNT_SCALAR || fyn->lazy || fyn->cow_src ||
+	    !fyn->sequence_start || !fyn->sequence_end ||
+	    fyn->sequence_start->handle.fyi != fyi || fyn->sequence_end->handle.fyi != fyi)
+		return false;
 
-		ret = fy_check_ref_loop(fyd, fyni, flags, ctxn);
+	/* it's placed as a block mapping value when re-scanned */
+	if (fy_node_is_flow_collection(fyn))
+		return fy_token_start_mark(fyn->sequence_start)->column > 0;
 
-		if (!ctx)
-			fy_node_walk_mark_end(ctxn);
+	sm = fy_token_start_mark(fyn->sequence_start);
+	em = fy_token_end_mark(fyn->sequence_end);
 
-		if (ret)
-			break;
+	/* a block collection spans whole lines, only indicators may precede it */
+	if (sm->column <= 0 || (size_t)sm->column > sm->input_pos)
+		return false;
+	for (i = sm->input_pos - sm->column; i < sm->input_pos; i++) {
+		c = text[i];
+		if (c != ' ' && c != '-' && c != '?' && c != ':')
+			return false;
+	}
+	i = sm->input_pos - sm->column;
+	if (i > 0 && !fy_is_lb(text[i - 1]))
+		return false;
 
-		break;
+	return em->column == 0 || em->input_pos == size;
+}
 
-	case FYNT_SEQUENCE:
-		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
-				fyni = fy_node_next(&fyn->sequence, fyni)) {
+static bool fy_node_reparse_contains(struct fy_node *fyn, size_t start, size_t end)
+{
+	return fy_token_start_mark(fyn->sequence_start)->input_pos <= start &&
+	       end < fy_token_end_mark(fyn->sequence_end)->input_pos;
+}
 
-			ret = fy_check_ref_loop(fyd, fyni, flags, ctx);
-			if (ret)
-				break;
-		}
-		break;
+/* find the deepest collection enclosing the edit that can be re-scanned */
+static struct fy_node *fy_document_reparse_region(struct fy_document *fyd, struct fy_input *fyi,
+						  const char *text, size_t size,
+						  size_t start, size_t end)
+{
+	struct fy_node *fyn, *fyni, *fyn_found;
+	struct fy_node_pair *fynp;
 
-	case FYNT_MAPPING:
-		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
+	fyn_found = NULL;
+	fyn = fyd->root;
+	while (fyn) {
+		fyni = NULL;
+		if (fyn->type == FYNT_SEQUENCE) {
+			for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+					fyni = fy_node_next(&fyn->sequence, fyni)) {
+				if (fy_node_reparse_eligible(fyni, fyi, text, size) &&
+				    fy_node_reparse_contains(fyni, start, end))
+					break;
+			}
+		} else if (fyn->type == FYNT_MAPPING) {
+			for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+					fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+				fyni = fynp->value;
+				if (fy_node_reparse_eligible(fyni, fyi, text, size) &&
+				    fy_node_reparse_contains(fyni, start, end))
+					break;
+				fyni = NULL;
+			}
+		}
+		if (fyni)
+			fyn_found = fyni;
+		fyn = fyni;
+	}
 
-			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
+	return fyn_found;
+}
 
-			ret = fy_check_ref_loop(fyd, fynp->key, flags, ctx);
-			if (ret)
-				break;
+/* the content lines of the region must stay inside its indentation context */
+static bool fy_reparse_indentation_ok(const char *s, size_t len, int indent, bool skip_comments)
+{
+	const char *e = s + len;
+	int col;
 
-			ret = fy_check_ref_loop(fyd, fynp->value, flags, ctx);
-			if (ret)
-				break;
+	/* the first line is the one the region starts on */
+	while (s < e && !fy_is_lb(*s))
+		s++;
+	while (s < e) {
+		s++;	/* the line break */
+		col = 0;
+		while (s < e && *s == ' ') {
+			s++;
+			col++;
 		}
-		break;
+		if (s < e && !fy_is_lb(*s) && !(skip_comments && *s == '#') && col < indent)
+			return false;
+		while (s < e && !fy_is_lb(*s))
+			s++;
 	}
+	return true;
+}
 
-	/* mark as visited */
-	fyn->marks |= FY_BIT(31);
+static bool fy_reparse_has_anchors(struct fy_document *fyd, struct fy_node *fyn)
+{
+	struct fy_anchor *fya;
+	struct fy_node *fyni;
 
-	return ret;
+	for (fya = fy_anchor_list_head(&fyd->anchors); fya;
+			fya = fy_anchor_next(&fyd->anchors, fya)) {
+		for (fyni = fya->fyn; fyni; fyni = fyni->parent)
+			if (fyni == fyn)
+				return true;
+	}
+	return false;
 }
 
-char *fy_node_get_parent_address(struct fy_node *fyn)
+static void fy_reparse_mark(const struct fy_reparse *fyrp, struct fy_mark *fym, bool tmp)
 {
-	struct fy_node *parent, *fyni;
-	struct fy_node_pair *fynp;
-	char *path = NULL;
-	int idx, ret;
+	if (tmp) {
+		/* the padding matches the column of the region start */
+		fym->input_pos = fym->input_pos >= fyrp->skip ?
+				 fym->input_pos - fyrp->skip + fyrp->region.input_pos :
+				 fyrp->region.input_pos;
+		fym->line = fym->line >= fyrp->lines ?
+			    fym->line - fyrp->lines + fyrp->region.line :
+			    fyrp->region.line;
+		return;
+	}
 
-	if (!fyn || !fyn->parent)
-		return NULL;
+	fym->input_pos = fym->input_pos - fyrp->old_end.input_pos + fyrp->new_end.input_pos;
+	if (fym->line == fyrp->old_end.line)
+		fym->column = fym->column - fyrp->old_end.column + fyrp->new_end.column;
+	fym->line = fym->line - fyrp->old_end.line + fyrp->new_end.line;
+}
 
-	parent = fyn->parent;
+static bool fy_reparse_atom(const struct fy_reparse *fyrp, struct fy_atom *atom)
+{
+	bool tmp;
 
-	if (fy_node_is_sequence(parent)) {
-		/* for a sequence, find the index */
-		idx = 0;
-		for (fyni = fy_node_list_head(&parent->sequence); fyni && fyni != fyn;
-				fyni = fy_node_next(&parent->sequence, fyni))
-			idx++;
+	if (atom->fyi != fyrp->fyi_old && atom->fyi != fyrp->fyi_tmp)
+		return false;
 
-		if (fyni) {
-			ret = asprintf(&path, "[%d]", idx);
-			if (ret == -1)
-				path = NULL;
-		}
+	/* nothing changes before the edit */
+	tmp = atom->fyi == fyrp->fyi_tmp;
+	if (tmp || atom->start_mark.input_pos >= fyrp->old_end.input_pos) {
+		fy_reparse_mark(fyrp, &atom->start_mark, tmp);
+		fy_reparse_mark(fyrp, &atom->end_mark, tmp);
+	}
+	atom->fyi = fyrp->fyi_new;
 
-	} else if (fy_node_is_mapping(parent)) {
-		idx = 0;
-		for (fynp = fy_node_pair_list_head(&parent->mapping); fynp && fynp->value != fyn;
-				fynp = fy_node_pair_next(&parent->mapping, fynp))
-			idx++;
+	return true;
+}
 
-		if (fynp)
-			path = fy_emit_node_to_string(fynp->key, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+/* a token is moved once; on the new input it's left alone when met again */
+static void fy_reparse_token(const struct fy_reparse *fyrp, struct fy_token *fyt)
+{
+	unsigned int i;
 
-	}
+	if (!fyt)
+		return;
 
-	return path;
+	for (i = 0; fyt->comment && i < fycp_max; i++)
+		fy_reparse_atom(fyrp, &fyt->comment[i]);
+
+	if (!fy_reparse_atom(fyrp, &fyt->handle))
+		return;
+
+	/* text pointing directly at the old input is looked up again */
+	if (fyt->text && fyt->text != fyt->text0 && !fyt->istr)
+		fyt->text = NULL;
+
+	if (fyt->type == FYTT_TAG)
+		fy_reparse_token(fyrp, fyt->tag.fyt_td);
 }
 
-char *fy_node_get_path(struct fy_node *fyn)
+static void fy_reparse_node(const struct fy_reparse *fyrp, struct fy_node *fyn)
 {
-	struct path_track {
-		struct path_track *prev;
-		char *path;
-	};
-	struct path_track *track, *newtrack;
-	char *path, *s, *path_mem;
-	size_t len;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
 
 	if (!fyn)
-		return NULL;
-
-	/* easy on the root */
-	if (!fyn->parent)
-		return strdup("/");
+		return;
 
-	track = NULL;
-	len = 0;
-	while ((path = fy_node_get_parent_address(fyn))) {
-		newtrack = alloca(sizeof(*newtrack));
-		newtrack->prev = track;
-		newtrack->path = path;
+	fy_reparse_token(fyrp, fyn->tag);
 
-		track = newtrack;
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		fy_reparse_token(fyrp, fyn->scalar);
+		break;
 
-		len += strlen(path) + 1;
+	case FYNT_SEQUENCE:
+		fy_reparse_token(fyrp, fyn->sequence_start);
+		fy_reparse_token(fyrp, fyn->sequence_end);
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni))
+			fy_reparse_node(fyrp, fyni);
+		break;
 
-		fyn = fyn->parent;
+	case FYNT_MAPPING:
+		fy_reparse_token(fyrp, fyn->mapping_start);
+		fy_reparse_token(fyrp, fyn->mapping_end);
+		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn->mapping, fynp)) {
+			fy_reparse_node(fyrp, fynp->key);
+			fy_reparse_node(fyrp, fynp->value);
+		}
+		break;
 	}
-	len += 2;
+}
 
-	path_mem = malloc(len);
+static void fy_reparse_document(const struct fy_reparse *fyrp, struct fy_document *fyd)
+{
+	struct fy_document_state *fyds = fyd->fyds;
+	struct fy_anchor *fya;
+	struct fy_token *fyt;
 
-	s = path_mem;
+	fy_reparse_node(fyrp, fyd->root);
 
-	while (track) {
-		len = strlen(track->path);
-		if (s) {
-			*s++ = '/';
-			memcpy(s, track->path, len);
-			s += len;
-		}
-		free(track->path);
-		track = track->prev;
-	}
+	for (fya = fy_anchor_list_head(&fyd->anchors); fya;
+			fya = fy_anchor_next(&fyd->anchors, fya))
+		fy_reparse_token(fyrp, fya->anchor);
 
-	if (s)
-		*s = '\0';
+	if (!fyds)
+		return;
 
-	return path_mem;
+	fy_reparse_token(fyrp, fyds->fyt_vd);
+	for (fyt = fy_token_list_head(&fyds->fyt_td); fyt;
+			fyt = fy_token_next(&fyds->fyt_td, fyt))
+		fy_reparse_token(fyrp, fyt);
+	if (fyds->end_mark.input_pos >= fyrp->old_end.input_pos)
+		fy_reparse_mark(fyrp, &fyds->end_mark, false);
 }
 
-struct fy_node *fy_document_load_node(struct fy_document *fyd)
+int fy_document_reparse(struct fy_document *fyd, const char *str, size_t len,
+			size_t edit_start, size_t edit_old_len, size_t edit_new_len)
 {
-	struct fy_document_state *fyds;
+	static const char head[] = "r:\n", tail[] = "s:\n";
+	struct fy_reparse fyr, *fyrp = &fyr;
 	struct fy_parser *fyp;
-	struct fy_eventp *fyep = NULL;
-	struct fy_event *fye = NULL;
-	struct fy_node *fyn = NULL;
-	struct fy_error_ctx ec;
-	int rc;
-	bool was_stream_start;
+	struct fy_node *fyn, *fyn_tmp = NULL, *fyn_new = NULL, *fyn_parent, *fyn_prev, *fyn_p;
+	struct fy_node_pair *fynp;
+	struct fy_document_state *fyds;
+	struct fy_atom handle;
+	const struct fy_mark *sm, *em;
+	struct fy_mark ds_start_mark, ds_end_mark;
+	const char *old_text;
+	char *buf = NULL, *p;
+	size_t old_size, region_len, tmp_len;
+	unsigned int anchor_count;
+	bool flow, more, ds_start_implicit, ds_end_implicit;
+	int indent;
+
+	if (!fyd || !fyd->fyp || !fyd->root || !str || fyd->lazy || fyd->cow_shared ||
+	    fyd->root->type == FYNT_SCALAR || !fyd->root->sequence_start)
+		return -1;
 
-	if (!fyd || !fyd->fyp)
-		return NULL;
+	fyp = fyd->fyp;
 
-	/* get start document state */
-	fyds = fyd->fyds;
+	if (len == (size_t)-1)
+		len = strlen(str);
 
-	fyp = fyd->fyp;
+	/* comments are attached by looking at what follows the region */
+	if ((fyp->cfg.flags & FYPCF_PARSE_COMMENTS) ||
+	    (fyd->fyds && (fyd->fyds->version_explicit || fyd->fyds->tags_explicit)))
+		return -1;
 
-again:
-	was_stream_start = false;
-	do {
-		/* get next event */
-		fyep = fy_parse_private(fyp);
+	memset(fyrp, 0, sizeof(*fyrp));
+	fyrp->fyi_old = fyd->root->sequence_start->handle.fyi;
+	if (!fyrp->fyi_old || fyrp->fyi_old->window ||
+	    (fyrp->fyi_old->cfg.type != fyit_memory && fyrp->fyi_old->cfg.type != fyit_file))
+		return -1;
 
-		/* no more */
-		if (!fyep)
-			return NULL;
+	old_text = fy_input_start(fyrp->fyi_old);
+	old_size = fy_input_size(fyrp->fyi_old);
+	if (!old_text || edit_start > old_size || edit_old_len > old_size - edit_start ||
+	    edit_new_len > len - edit_start || len - edit_new_len != old_size - edit_old_len)
+		return -1;
 
-		was_stream_start = fyep->e.type == FYET_STREAM_START;
+	fyn = fy_document_reparse_region(fyd, fyrp->fyi_old, old_text, old_size,
+					 edit_start, edit_start + edit_old_len);
+	if (!fyn || fy_reparse_has_anchors(fyd, fyn))
+		return -1;
 
-		if (was_stream_start) {
-			fy_parse_eventp_recycle(fyp, fyep);
-			fyep = NULL;
-		}
+	flow = fy_node_is_flow_collection(fyn);
+	sm = fy_token_start_mark(fyn->sequence_start);
+	em = fy_token_end_mark(fyn->sequence_end);
+	fyrp->region = *sm;
+	region_len = em->input_pos - sm->input_pos - edit_old_len + edit_new_len;
+	more = em->input_pos < old_size;
+
+	/* a flow collection must stay right of the enclosing block one */
+	indent = sm->column;
+	if (flow) {
+		for (fyn_p = fyn->parent; fyn_p && fy_node_is_flow_collection(fyn_p); fyn_p = fyn_p->parent)
+			;
+		indent = fyn_p && fyn_p->sequence_start ?
+			 fy_token_start_mark(fyn_p->sequence_start)->column + 1 : 1;
+	}
+	if (!fy_reparse_indentation_ok(str + sm->input_pos, region_len, indent, !flow))
+		return -1;
 
-	} while (was_stream_start);
+	/* where the edit ends, on the old and on the new text */
+	fyrp->old_end = *sm;
+	fy_text_mark_advance(old_text, edit_start + edit_old_len, &fyrp->old_end);
+	fyrp->new_end = *sm;
+	fy_text_mark_advance(str, edit_start + edit_new_len, &fyrp->new_end);
 
-	fye = &fyep->e;
+	/*
+	 * The region is re-scanned as the value of a mapping, on the same
+	 * column as in the document. When the document goes on past it,
+	 * it is followed by another key, like it is by less indented content.
+	 */
+	fyrp->skip = sizeof(head) - 1 + sm->column;
+	fyrp->lines = 1;
+	tmp_len = fyrp->skip + region_len + (more ? flow + sizeof(tail) - 1 : 0);
+	buf = malloc(tmp_len + 1);
+	if (!buf)
+		return -1;
+	p = buf;
+	memcpy(p, head, sizeof(head) - 1);
+	p += sizeof(head) - 1;
+	memset(p, ' ', sm->column);
+	p += sm->column;
+	memcpy(p, str + sm->input_pos, region_len);
+	p += region_len;
+	if (more) {
+		if (flow)
+			*p++ = '\n';
+		memcpy(p, tail, sizeof(tail) - 1);
+		p += sizeof(tail) - 1;
+	}
+	*p = '\0';
 
-	/* STREAM_END */
-	if (fye->type == FYET_STREAM_END) {
-		fy_parse_eventp_recycle(fyp, fyep);
+	/*
+	 * The wrapper is parsed as a document of its own, and the parser
+	 * updates the state the document shares with it; keep the
+	 * document's own start and end.
+	 */
+	fyds = fyp->current_document_state;
+	if (fyds) {
+		ds_start_implicit = fyds->start_implicit;
+		ds_end_implicit = fyds->end_implicit;
+		ds_start_mark = fyds->start_mark;
+		ds_end_mark = fyds->end_mark;
+	}
 
-		/* final STREAM_END? */
-		if (fyp->state == FYPS_END)
-			return NULL;
+	anchor_count = fyd->anchor_count;
+	fyn_tmp = fy_node_build_from_string(fyd, buf, tmp_len);
 
-		/* multi-stream */
-		goto again;
+	if (fyds) {
+		fyds->start_implicit = ds_start_implicit;
+		fyds->end_implicit = ds_end_implicit;
+		fyds->start_mark = ds_start_mark;
+		fyds->end_mark = ds_end_mark;
 	}
 
-	FY_ERROR_CHECK(fyp, fy_document_event_get_token(fye), &ec, FYEM_DOC,
-			fye->type == FYET_DOCUMENT_START,
-			err_bad_event);
+	if (!fyn_tmp || fyd->anchor_count != anchor_count ||
+	    fyn_tmp->type != FYNT_MAPPING || fy_node_is_flow_collection(fyn_tmp) ||
+	    fy_node_mapping_item_count(fyn_tmp) != 1 + more)
+		goto err_out;
 
-	/* if we have a fixed document state, drop the reference */
-	if (fye->document_start.document_state == fyds)
-		fy_document_state_unref(fyds);
+	/* take the value out of the wrapper */
+	fynp = fy_node_pair_list_head(&fyn_tmp->mapping);
+	fyn_new = fynp->value;
+	if (!fyn_new || fyn_new->type != fyn->type || fy_node_is_flow_collection(fyn_new) != flow ||
+	    !fyn_new->sequence_start || !fyn_new->sequence_end ||
+	    fy_token_start_mark(fyn_new->sequence_start)->input_pos != fyrp->skip ||
+	    fy_token_end_mark(fyn_new->sequence_end)->input_pos != fyrp->skip + region_len) {
+		fyn_new = NULL;
+		goto err_out;
+	}
+	fynp->value = NULL;
+	fyn_new->parent = NULL;
+	fy_node_free(fyn_tmp);
+	fyn_tmp = NULL;
 
-	fy_doc_debug(fyp, "calling load_node() for root");
-	rc = fy_parse_document_load_node(fyp, fyd, fy_parse_private(fyp), &fyn);
-	fy_error_check(fyp, !rc, err_out,
-			"fy_parse_document_load_node() failed");
+	fyrp->fyi_tmp = fyn_new->sequence_start->handle.fyi;
+	fyrp->fyi_new = fy_parse_input_from_data(fyp, str, len, &handle, true);
+	if (!fyrp->fyi_new)
+		goto err_out;
 
-	rc = fy_parse_document_load_end(fyp, fyd, fy_parse_private(fyp));
-	fy_error_check(fyp, !rc, err_out,
-			"fy_parse_document_load_node() failed");
+	/* the tag of the collection is before the region */
+	if (!fyn_new->tag) {
+		fyn_new->tag = fyn->tag;
+		fyn->tag = NULL;
+	}
 
-	/* always resolve parents */
-	fy_resolve_parent_node(fyd, fyn, NULL);
+	/* splice it in place of the old one */
+	fyn_parent = fyn->parent;
+	if (fyn_parent->type == FYNT_SEQUENCE) {
+		fyn_prev = fy_node_prev(&fyn_parent->sequence, fyn);
+		fy_node_list_del(&fyn_parent->sequence, fyn);
+		if (!fyn_prev)
+			fy_node_list_add(&fyn_parent->sequence, fyn_new);
+		else
+			fy_node_list_insert_after(&fyn_parent->sequence, fyn_prev, fyn_new);
+		fy_node_items_replace(fyn_parent, fyn, fyn_new);
+	} else {
+		for (fynp = fy_node_pair_list_head(&fyn_parent->mapping); fynp;
+				fynp = fy_node_pair_next(&fyn_parent->mapping, fynp)) {
+			if (fynp->value == fyn)
+				break;
+		}
+		assert(fynp);
+		fynp->value = fyn_new;
+		fy_node_hash_invalidate(fyn_parent);
+	}
+	fyn_new->parent = fyn_parent;
+	fyn->parent = NULL;
+	fy_node_free(fyn);
 
-	return fyn;
+	fy_reparse_document(fyrp, fyd);
+
+	free(buf);
+
+	return 0;
 
 err_out:
-	fy_parse_eventp_recycle(fyp, fyep);
-	return NULL;
+	fy_node_free(fyn_tmp);
+	fy_node_free(fyn_new);
+	free(buf);
+	return -1;
+}
 
-err_bad_event:
-	fy_error_report(fyp, &ec, "bad event");
-	goto err_out;
+void fy_document_set_root(struct fy_document *fyd, struct fy_node *fyn)
+{
+	if (!fyd)
+		return;
+
+	if (fyd->root) {
+		fy_node_free(fyd->root);
+		fyd->root = NULL;
+	}
+	fyn->parent = NULL;
+	fyd->root = fyn;
+	/* any change thaws the document */
+	fyd->frozen = false;
 }
 
-static struct fy_node *
-fy_node_build_internal(struct fy_document *fyd,
-		int (*parser_setup)(struct fy_parser *fyp, void *user),
-		void *user)
+struct fy_node *fy_node_create_scalar(struct fy_document *fyd, const char *data, size_t size)
 {
 	struct fy_parser *fyp;
-	struct fy_node *fyn;
-	struct fy_eventp *fyep;
-	struct fy_error_ctx ec;
-	int rc;
-	bool got_stream_end;
+	struct fy_node *fyn = NULL;
+	struct fy_input *fyi;
+	struct fy_atom handle;
+	enum fy_scalar_style style;
 
-	if (!fyd || !fyd->fyp || !parser_setup)
+	if (!fyd)
 		return NULL;
 
-	fyp = fyd->fyp;
+	if (data && size == (size_t)-1)
+		size = strlen(data);
 
-	rc = (*parser_setup)(fyp, user);
-	fy_error_check(fyp, !rc, err_out,
-			"parser_setup() failed");
+	fyp = fyd->fyp;
 
-	fyn = fy_document_load_node(fyd);
+	fyn = fy_node_alloc(fyd, FYNT_SCALAR);
 	fy_error_check(fyp, fyn, err_out,
-			"fy_document_load_node() failed");
+			"fy_node_alloc() failed");
 
-	got_stream_end = false;
-	while (!got_stream_end && (fyep = fy_parse_private(fyp)) != NULL) {
-		if (fyep->e.type == FYET_STREAM_END)
-			got_stream_end = true;
-		fy_parse_eventp_recycle(fyp, fyep);
-	}
+	fyi = fy_parse_input_from_data(fyp, data, size, &handle, false);
+	fy_error_check(fyp, fyi, err_out,
+			"fy_parse_input_from_data() failed");
 
-	if (got_stream_end) {
-		fyep = fy_parse_private(fyp);
+	style = handle.style == FYAS_PLAIN ? FYSS_PLAIN : FYSS_DOUBLE_QUOTED;
 
-		FY_ERROR_CHECK(fyp, fy_document_event_get_token(&fyep->e), &ec, FYEM_DOC,
-				!fyep,
-				err_trailing_event);
-		fy_parse_eventp_recycle(fyp, fyep);
-	}
+	fyn->scalar = fy_token_create(fyp, FYTT_SCALAR, &handle, style);
+	fy_error_check(fyp, fyn->scalar, err_out,
+			"fy_token_create() failed");
 
 	return fyn;
 
 err_out:
+	fy_node_free(fyn);
 	return NULL;
-
-err_trailing_event:
-	fy_error_report(fyp, &ec, "trailing events after the last");
-	goto err_out;
 }
 
-struct fy_node *fy_node_build_from_string(struct fy_document *fyd, const char *str, size_t len)
+/* a line starting with whitespace; folding keeps the breaks around it */
+static bool fy_text_has_indented_line(const char *data, size_t size)
 {
-	struct fy_document_build_string_ctx ctx = {
-		.str = str,
-		.len = len,
-	};
+	const char *s = data, *e = data + size;
 
-	return fy_node_build_internal(fyd, parser_setup_from_string, &ctx);
+	while ((s = memchr(s, '\n', e - s)) != NULL && ++s < e) {
+		if (fy_is_ws(*s))
+			return true;
+	}
+	return false;
 }
 
-struct fy_node *fy_node_build_from_file(struct fy_document *fyd, const char *file)
+/* the style, or double quoted when that wouldn't give back exactly the text */
+static enum fy_scalar_style fy_scalar_text_style(const char *data, size_t size,
+						 unsigned int aflags, bool escaped,
+						 enum fy_scalar_style style)
 {
-	struct fy_document_build_file_ctx ctx = {
-		.file = file,
-	};
-
-	return fy_node_build_internal(fyd, parser_setup_from_file, &ctx);
+	switch (style) {
+	case FYSS_ANY:
+	case FYSS_PLAIN:
+		/* stay clear of anything starting with an indicator too */
+		if (size && fy_atom_content_is_direct(data, size, aflags) &&
+		    !(aflags & (FYACF_STARTS_WITH_WS | FYACF_ENDS_WITH_WS)) &&
+		    !strchr("-?:,[]{}#&*!|>'\"%@`", data[0]))
+			return FYSS_PLAIN;
+		break;
+	case FYSS_SINGLE_QUOTED:
+		if ((aflags & (FYACF_PRINTABLE | FYACF_LB)) == FYACF_PRINTABLE)
+			return style;
+		break;
+	case FYSS_LITERAL:
+	case FYSS_FOLDED:
+		/* trailing blanks and a bare run of breaks don't survive chomping */
+		if (size && !escaped && (aflags & FYACF_PRINTABLE) &&
+		    !(aflags & (FYACF_STARTS_WITH_WS | FYACF_ENDS_WITH_WS)) &&
+		    fy_find_non_lb(data, size) &&
+		    (style != FYSS_FOLDED || !fy_text_has_indented_line(data, size)))
+			return style;
+		break;
+	default:
+		break;
+	}
+	return FYSS_DOUBLE_QUOTED;
 }
 
-struct fy_node *fy_node_build_from_fp(struct fy_document *fyd, FILE *fp)
+/* copied scalars larger than a quarter chunk get an input of their own */
+#define FY_DOCUMENT_BUILD_CHUNK	(16 << 10)
+
+/* get an input holding the data, and their position in it */
+static struct fy_input *fy_document_build_input(struct fy_document *fyd,
+						const char *data, size_t size,
+						enum fy_node_build_data mode,
+						size_t *posp)
 {
-	struct fy_document_build_fp_ctx ctx = {
-		.name = NULL,
-		.fp = fp,
-	};
+	struct fy_parser *fyp = fyd->fyp;
+	struct fy_input *fyi;
+	void *buf = NULL;
 
-	return fy_node_build_internal(fyd, parser_setup_from_fp, &ctx);
-}
+	*posp = 0;
 
-void fy_document_set_root(struct fy_document *fyd, struct fy_node *fyn)
-{
-	if (!fyd)
-		return;
+	switch (mode) {
+	case FYNBD_REFERENCE:
+	case FYNBD_TAKE:
+		fyi = fy_parse_input_from_buffer(fyp, data, size, mode == FYNBD_TAKE);
+		if (!fyi && mode == FYNBD_TAKE)
+			free((void *)data);
+		return fyi;
 
-	if (fyd->root) {
-		fy_node_free(fyd->root);
-		fyd->root = NULL;
+	case FYNBD_COPY:
+		break;
+
+	default:
+		return NULL;
 	}
-	fyn->parent = NULL;
-	fyd->root = fyn;
+
+	if (size > FY_DOCUMENT_BUILD_CHUNK / 4) {
+		buf = malloc(size);
+		fy_error_check(fyp, buf, err_out,
+				"malloc() failed");
+		memcpy(buf, data, size);
+		return fy_document_build_input(fyd, buf, size, FYNBD_TAKE, posp);
+	}
+
+	if (fyd->build_fyi && fyd->build_used + size <= FY_DOCUMENT_BUILD_CHUNK) {
+		fyi = fyd->build_fyi;
+		*posp = fyd->build_used;
+		if (size)
+			memcpy((char *)fyi->buffer + *posp, data, size);
+		fyd->build_used += size;
+		return fyi;
+	}
+
+	/* start a new chunk with the data at its head */
+	buf = malloc(FY_DOCUMENT_BUILD_CHUNK);
+	fy_error_check(fyp, buf, err_out,
+			"malloc() failed");
+	if (size)
+		memcpy(buf, data, size);
+
+	fyi = fy_parse_input_from_buffer(fyp, buf, FY_DOCUMENT_BUILD_CHUNK, true);
+	if (!fyi) {
+		free(buf);
+		goto err_out;
+	}
+
+	fy_input_unref(fyd->build_fyi);
+	fyd->build_fyi = fy_input_ref(fyi);
+	fyd->build_used = size;
+
+	return fyi;
+
+err_out:
+	return NULL;
 }
 
-struct fy_node *fy_node_create_scalar(struct fy_document *fyd, const char *data, size_t size)
+struct fy_node *fy_node_create_scalar_direct(struct fy_document *fyd,
+					     const char *data, size_t size,
+					     enum fy_scalar_style style,
+					     enum fy_node_build_data mode)
 {
 	struct fy_parser *fyp;
 	struct fy_node *fyn = NULL;
 	struct fy_input *fyi;
 	struct fy_atom handle;
-	enum fy_scalar_style style;
+	unsigned int aflags;
+	bool direct, escaped;
+	char *buf;
+	size_t pos;
 
-	if (!fyd)
+	if (!fyd || (!data && size) || style < FYSS_ANY || style >= FYSS_MAX) {
+		if (fyd && mode == FYNBD_TAKE)
+			free((void *)data);
 		return NULL;
+	}
 
 	if (data && size == (size_t)-1)
 		size = strlen(data);
 
 	fyp = fyd->fyp;
 
-	fyn = fy_node_alloc(fyd, FYNT_SCALAR);
-	fy_error_check(fyp, fyn, err_out,
-			"fy_node_alloc() failed");
+	if (size > 0)
+		aflags = fy_analyze_scalar_content(data, size);
+	else
+		aflags = FYACF_EMPTY | FYACF_FLOW_PLAIN | FYACF_BLOCK_PLAIN;
 
-	fyi = fy_parse_input_from_data(fyp, data, size, &handle, false);
+	/* the text is the content, as is, unless it has to be escaped */
+	direct = fy_atom_content_is_direct(data, size, aflags);
+	escaped = !direct && fy_atom_content_needs_escape(data, size);
+	style = fy_scalar_text_style(data, size, aflags, escaped, style);
+
+	if (!escaped) {
+		fyi = fy_document_build_input(fyd, data, size, mode, &pos);
+	} else {
+		buf = malloc(FY_ATOM_CONTENT_ESCAPE_MAX(size));
+		if (buf) {
+			size = fy_atom_content_escape(data, size, buf);
+			fyi = fy_document_build_input(fyd, buf, size, FYNBD_COPY, &pos);
+			free(buf);
+		} else
+			fyi = NULL;
+		if (mode == FYNBD_TAKE)
+			free((void *)data);
+	}
 	fy_error_check(fyp, fyi, err_out,
-			"fy_parse_input_from_data() failed");
+			"fy_document_build_input() failed");
+
+	fyn = fy_node_alloc(fyd, FYNT_SCALAR);
+	fy_error_check(fyp, fyn, err_out,
+			"fy_node_alloc() failed");
 
-	style = handle.style == FYAS_PLAIN ? FYSS_PLAIN : FYSS_DOUBLE_QUOTED;
+	fyn->style = fy_node_style_from_scalar_style(style);
+
+	fy_atom_content_setup(&handle, fyi, pos, size,
+			      fy_utf8_count(size ? (const char *)fy_input_start(fyi) + pos : NULL, size),
+			      aflags, direct, escaped);
 
 	fyn->scalar = fy_token_create(fyp, FYTT_SCALAR, &handle, style);
 	fy_error_check(fyp, fyn->scalar, err_out,
@@ -3801,7 +7055,8 @@ static int tag_handle_length(const char *data, size_t len)
 	s += w;
 
 	c = fy_utf8_get(s, e - s, &w);
-	if (fy_is_ws(c))
+	/* the non-specific tag '!' may be all there is */
+	if (fy_is_ws(c) || c < 0)
 		return s - data;
 	/* if first character is !, empty handle */
 	if (c == '!') {
@@ -3908,21 +7163,18 @@ static int tag_uri_length(const char *data, size_t len)
 	return uri_length;
 }
 
-
-int fy_node_set_tag(struct fy_node *fyn, const char *data, size_t len)
+/* a tag token for the text, resolved with the directives of the document */
+static struct fy_token *fy_document_tag_create(struct fy_document *fyd, const char *data, size_t len)
 {
-	struct fy_document *fyd;
 	int total_length, handle_length, uri_length, prefix_length, suffix_length;
 	const char *s, *e, *handle_start;
 	int c, w, cn, wn;
 	struct fy_atom handle;
 	struct fy_input *fyi = NULL;
-	struct fy_token *fyt = NULL, *fyt_td = NULL;
-
-	if (!fyn || !data || !len || !fyn->fyd)
-		return -1;
+	struct fy_token *fyt_td = NULL;
 
-	fyd = fyn->fyd;
+	if (!fyd || !data || !len)
+		return NULL;
 
 	if (len == (size_t)-1)
 		len = strlen(data);
@@ -3935,7 +7187,7 @@ int fy_node_set_tag(struct fy_node *fyn, const char *data, size_t len)
 	/* it must start with '!' */
 	c = fy_utf8_get(s, e - s, &w);
 	if (c != '!')
-		return -1;
+		return NULL;
 	cn = fy_utf8_get(s + w, e - (s + w), &wn);
 	if (cn == '<') {
 		prefix_length = 2;
@@ -3951,13 +7203,13 @@ int fy_node_set_tag(struct fy_node *fyn, const char *data, size_t len)
 		/* we scan back to back, and split handle/suffix */
 		handle_length = tag_handle_length(s, e - s);
 		if (handle_length <= 0)
-			return -1;
+			return NULL;
 		s += handle_length;
 	}
 
 	uri_length = tag_uri_length(s, e - s);
 	if (uri_length < 0)
-		return -1;
+		return NULL;
 
 	/* a handle? */
 	if (!prefix_length && (handle_length == 0 || data[handle_length - 1] != '!')) {
@@ -3974,29 +7226,44 @@ int fy_node_set_tag(struct fy_node *fyn, const char *data, size_t len)
 
 	/* everything must be consumed */
 	if (total_length != (int)len)
-		return -1;
+		return NULL;
 
 	handle_start = data + prefix_length;
 
 	fyt_td = fy_document_state_lookup_tag_directive(fyd->fyds,
 			handle_start, handle_length);
 	if (!fyt_td)
-		return -1;
+		return NULL;
 
 	fyi = fy_parse_input_from_data(fyd->fyp, data, len, &handle, true);
 	if (!fyi)
-		return -1;
+		return NULL;
 
 	handle.style = FYAS_URI;
 	handle.direct_output = false;
 	handle.storage_hint = 0;
 	handle.storage_hint_valid = false;
 
-	fyt = fy_token_create(fyd->fyp, FYTT_TAG, &handle, prefix_length,
-				handle_length, uri_length, fyt_td);
+	return fy_token_create(fyd->fyp, FYTT_TAG, &handle, prefix_length,
+			       handle_length, uri_length, fyt_td);
+}
+
+int fy_node_set_tag(struct fy_node *fyn, const char *data, size_t len)
+{
+	struct fy_token *fyt;
+
+	if (!fyn || !data || !len || !fyn->fyd)
+		return -1;
+
+	fyt = fy_document_tag_create(fyn->fyd, data, len);
 	if (!fyt)
 		return -1;
 
+	if (fy_node_cow_detach_path(fyn)) {
+		fy_token_unref(fyt);
+		return -1;
+	}
+
 	fy_token_unref(fyn->tag);
 	fyn->tag = fyt;
 
@@ -4015,7 +7282,8 @@ struct fy_node *fy_node_create_mapping(struct fy_document *fyd)
 
 static int fy_node_sequence_insert_prepare(struct fy_node *fyn_seq, struct fy_node *fyn)
 {
-	if (!fyn_seq || !fyn || fyn_seq->type != FYNT_SEQUENCE)
+	if (!fyn_seq || !fyn || fyn_seq->type != FYNT_SEQUENCE ||
+	    fy_node_prepare_change(fyn_seq))
 		return -1;
 
 	fyn->parent = fyn_seq;
@@ -4031,6 +7299,31 @@ int fy_node_sequence_append(struct fy_node *fyn_seq, struct fy_node *fyn)
 		return ret;
 
 	fy_node_list_add_tail(&fyn_seq->sequence, fyn);
+	fy_node_items_push(fyn_seq, fyn);
+	return 0;
+}
+
+int fy_node_sequence_append_items(struct fy_node *fyn_seq, struct fy_node **items, int count)
+{
+	int i;
+
+	if (!fyn_seq || fyn_seq->type != FYNT_SEQUENCE || count < 0 || (count && !items) ||
+	    fy_node_prepare_change(fyn_seq))
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		if (!items[i])
+			return -1;
+	}
+
+	fy_node_items_reserve(fyn_seq, count);
+
+	for (i = 0; i < count; i++) {
+		items[i]->parent = fyn_seq;
+		fy_node_list_add_tail(&fyn_seq->sequence, items[i]);
+		fy_node_items_push(fyn_seq, items[i]);
+	}
+
 	return 0;
 }
 
@@ -4043,6 +7336,7 @@ int fy_node_sequence_prepend(struct fy_node *fyn_seq, struct fy_node *fyn)
 		return ret;
 
 	fy_node_list_add(&fyn_seq->sequence, fyn);
+	fy_node_items_invalidate(fyn_seq);
 	return 0;
 }
 
@@ -4073,6 +7367,7 @@ int fy_node_sequence_insert_before(struct fy_node *fyn_seq,
 		return ret;
 
 	fy_node_list_insert_before(&fyn_seq->sequence, fyn_mark, fyn);
+	fy_node_items_invalidate(fyn_seq);
 
 	return 0;
 }
@@ -4090,15 +7385,18 @@ int fy_node_sequence_insert_after(struct fy_node *fyn_seq,
 		return ret;
 
 	fy_node_list_insert_after(&fyn_seq->sequence, fyn_mark, fyn);
+	fy_node_items_invalidate(fyn_seq);
 
 	return 0;
 }
 
 struct fy_node *fy_node_sequence_remove(struct fy_node *fyn_seq, struct fy_node *fyn)
 {
-	if (!fy_node_sequence_contains_node(fyn_seq, fyn))
+	if (!fy_node_sequence_contains_node(fyn_seq, fyn) ||
+	    fy_node_prepare_change(fyn_seq))
 		return NULL;
 
+	fy_node_items_remove(fyn_seq, fyn);
 	fy_node_list_del(&fyn_seq->sequence, fyn);
 	fyn->parent = NULL;
 	return fyn;
@@ -4112,12 +7410,16 @@ fy_node_mapping_pair_insert_prepare(struct fy_node *fyn_map,
 	struct fy_node_pair *fynp;
 
 	if (!fyn_map || fyn_map->type != FYNT_MAPPING ||
-	    fy_node_mapping_key_is_duplicate(fyn_map, fyn_key))
+	    fy_node_mapping_key_is_duplicate(fyn_map, fyn_key) ||
+	    fy_node_prepare_change(fyn_map))
 		return NULL;
 
 	fyd = fyn_map->fyd;
 	assert(fyd);
 
+	if (fy_node_key_intern(fyd, fyn_key))
+		return NULL;
+
 	fynp = fy_node_pair_alloc(fyd);
 	if (!fynp)
 		return NULL;
@@ -4144,6 +7446,31 @@ int fy_node_mapping_append(struct fy_node *fyn_map,
 		return -1;
 
 	fy_node_pair_list_add_tail(&fyn_map->mapping, fynp);
+	fy_node_items_push(fyn_map, fynp);
+	fy_node_mapping_index_add(fyn_map, fynp);
+
+	return 0;
+}
+
+int fy_node_mapping_append_pairs(struct fy_node *fyn_map, struct fy_node **items, int count)
+{
+	int i;
+
+	if (!fyn_map || fyn_map->type != FYNT_MAPPING || count < 0 || (count && !items) ||
+	    fy_node_prepare_change(fyn_map))
+		return -1;
+
+	fy_node_items_reserve(fyn_map, count);
+
+	/* index up front, so that the duplicate key checks do not go linear */
+	if (!fyn_map->mapping_index &&
+	    fy_node_mapping_item_count(fyn_map) + count >= FY_NODE_MAPPING_INDEX_MIN)
+		fy_node_mapping_index_build(fyn_map);
+
+	for (i = 0; i < count; i++) {
+		if (fy_node_mapping_append(fyn_map, items[i * 2], items[i * 2 + 1]))
+			return -1;
+	}
 
 	return 0;
 }
@@ -4158,6 +7485,8 @@ int fy_node_mapping_prepend(struct fy_node *fyn_map,
 		return -1;
 
 	fy_node_pair_list_add(&fyn_map->mapping, fynp);
+	fy_node_items_invalidate(fyn_map);
+	fy_node_mapping_index_add(fyn_map, fynp);
 
 	return 0;
 }
@@ -4178,9 +7507,12 @@ bool fy_node_mapping_contains_pair(struct fy_node *fyn_map, struct fy_node_pair
 
 int fy_node_mapping_remove(struct fy_node *fyn_map, struct fy_node_pair *fynp)
 {
-	if (!fy_node_mapping_contains_pair(fyn_map, fynp))
+	if (!fy_node_mapping_contains_pair(fyn_map, fynp) ||
+	    fy_node_prepare_change(fyn_map))
 		return -1;
 
+	fy_node_items_remove(fyn_map, fynp);
+	fy_node_mapping_index_del(fyn_map, fynp);
 	fy_node_pair_list_del(&fyn_map->mapping, fynp);
 
 	if (fynp->value)
@@ -4198,7 +7530,7 @@ struct fy_node *fy_node_mapping_remove_by_key(struct fy_node *fyn_map, struct fy
 	struct fy_node *fyn_value;
 
 	fynp = fy_node_mapping_lookup_pair(fyn_map, fyn_key);
-	if (!fynp)
+	if (!fynp || fy_node_prepare_change(fyn_map))
 		return NULL;
 
 	fyn_value = fynp->value;
@@ -4210,6 +7542,8 @@ struct fy_node *fy_node_mapping_remove_by_key(struct fy_node *fyn_map, struct fy
 		fy_node_free(fyn_key);
 	fynp->value = NULL;
 
+	fy_node_items_remove(fyn_map, fynp);
+	fy_node_mapping_index_del(fyn_map, fynp);
 	fy_node_pair_list_del(&fyn_map->mapping, fynp);
 
 	fy_node_pair_free(fynp);
@@ -4222,127 +7556,255 @@ void *fy_node_mapping_sort_ctx_arg(struct fy_node_mapping_sort_ctx *ctx)
 	return ctx->arg;
 }
 
-static int fy_node_mapping_sort_cmp(
-#ifdef __APPLE__
-void *arg, const void *a, const void *b
-#else
-const void *a, const void *b, void *arg
-#endif
-)
-{
-	struct fy_node_mapping_sort_ctx *ctx = arg;
-	struct fy_node_pair * const *fynppa = a, * const *fynppb = b;
+/*
+ * A mapping pair with its sort key extracted up front; the default
+ * order never has to go back to the tokens while sorting.
+ */
+struct fy_node_sort_key {
+	uint64_t prefix;	/* first 8 bytes of the text, big endian */
+	const char *text;
+	size_t len;
+	int class;
+	int idx;
+	struct fy_node_pair *fynp;
+};
 
-	assert(fynppa >= ctx->fynpp && fynppa < ctx->fynpp + ctx->count);
-	assert(fynppb >= ctx->fynpp && fynppb < ctx->fynpp + ctx->count);
+/* classes in default sort order */
+enum fy_node_sort_class {
+	FYNSC_MAPPING,
+	FYNSC_SEQUENCE,
+	FYNSC_ALIAS,
+	FYNSC_NULL,
+	FYNSC_SCALAR,
+};
 
-	return ctx->key_cmp(*fynppa, *fynppb, ctx->arg);
-}
+/* below this insertion sort is faster than merging */
+#define FY_NODE_SORT_RUN	16
 
-/* not! thread safe! */
-#if !defined(HAVE_QSORT_R) || !HAVE_QSORT_R
-static struct fy_node_mapping_sort_ctx *fy_node_mapping_sort_ctx_no_qsort_r;
+/* a fy_node_sort() with less keys than this is not worth the threads */
+#define FY_NODE_SORT_PARALLEL_MIN	16384
 
-static int fy_node_mapping_sort_cmp_no_qsort_r(const void *a, const void *b)
+static int fy_node_sort_key_setup(struct fy_node_sort_key *key, struct fy_node_pair *fynp,
+				  int idx, const struct fy_node_mapping_sort_ctx *ctx)
 {
-#ifdef __APPLE__
-	return fy_node_mapping_sort_cmp(
-			fy_node_mapping_sort_ctx_no_qsort_r,
-			a, b);
-#else
-	return fy_node_mapping_sort_cmp( a, b,
-			fy_node_mapping_sort_ctx_no_qsort_r);
-#endif
+	struct fy_node *fyn = fynp->key;
+	const uint8_t *s;
+	size_t i;
+
+	memset(key, 0, sizeof(*key));
+	key->fynp = fynp;
+	key->idx = idx;
+
+	/* user supplied comparison; nothing to extract */
+	if (ctx->key_cmp)
+		return 0;
+
+	if (!fyn) {
+		key->class = FYNSC_NULL;
+		return 0;
+	}
+
+	if (fyn->type == FYNT_MAPPING) {
+		key->class = FYNSC_MAPPING;
+		return 0;
+	}
+
+	if (fyn->type == FYNT_SEQUENCE) {
+		key->class = FYNSC_SEQUENCE;
+		return 0;
+	}
+
+	key->class = fy_node_is_alias(fyn) ? FYNSC_ALIAS : FYNSC_SCALAR;
+	if (!fyn->scalar)
+		return 0;
+
+	key->text = fy_token_get_text(fyn->scalar, &key->len);
+	if (!key->text)
+		return -1;
+
+	s = (const uint8_t *)key->text;
+	for (i = 0; i < sizeof(key->prefix); i++)
+		key->prefix = (key->prefix << 8) | (i < key->len ? s[i] : 0);
+
+	return 0;
 }
 
+static int fy_node_sort_key_cmp(const struct fy_node_sort_key *a,
+				const struct fy_node_sort_key *b,
+				const struct fy_node_mapping_sort_ctx *ctx)
+{
+	size_t l;
+	int ret;
+
+	if (ctx->key_cmp)
+		return ctx->key_cmp(a->fynp, b->fynp, ctx->arg);
 
-#endif
+	if (a->class != b->class)
+		return a->class < b->class ? -1 : 1;
+
+	/* collections keep their relative order */
+	if (a->class < FYNSC_ALIAS || a->class == FYNSC_NULL)
+		return a->idx < b->idx ? -1 : a->idx > b->idx ? 1 : 0;
+
+	if (a->prefix != b->prefix)
+		return a->prefix < b->prefix ? -1 : 1;
+
+	/* the prefix covers the short keys completely */
+	if (a->len > sizeof(a->prefix) && b->len > sizeof(b->prefix)) {
+		l = a->len < b->len ? a->len : b->len;
+		ret = memcmp(a->text + sizeof(a->prefix), b->text + sizeof(b->prefix),
+			     l - sizeof(a->prefix));
+		if (ret)
+			return ret;
+	}
 
-/* the default sort method */
-static int fy_node_mapping_sort_cmp_default(const struct fy_node_pair *fynp_a,
-					    const struct fy_node_pair *fynp_b,
-					    void *arg __attribute__((__unused__)))
+	return a->len == b->len ? 0 : a->len < b->len ? -1 : 1;
+}
+
+/*
+ * Stable bottom-up merge sort of the keys, using tmp (of the same size)
+ * as scratch space. Unlike qsort_r this is reentrant everywhere and the
+ * comparison method is called with the context directly.
+ */
+static void fy_node_sort_keys(struct fy_node_sort_key *keys, struct fy_node_sort_key *tmp,
+			      int count, const struct fy_node_mapping_sort_ctx *ctx)
 {
-	int idx_a, idx_b;
-	bool alias_a, alias_b, scalar_a, scalar_b;
-	struct fy_token *fyt1, *fyt2;
+	struct fy_node_sort_key *src, *dst, *t, key;
+	int i, j, k, l, m, e, width;
+
+	/* insertion sort the short runs */
+	for (i = 0; i < count; i += FY_NODE_SORT_RUN) {
+		e = i + FY_NODE_SORT_RUN < count ? i + FY_NODE_SORT_RUN : count;
+		for (j = i + 1; j < e; j++) {
+			if (fy_node_sort_key_cmp(&keys[j - 1], &keys[j], ctx) <= 0)
+				continue;
+			key = keys[j];
+			for (k = j; k > i && fy_node_sort_key_cmp(&keys[k - 1], &key, ctx) > 0; k--)
+				keys[k] = keys[k - 1];
+			keys[k] = key;
+		}
+	}
 
-	/* order is: maps first, followed by sequences, and last scalars sorted */
-	scalar_a = !fynp_a->key || fy_node_is_scalar(fynp_a->key);
-	scalar_b = !fynp_b->key || fy_node_is_scalar(fynp_b->key);
+	src = keys;
+	dst = tmp;
+	for (width = FY_NODE_SORT_RUN; width < count; width *= 2) {
+		for (i = 0; i < count; i += 2 * width) {
+			m = i + width < count ? i + width : count;
+			e = i + 2 * width < count ? i + 2 * width : count;
 
-	/* scalar? perform comparison */
-	if (scalar_a && scalar_b) {
+			/* already in order, just copy */
+			if (m >= e || fy_node_sort_key_cmp(&src[m - 1], &src[m], ctx) <= 0) {
+				memcpy(dst + i, src + i, (e - i) * sizeof(*dst));
+				continue;
+			}
 
-		/* if both are aliases, sort skipping the '*' */
-		alias_a = fy_node_is_alias(fynp_a->key);
-		alias_b = fy_node_is_alias(fynp_b->key);
+			for (j = i, l = m, k = i; j < m && l < e; k++) {
+				if (fy_node_sort_key_cmp(&src[l], &src[j], ctx) < 0)
+					dst[k] = src[l++];
+				else
+					dst[k] = src[j++];
+			}
+			if (j < m)
+				memcpy(dst + k, src + j, (m - j) * sizeof(*dst));
+			else if (l < e)
+				memcpy(dst + k, src + l, (e - l) * sizeof(*dst));
+		}
+		t = src;
+		src = dst;
+		dst = t;
+	}
 
-		/* aliases win */
-		if (alias_a && !alias_b)
-			return -1;
+	if (src != keys)
+		memcpy(keys, src, count * sizeof(*keys));
+}
 
-		if (!alias_a && alias_b)
-			return 1;
+/* extract the keys of a mapping; the array has room for count + 1 entries */
+static struct fy_node_sort_key *fy_node_mapping_sort_keys(struct fy_node *fyn_map,
+		const struct fy_node_mapping_sort_ctx *ctx, int *countp)
+{
+	struct fy_node_sort_key *keys;
+	struct fy_node_pair *fynpi;
+	int count, i;
+
+	count = fy_node_mapping_item_count(fyn_map);
+	if (count < 0)
+		return NULL;
+
+	keys = malloc((count + 1) * sizeof(*keys));
+	if (!keys)
+		return NULL;
 
-		fyt1 = fynp_a->key ? fynp_a->key->scalar : NULL;
-		fyt2 = fynp_b->key ? fynp_b->key->scalar : NULL;
+	for (i = 0, fynpi = fy_node_pair_list_head(&fyn_map->mapping); i < count && fynpi;
+		fynpi = fy_node_pair_next(&fyn_map->mapping, fynpi), i++) {
 
-		return fy_token_cmp(fyt1, fyt2);
+		if (fy_node_sort_key_setup(&keys[i], fynpi, i, ctx)) {
+			free(keys);
+			return NULL;
+		}
 	}
+	assert(i == count);
 
-	/* b is scalar, a is not */
-	if (!scalar_a && scalar_b)
-		return -1;
+	*countp = count;
+	return keys;
+}
+
+static int fy_node_mapping_sort_keys_sorted(struct fy_node *fyn_map,
+		const struct fy_node_mapping_sort_ctx *ctx,
+		struct fy_node_sort_key **keysp, int *countp)
+{
+	struct fy_node_sort_key *keys, *tmp;
+	int count;
 
-	/* a is scalar, b is not */
-	if (scalar_a && !scalar_b)
-		return 1;
+	keys = fy_node_mapping_sort_keys(fyn_map, ctx, &count);
+	if (!keys)
+		return -1;
 
-	/* different types, mappings win */
-	if (fynp_a->key->type != fynp_b->key->type)
-		return fynp_a->key->type == FYNT_MAPPING ? -1 : 1;
+	if (count > FY_NODE_SORT_RUN) {
+		tmp = malloc(count * sizeof(*tmp));
+		if (!tmp) {
+			free(keys);
+			return -1;
+		}
+		fy_node_sort_keys(keys, tmp, count, ctx);
+		free(tmp);
+	} else
+		fy_node_sort_keys(keys, NULL, count, ctx);
 
-	/* ok, need to compare indices now */
-	idx_a = fy_node_mapping_get_pair_index(fynp_a->parent, fynp_a);
-	idx_b = fy_node_mapping_get_pair_index(fynp_b->parent, fynp_b);
+	*keysp = keys;
+	*countp = count;
+	return 0;
+}
 
-	return idx_a > idx_b ? 1 : (idx_a < idx_b ? -1 : 0);
+static void fy_node_mapping_sort_ctx_setup(struct fy_node_mapping_sort_ctx *ctx,
+		fy_node_mapping_sort_fn key_cmp, void *arg)
+{
+	ctx->key_cmp = key_cmp;
+	ctx->arg = arg;
 }
 
-void fy_node_mapping_perform_sort(struct fy_node *fyn_map,
+int fy_node_mapping_perform_sort(struct fy_node *fyn_map,
 		fy_node_mapping_sort_fn key_cmp, void *arg,
 		struct fy_node_pair **fynpp, int count)
 {
-	int i;
-	struct fy_node_pair *fynpi;
 	struct fy_node_mapping_sort_ctx ctx;
+	struct fy_node_sort_key *keys;
+	int i, nkeys;
 
-	for (i = 0, fynpi = fy_node_pair_list_head(&fyn_map->mapping); i < count && fynpi;
-		fynpi = fy_node_pair_next(&fyn_map->mapping, fynpi), i++)
-		fynpp[i] = fynpi;
+	fy_node_mapping_sort_ctx_setup(&ctx, key_cmp, arg);
+
+	if (fy_node_mapping_sort_keys_sorted(fyn_map, &ctx, &keys, &nkeys))
+		return -1;
+
+	for (i = 0; i < count && i < nkeys; i++)
+		fynpp[i] = keys[i].fynp;
 
 	/* if there's enough space, put down a NULL at the end */
 	if (i < count)
 		fynpp[i++] = NULL;
-	assert(i == count);
 
-	ctx.key_cmp = key_cmp ? : fy_node_mapping_sort_cmp_default;
-	ctx.arg = arg;
-	ctx.fynpp = fynpp;
-	ctx.count = count;
-#if defined(HAVE_QSORT_R) && HAVE_QSORT_R
-#ifdef __APPLE__
-	qsort_r(fynpp, count, sizeof(*fynpp), &ctx, fy_node_mapping_sort_cmp);
-#else
-	qsort_r(fynpp, count, sizeof(*fynpp), fy_node_mapping_sort_cmp, &ctx);
-#endif
-#else
-	/* caution, not thread safe */
-	fy_node_mapping_sort_ctx_no_qsort_r = &ctx;
-	qsort(fynpp, count, sizeof(*fynpp), fy_node_mapping_sort_cmp_no_qsort_r);
-	fy_node_mapping_sort_ctx_no_qsort_r = NULL;
-#endif
+	free(keys);
+
+	return 0;
 }
 
 struct fy_node_pair **fy_node_mapping_sort_array(struct fy_node *fyn_map,
@@ -4361,7 +7823,10 @@ struct fy_node_pair **fy_node_mapping_sort_array(struct fy_node *fyn_map,
 
 	memset(fynpp, 0, (count + 1) * sizeof(*fynpp));
 
-	fy_node_mapping_perform_sort(fyn_map, key_cmp, arg, fynpp, count);
+	if (fy_node_mapping_perform_sort(fyn_map, key_cmp, arg, fynpp, count)) {
+		free(fynpp);
+		return NULL;
+	}
 
 	if (countp)
 		*countp = count;
@@ -4377,73 +7842,250 @@ void fy_node_mapping_sort_release_array(struct fy_node *fyn_map, struct fy_node_
 	free(fynpp);
 }
 
+/* rebuild the pair list of the mapping in the order of the keys */
+static void fy_node_mapping_sort_apply(struct fy_node *fyn_map,
+		const struct fy_node_sort_key *keys, int count)
+{
+	struct fy_node_pair *fynpi;
+	int i;
+
+	fy_node_pair_list_init(&fyn_map->mapping);
+	fyn_map->items_count = 0;
+	for (i = 0; i < count; i++) {
+		fynpi = keys[i].fynp;
+		fy_node_pair_list_add_tail(&fyn_map->mapping, fynpi);
+		fy_node_items_push(fyn_map, fynpi);
+	}
+}
+
 int fy_node_mapping_sort(struct fy_node *fyn_map,
 		fy_node_mapping_sort_fn key_cmp,
 		void *arg)
 {
-	int count, i;
-	struct fy_node_pair **fynpp, *fynpi;
+	struct fy_node_mapping_sort_ctx ctx;
+	struct fy_node_sort_key *keys;
+	int count;
+
+	if (fy_node_prepare_change(fyn_map))
+		return -1;
+
+	fy_node_mapping_sort_ctx_setup(&ctx, key_cmp, arg);
+
+	if (fy_node_mapping_sort_keys_sorted(fyn_map, &ctx, &keys, &count))
+		return -1;
+
+	fy_node_mapping_sort_apply(fyn_map, keys, count);
+
+	free(keys);
+
+	return 0;
+}
+
+/* a mapping of a tree being sorted */
+struct fy_node_sort_job {
+	struct fy_node *fyn;
+	struct fy_node_sort_key *keys;
+	int count;
+};
+
+struct fy_node_sort_tree {
+	struct fy_node_mapping_sort_ctx ctx;
+	struct fy_node_sort_job *jobs;
+	unsigned int count;
+	unsigned int alloc;
+	unsigned int next;
+	size_t total;
+	int max_count;
+	bool failed;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
+/*
+ * Prepare every mapping in the tree for sorting and extract the keys.
+ * Anything that touches shared state (lazy expansion, detaching copies,
+ * creating the cached token text) happens here, so the sorting itself
+ * only ever touches the job's own keys.
+ */
+static int fy_node_sort_collect(struct fy_node_sort_tree *fyst, struct fy_node *fyn)
+{
+	struct fy_node_sort_job *job, *jobs;
+	struct fy_node_sort_key *keys;
+	struct fy_node *fyni;
+	unsigned int alloc;
+	int i, count;
+
+	if (!fyn)
+		return 0;
+
+	if (fy_node_lazy_expand(fyn))
+		return -1;
+
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		break;
+
+	case FYNT_SEQUENCE:
+		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
+				fyni = fy_node_next(&fyn->sequence, fyni)) {
+
+			if (fy_node_sort_collect(fyst, fyni))
+				return -1;
+		}
+		break;
+
+	case FYNT_MAPPING:
+		if (fy_node_prepare_change(fyn))
+			return -1;
+
+		if (fyst->count >= fyst->alloc) {
+			alloc = fyst->alloc ? fyst->alloc * 2 : 16;
+			jobs = realloc(fyst->jobs, alloc * sizeof(*jobs));
+			if (!jobs)
+				return -1;
+			fyst->jobs = jobs;
+			fyst->alloc = alloc;
+		}
+
+		job = &fyst->jobs[fyst->count];
+		job->fyn = fyn;
+		job->keys = fy_node_mapping_sort_keys(fyn, &fyst->ctx, &job->count);
+		if (!job->keys)
+			return -1;
+		fyst->count++;
+
+		fyst->total += job->count;
+		if (job->count > fyst->max_count)
+			fyst->max_count = job->count;
+
+		/* the job array moves while collecting the children */
+		keys = job->keys;
+		count = job->count;
+
+		/* the parent of the key is always NULL */
+		for (i = 0; i < count; i++) {
+			if (fy_node_sort_collect(fyst, keys[i].fynp->key) ||
+			    fy_node_sort_collect(fyst, keys[i].fynp->value))
+				return -1;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+static struct fy_node_sort_job *fy_node_sort_next_job(struct fy_node_sort_tree *fyst)
+{
+	struct fy_node_sort_job *job = NULL;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&fyst->lock);
+#endif
+	if (!fyst->failed && fyst->next < fyst->count)
+		job = &fyst->jobs[fyst->next++];
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&fyst->lock);
+#endif
+	return job;
+}
+
+static void *fy_node_sort_worker(void *arg)
+{
+	struct fy_node_sort_tree *fyst = arg;
+	struct fy_node_sort_job *job;
+	struct fy_node_sort_key *tmp;
+
+	/* enough scratch space for the largest mapping */
+	tmp = malloc((fyst->max_count + 1) * sizeof(*tmp));
+	if (!tmp) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&fyst->lock);
+#endif
+		fyst->failed = true;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&fyst->lock);
+#endif
+		return NULL;
+	}
+
+	while ((job = fy_node_sort_next_job(fyst)) != NULL)
+		fy_node_sort_keys(job->keys, tmp, job->count, &fyst->ctx);
+
+	free(tmp);
+
+	return NULL;
+}
+
+static void fy_node_sort_run(struct fy_node_sort_tree *fyst)
+{
+#ifdef HAVE_PTHREAD
+	pthread_t *tids = NULL;
+	int i, jobs, started = 0;
+	long ncpus;
+
+	/* user comparison methods are not required to be thread safe */
+	jobs = 1;
+	if (!fyst->ctx.key_cmp && fyst->count > 1 && fyst->total >= FY_NODE_SORT_PARALLEL_MIN) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = ncpus > 0 ? (int)ncpus : 1;
+		if ((unsigned int)jobs > fyst->count)
+			jobs = (int)fyst->count;
+	}
 
-	fynpp = fy_node_mapping_sort_array(fyn_map, key_cmp, arg, &count);
-	if (!fynpp)
-		return -1;
+	pthread_mutex_init(&fyst->lock, NULL);
 
-	fy_node_pair_list_init(&fyn_map->mapping);
-	for (i = 0; i < count; i++) {
-		fynpi = fynpp[i];
-		fy_node_pair_list_add_tail(&fyn_map->mapping, fynpi);
+	/* the calling thread is a worker too */
+	if (jobs > 1)
+		tids = malloc((jobs - 1) * sizeof(*tids));
+	if (tids) {
+		for (i = 0; i < jobs - 1; i++) {
+			if (pthread_create(&tids[started], NULL, fy_node_sort_worker, fyst))
+				break;
+			started++;
+		}
 	}
+#endif
 
-	fy_node_mapping_sort_release_array(fyn_map, fynpp);
+	fy_node_sort_worker(fyst);
 
-	return 0;
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+
+	pthread_mutex_destroy(&fyst->lock);
+#endif
 }
 
 int fy_node_sort(struct fy_node *fyn, fy_node_mapping_sort_fn key_cmp, void *arg)
 {
-	struct fy_node *fyni;
-	struct fy_node_pair *fynp, *fynpi;
+	struct fy_node_sort_tree fyst;
+	struct fy_node_sort_job *job;
+	unsigned int i;
 	int ret;
 
 	if (!fyn)
 		return 0;
 
-	switch (fyn->type) {
-	case FYNT_SCALAR:
-		break;
-
-	case FYNT_SEQUENCE:
-		for (fyni = fy_node_list_head(&fyn->sequence); fyni;
-				fyni = fy_node_next(&fyn->sequence, fyni)) {
-
-			fy_node_sort(fyni, key_cmp, arg);
-		}
-		break;
-
-	case FYNT_MAPPING:
-		ret = fy_node_mapping_sort(fyn, key_cmp, arg);
-		if (ret)
-			return ret;
-
-		for (fynp = fy_node_pair_list_head(&fyn->mapping); fynp; fynp = fynpi) {
-
-			fynpi = fy_node_pair_next(&fyn->mapping, fynp);
-
-			/* the parent of the key is always NULL */
-			ret = fy_node_sort(fynp->key, key_cmp, arg);
-			if (ret)
-				return ret;
+	memset(&fyst, 0, sizeof(fyst));
+	fy_node_mapping_sort_ctx_setup(&fyst.ctx, key_cmp, arg);
 
-			ret = fy_node_sort(fynp->value, key_cmp, arg);
-			if (ret)
-				return ret;
+	ret = fy_node_sort_collect(&fyst, fyn);
+	if (!ret) {
+		fy_node_sort_run(&fyst);
+		ret = fyst.failed ? -1 : 0;
+	}
 
-			fynp->parent = fyn;
-		}
-		break;
+	for (i = 0; i < fyst.count; i++) {
+		job = &fyst.jobs[i];
+		if (!ret)
+			fy_node_mapping_sort_apply(job->fyn, job->keys, job->count);
+		free(job->keys);
 	}
+	free(fyst.jobs);
 
-	return 0;
+	return ret;
 }
 
 int fy_parser_move_log_to_document(struct fy_parser *fyp, struct fy_document *fyd)
@@ -4642,7 +8284,7 @@ int fy_node_vscanf(struct fy_node *fyn, const char *fmt, va_list ap)
 		s = t;
 
 		/* find by (relative) path */
-		fynv = fy_node_by_path(fyn, key, t - s, FYNWF_DONT_FOLLOW);
+		fynv = fy_node_by_path(fyn, key, (size_t)(te - key), FYNWF_DONT_FOLLOW);
 		if (!fynv || fynv->type != FYNT_SCALAR)
 			break;
 
@@ -4710,6 +8352,440 @@ int fy_document_scanf(struct fy_document *fyd, const char *fmt, ...)
 	return ret;
 }
 
+/* use a direct conversion for the plain integer and floating point specifiers */
+static void fy_scanf_field_setup(struct fy_scanf_field *fysf)
+{
+	const char *s = fysf->fmtspec + 1;	/* skip '%' */
+	enum fy_scanf_length length;
+	enum fy_scanf_conv conv;
+	int base = 0;
+
+	fysf->conv = fyscv_generic;
+
+	if (s[0] == 'h' && s[1] == 'h') {
+		length = fysl_hh;
+		s += 2;
+	} else if (s[0] == 'l' && s[1] == 'l') {
+		length = fysl_ll;
+		s += 2;
+	} else if (s[0] && strchr("hljztL", s[0])) {
+		length = s[0] == 'h' ? fysl_h :
+			 s[0] == 'l' ? fysl_l :
+			 s[0] == 'j' ? fysl_j :
+			 s[0] == 'z' ? fysl_z :
+			 s[0] == 't' ? fysl_t : fysl_L;
+		s++;
+	} else
+		length = fysl_none;
+
+	/* a single conversion character, no width or anything else */
+	if (!s[0] || s[1])
+		return;
+
+	switch (s[0]) {
+	case 'd':
+		conv = fyscv_signed;
+		base = 10;
+		break;
+	case 'i':
+		conv = fyscv_signed;
+		base = 0;
+		break;
+	case 'u':
+		conv = fyscv_unsigned;
+		base = 10;
+		break;
+	case 'o':
+		conv = fyscv_unsigned;
+		base = 8;
+		break;
+	case 'x':
+	case 'X':
+		conv = fyscv_unsigned;
+		base = 16;
+		break;
+	case 'f':
+	case 'F':
+	case 'e':
+	case 'E':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		conv = fyscv_float;
+		break;
+	default:
+		return;
+	}
+
+	if ((conv == fyscv_float && length != fysl_none && length != fysl_l && length != fysl_L) ||
+	    (conv != fyscv_float && length == fysl_L))
+		return;
+
+	fysf->conv = conv;
+	fysf->length = length;
+	fysf->base = base;
+}
+
+/*
+ * Convert the scalar text directly; only when all of it is a number,
+ * everything else is left to vsscanf() so that the result is the same.
+ */
+static bool fy_scanf_field_convert(const struct fy_scanf_field *fysf,
+				   const char *s, size_t len, void *ptr)
+{
+	const char *e = s + len;
+	unsigned long long v;
+	long long sv;
+	long double ld = 0.0;
+	double d = 0.0;
+	float f = 0.0;
+	char buf[64], *end;
+	int base, digit;
+	bool neg;
+	size_t n;
+
+	/* leading space is skipped, trailing is where the number ends */
+	while (s < e && isspace((unsigned char)*s))
+		s++;
+	while (e > s && isspace((unsigned char)e[-1]))
+		e--;
+	if (s >= e)
+		return false;
+
+	if (fysf->conv == fyscv_float) {
+		n = (size_t)(e - s);
+		if (n >= sizeof(buf))
+			return false;
+		memcpy(buf, s, n);
+		buf[n] = '\0';
+
+		if (fysf->length == fysl_L)
+			ld = strtold(buf, &end);
+		else if (fysf->length == fysl_l)
+			d = strtod(buf, &end);
+		else
+			f = strtof(buf, &end);
+
+		if (end != buf + n)
+			return false;
+
+		if (fysf->length == fysl_L)
+			*(long double *)ptr = ld;
+		else if (fysf->length == fysl_l)
+			*(double *)ptr = d;
+		else
+			*(float *)ptr = f;
+
+		return true;
+	}
+
+	neg = false;
+	if (*s == '+' || *s == '-') {
+		neg = *s == '-';
+		s++;
+	}
+
+	base = fysf->base;
+	if ((base == 0 || base == 16) && e - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+		base = 16;
+		s += 2;
+	} else if (base == 0)
+		base = s < e && *s == '0' ? 8 : 10;
+
+	for (v = 0, n = 0; s < e; s++, n++) {
+		if (*s >= '0' && *s <= '9')
+			digit = *s - '0';
+		else if ((*s | 0x20) >= 'a' && (*s | 0x20) <= 'f')
+			digit = (*s | 0x20) - 'a' + 10;
+		else
+			break;
+		if (digit >= base)
+			break;
+		/* out of range is left to vsscanf() */
+		if (v > (ULLONG_MAX - digit) / base)
+			return false;
+		v = v * base + digit;
+	}
+
+	if (!n || s != e)
+		return false;
+
+	if (fysf->conv == fyscv_unsigned) {
+		if (neg)
+			v = 0 - v;
+
+		switch (fysf->length) {
+		case fysl_hh:
+			*(unsigned char *)ptr = (unsigned char)v;
+			break;
+		case fysl_h:
+			*(unsigned short *)ptr = (unsigned short)v;
+			break;
+		case fysl_l:
+			*(unsigned long *)ptr = (unsigned long)v;
+			break;
+		case fysl_ll:
+			*(unsigned long long *)ptr = v;
+			break;
+		case fysl_j:
+			*(uintmax_t *)ptr = (uintmax_t)v;
+			break;
+		case fysl_z:
+			*(size_t *)ptr = (size_t)v;
+			break;
+		case fysl_t:
+			*(ptrdiff_t *)ptr = (ptrdiff_t)v;
+			break;
+		default:
+			*(unsigned int *)ptr = (unsigned int)v;
+			break;
+		}
+		return true;
+	}
+
+	if (v > (unsigned long long)LLONG_MAX + (neg ? 1 : 0))
+		return false;
+	sv = neg ? -(long long)(v - 1) - 1 : (long long)v;
+
+	switch (fysf->length) {
+	case fysl_hh:
+		*(signed char *)ptr = (signed char)sv;
+		break;
+	case fysl_h:
+		*(short *)ptr = (short)sv;
+		break;
+	case fysl_l:
+		*(long *)ptr = (long)sv;
+		break;
+	case fysl_ll:
+		*(long long *)ptr = sv;
+		break;
+	case fysl_j:
+		*(intmax_t *)ptr = (intmax_t)sv;
+		break;
+	case fysl_z:
+		*(ssize_t *)ptr = (ssize_t)sv;
+		break;
+	case fysl_t:
+		*(ptrdiff_t *)ptr = (ptrdiff_t)sv;
+		break;
+	default:
+		*(int *)ptr = (int)sv;
+		break;
+	}
+	return true;
+}
+
+struct fy_scanf_program *fy_scanf_compile(const char *fmt)
+{
+	struct fy_scanf_program *fysp;
+	struct fy_scanf_field *fields;
+	struct fy_path_query **fypqs;
+	char *s, *e, *t, *te, *key, *fmtspec;
+	int alloc = 0;
+	size_t len;
+
+	if (!fmt)
+		goto err_inval;
+
+	fysp = malloc(sizeof(*fysp));
+	if (!fysp)
+		return NULL;
+	memset(fysp, 0, sizeof(*fysp));
+
+	len = strlen(fmt);
+	fysp->fmt = malloc(len + 1);
+	if (!fysp->fmt)
+		goto err_out;
+	memcpy(fysp->fmt, fmt, len + 1);
+	s = fysp->fmt;
+	e = s + len;
+
+	/* same format as fy_node_vscanf(), split in the same way */
+	while (s < e) {
+		/* a '%' format must exist */
+		t = strchr(s, '%');
+		if (!t)
+			goto err_inval_out;
+
+		/* skip escaped % */
+		if (t + 1 < e && t[1] == '%') {
+			s = t + 2;
+			continue;
+		}
+
+		/* trim spaces from key */
+		while (isspace(*s))
+			s++;
+		te = t;
+		while (te > s && isspace(te[-1]))
+			*--te = '\0';
+
+		key = s;
+
+		/* we have to scan until the next space that's not in char set */
+		fmtspec = t;
+		while (t < e) {
+			if (isspace(*t))
+				break;
+			/* character set (may include space) */
+			if (*t == '[') {
+				t++;
+				/* skip caret */
+				if (t < e && *t == '^')
+					t++;
+				/* if first character in the set is ']' accept it */
+				if (t < e && *t == ']')
+					t++;
+				/* now skip until end of character set */
+				while (t < e && *t != ']')
+					t++;
+				continue;
+			}
+			t++;
+		}
+		if (t < e)
+			*t++ = '\0';
+
+		s = t;
+
+		if (fysp->count >= alloc) {
+			alloc = alloc ? alloc * 2 : 8;
+			fields = realloc(fysp->fields, alloc * sizeof(*fields));
+			if (!fields)
+				goto err_out;
+			fysp->fields = fields;
+			fypqs = realloc(fysp->fypqs, alloc * sizeof(*fypqs));
+			if (!fypqs)
+				goto err_out;
+			fysp->fypqs = fypqs;
+		}
+
+		/* the path query doesn't need the key after compiling */
+		fysp->fypqs[fysp->count] = fy_path_query_create(key, (size_t)(te - key),
+								FYNWF_DONT_FOLLOW);
+		if (!fysp->fypqs[fysp->count])
+			goto err_out;
+
+		memset(&fysp->fields[fysp->count], 0, sizeof(*fysp->fields));
+		fysp->fields[fysp->count].fmtspec = fmtspec;
+		fy_scanf_field_setup(&fysp->fields[fysp->count]);
+		fysp->count++;
+	}
+
+	return fysp;
+
+err_inval_out:
+	fy_scanf_program_destroy(fysp);
+err_inval:
+	errno = -EINVAL;
+	return NULL;
+
+err_out:
+	fy_scanf_program_destroy(fysp);
+	return NULL;
+}
+
+void fy_scanf_program_destroy(struct fy_scanf_program *fysp)
+{
+	int i;
+
+	if (!fysp)
+		return;
+
+	for (i = 0; i < fysp->count; i++)
+		fy_path_query_destroy(fysp->fypqs[i]);
+	free(fysp->fypqs);
+	free(fysp->fields);
+	free(fysp->fmt);
+	free(fysp);
+}
+
+int fy_scanf_program_vexec(struct fy_scanf_program *fysp, struct fy_node *fyn, va_list ap)
+{
+	const struct fy_scanf_field *fysf;
+	struct fy_node **fyns, *fynv;
+	const char *value;
+	char *value0;
+	size_t value_len, value0_len;
+	int i, count, ret;
+	va_list apt;
+	void *ptr;
+
+	if (!fysp || !fyn)
+		goto err_out;
+
+	/* all the paths in a single walk */
+	fyns = alloca(fysp->count * sizeof(*fyns));
+	if (fy_path_query_exec_batch(fysp->fypqs, fysp->count, fyn, fyns))
+		goto err_out;
+
+	value0 = NULL;
+	value0_len = 0;
+	count = 0;
+	for (i = 0; i < fysp->count; i++) {
+		fysf = &fysp->fields[i];
+
+		fynv = fyns[i];
+		if (!fynv || fynv->type != FYNT_SCALAR)
+			break;
+
+		/* there must be a text */
+		value = fy_token_get_text(fynv->scalar, &value_len);
+		if (!value)
+			break;
+
+		va_copy(apt, ap);
+		/* scanf, all arguments are pointers */
+		ptr = va_arg(ap, void *);
+
+		if (fysf->conv != fyscv_generic &&
+		    fy_scanf_field_convert(fysf, value, value_len, ptr)) {
+			va_end(apt);
+			count++;
+			continue;
+		}
+
+		/* allocate buffer it's smaller than the one we have already */
+		if (!value0 || value0_len < value_len) {
+			value0 = alloca(value_len + 1);
+			value0_len = value_len;
+		}
+
+		memcpy(value0, value, value_len);
+		value0[value_len] = '\0';
+
+		/* pass it to the system's scanf method */
+		ret = vsscanf(value0, fysf->fmtspec, apt);
+		va_end(apt);
+
+		/* since it's a single specifier, it must be one on success */
+		if (ret != 1)
+			break;
+
+		count++;
+	}
+
+	return count;
+
+err_out:
+	errno = -EINVAL;
+	return -1;
+}
+
+int fy_scanf_program_exec(struct fy_scanf_program *fysp, struct fy_node *fyn, ...)
+{
+	va_list ap;
+	int ret;
+
+	va_start(ap, fyn);
+	ret = fy_scanf_program_vexec(fysp, fyn, ap);
+	va_end(ap);
+
+	return ret;
+}
+
 bool fy_document_has_directives(const struct fy_document *fyd)
 {
 	struct fy_document_state *fyds;
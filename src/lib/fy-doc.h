@@ -24,10 +24,10 @@
 #include "fy-list.h"
 #include "fy-typelist.h"
 #include "fy-talloc.h"
+#include "fy-arena.h"
 #include "fy-types.h"
 #include "fy-diag.h"
-
-struct fy_eventp;
+#include "fy-event.h"
 
 FY_TYPE_FWD_DECL_LIST(document);
 
@@ -54,8 +54,23 @@ struct fy_node_pair {
 	struct fy_node *value;
 	struct fy_document *fyd;
 	struct fy_node *parent;
+	struct hlist_node hnode;	/* on the key index of the parent */
+	uint32_t hash;			/* hash of the key */
+	int idx;			/* position in the parent's items */
 };
 FY_TYPE_FWD_DECL_LIST(node_pair);
+
+/*
+ * Hashed key index of a mapping, built once it grows large.
+ * Collection keys can change under it, so they are left out
+ * and only counted; lookups for them go through the list.
+ */
+struct fy_node_mapping_index {
+	unsigned int count;		/* number of indexed pairs */
+	unsigned int complex;		/* number of pairs left out */
+	unsigned int mask;		/* number of buckets - 1 */
+	struct hlist_head buckets[];
+};
 FY_TYPE_DECL_LIST(node_pair);
 
 FY_TYPE_FWD_DECL_LIST(node);
@@ -80,6 +95,21 @@ struct fy_node {
 		struct fy_token *sequence_end;
 		struct fy_token *mapping_end;
 	};
+	struct fy_node_mapping_index *mapping_index;
+	/* item vector (nodes or pairs) for indexed access */
+	void **items;
+	int items_count;		/* -1 when stale */
+	int items_alloc;
+	/* content events of a collection not expanded yet (lazy mode) */
+	struct fy_eventp_list lazy_events;
+	/* structural hash, valid while hash_valid is set */
+	uint32_t hash;
+	/* a lazy copy shares the content of cow_src until expanded */
+	struct fy_node *cow_src;
+	struct list_head cow_node;	/* on the cow_copies list of cow_src */
+	struct list_head cow_copies;	/* lazy copies of this node */
+	bool lazy : 1;
+	bool hash_valid : 1;
 };
 FY_TYPE_DECL_LIST(node);
 
@@ -87,23 +117,74 @@ struct fy_node *fy_node_alloc(struct fy_document *fyd, enum fy_node_type type);
 struct fy_node_pair *fy_node_pair_alloc(struct fy_document *fyd);
 void fy_node_pair_free(struct fy_node_pair *fynp);
 
+/* build the children of a lazy collection (but not their contents) */
+int fy_node_lazy_expand_internal(struct fy_node *fyn);
+
+static inline int fy_node_lazy_expand(struct fy_node *fyn)
+{
+	return fyn && fyn->lazy ? fy_node_lazy_expand_internal(fyn) : 0;
+}
+
+/* build the complete subtree of a node */
+int fy_node_lazy_expand_all(struct fy_node *fyn);
+
+/* the node holding the content; lazy copies share that of their source */
+static inline struct fy_node *fy_node_content(struct fy_node *fyn)
+{
+	return fyn && fyn->cow_src ? fyn->cow_src : fyn;
+}
+
 struct fy_anchor {
 	struct list_head node;
 	struct fy_node *fyn;
 	struct fy_token *anchor;
+	struct hlist_node hnode_text;	/* on the text buckets of the index */
+	struct hlist_node hnode_node;	/* on the node buckets of the index */
+	uint32_t hash;			/* hash of the anchor text */
+	int seq;			/* increases along the anchor list */
 };
 FY_TYPE_FWD_DECL_LIST(anchor);
 FY_TYPE_DECL_LIST(anchor);
 
+/* hashed anchor index of a document, built once it has enough anchors */
+struct fy_anchor_index {
+	unsigned int count;		/* number of indexed anchors */
+	unsigned int mask;		/* number of buckets - 1 */
+	struct hlist_head buckets[];	/* by text, followed by by node */
+};
+
 struct fy_document {
 	struct list_head node;
 	struct fy_talloc_list tallocs;
 	struct fy_anchor_list anchors;
+	struct fy_anchor_index *anchor_index;
+	unsigned int anchor_count;
+	int anchor_seq_head;		/* seq of the next anchor added at the head */
+	int anchor_seq_tail;		/* seq of the last anchor added at the tail */
 	struct fy_document_state *fyds;
 	struct fy_parser *fyp;
 	struct fy_node *root;
 	bool owns_parser : 1;
 	bool parse_error : 1;
+	bool use_arena : 1;
+	bool lazy : 1;
+	bool frozen : 1;		/* all the cached state computed, see fy_document_freeze() */
+
+	/* events replayed while expanding a lazy collection */
+	struct fy_eventp_list *lazy_replay;
+
+	/* number of lazy copies sharing nodes of this document */
+	unsigned int cow_shared;
+
+	/* nodes, pairs & anchors when FYPCF_DOCUMENT_ARENA is set */
+	struct fy_arena arena;
+
+	/* chunk the direct builder copies small scalars in */
+	struct fy_input *build_fyi;
+	size_t build_used;
+
+	/* the mapping keys are interned here (when not NULL) */
+	struct fy_intern *intern;
 
 	FILE *errfp;
 	char *errbuf;
@@ -115,6 +196,20 @@ struct fy_document {
 /* only the list declaration/methods */
 FY_TYPE_DECL_LIST(document);
 
+static inline void *fy_document_obj_alloc(struct fy_document *fyd, size_t size)
+{
+	return fyd->use_arena ? fy_arena_alloc(&fyd->arena, size) : malloc(size);
+}
+
+void fy_node_hash_invalidate(struct fy_node *fyn);
+
+/* arena objects are released with the document */
+static inline void fy_document_obj_free(struct fy_document *fyd, void *ptr)
+{
+	if (!fyd->use_arena)
+		free(ptr);
+}
+
 struct fy_document_state *fy_document_state_alloc(void);
 void fy_document_state_free(struct fy_document_state *fyds);
 struct fy_document_state *fy_document_state_ref(struct fy_document_state *fyds);
@@ -129,11 +224,9 @@ void fy_document_dump_tag_directives(struct fy_document *fyd, const char *banner
 struct fy_node_mapping_sort_ctx {
 	fy_node_mapping_sort_fn key_cmp;
 	void *arg;
-	struct fy_node_pair **fynpp;
-	int count;
 };
 
-void fy_node_mapping_perform_sort(struct fy_node *fyn_map,
+int fy_node_mapping_perform_sort(struct fy_node *fyn_map,
 		fy_node_mapping_sort_fn key_cmp, void *arg,
 		struct fy_node_pair **fynpp, int count);
 
@@ -143,6 +236,8 @@ struct fy_node_pair **fy_node_mapping_sort_array(struct fy_node *fyn_map,
 
 void fy_node_mapping_sort_release_array(struct fy_node *fyn_map, struct fy_node_pair **fynpp);
 
+extern const struct fy_parse_cfg doc_parse_default_cfg;
+
 int fy_parser_move_log_to_document(struct fy_parser *fyp, struct fy_document *fyd);
 bool fy_document_has_error(struct fy_document *fyd);
 const char *fy_document_get_log(struct fy_document *fyd, size_t *sizep);
@@ -159,4 +254,80 @@ bool fy_check_ref_loop(struct fy_document *fyd, struct fy_node *fyn,
 		       enum fy_node_walk_flags flags,
 		       struct fy_node_walk_ctx *ctx);
 
+/*
+ * A compiled path step; the path component at this offset interpreted
+ * both as a sequence index and as a mapping key, since which one
+ * applies depends on the node it is applied to.
+ */
+struct fy_path_step {
+	size_t offset;			/* of the component in the path */
+	bool end : 1;			/* nothing but '/' left */
+	bool seq_valid : 1;
+	bool map_valid : 1;
+	bool key_simple : 1;
+	int idx;			/* sequence index */
+	int seq_next;			/* step after the index */
+	const char *key;		/* mapping key */
+	size_t key_len;
+	uint32_t key_hash;		/* when simple */
+	struct fy_document *fyd_key;	/* when not simple */
+	int map_next;			/* step after the key */
+};
+
+/* the path walked directly, or after an anchor, and the *</path> form */
+enum fy_path_region {
+	fypr_path,
+	fypr_alt,
+};
+
+struct fy_path_query {
+	char *path;
+	size_t len;
+	enum fy_node_walk_flags flags;
+	bool invalid : 1;		/* never matches */
+	bool has_anchor : 1;
+	const char *anchor;
+	size_t anchor_len;
+	int start[2];			/* first step of each region or -1 */
+	int *memo[2];			/* offset to step of each region */
+	struct fy_path_step *steps;
+	int steps_count;
+	int steps_alloc;
+};
+
+/* conversions performed directly on the scalar text */
+enum fy_scanf_conv {
+	fyscv_generic,		/* vsscanf() it */
+	fyscv_signed,
+	fyscv_unsigned,
+	fyscv_float,
+};
+
+/* scanf length modifiers */
+enum fy_scanf_length {
+	fysl_none,
+	fysl_hh,
+	fysl_h,
+	fysl_l,
+	fysl_ll,
+	fysl_j,
+	fysl_z,
+	fysl_t,
+	fysl_L,
+};
+
+struct fy_scanf_field {
+	const char *fmtspec;		/* zero terminated, for vsscanf() */
+	enum fy_scanf_conv conv;
+	enum fy_scanf_length length;
+	int base;			/* 0 for %i */
+};
+
+struct fy_scanf_program {
+	char *fmt;			/* fields point into it */
+	int count;
+	struct fy_scanf_field *fields;
+	struct fy_path_query **fypqs;	/* one per field */
+};
+
 #endif
@@ -113,7 +113,7 @@ char *fy_simple_key_dump_format(struct fy_parser *fyp, struct fy_simple_key *fys
 	return buf;
 }
 
-char *fy_simple_key_list_dump_format(struct fy_parser *fyp, struct fy_simple_key_list *fyskl,
+char *fy_simple_key_stack_dump_format(struct fy_parser *fyp, struct fy_simple_key_stack *fysks,
 		struct fy_simple_key *fysk_highlight, char *buf, size_t bufsz)
 {
 	char *s, *e;
@@ -121,10 +121,12 @@ char *fy_simple_key_list_dump_format(struct fy_parser *fyp, struct fy_simple_key
 
 	s = buf;
 	e = buf + bufsz - 1;
-	for (fysk = fy_simple_key_list_first(fyskl); fysk; fysk = fy_simple_key_next(fyskl, fysk)) {
+	/* from the top down */
+	for (fysk = fy_simple_key_stack_top(fysks); fysk;
+			fysk = fy_simple_key_stack_below(fysks, fysk)) {
 
 		s += snprintf(s, e - s, "%s%s",
-				fysk != fy_simple_key_list_first(fyskl) ? "," : "",
+				fysk != fy_simple_key_stack_top(fysks) ? "," : "",
 				fysk_highlight == fysk ? "*" : "");
 
 		fy_simple_key_dump_format(fyp, fysk, s, e - s);
@@ -161,7 +163,7 @@ void fy_debug_dump_token(struct fy_parser *fyp, struct fy_token *fyt, const char
 			fy_token_dump_format(fyt, buf, sizeof(buf)));
 }
 
-void fy_debug_dump_simple_key_list(struct fy_parser *fyp, struct fy_simple_key_list *fyskl,
+void fy_debug_dump_simple_key_stack(struct fy_parser *fyp, struct fy_simple_key_stack *fysks,
 		struct fy_simple_key *fysk_highlight, const char *banner)
 {
 	char buf[1024];
@@ -170,7 +172,7 @@ void fy_debug_dump_simple_key_list(struct fy_parser *fyp, struct fy_simple_key_l
 		return;
 
 	fy_scan_debug(fyp, "%s%s\n", banner,
-			fy_simple_key_list_dump_format(fyp, fyskl, fysk_highlight, buf, sizeof(buf)));
+			fy_simple_key_stack_dump_format(fyp, fysks, fysk_highlight, buf, sizeof(buf)));
 }
 
 void fy_debug_dump_simple_key(struct fy_parser *fyp, struct fy_simple_key *fysk, const char *banner)
@@ -201,6 +203,10 @@ void fy_debug_dump_input(struct fy_parser *fyp, const struct fy_input_cfg *fyic,
 		fy_scan_debug(fyp, "%s: start=%p size=%zu\n", banner,
 				fyic->memory.data, fyic->memory.size);
 		break;
+	case fyit_callback:
+		fy_scan_debug(fyp, "%s: feed=\"%s\"\n", banner,
+				fyic->callback.name);
+		break;
 	default:
 		break;
 	}
@@ -16,6 +16,7 @@
 #include <limits.h>
 #include <unistd.h>
 #include <ctype.h>
+#include <sys/uio.h>
 
 #include <libfyaml.h>
 
@@ -63,6 +64,13 @@ static inline bool fy_emit_is_block_mode(const struct fy_emitter *emit)
 	return flags == FYECF_MODE_BLOCK;
 }
 
+static inline bool fy_emit_is_original_mode(const struct fy_emitter *emit)
+{
+	enum fy_emitter_cfg_flags flags = emit->cfg->flags & FYECF_MODE(FYECF_MODE_MASK);
+
+	return flags == FYECF_MODE_ORIGINAL;
+}
+
 static inline bool fy_emit_is_oneline(const struct fy_emitter *emit)
 {
 	enum fy_emitter_cfg_flags flags = emit->cfg->flags & FYECF_MODE(FYECF_MODE_MASK);
@@ -100,47 +108,115 @@ void fy_emit_scalar(struct fy_emitter *emit, struct fy_node *fyn, int flags, int
 void fy_emit_sequence(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent);
 void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent);
 
-void fy_emit_write(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len)
+/* pending output is handed over when this much has accumulated */
+#define FY_EMIT_OUTPUT_BUFFER_DEFAULT	8192
+
+static void fy_emit_output_bulk(struct fy_emitter *emit, const char *str, int len)
 {
-	int c, w;
-	const char *m, *e;
-	int outlen;
+	struct iovec iov[2];
+	int iovcnt = 0, total = 0, outlen;
 
-	if (!len)
+	if (emit->obuf_next) {
+		iov[iovcnt].iov_base = emit->obuf;
+		iov[iovcnt].iov_len = emit->obuf_next;
+		total += (int)emit->obuf_next;
+		iovcnt++;
+	}
+	if (len > 0) {
+		iov[iovcnt].iov_base = (void *)str;
+		iov[iovcnt].iov_len = len;
+		total += len;
+		iovcnt++;
+	}
+	emit->obuf_next = 0;
+
+	if (!iovcnt)
 		return;
 
-	outlen = emit->cfg->output(emit, type, str, len, emit->cfg->userdata);
-	if (outlen != len)
+	outlen = emit->cfg->output_bulk(emit, iov, iovcnt, emit->cfg->userdata);
+	if (outlen != total)
 		emit->output_error = true;
+}
 
-	e = str + len;
-	while ((c = fy_utf8_get(str, (e - str), &w)) != -1) {
+void fy_emit_flush(struct fy_emitter *emit)
+{
+	if (emit->cfg->output_bulk)
+		fy_emit_output_bulk(emit, NULL, 0);
+}
 
-		/* special handling for MSDOS */
-		if (c == '\r' && (e - str) > 1 && str[1] == '\n') {
-			str += 2;
-			emit->column = 0;
-			emit->line++;
-			continue;
-		}
+static void fy_emit_output(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len)
+{
+	int outlen;
 
-		/* regular line break */
-		if (fy_is_lb(c)) {
-			emit->column = 0;
-			emit->line++;
-			str += w;
-			continue;
+	if (!emit->cfg->output_bulk) {
+		outlen = emit->cfg->output(emit, type, str, len, emit->cfg->userdata);
+		if (outlen != len)
+			emit->output_error = true;
+		return;
+	}
+
+	if (!emit->obuf) {
+		emit->obuf_size = emit->cfg->output_buffer_size ?
+				  emit->cfg->output_buffer_size :
+				  FY_EMIT_OUTPUT_BUFFER_DEFAULT;
+		emit->obuf = malloc(emit->obuf_size);
+		emit->obuf_next = 0;
+
+		/* no buffer, write directly */
+		if (!emit->obuf) {
+			emit->obuf_size = 0;
+			fy_emit_output_bulk(emit, str, len);
+			return;
 		}
+	}
+
+	/* doesn't fit; goes out along with what's pending without a copy */
+	if ((size_t)len > emit->obuf_size - emit->obuf_next) {
+		fy_emit_output_bulk(emit, str, len);
+		return;
+	}
+
+	memcpy(emit->obuf + emit->obuf_next, str, len);
+	emit->obuf_next += len;
+}
+
+/* text without line breaks, occupying width columns */
+void fy_emit_write_width(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len, int width)
+{
+	if (!len)
+		return;
 
-		/* completely ignore ANSI color escape sequences */
-		if (c == '\x1b' && (e - str) > 2 && str[1] == '[' &&
-		    (m = memchr(str, 'm', e - str)) != NULL) {
-			str = m + 1;
+	fy_emit_output(emit, type, str, len);
+	emit->column += width;
+}
+
+/*
+ * Text of unknown width; count the characters by their first octets
+ * and look for line breaks (including NEL, LS & PS) without decoding.
+ */
+void fy_emit_write(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len)
+{
+	const uint8_t *s, *e;
+
+	if (!len)
+		return;
+
+	fy_emit_output(emit, type, str, len);
+
+	s = (const uint8_t *)str;
+	e = s + len;
+	for (; s < e; s++) {
+		/* MSDOS line breaks are counted at the \n */
+		if (*s == '\r' && s + 1 < e && s[1] == '\n')
 			continue;
-		}
 
-		emit->column++;
-		str += w;
+		if (*s == '\n' || *s == '\r' ||
+		    (*s == 0xc2 && s + 1 < e && s[1] == 0x85) ||
+		    (*s == 0xe2 && s + 2 < e && s[1] == 0x80 && (s[2] == 0xa8 || s[2] == 0xa9))) {
+			emit->column = 0;
+			emit->line++;
+		} else if ((*s & 0xc0) != 0x80)
+			emit->column++;
 	}
 }
 
@@ -152,9 +228,17 @@ void fy_emit_puts(struct fy_emitter *emit, enum fy_emitter_write_type type, cons
 void fy_emit_putc(struct fy_emitter *emit, enum fy_emitter_write_type type, int c)
 {
 	char buf[FY_UTF8_FORMAT_BUFMIN];
+	int len;
+
+	len = fy_utf8_width(c);
+	fy_utf8_put_unchecked(buf, c);
+	fy_emit_output(emit, type, buf, len);
 
-	fy_utf8_format(c, buf, fyue_none);
-	fy_emit_puts(emit, type, buf);
+	if (fy_is_lb(c)) {
+		emit->column = 0;
+		emit->line++;
+	} else
+		emit->column++;
 }
 
 void fy_emit_vprintf(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *fmt, va_list ap)
@@ -211,7 +295,7 @@ void fy_emit_write_indent(struct fy_emitter *emit, int indent)
 		ws = alloca(len + 1);
 		memset(ws, ' ', len);
 		ws[len] = '\0';
-		fy_emit_write(emit, fyewt_indent, ws, len);
+		fy_emit_write_width(emit, fyewt_indent, ws, len, len);
 	}
 
 	emit->flags |= FYEF_WHITESPACE | FYEF_INDENTATION;
@@ -342,7 +426,7 @@ int fy_emit_increase_indent(struct fy_emitter *emit, int flags, int indent)
 void fy_emit_write_comment(struct fy_emitter *emit, int flags, int indent, const char *str, size_t len)
 {
 	const char *s, *e, *sr;
-	int c, w;
+	int c, w, width;
 	bool breaks;
 
 	if (!str || !len)
@@ -359,33 +443,37 @@ void fy_emit_write_comment(struct fy_emitter *emit, int flags, int indent, const
 	e = str + len;
 
 	sr = s;	/* start of normal output run */
+	width = 0;
 	breaks = false;
 	while (s < e && (c = fy_utf8_get(s, e - s, &w)) > 0) {
 
 		if (fy_is_break(c)) {
 
 			/* output run */
-			fy_emit_write(emit, fyewt_comment, sr, s - sr);
+			fy_emit_write_width(emit, fyewt_comment, sr, s - sr, width);
 			sr = s + w;
+			width = 0;
 			fy_emit_write_indent(emit, indent);
 			emit->flags |= FYEF_INDENTATION;
 			breaks = true;
 		} else {
 
 			if (breaks) {
-				fy_emit_write(emit, fyewt_comment, sr, s - sr);
+				fy_emit_write_width(emit, fyewt_comment, sr, s - sr, width);
 				sr = s;
+				width = 0;
 				fy_emit_write_indent(emit, indent);
 			}
 			emit->flags &= ~FYEF_INDENTATION;
 			breaks = false;
+			width++;
 		}
 
 		s += w;
 	}
 
 	/* dump what's remaining */
-	fy_emit_write(emit, fyewt_comment, sr, s - sr);
+	fy_emit_write_width(emit, fyewt_comment, sr, s - sr, width);
 
 	emit->flags |= (FYEF_WHITESPACE | FYEF_INDENTATION);
 }
@@ -397,7 +485,7 @@ struct fy_atom *fy_emit_token_comment_handle(struct fy_emitter *emit, struct fy_
 	if (!fyt)
 		return NULL;
 
-	handle = &fyt->comment[placement];
+	handle = fy_token_comment(fyt, placement);
 	return fy_atom_is_set(handle) ? handle : NULL;
 }
 
@@ -540,7 +628,8 @@ void fy_emit_node_internal(struct fy_emitter *emit, struct fy_node *fyn, int fla
 	struct fy_anchor *fya;
 	struct fy_token *fyt_anchor = NULL;
 
-	if (!(emit->cfg->flags & FYECF_STRIP_LABELS)) {
+	/* shared content is a copy; copies never carry the anchors */
+	if (!(emit->cfg->flags & FYECF_STRIP_LABELS) && !emit->shared_depth) {
 		fya = fy_document_lookup_anchor_by_node(emit->fyd, fyn);
 		if (fya)
 			fyt_anchor = fya->anchor;
@@ -567,10 +656,148 @@ void fy_emit_node_internal(struct fy_emitter *emit, struct fy_node *fyn, int fla
 	}
 }
 
+/*
+ * Direct output of a token along with its width; a direct output atom
+ * is on a single line, so the width is known from its marks.
+ */
+static const char *
+fy_emit_token_direct_output(struct fy_token *fyt, size_t *lenp, int *widthp)
+{
+	const struct fy_atom *atom;
+	const char *str;
+
+	str = fy_token_get_direct_output(fyt, lenp);
+	if (!str)
+		return NULL;
+
+	atom = fy_token_atom(fyt);
+	if (atom->start_mark.line != atom->end_mark.line)
+		return NULL;
+
+	*widthp = atom->end_mark.column - atom->start_mark.column;
+	return str;
+}
+
+/*
+ * Check that the source lines of a multi line flow scalar can be
+ * copied as they are; every continuation line must be indented at
+ * least as much as the emitter would indent it and no line may go
+ * over the width.
+ */
+static bool fy_emit_original_lines_fit(struct fy_emitter *emit, const char *str, size_t len, int indent)
+{
+	const uint8_t *s, *e;
+	int column, width, spaces;
+	bool line_start;
+
+	width = fy_emit_width(emit);
+	column = emit->column;
+	spaces = 0;
+	line_start = false;
+
+	s = (const uint8_t *)str;
+	e = s + len;
+	for (; s < e; s++) {
+		if (*s == '\n' || *s == '\r') {
+			column = 0;
+			spaces = 0;
+			line_start = true;
+			continue;
+		}
+
+		/* don't bother with NEL, LS & PS */
+		if (*s == 0xc2 || *s == 0xe2)
+			return false;
+
+		if (line_start) {
+			if (*s == ' ') {
+				spaces++;
+				column++;
+				continue;
+			}
+			if (spaces < indent)
+				return false;
+			line_start = false;
+		}
+
+		if ((*s & 0xc0) != 0x80 && ++column > width)
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Original mode pass through; copy the source of a parsed scalar
+ * straight to the output when it is in the same style and it would
+ * end up at the same indentation. Returns true when output.
+ */
+static bool fy_emit_token_write_original(struct fy_emitter *emit, struct fy_token *fyt,
+					 enum fy_atom_style style, enum fy_emitter_write_type wtype,
+					 int flags, int indent)
+{
+	struct fy_atom *atom;
+	const char *str, *e, *t;
+	size_t len;
+
+	if (!fy_emit_is_original_mode(emit))
+		return false;
+
+	atom = fy_token_atom(fyt);
+	if (!fy_atom_is_set(atom) || atom->style != style)
+		return false;
+
+	str = fy_atom_data(atom);
+	len = fy_atom_size(atom);
+	if (!str || !len)
+		return false;
+
+	if (fy_atom_style_is_block(style)) {
+		/* the content lines are at the indentation of the source */
+		if ((int)atom->increment != indent)
+			return false;
+
+		/* folded scalars get refolded at the width */
+		if (style == FYAS_FOLDED && !fy_emit_original_lines_fit(emit, str, len, indent))
+			return false;
+
+		/* drop the indentation of the line following the scalar */
+		e = str + len;
+		for (t = e; t > str && t[-1] == ' '; t--)
+			;
+		if (t == str || t[-1] == '\n' || t[-1] == '\r')
+			e = t;
+		len = e - str;
+		if (!len)
+			return false;
+
+		fy_emit_write(emit, wtype, str, len);
+
+		/* when ending at a line break the next line is already started */
+		if (e[-1] == '\n' || e[-1] == '\r')
+			emit->flags |= FYEF_WHITESPACE | FYEF_INDENTATION;
+		else
+			emit->flags &= ~FYEF_INDENTATION;
+		return true;
+
+	} else if (atom->start_mark.line != atom->end_mark.line) {
+		if (flags & DDNF_SIMPLE)
+			return false;
+
+		if (!fy_emit_original_lines_fit(emit, str, len, indent))
+			return false;
+
+	} else if (emit->column + atom->end_mark.column - atom->start_mark.column > fy_emit_width(emit))
+		return false;
+
+	fy_emit_write(emit, wtype, str, len);
+	return true;
+}
+
 void fy_emit_token_write_plain(struct fy_emitter *emit, struct fy_token *fyt, int flags, int indent)
 {
 	bool allow_breaks, should_indent, spaces, breaks;
-	int c;
+	int c, width;
 	enum fy_emitter_write_type wtype;
 	const char *str = NULL;
 	size_t len = 0;
@@ -583,12 +810,16 @@ void fy_emit_token_write_plain(struct fy_emitter *emit, struct fy_token *fyt, in
 	wtype = (flags & DDNF_SIMPLE_SCALAR_KEY) ? fyewt_plain_scalar_key : fyewt_plain_scalar;
 
 	/* simple case first (90% of cases) */
-	str = fy_token_get_direct_output(fyt, &len);
+	str = fy_emit_token_direct_output(fyt, &len, &width);
 	if (str) {
-		fy_emit_write(emit, wtype, str, len);
+		fy_emit_write_width(emit, wtype, str, len, width);
 		goto out;
 	}
 
+	/* multi line, same as the source */
+	if (fy_emit_token_write_original(emit, fyt, FYAS_PLAIN, wtype, flags, indent))
+		goto out;
+
 	atom = fy_token_atom(fyt);
 	if (!atom)
 		goto out;
@@ -659,7 +890,7 @@ void fy_emit_token_write_alias(struct fy_emitter *emit, struct fy_token *fyt, in
 	const char *str = NULL;
 	size_t len = 0;
 	struct fy_atom_iter iter;
-	int c;
+	int c, width;
 
 	if (!fyt)
 		return;
@@ -667,9 +898,9 @@ void fy_emit_token_write_alias(struct fy_emitter *emit, struct fy_token *fyt, in
 	fy_emit_write_indicator(emit, di_star, flags, indent, fyewt_alias);
 
 	/* try direct output first (99% of cases) */
-	str = fy_token_get_direct_output(fyt, &len);
+	str = fy_emit_token_direct_output(fyt, &len, &width);
 	if (str) {
-		fy_emit_write(emit, fyewt_alias, str, len);
+		fy_emit_write_width(emit, fyewt_alias, str, len, width);
 		return;
 	}
 
@@ -686,7 +917,7 @@ void fy_emit_token_write_alias(struct fy_emitter *emit, struct fy_token *fyt, in
 void fy_emit_token_write_quoted(struct fy_emitter *emit, struct fy_token *fyt, int flags, int indent, char qc)
 {
 	bool allow_breaks, spaces, breaks;
-	int c, i, w, digit;
+	int c, i, w, digit, width;
 	enum fy_emitter_write_type wtype;
 	const char *str = NULL;
 	size_t len = 0;
@@ -709,12 +940,18 @@ void fy_emit_token_write_quoted(struct fy_emitter *emit, struct fy_token *fyt, i
 		goto out;
 
 	/* simple case of direct output (large amount of cases) */
-	str = fy_token_get_direct_output(fyt, &len);
+	str = fy_emit_token_direct_output(fyt, &len, &width);
 	if (str) {
-		fy_emit_write(emit, wtype, str, len);
+		fy_emit_write_width(emit, wtype, str, len, width);
 		goto out;
 	}
 
+	/* escapes or multi line, same as the source */
+	if (fy_emit_token_write_original(emit, fyt,
+			qc == '\'' ? FYAS_SINGLE_QUOTED : FYAS_DOUBLE_QUOTED,
+			wtype, flags, indent))
+		goto out;
+
 	/* no atom? i.e. empty */
 	atom = fy_token_atom(fyt);
 	if (!atom)
@@ -918,6 +1155,9 @@ void fy_emit_token_write_literal(struct fy_emitter *emit, struct fy_token *fyt,
 	fy_emit_putc(emit, fyewt_linebreak, '\n');
 	emit->flags |= FYEF_WHITESPACE | FYEF_INDENTATION;
 
+	if (fy_emit_token_write_original(emit, fyt, FYAS_LITERAL, fyewt_literal_scalar, flags, indent))
+		return;
+
 	atom = fy_token_atom(fyt);
 	if (!atom)
 		goto out;
@@ -965,6 +1205,9 @@ void fy_emit_token_write_folded(struct fy_emitter *emit, struct fy_token *fyt, i
 	fy_emit_putc(emit, fyewt_linebreak, '\n');
 	emit->flags |= FYEF_WHITESPACE | FYEF_INDENTATION;
 
+	if (fy_emit_token_write_original(emit, fyt, FYAS_FOLDED, fyewt_folded_scalar, flags, indent))
+		return;
+
 	atom = fy_token_atom(fyt);
 	if (!atom)
 		return;
@@ -1239,11 +1482,21 @@ void fy_emit_sequence(struct fy_emitter *emit, struct fy_node *fyn, int flags, i
 {
 	struct fy_node *fyni, *fynin;
 	struct fy_token *fyt_value;
-	bool last;
+	bool last, shared;
 	struct fy_emit_save_ctx sct, *sc = &sct;
 
 	memset(sc, 0, sizeof(*sc));
 
+	/* lazy copies are emitted straight from their source */
+	shared = fyn != fy_node_content(fyn);
+	if (shared) {
+		fyn = fy_node_content(fyn);
+		emit->shared_depth++;
+	}
+
+	/* lazy collections are built just before emitting them */
+	fy_node_lazy_expand(fyn);
+
 	sc->flags = flags;
 	sc->indent = indent;
 	sc->empty = fy_node_list_empty(&fyn->sequence);
@@ -1265,6 +1518,9 @@ void fy_emit_sequence(struct fy_emitter *emit, struct fy_node *fyn, int flags, i
 	}
 
 	fy_emit_sequence_epilog(emit, sc);
+
+	if (shared)
+		emit->shared_depth--;
 }
 
 static void fy_emit_mapping_prolog(struct fy_emitter *emit, struct fy_emit_save_ctx *sc)
@@ -1380,13 +1636,22 @@ static void fy_emit_mapping_value_epilog(struct fy_emitter *emit, struct fy_emit
 void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, int indent)
 {
 	struct fy_node_pair *fynp, *fynpn, **fynpp = NULL;
+	struct fy_node *fyn_key;
 	struct fy_token *fyt_key, *fyt_value;
-	bool last, simple_key;
+	bool last, simple_key, shared;
 	int aflags, i;
 	struct fy_emit_save_ctx sct, *sc = &sct;
 
 	memset(sc, 0, sizeof(*sc));
 
+	shared = fyn != fy_node_content(fyn);
+	if (shared) {
+		fyn = fy_node_content(fyn);
+		emit->shared_depth++;
+	}
+
+	fy_node_lazy_expand(fyn);
+
 	sc->flags = flags;
 	sc->indent = indent;
 	sc->empty = fy_node_pair_list_empty(&fyn->mapping);
@@ -1417,17 +1682,19 @@ void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, in
 		fyt_value = fy_node_value_token(fynp->value);
 
 		simple_key = false;
-		if (fynp->key) {
-			switch (fynp->key->type) {
+		fyn_key = fy_node_content(fynp->key);
+		if (fyn_key) {
+			fy_node_lazy_expand(fyn_key);
+			switch (fyn_key->type) {
 			case FYNT_SCALAR:
-				aflags = fy_token_text_analyze(fynp->key->scalar);
+				aflags = fy_token_text_analyze(fyn_key->scalar);
 				simple_key = !!(aflags & FYTTAF_CAN_BE_SIMPLE_KEY);
 				break;
 			case FYNT_SEQUENCE:
-				simple_key = fy_node_list_empty(&fynp->key->sequence);
+				simple_key = fy_node_list_empty(&fyn_key->sequence);
 				break;
 			case FYNT_MAPPING:
-				simple_key = fy_node_pair_list_empty(&fynp->key->mapping);
+				simple_key = fy_node_pair_list_empty(&fyn_key->mapping);
 				break;
 			}
 		}
@@ -1447,6 +1714,9 @@ void fy_emit_mapping(struct fy_emitter *emit, struct fy_node *fyn, int flags, in
 		fy_node_mapping_sort_release_array(fyn, fynpp);
 
 	fy_emit_mapping_epilog(emit, sc);
+
+	if (shared)
+		emit->shared_depth--;
 }
 
 int fy_emit_common_document_start(struct fy_emitter *emit,
@@ -1589,10 +1859,10 @@ int fy_emit_common_document_end(struct fy_emitter *emit)
 
 	fyds = emit->fyds;
 
-	if (emit->column != 0) {
+	if (emit->column != 0)
 		fy_emit_putc(emit, fyewt_linebreak, '\n');
-		emit->flags = FYEF_WHITESPACE | FYEF_INDENTATION;
-	}
+	/* even without output (i.e. an empty json root) the next one starts afresh */
+	emit->flags = FYEF_WHITESPACE | FYEF_INDENTATION;
 
 	dem = ((dem_flags == FYECF_DOC_END_MARK_AUTO && !fyds->end_implicit) ||
 	        dem_flags == FYECF_DOC_END_MARK_ON) &&
@@ -1611,6 +1881,9 @@ int fy_emit_common_document_end(struct fy_emitter *emit)
 	/* stop our association with the document */
 	emit->fyds = NULL;
 
+	/* hand over the document's output */
+	fy_emit_flush(emit);
+
 	return 0;
 }
 
@@ -1650,6 +1923,9 @@ int fy_emit_common_explicit_document_end(struct fy_emitter *emit)
 	/* stop our association with the document */
 	emit->fyds = NULL;
 
+	/* hand over the document's output */
+	fy_emit_flush(emit);
+
 	return 0;
 }
 
@@ -1723,6 +1999,11 @@ void fy_emit_cleanup(struct fy_emitter *emit)
 
 	fy_emit_accum_cleanup(&emit->ea);
 
+	/* anything still pending is output now */
+	fy_emit_flush(emit);
+	if (emit->obuf)
+		free(emit->obuf);
+
 	while ((fyep = fy_eventp_list_pop(&emit->queued_events)) != NULL)
 		fy_eventp_release(fyep);
 
@@ -1735,8 +2016,10 @@ void fy_emit_cleanup(struct fy_emitter *emit)
 
 int fy_emit_node(struct fy_emitter *emit, struct fy_node *fyn)
 {
-	if (fyn)
+	if (fyn) {
 		fy_emit_node_internal(emit, fyn, DDNF_ROOT, -1);
+		fy_emit_flush(emit);
+	}
 	return 0;
 }
 
@@ -1756,6 +2039,8 @@ int fy_emit_root_node(struct fy_emitter *emit, struct fy_node *fyn)
 	/* bottom comment last */
 	fy_emit_node_comment(emit, fyn, DDNF_ROOT, -1, fycp_bottom);
 
+	fy_emit_flush(emit);
+
 	return 0;
 }
 
@@ -1818,9 +2103,8 @@ struct fy_emit_buffer_state {
 	bool grow;
 };
 
-static int do_buffer_output(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len, void *userdata)
+static int fy_emit_buffer_append(struct fy_emit_buffer_state *state, const char *str, int len)
 {
-	struct fy_emit_buffer_state *state = emit->cfg->userdata;
 	int left;
 	int pagesize = 0;
 	int size;
@@ -1854,6 +2138,25 @@ static int do_buffer_output(struct fy_emitter *emit, enum fy_emitter_write_type
 	return len;
 }
 
+static int do_buffer_output(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len, void *userdata)
+{
+	return fy_emit_buffer_append(emit->cfg->userdata, str, len);
+}
+
+static int do_buffer_output_bulk(struct fy_emitter *emit, const struct iovec *iov, int iovcnt, void *userdata)
+{
+	int i, len, total = 0;
+
+	for (i = 0; i < iovcnt; i++) {
+		len = fy_emit_buffer_append(emit->cfg->userdata, iov[i].iov_base, iov[i].iov_len);
+		if (len < 0)
+			return -1;
+		total += len;
+	}
+
+	return total;
+}
+
 static int fy_emit_str_internal(struct fy_document *fyd,
 				enum fy_emitter_cfg_flags flags,
 				struct fy_node *fyn, char **bufp, int *sizep,
@@ -1868,6 +2171,7 @@ static int fy_emit_str_internal(struct fy_document *fyd,
 	memset(&state, 0, sizeof(state));
 
 	emit_cfg.output = do_buffer_output;
+	emit_cfg.output_bulk = do_buffer_output_bulk;
 	emit_cfg.userdata = &state;
 	emit_cfg.flags = flags;
 	state.buf = *bufp;
@@ -1939,6 +2243,17 @@ static int do_file_output(struct fy_emitter *emit, enum fy_emitter_write_type ty
 	return fwrite(str, 1, len, fp);
 }
 
+static int do_file_output_bulk(struct fy_emitter *emit, const struct iovec *iov, int iovcnt, void *userdata)
+{
+	FILE *fp = userdata;
+	int i, total = 0;
+
+	for (i = 0; i < iovcnt; i++)
+		total += fwrite(iov[i].iov_base, 1, iov[i].iov_len, fp);
+
+	return total;
+}
+
 int fy_emit_document_to_fp(struct fy_document *fyd, enum fy_emitter_cfg_flags flags,
 			   FILE *fp)
 {
@@ -1951,6 +2266,7 @@ int fy_emit_document_to_fp(struct fy_document *fyd, enum fy_emitter_cfg_flags fl
 
 	memset(&emit_cfg, 0, sizeof(emit_cfg));
 	emit_cfg.output = do_file_output;
+	emit_cfg.output_bulk = do_file_output_bulk;
 	emit_cfg.userdata = fp;
 	emit_cfg.flags = flags;
 	fy_emit_setup(emit, &emit_cfg);
@@ -39,6 +39,7 @@ struct fy_emit_accum {
 	size_t next;
 	char inplace[FYEA_INPLACE_SZ];
 	int utf8_count;
+	bool has_lb;
 	int start_col, col;
 	int ts;
 	enum fy_emitter_write_type type;
@@ -93,6 +94,12 @@ struct fy_emitter {
 	struct fy_document *fyd;
 	struct fy_document_state *fyds;	/* fyd->fyds when fyd != NULL */
 	struct fy_emit_accum ea;
+	/* > 0 while emitting content shared by a lazy copy */
+	int shared_depth;
+	/* pending output of the bulk output method */
+	char *obuf;
+	size_t obuf_size;
+	size_t obuf_next;
 
 	/* streaming event mode */
 	enum fy_emitter_state state;
@@ -111,6 +118,8 @@ struct fy_emitter {
 };
 
 void fy_emit_write(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len);
+void fy_emit_write_width(struct fy_emitter *emit, enum fy_emitter_write_type type, const char *str, int len, int width);
+void fy_emit_flush(struct fy_emitter *emit);
 
 static inline bool fy_emit_whitespace(struct fy_emitter *emit)
 {
@@ -132,6 +141,7 @@ fy_emit_accum_reset(struct fy_emit_accum *ea)
 {
 	ea->next = 0;
 	ea->utf8_count = 0;
+	ea->has_lb = false;
 	ea->col = ea->start_col;
 }
 
@@ -191,9 +201,10 @@ fy_emit_accum_utf8_put(struct fy_emit_accum *ea, int c)
 		return -1;
 	ea->next += w;
 	ea->utf8_count++;
-	if (fy_is_lb(c))
+	if (fy_is_lb(c)) {
 		ea->col = 0;
-	else if (fy_is_tab(c))
+		ea->has_lb = true;
+	} else if (fy_is_tab(c))
 		ea->col += (ea->ts - (ea->col % ea->ts));
 	else
 		ea->col++;
@@ -204,8 +215,11 @@ fy_emit_accum_utf8_put(struct fy_emit_accum *ea, int c)
 static inline void
 fy_emit_accum_output(struct fy_emit_accum *ea)
 {
-	if (ea->next > 0)
+	/* without line breaks the width is the character count */
+	if (ea->next > 0 && ea->has_lb)
 		fy_emit_write(ea->emit, ea->type, ea->accum, ea->next);
+	else if (ea->next > 0)
+		fy_emit_write_width(ea->emit, ea->type, ea->accum, ea->next, ea->utf8_count);
 	fy_emit_accum_reset(ea);
 }
 
@@ -31,4 +31,7 @@ FY_PARSE_TYPE_DECL(eventp);
 
 void fy_eventp_release(struct fy_eventp *fyep);
 
+/* drop the references the event holds and mark it as FYET_NONE */
+void fy_event_clean(struct fy_event *fye);
+
 #endif
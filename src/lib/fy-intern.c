@@ -0,0 +1,162 @@
+/*
+ * fy-intern.c - interned (shared) key strings
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <stdlib.h>
+
+#include "fy-intern.h"
+
+#define FY_INTERN_BUCKETS_MIN	64
+
+static struct hlist_head *fy_intern_buckets_alloc(unsigned int nbuckets)
+{
+	struct hlist_head *buckets;
+	unsigned int i;
+
+	buckets = malloc(sizeof(*buckets) * nbuckets);
+	if (!buckets)
+		return NULL;
+
+	for (i = 0; i < nbuckets; i++)
+		INIT_HLIST_HEAD(&buckets[i]);
+
+	return buckets;
+}
+
+struct fy_intern *fy_intern_create(void)
+{
+	struct fy_intern *fyin;
+
+	fyin = malloc(sizeof(*fyin));
+	if (!fyin)
+		return NULL;
+
+	fyin->buckets = fy_intern_buckets_alloc(FY_INTERN_BUCKETS_MIN);
+	if (!fyin->buckets) {
+		free(fyin);
+		return NULL;
+	}
+
+	fyin->refs = 1;
+	fyin->count = 0;
+	fyin->mask = FY_INTERN_BUCKETS_MIN - 1;
+	fy_arena_init(&fyin->arena, 0);
+
+	return fyin;
+}
+
+struct fy_intern *fy_intern_ref(struct fy_intern *fyin)
+{
+	if (!fyin)
+		return NULL;
+
+	assert(fyin->refs + 1 > 0);
+	fyin->refs++;
+
+	return fyin;
+}
+
+void fy_intern_unref(struct fy_intern *fyin)
+{
+	if (!fyin)
+		return;
+
+	assert(fyin->refs > 0);
+	if (--fyin->refs > 0)
+		return;
+
+	fy_arena_cleanup(&fyin->arena);
+	free(fyin->buckets);
+	free(fyin);
+}
+
+void fy_intern_destroy(struct fy_intern *fyin)
+{
+	fy_intern_unref(fyin);
+}
+
+unsigned int fy_intern_count(struct fy_intern *fyin)
+{
+	return fyin ? fyin->count : 0;
+}
+
+const struct fy_intern_str *
+fy_intern_lookup(struct fy_intern *fyin, const char *str, size_t len, uint32_t hash)
+{
+	struct fy_intern_str *fyis;
+	struct hlist_node *pos;
+
+	if (!fyin || !str)
+		return NULL;
+
+	hlist_for_each_entry(fyis, pos, &fyin->buckets[hash & fyin->mask], hnode) {
+		if (fyis->hash == hash && fyis->len == len && !memcmp(fyis->str, str, len))
+			return fyis;
+	}
+
+	return NULL;
+}
+
+static void fy_intern_grow(struct fy_intern *fyin)
+{
+	struct hlist_head *buckets;
+	struct fy_intern_str *fyis;
+	struct hlist_node *pos, *n;
+	unsigned int i, nbuckets;
+
+	/* on allocation failure just live with longer chains */
+	nbuckets = (fyin->mask + 1) * 2;
+	buckets = fy_intern_buckets_alloc(nbuckets);
+	if (!buckets)
+		return;
+
+	for (i = 0; i <= fyin->mask; i++) {
+		hlist_for_each_entry_safe(fyis, pos, n, &fyin->buckets[i], hnode)
+			hlist_add_head(&fyis->hnode, &buckets[fyis->hash & (nbuckets - 1)]);
+	}
+
+	free(fyin->buckets);
+	fyin->buckets = buckets;
+	fyin->mask = nbuckets - 1;
+}
+
+const struct fy_intern_str *
+fy_intern_get(struct fy_intern *fyin, const char *str, size_t len, uint32_t hash)
+{
+	const struct fy_intern_str *fyis_found;
+	struct fy_intern_str *fyis;
+
+	if (!fyin || !str)
+		return NULL;
+
+	fyis_found = fy_intern_lookup(fyin, str, len, hash);
+	if (fyis_found)
+		return fyis_found;
+
+	fyis = fy_arena_alloc(&fyin->arena, sizeof(*fyis) + len + 1);
+	if (!fyis)
+		return NULL;
+
+	fyis->fyin = fyin;
+	fyis->hash = hash;
+	fyis->len = len;
+	memcpy(fyis->str, str, len);
+	fyis->str[len] = '\0';
+
+	hlist_add_head(&fyis->hnode, &fyin->buckets[hash & fyin->mask]);
+	if (++fyin->count > fyin->mask + 1)
+		fy_intern_grow(fyin);
+
+	return fyis;
+}
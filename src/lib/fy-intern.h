@@ -0,0 +1,51 @@
+/*
+ * fy-intern.h - interned (shared) key strings header
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_INTERN_H
+#define FY_INTERN_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <libfyaml.h>
+
+#include "fy-list.h"
+#include "fy-arena.h"
+
+/* the strings are carved out of the arena and live as long as the table */
+struct fy_intern_str {
+	struct hlist_node hnode;
+	struct fy_intern *fyin;		/* the table it belongs to */
+	uint32_t hash;
+	size_t len;
+	char str[];			/* zero terminated */
+};
+
+struct fy_intern {
+	int refs;
+	unsigned int count;
+	unsigned int mask;		/* number of buckets - 1 */
+	struct hlist_head *buckets;
+	struct fy_arena arena;
+};
+
+struct fy_intern *fy_intern_ref(struct fy_intern *fyin);
+void fy_intern_unref(struct fy_intern *fyin);
+
+/* find or add the string; NULL only on allocation failure */
+const struct fy_intern_str *
+fy_intern_get(struct fy_intern *fyin, const char *str, size_t len, uint32_t hash);
+
+/* find the string without adding it */
+const struct fy_intern_str *
+fy_intern_lookup(struct fy_intern *fyin, const char *str, size_t len, uint32_t hash);
+
+#endif
@@ -0,0 +1,457 @@
+/*
+ * fy-keys.c - duplicate mapping key checks on event streams
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-utils.h"
+#include "fy-keys.h"
+
+/* mappings up to this many keys are searched linearly */
+#define FY_KEY_CHECK_INDEX_MIN	16
+
+/*
+ * The encodings; a scalar is its kind followed by the length and
+ * the text, collections enclose the encodings of their items.
+ * Empty scalars are all equal, whatever their kind.
+ */
+#define FY_KEY_ENC_SCALAR	'='
+#define FY_KEY_ENC_ALIAS	'*'
+#define FY_KEY_ENC_SEQ_START	'['
+#define FY_KEY_ENC_SEQ_END	']'
+#define FY_KEY_ENC_MAP_START	'{'
+#define FY_KEY_ENC_MAP_END	'}'
+
+void fy_key_check_setup(struct fy_key_check *fykc)
+{
+	memset(fykc, 0, sizeof(*fykc));
+	fy_key_check_frame_stack_init(&fykc->frames);
+}
+
+void fy_key_check_cleanup(struct fy_key_check *fykc)
+{
+	struct fy_key_check_frame *fykcf;
+
+	while ((fykcf = fy_key_check_frame_stack_pop(&fykc->frames)) != NULL)
+		free(fykcf->buckets);
+	fy_key_check_frame_stack_cleanup(&fykc->frames);
+	free(fykc->keys);
+	free(fykc->bytes);
+	free(fykc->pairs);
+	fy_key_check_setup(fykc);
+}
+
+static void fy_key_check_mark(struct fy_mark *fym, const struct fy_mark *fym_src)
+{
+	if (fym_src)
+		*fym = *fym_src;
+	else
+		memset(fym, 0, sizeof(*fym));
+}
+
+static char *fy_key_check_bytes_reserve(struct fy_key_check *fykc, size_t len)
+{
+	unsigned int alloc;
+	char *bytes;
+
+	if (fykc->bytes_top + len > fykc->bytes_alloc) {
+		alloc = fykc->bytes_alloc ? fykc->bytes_alloc * 2 : 256;
+		while (alloc < fykc->bytes_top + len)
+			alloc *= 2;
+		bytes = realloc(fykc->bytes, alloc);
+		if (!bytes)
+			return NULL;
+		fykc->bytes = bytes;
+		fykc->bytes_alloc = alloc;
+	}
+
+	bytes = fykc->bytes + fykc->bytes_top;
+	fykc->bytes_top += len;
+
+	return bytes;
+}
+
+static int fy_key_check_bytes_append(struct fy_key_check *fykc, const void *data, size_t len)
+{
+	char *bytes;
+
+	bytes = fy_key_check_bytes_reserve(fykc, len);
+	if (!bytes)
+		return -1;
+	memcpy(bytes, data, len);
+	return 0;
+}
+
+static int fy_key_check_encode_scalar(struct fy_key_check *fykc, struct fy_token *fyt,
+				      bool alias, bool *emptyp)
+{
+	const char *text;
+	size_t text_len;
+	uint32_t len;
+	char *p;
+
+	/* the text is prepared once; the document builder will want it too */
+	text = fy_token_get_text(fyt, &text_len);
+	if (!text)
+		return -1;
+
+	len = text_len;
+	p = fy_key_check_bytes_reserve(fykc, 1 + sizeof(len) + len);
+	if (!p)
+		return -1;
+
+	*p++ = alias && len ? FY_KEY_ENC_ALIAS : FY_KEY_ENC_SCALAR;
+	memcpy(p, &len, sizeof(len));
+	memcpy(p + sizeof(len), text, len);
+
+	*emptyp = !len;
+	return 0;
+}
+
+/* (re)build the key index of a mapping; on allocation failure keep the old one */
+static void fy_key_check_index(struct fy_key_check *fykc, struct fy_key_check_frame *fykcf)
+{
+	struct fy_key_check_key *fykck;
+	unsigned int i, nbuckets;
+	int *buckets;
+
+	nbuckets = fykcf->buckets ? (fykcf->mask + 1) * 2 : FY_KEY_CHECK_INDEX_MIN * 2;
+	buckets = malloc(sizeof(*buckets) * nbuckets);
+	if (!buckets)
+		return;
+
+	for (i = 0; i < nbuckets; i++)
+		buckets[i] = -1;
+
+	for (i = fykcf->key_base; i < fykc->keys_top; i++) {
+		fykck = &fykc->keys[i];
+		/* the keys of small mappings aren't hashed */
+		if (!fykcf->buckets)
+			fykck->hash = fy_hash_data(fykc->bytes + fykck->start, fykck->len);
+		fykck->next = buckets[fykck->hash & (nbuckets - 1)];
+		buckets[fykck->hash & (nbuckets - 1)] = (int)i;
+	}
+
+	free(fykcf->buckets);
+	fykcf->buckets = buckets;
+	fykcf->mask = nbuckets - 1;
+}
+
+static inline bool fy_key_check_key_match(struct fy_key_check *fykc,
+					  const struct fy_key_check_key *fykck,
+					  unsigned int start, unsigned int len)
+{
+	return fykck->len == len &&
+	       !memcmp(fykc->bytes + fykck->start, fykc->bytes + start, len);
+}
+
+/* the key just encoded at the top of the byte stack: 1 when already there */
+static int fy_key_check_key_add(struct fy_key_check *fykc, struct fy_key_check_frame *fykcf)
+{
+	struct fy_key_check_key *fykck;
+	unsigned int start, len, i, alloc;
+	uint32_t hash = 0;
+	int j;
+
+	start = fykcf->key_start;
+	len = fykc->bytes_top - start;
+
+	if (!fykcf->buckets) {
+		for (i = fykcf->key_base; i < fykc->keys_top; i++) {
+			if (fy_key_check_key_match(fykc, &fykc->keys[i], start, len))
+				return 1;
+		}
+	} else {
+		hash = fy_hash_data(fykc->bytes + start, len);
+		for (j = fykcf->buckets[hash & fykcf->mask]; j >= 0; j = fykc->keys[j].next) {
+			if (fykc->keys[j].hash == hash &&
+			    fy_key_check_key_match(fykc, &fykc->keys[j], start, len))
+				return 1;
+		}
+	}
+
+	if (fykc->keys_top >= fykc->keys_alloc) {
+		alloc = fykc->keys_alloc ? fykc->keys_alloc * 2 : 64;
+		fykck = realloc(fykc->keys, sizeof(*fykck) * alloc);
+		if (!fykck)
+			return -1;
+		fykc->keys = fykck;
+		fykc->keys_alloc = alloc;
+	}
+
+	fykck = &fykc->keys[fykc->keys_top];
+	fykck->start = start;
+	fykck->len = len;
+	fykck->hash = hash;
+	fykck->next = -1;
+	if (fykcf->buckets) {
+		fykck->next = fykcf->buckets[hash & fykcf->mask];
+		fykcf->buckets[hash & fykcf->mask] = (int)fykc->keys_top;
+	}
+	fykc->keys_top++;
+
+	/* index once it's large, and keep the load factor under one */
+	if (fykc->keys_top - fykcf->key_base >
+			(fykcf->buckets ? fykcf->mask + 1 : FY_KEY_CHECK_INDEX_MIN))
+		fy_key_check_index(fykc, fykcf);
+
+	return 0;
+}
+
+struct fy_key_check_pair {
+	const char *data;
+	unsigned int len;
+};
+
+static int fy_key_check_pair_cmp(const void *a, const void *b)
+{
+	const struct fy_key_check_pair *fykcp1 = a, *fykcp2 = b;
+	unsigned int len;
+	int ret;
+
+	len = fykcp1->len < fykcp2->len ? fykcp1->len : fykcp2->len;
+	ret = memcmp(fykcp1->data, fykcp2->data, len);
+	if (ret)
+		return ret;
+	return fykcp1->len == fykcp2->len ? 0 : fykcp1->len < fykcp2->len ? -1 : 1;
+}
+
+/* put the pairs of an encoded mapping in canonical order */
+static int fy_key_check_sort_pairs(struct fy_key_check *fykc, struct fy_key_check_frame *fykcf)
+{
+	struct fy_key_check_pair *fykcps;
+	unsigned int i, count, start, end;
+	char *buf, *p;
+
+	count = fykc->pairs_top - fykcf->pair_base;
+	if (count < 2)
+		return 0;
+
+	start = fykc->pairs[fykcf->pair_base];
+	end = fykc->bytes_top;
+
+	fykcps = malloc(sizeof(*fykcps) * count);
+	buf = malloc(end - start);
+	if (!fykcps || !buf) {
+		free(fykcps);
+		free(buf);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		fykcps[i].data = fykc->bytes + fykc->pairs[fykcf->pair_base + i];
+		fykcps[i].len = (i + 1 < count ? fykc->pairs[fykcf->pair_base + i + 1] : end) -
+				fykc->pairs[fykcf->pair_base + i];
+	}
+
+	qsort(fykcps, count, sizeof(*fykcps), fy_key_check_pair_cmp);
+
+	for (i = 0, p = buf; i < count; p += fykcps[i].len, i++)
+		memcpy(p, fykcps[i].data, fykcps[i].len);
+	memcpy(fykc->bytes + start, buf, end - start);
+
+	free(buf);
+	free(fykcps);
+
+	return 0;
+}
+
+static int fy_key_check_pair_start(struct fy_key_check *fykc)
+{
+	unsigned int alloc, *pairs;
+
+	if (fykc->pairs_top >= fykc->pairs_alloc) {
+		alloc = fykc->pairs_alloc ? fykc->pairs_alloc * 2 : 16;
+		pairs = realloc(fykc->pairs, sizeof(*pairs) * alloc);
+		if (!pairs)
+			return -1;
+		fykc->pairs = pairs;
+		fykc->pairs_alloc = alloc;
+	}
+	fykc->pairs[fykc->pairs_top++] = fykc->bytes_top;
+
+	return 0;
+}
+
+static int fy_key_check_push_frame(struct fy_key_check *fykc, bool mapping, bool encoded,
+				   struct fy_token *fyt_start)
+{
+	struct fy_key_check_frame *fykcf;
+
+	fykcf = fy_key_check_frame_stack_push(&fykc->frames);
+	if (!fykcf)
+		return -1;
+
+	fykcf->bytes_base = fykc->bytes_top;
+	fykcf->key_base = fykc->keys_top;
+	fykcf->pair_base = fykc->pairs_top;
+	fykcf->key_start = 0;
+	fykcf->buckets = NULL;
+	fykcf->mask = 0;
+	fykcf->mapping = mapping;
+	fykcf->at_key = true;
+	fykcf->encoded = encoded;
+	if (mapping) {
+		fy_key_check_mark(&fykcf->ms_start_mark, fy_token_start_mark(fyt_start));
+		fy_key_check_mark(&fykcf->ms_end_mark, fy_token_end_mark(fyt_start));
+		fykcf->ms_fyi = fy_token_get_input(fyt_start);
+	}
+
+	return 0;
+}
+
+int fy_key_check_push(struct fy_key_check *fykc, bool mapping, struct fy_token *fyt_start)
+{
+	return fy_key_check_push_frame(fykc, mapping, false, fyt_start);
+}
+
+/* an item of the innermost collection is complete */
+static int fy_key_check_item_done(struct fy_key_check *fykc, struct fy_token *fyt_end,
+				  bool empty, struct fy_key_check_dup *dup)
+{
+	struct fy_key_check_frame *fykcf;
+	int rc;
+
+	fykcf = fy_key_check_frame_stack_top(&fykc->frames);
+	if (!fykcf || !fykcf->mapping)
+		return 0;
+
+	fykcf->at_key = !fykcf->at_key;
+	if (fykcf->at_key)
+		return 0;
+
+	/* the key is complete */
+	rc = fy_key_check_key_add(fykc, fykcf);
+	if (rc <= 0)
+		return rc;
+
+	/* an empty key has no position of its own, point at the mapping */
+	if (empty) {
+		dup->start_mark = fykcf->ms_start_mark;
+		dup->end_mark = fykcf->ms_end_mark;
+		dup->fyi = fykcf->ms_fyi;
+	} else {
+		if (fykcf->key_scalar)
+			fy_key_check_mark(&dup->start_mark, fy_token_start_mark(fyt_end));
+		else
+			dup->start_mark = fykcf->key_start_mark;
+		fy_key_check_mark(&dup->end_mark, fy_token_end_mark(fyt_end));
+		dup->fyi = fy_token_get_input(fyt_end);
+	}
+	return 1;
+}
+
+int fy_key_check_event(struct fy_key_check *fykc, struct fy_event *fye,
+		       struct fy_key_check_dup *dup)
+{
+	struct fy_key_check_frame *fykcf;
+	struct fy_token *fyt;
+	bool encode, alias, empty;
+	char c;
+
+	fykcf = fy_key_check_frame_stack_top(&fykc->frames);
+
+	/* keys and everything in them is encoded */
+	encode = fykcf && (fykcf->encoded || (fykcf->mapping && fykcf->at_key));
+
+	switch (fye->type) {
+	case FYET_SCALAR:
+	case FYET_ALIAS:
+		alias = fye->type == FYET_ALIAS;
+		fyt = alias ? fye->alias.anchor : fye->scalar.value;
+		empty = false;
+		if (encode) {
+			if (fykcf->mapping && fykcf->at_key) {
+				fykcf->key_start = fykc->bytes_top;
+				fykcf->key_scalar = true;
+				if (fykcf->encoded && fy_key_check_pair_start(fykc))
+					return -1;
+			}
+			if (fy_key_check_encode_scalar(fykc, fyt, alias, &empty))
+				return -1;
+		}
+		return fy_key_check_item_done(fykc, fyt, empty, dup);
+
+	case FYET_SEQUENCE_START:
+	case FYET_MAPPING_START:
+		fyt = fye->type == FYET_SEQUENCE_START ?
+			fye->sequence_start.sequence_start :
+			fye->mapping_start.mapping_start;
+		if (encode) {
+			if (fykcf->mapping && fykcf->at_key) {
+				fykcf->key_start = fykc->bytes_top;
+				fykcf->key_scalar = false;
+				fy_key_check_mark(&fykcf->key_start_mark, fy_token_start_mark(fyt));
+				if (fykcf->encoded && fy_key_check_pair_start(fykc))
+					return -1;
+			}
+			c = fye->type == FYET_SEQUENCE_START ?
+				FY_KEY_ENC_SEQ_START : FY_KEY_ENC_MAP_START;
+			if (fy_key_check_bytes_append(fykc, &c, 1))
+				return -1;
+		}
+		return fy_key_check_push_frame(fykc, fye->type == FYET_MAPPING_START,
+					       encode, fyt);
+
+	case FYET_SEQUENCE_END:
+	case FYET_MAPPING_END:
+		fyt = fye->type == FYET_SEQUENCE_END ?
+			fye->sequence_end.sequence_end :
+			fye->mapping_end.mapping_end;
+
+		/* not seen opening, nothing to do */
+		if (!fykcf)
+			return 0;
+
+		if (fykcf->encoded) {
+			if (fykcf->mapping && fy_key_check_sort_pairs(fykc, fykcf))
+				return -1;
+			c = fykcf->mapping ? FY_KEY_ENC_MAP_END : FY_KEY_ENC_SEQ_END;
+			if (fy_key_check_bytes_append(fykc, &c, 1))
+				return -1;
+		} else
+			fykc->bytes_top = fykcf->bytes_base;
+
+		fykc->keys_top = fykcf->key_base;
+		fykc->pairs_top = fykcf->pair_base;
+		free(fykcf->buckets);
+		fy_key_check_frame_stack_pop(&fykc->frames);
+
+		return fy_key_check_item_done(fykc, fyt, false, dup);
+
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+void fy_key_check_report(struct fy_parser *fyp, const struct fy_key_check_dup *dup)
+{
+	struct fy_error_ctx ec;
+
+	memset(&ec, 0, sizeof(ec));
+	ec.file = __FILE__;
+	ec.line = __LINE__;
+	ec.func = __func__;
+	ec.module = FYEM_DOC;
+	ec.failed_cond = "unique keys";
+	ec.start_mark = dup->start_mark;
+	ec.end_mark = dup->end_mark;
+	ec.fyi = dup->fyi;
+
+	fy_error_report(fyp, &ec, "duplicate key");
+}
@@ -0,0 +1,92 @@
+/*
+ * fy-keys.h - duplicate mapping key checks on event streams header
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifndef FY_KEYS_H
+#define FY_KEYS_H
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <libfyaml.h>
+
+#include "fy-types.h"
+#include "fy-atom.h"
+
+/* a key of a mapping that's still open, as an encoding in the byte stack */
+struct fy_key_check_key {
+	unsigned int start;
+	unsigned int len;
+	uint32_t hash;			/* once indexed */
+	int next;			/* on the same bucket, -1 at the end */
+};
+
+/* a collection that's still open */
+struct fy_key_check_frame {
+	unsigned int bytes_base;	/* byte stack top when opened */
+	unsigned int key_base;		/* its first key */
+	unsigned int pair_base;		/* its first pair, when encoded */
+	unsigned int key_start;		/* encoding of the key being read */
+	struct fy_mark key_start_mark;	/* and where it starts, for collection keys */
+	struct fy_mark ms_start_mark;	/* the mapping start, for empty keys */
+	struct fy_mark ms_end_mark;
+	struct fy_input *ms_fyi;
+	int *buckets;			/* key index, once the mapping is large */
+	unsigned int mask;		/* number of buckets - 1 */
+	bool mapping : 1;
+	bool at_key : 1;		/* the next item is a key */
+	bool encoded : 1;		/* part of the encoding of a key */
+	bool key_scalar : 1;		/* the key is a scalar (or alias) */
+};
+FY_PARSE_STACK_DECL(key_check_frame, 16);
+
+/*
+ * Duplicate key checks without building nodes, keys are equal when
+ * fy_node_compare() would find them equal. Keys are kept encoded,
+ * collection keys with their pairs in a canonical order, since the
+ * pair order does not matter. Only the innermost open collection gets
+ * items, so the keys of each mapping are on top of the stacks and go
+ * away once it's closed. The key text is copied; the events may be
+ * recycled at once.
+ */
+struct fy_key_check {
+	struct fy_key_check_frame_stack frames;
+	struct fy_key_check_key *keys;
+	unsigned int keys_top;
+	unsigned int keys_alloc;
+	char *bytes;
+	unsigned int bytes_top;
+	unsigned int bytes_alloc;
+	unsigned int *pairs;		/* pair starts of encoded mappings */
+	unsigned int pairs_top;
+	unsigned int pairs_alloc;
+};
+
+/* where the duplicate key is */
+struct fy_key_check_dup {
+	struct fy_mark start_mark;
+	struct fy_mark end_mark;
+	struct fy_input *fyi;
+};
+
+void fy_key_check_setup(struct fy_key_check *fykc);
+void fy_key_check_cleanup(struct fy_key_check *fykc);
+
+/* for a collection whose start event has been consumed already */
+int fy_key_check_push(struct fy_key_check *fykc, bool mapping, struct fy_token *fyt_start);
+
+/* 0 when fine, 1 on a duplicate key (filling in *dup), -1 on error */
+int fy_key_check_event(struct fy_key_check *fykc, struct fy_event *fye,
+		       struct fy_key_check_dup *dup);
+
+/* report the duplicate as an error of the parser */
+void fy_key_check_report(struct fy_parser *fyp, const struct fy_key_check_dup *dup);
+
+#endif
@@ -0,0 +1,545 @@
+/*
+ * fy-parallel.c - parallel multi-document loading
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+
+struct fy_parallel_segment {
+	const char *data;
+	size_t size;
+	int line;			/* line number of the first line */
+	struct fy_document *fyd;
+};
+
+struct fy_parallel_ctx {
+	const struct fy_parse_cfg *cfg;
+	const char *name;		/* input name for diagnostics */
+	struct fy_parallel_segment *segs;
+	unsigned int count;
+	unsigned int next;
+	bool failed;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+};
+
+/*
+ * Return the start of the line break ending the line at s, and the
+ * start of the next line in *nextp. All the YAML line breaks count,
+ * CR LF being a single one, just like the parser does.
+ */
+static const char *fy_parallel_line_end(const char *s, const char *e, const char **nextp)
+{
+	const uint8_t *p = (const uint8_t *)s, *pe = (const uint8_t *)e;
+	int w;
+
+	for (; p < pe; p++) {
+		switch (*p) {
+		case '\n':
+			w = 1;
+			break;
+		case '\r':
+			w = p + 1 < pe && p[1] == '\n' ? 2 : 1;
+			break;
+		case 0xc2:	/* NEL */
+			if (pe - p < 2 || p[1] != 0x85)
+				continue;
+			w = 2;
+			break;
+		case 0xe2:	/* LS, PS */
+			if (pe - p < 3 || p[1] != 0x80 || (p[2] != 0xa8 && p[2] != 0xa9))
+				continue;
+			w = 3;
+			break;
+		default:
+			continue;
+		}
+		*nextp = (const char *)p + w;
+		return (const char *)p;
+	}
+
+	*nextp = e;
+	return e;
+}
+
+/* the start of the line containing s */
+static const char *fy_parallel_line_start(const char *data, const char *s)
+{
+	const uint8_t *p = (const uint8_t *)s, *ps = (const uint8_t *)data;
+
+	for (; p > ps; p--) {
+		if (p[-1] == '\n' || p[-1] == '\r')
+			break;
+		if (p[-1] == 0x85 && p - ps >= 2 && p[-2] == 0xc2)
+			break;
+		if ((p[-1] == 0xa8 || p[-1] == 0xa9) && p - ps >= 3 &&
+		    p[-2] == 0x80 && p[-3] == 0xe2)
+			break;
+	}
+
+	return (const char *)p;
+}
+
+/* a document marker (--- or ...) at the start of the line */
+static bool fy_parallel_line_is_marker(const char *s, const char *e, char m)
+{
+	if (e - s < 3 || s[0] != m || s[1] != m || s[2] != m)
+		return false;
+
+	return e - s == 3 || fy_is_ws(s[3]);
+}
+
+/* a line that is empty, a comment or a directive */
+static bool fy_parallel_line_is_content(const char *s, const char *e)
+{
+	if (s < e && *s == '%')
+		return false;
+
+	while (s < e && fy_is_ws(*s))
+		s++;
+
+	return s < e && *s != '#';
+}
+
+static int fy_parallel_add_segment(struct fy_parallel_ctx *ctx, unsigned int *allocp,
+				   const char *s, const char *e, int line)
+{
+	struct fy_parallel_segment *segs;
+	unsigned int alloc;
+
+	if (s >= e)
+		return 0;
+
+	if (ctx->count >= *allocp) {
+		alloc = *allocp ? *allocp * 2 : 64;
+		segs = realloc(ctx->segs, alloc * sizeof(*segs));
+		if (!segs)
+			return -1;
+		ctx->segs = segs;
+		*allocp = alloc;
+	}
+
+	segs = &ctx->segs[ctx->count++];
+	segs->data = s;
+	segs->size = (size_t)(e - s);
+	segs->line = line;
+	segs->fyd = NULL;
+
+	return 0;
+}
+
+/*
+ * Split the stream to segments containing at most one document.
+ *
+ * A document start marker begins a new segment, unless the current
+ * segment has no content yet (i.e. only directives and comments) in
+ * which case they belong to the document that follows. A document
+ * end marker always closes the current segment.
+ *
+ * Document markers can't appear at the start of a line inside any
+ * kind of scalar, so splitting here is safe as long as the parser
+ * sees the same lines. It doesn't past a NUL, which ends its input;
+ * for those 1 is returned and the caller has to split with
+ * fy_parallel_split_serial() instead.
+ */
+static int fy_parallel_split(struct fy_parallel_ctx *ctx, const char *data, size_t size)
+{
+	const char *s, *e, *le, *next, *seg_start;
+	unsigned int alloc = 0;
+	int line, seg_line;
+	bool has_content;
+
+	if (memchr(data, '\0', size))
+		return 1;
+
+	s = data;
+	e = data + size;
+
+	/* a BOM at the start of the stream goes with the first segment */
+	if (e - s >= 3 && !memcmp(s, "\xef\xbb\xbf", 3))
+		s += 3;
+
+	seg_start = data;
+	seg_line = 0;
+	has_content = false;
+	for (line = 0; s < e; line++, s = next) {
+		le = fy_parallel_line_end(s, e, &next);
+
+		if (fy_parallel_line_is_marker(s, le, '-')) {
+			if (has_content) {
+				if (fy_parallel_add_segment(ctx, &alloc, seg_start, s, seg_line))
+					return -1;
+				seg_start = s;
+				seg_line = line;
+			}
+			has_content = true;
+		} else if (fy_parallel_line_is_marker(s, le, '.')) {
+			if (fy_parallel_add_segment(ctx, &alloc, seg_start, next, seg_line))
+				return -1;
+			seg_start = next;
+			seg_line = line + 1;
+			has_content = false;
+		} else if (!has_content && fy_parallel_line_is_content(s, le))
+			has_content = true;
+	}
+
+	return fy_parallel_add_segment(ctx, &alloc, seg_start, e, seg_line);
+}
+
+/*
+ * Split by running the parser over the whole stream, which is slow
+ * but sees the stream exactly like a serial load. A document that
+ * ends implicitly ends at the line of the token that follows it, an
+ * explicit one after the line of its end marker. On an error the rest
+ * of the stream goes to the last segment, so that building it reports
+ * the error.
+ */
+static int fy_parallel_split_serial(struct fy_parallel_ctx *ctx, const char *data, size_t size)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_parser *fyp;
+	struct fy_eventp *fyep;
+	struct fy_token *fyt;
+	const struct fy_mark *fym;
+	enum fy_event_type type;
+	const char *e, *next, *seg_start;
+	unsigned int alloc = 0;
+	int seg_line, line, rc = -1;
+
+	/* keep any errors quiet, they're reported by the segment build */
+	cfg = *ctx->cfg;
+	cfg.flags |= FYPCF_COLLECT_DIAG;
+
+	fyp = fy_parser_create(&cfg);
+	if (!fyp)
+		return -1;
+
+	/* nothing outlives the parser, no need for a copy */
+	if (fy_parser_set_string(fyp, data, size))
+		goto out;
+
+	e = data + size;
+	seg_start = data;
+	seg_line = 0;
+	while ((fyep = fy_parse_private(fyp)) != NULL) {
+		type = fyep->e.type;
+		fy_parse_eventp_recycle(fyp, fyep);
+		if (type != FYET_DOCUMENT_END)
+			continue;
+
+		fyt = fy_scan_peek(fyp);
+		if (!fyt || fyt->type == FYTT_STREAM_END)
+			break;
+
+		if (fyt->type == FYTT_DOCUMENT_END) {
+			fym = fy_token_end_mark(fyt);
+			if (!fym)
+				break;
+			fy_parallel_line_end(data + fym->input_pos, e, &next);
+			line = fym->line + 1;
+		} else {
+			fym = fy_token_start_mark(fyt);
+			if (!fym)
+				break;
+			next = fy_parallel_line_start(data, data + fym->input_pos);
+			line = fym->line;
+		}
+
+		if (fy_parallel_add_segment(ctx, &alloc, seg_start, next, seg_line))
+			goto out;
+		seg_start = next;
+		seg_line = line;
+	}
+
+	rc = fy_parallel_add_segment(ctx, &alloc, seg_start, e, seg_line);
+out:
+	fy_parser_destroy(fyp);
+	return rc;
+}
+
+static int fy_parallel_build_segment(const struct fy_parallel_ctx *ctx,
+				     struct fy_parallel_segment *seg)
+{
+	struct fy_parser *fyp;
+	struct fy_document *fyd = NULL;
+	struct fy_input_cfg fyic;
+	struct fy_eventp *fyep;
+	enum fy_event_type type;
+	size_t name_len;
+	char *buf;
+	int rc;
+
+	fyp = fy_parser_create(ctx->cfg);
+	if (!fyp)
+		return -1;
+
+	/* no more updating of the document state */
+	fyp->external_document_state = true;
+
+	/* the document outlives the source, keep a copy with the parser */
+	name_len = ctx->name ? strlen(ctx->name) + 1 : 0;
+	buf = fy_parser_alloc(fyp, seg->size + 1 + name_len);
+	fy_error_check(fyp, buf, err_out,
+			"fy_parser_alloc() failed");
+	memcpy(buf, seg->data, seg->size);
+	buf[seg->size] = '\0';
+	if (ctx->name)
+		memcpy(buf + seg->size + 1, ctx->name, name_len);
+
+	/* report the positions in the whole stream */
+	memset(&fyic, 0, sizeof(fyic));
+	fyic.type = fyit_memory;
+	fyic.memory.data = buf;
+	fyic.memory.size = seg->size;
+	fyic.memory.name = ctx->name ? buf + seg->size + 1 : NULL;
+	fyic.memory.line = seg->line;
+
+	rc = fy_parse_input_append(fyp, &fyic);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_parse_input_append() failed");
+
+	fyd = fy_parse_load_document(fyp);
+	if (!fyd) {
+		/* a segment with only comments has no document */
+		fy_error_check(fyp, !fyp->stream_error, err_out,
+				"fy_parse_load_document() failed");
+		fy_parser_destroy(fyp);
+		return 0;
+	}
+
+	/* move ownership of the parser to the document */
+	fyd->owns_parser = true;
+
+	/* there must be nothing but the stream end left */
+	while ((fyep = fy_parse_private(fyp)) != NULL) {
+		type = fyep->e.type;
+		fy_parse_eventp_recycle(fyp, fyep);
+		fy_error_check(fyp, type == FYET_STREAM_END, err_out_doc,
+				"more than one document in segment");
+	}
+	fy_error_check(fyp, !fyp->stream_error, err_out_doc,
+			"error after document end");
+
+	seg->fyd = fyd;
+	return 0;
+
+err_out_doc:
+	fy_document_destroy(fyd);
+	return -1;
+
+err_out:
+	fy_parser_destroy(fyp);
+	return -1;
+}
+
+static struct fy_parallel_segment *fy_parallel_next_segment(struct fy_parallel_ctx *ctx)
+{
+	struct fy_parallel_segment *seg = NULL;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&ctx->lock);
+#endif
+	if (!ctx->failed && ctx->next < ctx->count)
+		seg = &ctx->segs[ctx->next++];
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&ctx->lock);
+#endif
+	return seg;
+}
+
+static void fy_parallel_set_failed(struct fy_parallel_ctx *ctx)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&ctx->lock);
+#endif
+	ctx->failed = true;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&ctx->lock);
+#endif
+}
+
+static void *fy_parallel_worker(void *arg)
+{
+	struct fy_parallel_ctx *ctx = arg;
+	struct fy_parallel_segment *seg;
+
+	while ((seg = fy_parallel_next_segment(ctx)) != NULL) {
+		if (fy_parallel_build_segment(ctx, seg))
+			fy_parallel_set_failed(ctx);
+	}
+
+	return NULL;
+}
+
+static struct fy_document **
+fy_parallel_build(const struct fy_parse_cfg *cfg, const char *name,
+		  const char *data, size_t size, int jobs)
+{
+	struct fy_parallel_ctx ctx;
+	struct fy_document **fyds = NULL;
+#ifdef HAVE_PTHREAD
+	pthread_t *tids = NULL;
+	int i, started = 0;
+#endif
+	unsigned int j, n;
+	long ncpus;
+	int rc;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.cfg = cfg ? cfg : &doc_parse_default_cfg;
+	ctx.name = name;
+
+	rc = fy_parallel_split(&ctx, data, size);
+	if (rc > 0) {
+		ctx.count = 0;
+		rc = fy_parallel_split_serial(&ctx, data, size);
+	}
+	if (rc)
+		goto out;
+
+	if (jobs <= 0) {
+		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = ncpus > 0 ? (int)ncpus : 1;
+	}
+	if ((unsigned int)jobs > ctx.count)
+		jobs = ctx.count ? (int)ctx.count : 1;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	/* the calling thread is a worker too */
+	if (jobs > 1)
+		tids = malloc((jobs - 1) * sizeof(*tids));
+	if (tids) {
+		for (i = 0; i < jobs - 1; i++) {
+			if (pthread_create(&tids[started], NULL, fy_parallel_worker, &ctx))
+				break;
+			started++;
+		}
+	}
+#endif
+
+	fy_parallel_worker(&ctx);
+
+#ifdef HAVE_PTHREAD
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+	free(tids);
+
+	pthread_mutex_destroy(&ctx.lock);
+#endif
+
+	if (!ctx.failed)
+		fyds = malloc((ctx.count + 1) * sizeof(*fyds));
+
+	/* collect in stream order, skipping empty segments */
+	for (j = 0, n = 0; j < ctx.count; j++) {
+		if (!ctx.segs[j].fyd)
+			continue;
+		if (fyds)
+			fyds[n++] = ctx.segs[j].fyd;
+		else
+			fy_document_destroy(ctx.segs[j].fyd);
+	}
+	if (fyds)
+		fyds[n] = NULL;
+out:
+	free(ctx.segs);
+	return fyds;
+}
+
+struct fy_document **fy_document_build_all_from_string(const struct fy_parse_cfg *cfg,
+						       const char *str, size_t len, int jobs)
+{
+	if (!str)
+		return NULL;
+
+	if (len == (size_t)-1)
+		len = strlen(str);
+
+	return fy_parallel_build(cfg, NULL, str, len, jobs);
+}
+
+struct fy_document **fy_document_build_all_from_file(const struct fy_parse_cfg *cfg,
+						     const char *file, int jobs)
+{
+	struct fy_parser *fyp = NULL;
+	struct fy_document **fyds = NULL;
+	struct fy_input *fyi;
+	char *buf = NULL, *newbuf;
+	size_t size = 0, alloc = 0, nread;
+	const char *data;
+	int rc;
+
+	if (!file)
+		return NULL;
+
+	if (!cfg)
+		cfg = &doc_parse_default_cfg;
+
+	/* use a parser to open (and mmap) the file, honoring the search path */
+	fyp = fy_parser_create(cfg);
+	if (!fyp)
+		return NULL;
+
+	rc = fy_parser_set_input_file(fyp, file);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_parser_set_input_file() failed");
+
+	rc = fy_parse_get_next_input(fyp);
+	fy_error_check(fyp, rc > 0, err_out,
+			"failed to open %s", file);
+
+	fyi = fyp->current_input;
+	assert(fyi);
+
+	if (fyi->file.addr) {
+		data = fyi->file.addr;
+		size = fyi->file.length;
+	} else {
+		/* can't mmap; read it all */
+		fy_error_check(fyp, fyi->fp, err_out,
+				"no input stream for %s", file);
+		do {
+			if (size >= alloc) {
+				alloc = alloc ? alloc * 2 : 65536;
+				newbuf = realloc(buf, alloc);
+				fy_error_check(fyp, newbuf, err_out,
+						"realloc() failed");
+				buf = newbuf;
+			}
+			nread = fread(buf + size, 1, alloc - size, fyi->fp);
+			size += nread;
+		} while (nread > 0);
+
+		fy_error_check(fyp, !ferror(fyi->fp), err_out,
+				"failed to read %s", file);
+		data = buf ? buf : "";
+	}
+
+	fyds = fy_parallel_build(cfg, file, data, size, jobs);
+
+err_out:
+	free(buf);
+	fy_parser_destroy(fyp);
+	return fyds;
+}
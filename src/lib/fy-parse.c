@@ -21,12 +21,19 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <limits.h>
+#include <stdint.h>
+
+#if defined(HAVE_SWAPCONTEXT) && HAVE_SWAPCONTEXT
+#include <ucontext.h>
+#define FY_PARSER_FEED_SUSPEND
+#endif
 
 #include <libfyaml.h>
 
 #include "fy-parse.h"
 
 #include "fy-utils.h"
+#include "fy-keys.h"
 
 /* only check atom sizes on debug */
 #ifndef NDEBUG
@@ -82,8 +89,9 @@ const void *fy_ptr_slow_path(struct fy_parser *fyp, size_t *leftp)
 		/* fall-through */
 
 	case fyit_stream:
+	case fyit_callback:
 		left = fyi->read - fyp->current_input_pos;
-		p = fyi->buffer + fyp->current_input_pos;
+		p = fyi->buffer + (fyp->current_input_pos - fyi->discarded);
 		break;
 
 	case fyit_memory:
@@ -142,7 +150,8 @@ int fy_parse_get_next_input(struct fy_parser *fyp)
 	fyp->current_input_pos = 0;
 	fyp->current_c = -1;
 	fyp->current_w = 0;
-	fyp->line = 0;
+	/* a memory input may be a part of a larger stream */
+	fyp->line = fyi->cfg.type == fyit_memory ? fyi->cfg.memory.line : 0;
 	fyp->column = 0;
 
 	fy_scan_debug(fyp, "get next input: new input");
@@ -240,16 +249,21 @@ int fy_append_tag_directive(struct fy_parser *fyp,
 	struct fy_atom atom;
 
 	size = strlen(handle) + 1 + strlen(prefix);
-	data = fy_parse_alloc(fyp, size + 1);
+	data = malloc(size + 1);
 	fy_error_check(fyp, data, err_out,
-			"fy_parse_alloc() failed");
+			"malloc() failed");
 
 	snprintf(data, size + 1, "%s %s", handle, prefix);
 
 	fyi = fy_parse_input_from_data(fyp, data, size, &atom, true);
+	if (!fyi)
+		free(data);
 	fy_error_check(fyp, fyi, err_out,
 			"fy_parse_input_from_data() failed");
 
+	/* the input owns the data; a reset parser would pile them up otherwise */
+	fyi->buffer = data;
+
 	handle_size = strlen(handle);
 	prefix_size = strlen(prefix);
 
@@ -258,6 +272,10 @@ int fy_append_tag_directive(struct fy_parser *fyp,
 	fy_error_check(fyp, fyt, err_out,
 			"fy_token_create() failed");
 
+	/* the tags of copies in other documents still point to it */
+	fyt->handle.fyi = fy_input_ref(fyi);
+	fyt->input_ref = true;
+
 	fy_token_list_add_tail(&fyds->fyt_td, fyt);
 
 	if (!fy_tag_is_default(handle, handle_size, prefix, prefix_size))
@@ -351,7 +369,7 @@ int fy_reset_document_state(struct fy_parser *fyp)
 	/* TODO check when cleaning flow lists */
 	fyp->flow_level = 0;
 	fyp->flow = FYFT_NONE;
-	fy_parse_flow_list_recycle_all(fyp, &fyp->flow_stack);
+	fy_flow_stack_reset(&fyp->flow_stack);
 
 	return 0;
 
@@ -507,6 +525,86 @@ err_duplicate_tag_directive:
 	goto err_out;
 }
 
+/*
+ * Push mode; the scanner pulls its input as it goes, so when it runs
+ * out of fed data mid token it is suspended on its own stack, and
+ * resumed from fy_parser_parse() when the application fed some more.
+ * Switching stacks isn't free (it saves the signal mask too), so once
+ * there the parser keeps going for a batch of events, and once all of
+ * the input is in it runs on the caller's stack.
+ */
+#define FY_PARSER_FEED_STACK	(256 << 10)
+#define FY_PARSER_FEED_BATCH	64
+
+struct fy_parser_feed {
+	struct fy_parser *fyp;
+	struct fy_input *fyi;		/* the fed input */
+	bool need_input;		/* the last parse ran out of fed data */
+#ifdef FY_PARSER_FEED_SUSPEND
+	bool running;			/* the parser runs on the feed stack */
+	bool suspended;			/* and is waiting for input mid parse */
+	void *stack;
+	struct fy_eventp_list queued;	/* parsed ahead on the feed stack */
+	ucontext_t caller;
+	ucontext_t ctx;
+#endif
+};
+
+static void fy_parser_key_check_free(struct fy_parser *fyp)
+{
+	if (!fyp->key_check)
+		return;
+
+	fy_key_check_cleanup(fyp->key_check);
+	free(fyp->key_check);
+	fyp->key_check = NULL;
+}
+
+static void fy_parser_feed_free(struct fy_parser *fyp)
+{
+	struct fy_parser_feed *feed;
+#ifdef FY_PARSER_FEED_SUSPEND
+	struct fy_eventp *fyep;
+#endif
+
+	feed = fyp->feed;
+	if (!feed)
+		return;
+
+	/* a parse suspended mid token is simply abandoned */
+	fy_input_unref(feed->fyi);
+#ifdef FY_PARSER_FEED_SUSPEND
+	while ((fyep = fy_eventp_list_pop(&feed->queued)) != NULL)
+		fy_parse_eventp_recycle(fyp, fyep);
+	if (feed->stack)
+		free(feed->stack);
+#endif
+	free(feed);
+	fyp->feed = NULL;
+}
+
+/* suspend until more input is fed; false if the parser can't be */
+static bool fy_parser_feed_wait(struct fy_parser *fyp)
+{
+#ifdef FY_PARSER_FEED_SUSPEND
+	struct fy_parser_feed *feed;
+
+	feed = fyp->feed;
+	if (!feed || !feed->running)
+		return false;
+
+	feed->need_input = true;
+	feed->running = false;
+	feed->suspended = true;
+	swapcontext(&feed->ctx, &feed->caller);
+	feed->suspended = false;
+	feed->running = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
 static const struct fy_parse_cfg default_parse_cfg = {
 	.search_path = "",
 	.flags = FYPCF_DEBUG_LEVEL_INFO | FYPCF_DEBUG_DIAG_TYPE | FYPCF_COLOR_AUTO | FYPCF_DEBUG_ALL,
@@ -522,13 +620,11 @@ int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 
 	fy_talloc_list_init(&fyp->tallocs);
 
-	fy_indent_list_init(&fyp->indent_stack);
-	fy_indent_list_init(&fyp->recycled_indent);
+	fy_indent_stack_init(&fyp->indent_stack);
 	fyp->indent = -2;
 	fyp->generated_block_map = false;
 
-	fy_simple_key_list_init(&fyp->simple_keys);
-	fy_simple_key_list_init(&fyp->recycled_simple_key);
+	fy_simple_key_stack_init(&fyp->simple_keys);
 
 	fy_token_list_init(&fyp->queued_tokens);
 	fy_token_list_init(&fyp->recycled_token);
@@ -538,14 +634,12 @@ int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 	fy_input_list_init(&fyp->recycled_input);
 
 	fyp->state = FYPS_NONE;
-	fy_parse_state_log_list_init(&fyp->state_stack);
-	fy_parse_state_log_list_init(&fyp->recycled_parse_state_log);
+	fy_parse_state_log_stack_init(&fyp->state_stack);
 
 	fy_eventp_list_init(&fyp->recycled_eventp);
 
-	fy_flow_list_init(&fyp->flow_stack);
+	fy_flow_stack_init(&fyp->flow_stack);
 	fyp->flow = FYFT_NONE;
-	fy_flow_list_init(&fyp->recycled_flow);
 
 	fy_document_state_list_init(&fyp->recycled_document_state);
 
@@ -558,11 +652,15 @@ int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg)
 	if (fyp->suppress_recycling)
 		fy_notice(fyp, "Suppressing recycling");
 
+	fyp->collect_stats = !!(fyp->cfg.flags & FYPCF_COLLECT_STATS);
+
 	fyp->current_document_state = NULL;
 	rc = fy_reset_document_state(fyp);
 	fy_error_check(fyp, !rc, err_out_rc,
 			"fy_reset_document_state() failed");
 
+	fy_intern_ref(fyp->cfg.intern);
+
 	return 0;
 
 err_out_rc:
@@ -579,25 +677,31 @@ void fy_parse_cleanup(struct fy_parser *fyp)
 	if (fyp->errbuf)
 		free(fyp->errbuf);
 
-	fy_parse_indent_list_recycle_all(fyp, &fyp->indent_stack);
-	fy_parse_simple_key_list_recycle_all(fyp, &fyp->simple_keys);
+	fy_indent_stack_cleanup(&fyp->indent_stack);
+	fy_simple_key_stack_cleanup(&fyp->simple_keys);
 	fy_token_list_unref_all(&fyp->queued_tokens);
 
-	fy_parse_parse_state_log_list_recycle_all(fyp, &fyp->state_stack);
-	fy_parse_flow_list_recycle_all(fyp, &fyp->flow_stack);
+	fy_parse_state_log_stack_cleanup(&fyp->state_stack);
+	fy_flow_stack_cleanup(&fyp->flow_stack);
 
 	fy_token_unref(fyp->stream_end_token);
 
 	if (fyp->current_document_state)
 		fy_document_state_unref(fyp->current_document_state);
 
+	fy_parser_feed_free(fyp);
+	fy_parser_key_check_free(fyp);
+
 	for (fyi = fy_input_list_head(&fyp->queued_inputs); fyi; fyi = fyin) {
 		fyin = fy_input_next(&fyp->queued_inputs, fyi);
 		fy_input_unref(fyi);
 	}
 
+	/* tokens in sliding window mode may keep their input alive */
 	for (fyi = fy_input_list_head(&fyp->parsed_inputs); fyi; fyi = fyin) {
 		fyin = fy_input_next(&fyp->parsed_inputs, fyi);
+		fy_input_list_del(&fyp->parsed_inputs, fyi);
+		fyi->on_list = NULL;
 		fy_input_unref(fyi);
 	}
 
@@ -605,15 +709,13 @@ void fy_parse_cleanup(struct fy_parser *fyp)
 	fyp->current_input = NULL;
 
 	/* and vacuum (free everything) */
-	fy_parse_indent_vacuum(fyp);
-	fy_parse_simple_key_vacuum(fyp);
 	fy_parse_token_vacuum(fyp);
 	fy_parse_input_vacuum(fyp);
-	fy_parse_parse_state_log_vacuum(fyp);
 	fy_parse_eventp_vacuum(fyp);
-	fy_parse_flow_vacuum(fyp);
 	// fy_parse_document_state_vacuum(fyp);
 
+	fy_intern_unref(fyp->cfg.intern);
+
 	/* and release all the remaining tracked memory */
 	fy_tfree_all(&fyp->tallocs);
 }
@@ -782,11 +884,22 @@ int fy_parse_input_open(struct fy_parser *fyp, struct fy_input *fyi)
 
 	assert(fyi->state == FYIS_QUEUED);
 
+	/* the data fed so far are already in the buffer */
+	if (fyi->cfg.type == fyit_callback) {
+		fyi->window = fyp->cfg.stream_window;
+		fyi->state = FYIS_PARSE_IN_PROGRESS;
+		return 0;
+	}
+
 	/* reset common data */
 	fyi->buffer = NULL;
 	fyi->allocated = 0;
 	fyi->read = 0;
 	fyi->chunk = 0;
+	fyi->window = 0;
+	fyi->discarded = 0;
+	fyi->pins = NULL;
+	fyi->pins_count = 0;
 	fyi->fp = NULL;
 
 	switch (fyi->cfg.type) {
@@ -833,6 +946,7 @@ int fy_parse_input_open(struct fy_parser *fyp, struct fy_input *fyi)
 		fy_error_check(fyp, fyi->buffer, err_out,
 				"fy_alloc() failed");
 		fyi->allocated = fyi->chunk;
+		fyi->window = fyp->cfg.stream_window;
 		break;
 
 	case fyit_stream:
@@ -845,6 +959,7 @@ int fy_parse_input_open(struct fy_parser *fyp, struct fy_input *fyi)
 				"fy_alloc() failed");
 		fyi->allocated = fyi->chunk;
 		fyi->fp = fyi->cfg.stream.fp;
+		fyi->window = fyp->cfg.stream_window;
 		break;
 
 	case fyit_memory:
@@ -898,18 +1013,36 @@ void fy_input_close(struct fy_input *fyi)
 		memset(&fyi->stream, 0, sizeof(fyi->stream));
 		break;
 
+	case fyit_callback:
+		if (fyi->buffer) {
+			free(fyi->buffer);
+			fyi->buffer = NULL;
+		}
+		break;
+
 	case fyit_memory:
-		/* nothing */
+		/* only when the data is owned */
+		if (fyi->buffer) {
+			free(fyi->buffer);
+			fyi->buffer = NULL;
+		}
 		break;
 
 	default:
 		break;
 	}
+
+	if (fyi->pins) {
+		free(fyi->pins);
+		fyi->pins = NULL;
+		fyi->pins_count = 0;
+	}
 }
 
 int fy_parse_input_done(struct fy_parser *fyp)
 {
 	struct fy_input *fyi;
+	size_t size;
 	void *buf;
 
 	if (!fyp)
@@ -927,15 +1060,17 @@ int fy_parse_input_done(struct fy_parser *fyp)
 		/* fall-through */
 
 	case fyit_stream:
+	case fyit_callback:
 		fy_error_check(fyp, fyp, err_out,
 				"no parser associated with input");
 		/* chop extra buffer */
-		buf = realloc(fyi->buffer, fyp->current_input_pos);
-		fy_error_check(fyp, buf || !fyp->current_input_pos, err_out,
+		size = fyp->current_input_pos - fyi->discarded;
+		buf = realloc(fyi->buffer, size);
+		fy_error_check(fyp, buf || !size, err_out,
 				"realloc() failed");
 
 		fyi->buffer = buf;
-		fyi->allocated = fyp->current_input_pos;
+		fyi->allocated = size;
 		break;
 	default:
 		break;
@@ -956,15 +1091,10 @@ err_out:
 	return -1;
 }
 
-struct fy_input *fy_parse_input_from_data(struct fy_parser *fyp,
-		const char *data, size_t size, struct fy_atom *handle,
-		bool simple)
+struct fy_input *fy_parse_input_from_buffer(struct fy_parser *fyp,
+		const void *data, size_t size, bool owned)
 {
 	struct fy_input *fyi;
-	unsigned int aflags;
-
-	if (data && size == (size_t)-1)
-		size = strlen(data);
 
 	fyi = fy_input_alloc();
 	fy_error_check(fyp, fyi, err_out,
@@ -975,12 +1105,37 @@ struct fy_input *fy_parse_input_from_data(struct fy_parser *fyp,
 	fyi->cfg.memory.data = data;
 	fyi->cfg.memory.size = size;
 
-	fyi->buffer = NULL;
-	fyi->allocated = 0;
+	/* owned data are freed on close */
+	fyi->buffer = owned ? (void *)data : NULL;
+	fyi->allocated = owned ? size : 0;
 	fyi->read = 0;
 	fyi->chunk = 0;
 	fyi->fp = NULL;
 
+	fyi->state = FYIS_PARSED;
+	fyi->on_list = &fyp->parsed_inputs;
+	fy_input_list_add_tail(fyi->on_list, fyi);
+
+	return fyi;
+
+err_out:
+	return NULL;
+}
+
+struct fy_input *fy_parse_input_from_data(struct fy_parser *fyp,
+		const char *data, size_t size, struct fy_atom *handle,
+		bool simple)
+{
+	struct fy_input *fyi;
+	unsigned int aflags;
+
+	if (data && size == (size_t)-1)
+		size = strlen(data);
+
+	fyi = fy_parse_input_from_buffer(fyp, data, size, false);
+	if (!fyi)
+		return NULL;
+
 	if (size > 0)
 		aflags = fy_analyze_scalar_content(data, size);
 	else
@@ -1018,23 +1173,101 @@ struct fy_input *fy_parse_input_from_data(struct fy_parser *fyp,
 	handle->increment = 0;
 	handle->fyi = fyi;
 
-	fyi->state = FYIS_PARSED;
-	fyi->on_list = &fyp->parsed_inputs;
-	fy_input_list_add_tail(fyi->on_list, fyi);
-
 	return fyi;
+}
+
+int fy_input_window_pin(struct fy_input *fyi, size_t pos)
+{
+	unsigned int *pins;
+	size_t idx, count;
+
+	if (!fyi || !fyi->window)
+		return 0;
+
+	assert(pos >= fyi->discarded);
+	idx = (pos - fyi->discarded) / fyi->window;
+	if (idx >= fyi->pins_count) {
+		count = fyi->pins_count ? fyi->pins_count * 2 : 16;
+		while (count <= idx)
+			count *= 2;
+		pins = realloc(fyi->pins, count * sizeof(*pins));
+		if (!pins)
+			return -1;
+		memset(pins + fyi->pins_count, 0,
+		       (count - fyi->pins_count) * sizeof(*pins));
+		fyi->pins = pins;
+		fyi->pins_count = count;
+	}
+	fyi->pins[idx]++;
+
+	/* the token may outlive the parser; keep the buffer around */
+	fy_input_ref(fyi);
+
+	return 0;
+}
+
+void fy_input_window_unpin(struct fy_input *fyi, size_t pos)
+{
+	size_t idx;
+
+	if (!fyi || !fyi->window)
+		return;
+
+	assert(pos >= fyi->discarded);
+	idx = (pos - fyi->discarded) / fyi->window;
+	assert(idx < fyi->pins_count && fyi->pins[idx] > 0);
+	fyi->pins[idx]--;
 
-err_out:
 	fy_input_unref(fyi);
-	return NULL;
+}
+
+/*
+ * Release the whole window blocks at the start of the buffer that
+ * no live token starts in, and that are before the token being scanned
+ * (and a pending comment). What remains is moved to the buffer start.
+ */
+static void fy_input_window_compact(struct fy_parser *fyp, struct fy_input *fyi)
+{
+	size_t keep_pos, blocks, n, size;
+
+	keep_pos = fyp->fetch_input_pos;
+	if (keep_pos > fyp->current_input_pos)
+		keep_pos = fyp->current_input_pos;
+	if (fy_atom_is_set(&fyp->last_comment) && fyp->last_comment.fyi == fyi &&
+	    fyp->last_comment.start_mark.input_pos < keep_pos)
+		keep_pos = fyp->last_comment.start_mark.input_pos;
+
+	if (keep_pos <= fyi->discarded)
+		return;
+
+	blocks = (keep_pos - fyi->discarded) / fyi->window;
+	for (n = 0; n < blocks && (n >= fyi->pins_count || !fyi->pins[n]); n++)
+		;
+	if (!n)
+		return;
+
+	size = n * fyi->window;
+
+	fy_scan_debug(fyp, "input window releasing %zu bytes at %zu",
+			size, fyi->discarded);
+
+	memmove(fyi->buffer, fyi->buffer + size,
+		fyi->read - fyi->discarded - size);
+	if (n < fyi->pins_count) {
+		memmove(fyi->pins, fyi->pins + n,
+			(fyi->pins_count - n) * sizeof(*fyi->pins));
+		memset(fyi->pins + fyi->pins_count - n, 0, n * sizeof(*fyi->pins));
+	} else if (fyi->pins)
+		memset(fyi->pins, 0, fyi->pins_count * sizeof(*fyi->pins));
+
+	fyi->discarded += size;
 }
 
 const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 				    size_t pull, size_t *leftp)
 {
 	const void *p;
-	size_t left, pos, size, nread, nreadreq, missing;
-	size_t space __FY_DEBUG_UNUSED__;
+	size_t left, pos, size, nread, nreadreq, missing, space;
 	void *buf;
 
 	if (!fyp || !fyi) {
@@ -1043,6 +1276,9 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 		return NULL;
 	}
 
+	if (fyp->collect_stats)
+		fyp->stats.input_pulls++;
+
 	p = NULL;
 	left = 0;
 	pos = fyp->current_input_pos;
@@ -1069,7 +1305,7 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 		assert(fyi->read >= pos);
 
 		left = fyi->read - pos;
-		p = fyi->buffer + pos;
+		p = fyi->buffer + (pos - fyi->discarded);
 
 		/* enough to satisfy directly */
 		if (left >= pull)
@@ -1084,14 +1320,20 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 			break;
 		}
 
-		space = fyi->allocated - pos;
-
 		/* if we're missing more than the buffer space */
 		missing = pull - left;
 
+		/* release what's no longer referenced before growing */
+		if (fyi->window && missing > fyi->allocated - (fyi->read - fyi->discarded)) {
+			fy_input_window_compact(fyp, fyi);
+			p = fyi->buffer + (pos - fyi->discarded);
+		}
+
+		space = fyi->allocated - (fyi->read - fyi->discarded);
+
 		fy_scan_debug(fyp, "input: space=%zu missing=%zu", space, missing);
 
-		if (missing > 0) {
+		if (missing > space) {
 
 			/* align size to chunk */
 			size = fyi->allocated + missing + fyi->chunk - 1;
@@ -1109,23 +1351,27 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 			fyi->buffer = buf;
 			fyi->allocated = size;
 
-			space = fyi->allocated - pos;
-			p = fyi->buffer + pos;
+			space = fyi->allocated - (fyi->read - fyi->discarded);
+			p = fyi->buffer + (pos - fyi->discarded);
 		}
 
 		/* always try to read up to the allocated space */
 		do {
-			nreadreq = fyi->allocated - fyi->read;
+			nreadreq = fyi->allocated - (fyi->read - fyi->discarded);
 
 			fy_scan_debug(fyp, "performing read request of %zu", nreadreq);
 
-			nread = fread(fyi->buffer + fyi->read, 1, nreadreq, fyi->fp);
+			nread = fread(fyi->buffer + (fyi->read - fyi->discarded), 1,
+				      nreadreq, fyi->fp);
 
 			fy_scan_debug(fyp, "read returned %zu", nread);
 
 			if (!nread)
 				break;
 
+			if (fyp->collect_stats)
+				fyp->stats.input_read_bytes += nread;
+
 			fyi->read += nread;
 			left = fyi->read - pos;
 		} while (left < pull);
@@ -1148,6 +1394,21 @@ const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 		p = fyi->cfg.memory.data + pos;
 		break;
 
+	case fyit_callback:
+		assert(fyi->read >= pos);
+
+		/* wait for the application to feed enough (or the end) */
+		while ((left = fyi->read - pos) < pull && !fyi->callback.eof) {
+			if (!fy_parser_feed_wait(fyp))
+				break;
+		}
+		if (!left) {
+			fy_scan_debug(fyp, "fed input exhausted");
+			break;
+		}
+		p = fyi->buffer + (pos - fyi->discarded);
+		break;
+
 	default:
 		assert(0);
 		break;
@@ -1201,13 +1462,16 @@ int fy_parse_input_reset(struct fy_parser *fyp)
 			err_out, "parser cannot be reset at state '%s'",
 				state_txt[fyp->state]);
 
+	/* a new input ends push mode */
+	fy_parser_feed_free(fyp);
+
 	for (fyi = fy_input_list_head(&fyp->queued_inputs); fyi; fyi = fyin) {
 		fyin = fy_input_next(&fyp->queued_inputs, fyi);
 		fyi->on_list = NULL;
 		fy_input_unref(fyi);
 	}
 
-	fy_parse_parse_state_log_list_recycle_all(fyp, &fyp->state_stack);
+	fy_parse_state_log_stack_reset(&fyp->state_stack);
 
 	fyp->stream_end_produced = false;
 	fyp->stream_start_produced = false;
@@ -1249,6 +1513,10 @@ int fy_parse_input_append(struct fy_parser *fyp, const struct fy_input_cfg *fyic
 		memset(&fyi->stream, 0, sizeof(fyi->stream));
 		break;
 
+	case fyit_callback:
+		memset(&fyi->callback, 0, sizeof(fyi->callback));
+		break;
+
 	case fyit_memory:
 		/* nothing to do for memory */
 		break;
@@ -1294,6 +1562,30 @@ const void *fy_ensure_lookahead_slow_path(struct fy_parser *fyp, size_t size, si
 	return p;
 }
 
+/* consume a comment body up to the line break, tracking whitespace */
+static void fy_scan_comment_body(struct fy_parser *fyp, bool *has_wsp)
+{
+	const char *p;
+	size_t left, n;
+	int c;
+
+	while (!(fy_is_breakz(c = fy_parse_peek(fyp)))) {
+		/* skip over the ascii part in one go */
+		p = fy_ptr(fyp, &left);
+		n = p ? fy_span_comment_safe(p, left) : 0;
+		if (n > 1) {
+			if (has_wsp && !*has_wsp &&
+			    (memchr(p, ' ', n) || memchr(p, '\t', n)))
+				*has_wsp = true;
+			fy_advance_ascii(fyp, n);
+			continue;
+		}
+		if (has_wsp && fy_is_ws(c))
+			*has_wsp = true;
+		fy_advance(fyp, c);
+	}
+}
+
 int fy_scan_comment(struct fy_parser *fyp, struct fy_atom *handle, bool single_line)
 {
 	int c, column, start_column, lines, scan_ahead;
@@ -1306,8 +1598,7 @@ int fy_scan_comment(struct fy_parser *fyp, struct fy_atom *handle, bool single_l
 	/* if it's no comment parsing is enabled just consume it */
 	if (!(fyp->cfg.flags & FYPCF_PARSE_COMMENTS)) {
 		fy_advance(fyp, c);
-		while (!(fy_is_breakz(c = fy_parse_peek(fyp))))
-			fy_advance(fyp, c);
+		fy_scan_comment_body(fyp, NULL);
 		return 0;
 	}
 
@@ -1328,11 +1619,8 @@ int fy_scan_comment(struct fy_parser *fyp, struct fy_atom *handle, bool single_l
 		if (c == '#') {
 			/* chomp until line break */
 			fy_advance(fyp, c);
-			while (!(fy_is_breakz(c = fy_parse_peek(fyp)))) {
-				if (fy_is_ws(c))
-					has_ws = true;
-				fy_advance(fyp, c);
-			}
+			fy_scan_comment_body(fyp, &has_ws);
+			c = fy_parse_peek(fyp);
 
 			/* end of input break */
 			if (fy_is_z(c))
@@ -1382,8 +1670,26 @@ int fy_scan_comment(struct fy_parser *fyp, struct fy_atom *handle, bool single_l
 	return 0;
 }
 
+/* scan a comment of a token; its storage is only allocated when comments are parsed */
+static int fy_scan_token_comment(struct fy_parser *fyp, struct fy_token *fyt,
+				 enum fy_comment_placement placement, bool single_line)
+{
+	struct fy_atom *handle = NULL;
+
+	if (fyp->cfg.flags & FYPCF_PARSE_COMMENTS) {
+		handle = fy_token_comment_alloc(fyt, placement);
+		if (!handle)
+			return -1;
+	}
+
+	return fy_scan_comment(fyp, handle, single_line);
+}
+
 int fy_attach_comments_if_any(struct fy_parser *fyp, struct fy_token *fyt)
 {
+	struct fy_atom *handle;
+	const void *p;
+	size_t left;
 	int c, rc;
 
 	if (!fyp || !fyt)
@@ -1392,27 +1698,40 @@ int fy_attach_comments_if_any(struct fy_parser *fyp, struct fy_token *fyt)
 	/* if a last comment exists and is valid */
 	if ((fyp->cfg.flags & FYPCF_PARSE_COMMENTS) &&
 	    fy_atom_is_set(&fyp->last_comment)) {
-		memcpy(&fyt->comment[fycp_top], &fyp->last_comment, sizeof(fyp->last_comment));
-		memset(&fyp->last_comment, 0, sizeof(fyp->last_comment));
-
-		fy_notice(fyp, "token: %s attaching top comment:\n%s\n",
-				fy_token_debug_text_a(fyt),
-				fy_atom_get_text_a(&fyt->comment[fycp_top]));
+		handle = fy_token_comment_alloc(fyt, fycp_top);
+		fy_error_check(fyp, handle, err_out,
+				"fy_token_comment_alloc() failed");
+
+		if (!fy_input_window_pin(fyp->last_comment.fyi,
+					 fyp->last_comment.start_mark.input_pos)) {
+			memcpy(handle, &fyp->last_comment, sizeof(fyp->last_comment));
+			memset(&fyp->last_comment, 0, sizeof(fyp->last_comment));
+			fyt->comment_pinned = !!handle->fyi->window;
+
+			fy_notice(fyp, "token: %s attaching top comment:\n%s\n",
+					fy_token_debug_text_a(fyt),
+					fy_atom_get_text_a(handle));
+		}
 	}
 
 	/* right hand comment */
 
 	/* skip white space */
+	p = fy_ptr(fyp, &left);
+	if (p)
+		fy_advance_ascii(fyp, fy_span_ws(p, left));
 	while (fy_is_ws(c = fy_parse_peek(fyp)))
 		fy_advance(fyp, c);
 
 	if (c == '#') {
-		rc = fy_scan_comment(fyp, &fyt->comment[fycp_right], false);
+		rc = fy_scan_token_comment(fyp, fyt, fycp_right, false);
 		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_scan_comment() failed");
+				"fy_scan_token_comment() failed");
 	}
 	return 0;
 
+err_out:
+	rc = -1;
 err_out_rc:
 	return rc;
 }
@@ -1422,6 +1741,8 @@ int fy_scan_to_next_token(struct fy_parser *fyp)
 	int c, c_after_ws, i, rc = 0;
 	bool tabs_allowed;
 	ssize_t offset;
+	const void *p;
+	size_t left;
 
 	memset(&fyp->last_comment, 0, sizeof(fyp->last_comment));
 
@@ -1446,6 +1767,10 @@ int fy_scan_to_next_token(struct fy_parser *fyp)
 
 		/* skip white space, tabs are allowed in flow context */
 		/* tabs also allowed in block context but not at start of line or after -?: */
+		p = fy_ptr(fyp, &left);
+		if (p)
+			fy_advance_ascii(fyp, tabs_allowed ?
+					fy_span_ws(p, left) : fy_span_space(p, left));
 		while ((c = fy_parse_peek(fyp)) == ' ' || (c == '\t' && tabs_allowed))
 			fy_advance(fyp, c);
 
@@ -1531,7 +1856,7 @@ static int fy_purge_stale_simple_keys(struct fy_parser *fyp, bool *did_purgep,
 	int line;
 
 	*did_purgep = false;
-	while ((fysk = fy_simple_key_list_head(&fyp->simple_keys)) != NULL) {
+	while ((fysk = fy_simple_key_stack_top(&fyp->simple_keys)) != NULL) {
 
 		fy_scan_debug(fyp, "purge-check: flow_level=%d fysk->flow_level=%d fysk->mark.line=%d line=%d",
 				fyp->flow_level, fysk->flow_level,
@@ -1556,13 +1881,12 @@ static int fy_purge_stale_simple_keys(struct fy_parser *fyp, bool *did_purgep,
 
 		fy_debug_dump_simple_key(fyp, fysk, "purging: ");
 
-		fy_simple_key_list_del(&fyp->simple_keys, fysk);
-		fy_parse_simple_key_recycle(fyp, fysk);
+		fy_simple_key_stack_pop(&fyp->simple_keys);
 
 		*did_purgep = true;
 	}
 
-	if (*did_purgep && fy_simple_key_list_empty(&fyp->simple_keys))
+	if (*did_purgep && fy_simple_key_stack_empty(&fyp->simple_keys))
 		fy_scan_debug(fyp, "(purge) simple key list is now empty!");
 
 	return 0;
@@ -1575,19 +1899,28 @@ err_remove_required:
 	goto err_out;
 }
 
+/* update a stack depth high-water mark; only when collecting statistics */
+static void fy_parse_stats_depth(unsigned int *maxp, unsigned int depth)
+{
+	if (depth > *maxp)
+		*maxp = depth;
+}
+
 int fy_push_indent(struct fy_parser *fyp, int indent, bool generated_block_map)
 {
 	struct fy_indent *fyit;
 
-	fyit = fy_parse_indent_alloc(fyp);
+	/* push */
+	fyit = fy_indent_stack_push(&fyp->indent_stack);
 	fy_error_check(fyp, fyit != NULL, err_out,
-		"fy_indent_alloc() failed");
+		"fy_indent_stack_push() failed");
 
 	fyit->indent = fyp->indent;
 	fyit->generated_block_map = fyp->generated_block_map;
 
-	/* push */
-	fy_indent_list_push(&fyp->indent_stack, fyit);
+	if (fyp->collect_stats)
+		fy_parse_stats_depth(&fyp->stats.indent_depth_max,
+				     fyp->indent_stack.top);
 
 	/* update current state */
 	fyp->parent_indent = fyp->indent;
@@ -1624,7 +1957,7 @@ int fy_parse_unroll_indent(struct fy_parser *fyp, int column)
 		fy_error_check(fyp, fyt, err_out,
 				"fy_token_queue() failed");
 
-		fyi = fy_indent_list_pop(&fyp->indent_stack);
+		fyi = fy_indent_stack_pop(&fyp->indent_stack);
 		fy_error_check(fyp, fyi, err_out,
 				"no indent on stack popped");
 
@@ -1634,11 +1967,8 @@ int fy_parse_unroll_indent(struct fy_parser *fyp, int column)
 		fyp->indent = fyi->indent;
 		fyp->generated_block_map = fyi->generated_block_map;
 
-		/* pop and recycle */
-		fy_parse_indent_recycle(fyp, fyi);
-
 		/* update the parent indent */
-		fyi = fy_indent_list_head(&fyp->indent_stack);
+		fyi = fy_indent_stack_top(&fyp->indent_stack);
 		fyp->parent_indent = fyi ? fyi->indent : -2;
 
 		fy_scan_debug(fyp, "pop indent %d -> %d (parent %d) - generated_block_map=%s\n",
@@ -1653,12 +1983,9 @@ err_out:
 
 void fy_remove_all_simple_keys(struct fy_parser *fyp)
 {
-	struct fy_simple_key *fysk;
-
 	fy_scan_debug(fyp, "SK: removing all");
 
-	while ((fysk = fy_simple_key_list_pop(&fyp->simple_keys)) != NULL)
-		fy_parse_simple_key_recycle(fyp, fysk);
+	fy_simple_key_stack_reset(&fyp->simple_keys);
 
 	fyp->simple_key_allowed = true;
 	fy_scan_debug(fyp, "simple_key_allowed -> %s\n", fyp->simple_key_allowed ? "true" : "false");
@@ -1669,9 +1996,9 @@ struct fy_simple_key *fy_would_remove_required_simple_key(struct fy_parser *fyp)
 	struct fy_simple_key *fysk;
 
 	/* no simple key? */
-	for (fysk = fy_simple_key_list_head(&fyp->simple_keys);
+	for (fysk = fy_simple_key_stack_top(&fyp->simple_keys);
 			fysk && fysk->flow_level >= fyp->flow_level;
-			fysk = fy_simple_key_next(&fyp->simple_keys, fysk)) {
+			fysk = fy_simple_key_stack_below(&fyp->simple_keys, fysk)) {
 		if (fysk->required)
 			return fysk;
 	}
@@ -1685,25 +2012,22 @@ int fy_remove_simple_key(struct fy_parser *fyp, enum fy_token_type next_type)
 	struct fy_error_ctx ec;
 
 	/* no simple key? */
-	while ((fysk = fy_simple_key_list_first(&fyp->simple_keys)) != NULL &&
+	while ((fysk = fy_simple_key_stack_top(&fyp->simple_keys)) != NULL &&
 		fysk->flow_level >= fyp->flow_level) {
 
 		fy_debug_dump_simple_key(fyp, fysk, "removing: ");
 
-		/* remove it from the list */
-		fy_simple_key_list_del(&fyp->simple_keys, fysk);
+		/* remove it from the stack (it stays valid until a push) */
+		fy_simple_key_stack_pop(&fyp->simple_keys);
 
 		FY_ERROR_CHECK(fyp, fysk->token, &ec, FYEM_SCAN,
 				!fysk->required,
 				err_remove_required);
-
-		fy_parse_simple_key_recycle(fyp, fysk);
 	}
 
 	return 0;
 
 err_out:
-	fy_parse_simple_key_recycle(fyp, fysk);
 	return -1;
 
 err_remove_required:
@@ -1719,8 +2043,8 @@ struct fy_simple_key *fy_simple_key_find(struct fy_parser *fyp, const struct fy_
 		return NULL;
 
 	/* no simple key? */
-	for (fysk = fy_simple_key_list_head(&fyp->simple_keys); fysk;
-			fysk = fy_simple_key_next(&fyp->simple_keys, fysk))
+	for (fysk = fy_simple_key_stack_top(&fyp->simple_keys); fysk;
+			fysk = fy_simple_key_stack_below(&fyp->simple_keys, fysk))
 		if (fysk->token == fyt)
 			return fysk;
 
@@ -1761,24 +2085,26 @@ int fy_save_simple_key(struct fy_parser *fyp, struct fy_mark *mark, struct fy_ma
 				fyp->pending_complex_key_column);
 	}
 
-	fysk = fy_simple_key_list_head(&fyp->simple_keys);
+	fysk = fy_simple_key_stack_top(&fyp->simple_keys);
 
 	/* create new simple key if it does not exist or if has flow level less */
 	if (!fysk || fysk->flow_level < fyp->flow_level) {
 
-		fysk = fy_parse_simple_key_alloc(fyp);
+		fysk = fy_simple_key_stack_push(&fyp->simple_keys);
 		fy_error_check(fyp, fysk != NULL, err_out,
-			"fy_simple_key_alloc()");
+			"fy_simple_key_stack_push() failed");
 
 		fy_scan_debug(fyp, "new simple key");
 
-		fy_simple_key_list_push(&fyp->simple_keys, fysk);
+		if (fyp->collect_stats)
+			fy_parse_stats_depth(&fyp->stats.simple_key_depth_max,
+					     fyp->simple_keys.top);
 
 	} else {
 		fy_error_check(fyp, !fysk->possible || !fysk->required, err_out,
 				"cannot save simple key, top is required");
 
-		if (fysk == fy_simple_key_list_tail(&fyp->simple_keys))
+		if (fyp->simple_keys.top == 1)
 			fy_scan_debug(fyp, "(reuse) simple key list is now empty!");
 
 		fy_scan_debug(fyp, "reusing simple key");
@@ -1793,7 +2119,7 @@ int fy_save_simple_key(struct fy_parser *fyp, struct fy_mark *mark, struct fy_ma
 	fysk->token = fyt;
 	fysk->flow_level = flow_level;
 
-	fy_debug_dump_simple_key_list(fyp, &fyp->simple_keys, fysk, "fyp->simple_keys (saved): ");
+	fy_debug_dump_simple_key_stack(fyp, &fyp->simple_keys, fysk, "fyp->simple_keys (saved): ");
 
 	return 0;
 
@@ -1838,9 +2164,9 @@ int fy_parse_flow_push(struct fy_parser *fyp)
 {
 	struct fy_flow *fyf;
 
-	fyf = fy_parse_flow_alloc(fyp);
+	fyf = fy_flow_stack_push(&fyp->flow_stack);
 	fy_error_check(fyp, fyf != NULL, err_out,
-			"fy_flow_alloc() failed!");
+			"fy_flow_stack_push() failed!");
 	fyf->flow = fyp->flow;
 
 	fyf->pending_complex_key_column = fyp->pending_complex_key_column;
@@ -1850,8 +2176,6 @@ int fy_parse_flow_push(struct fy_parser *fyp)
 			(int)fyf->flow,
 			fyf->pending_complex_key_column);
 
-	fy_flow_list_push(&fyp->flow_stack, fyf);
-
 	if (fyp->pending_complex_key_column >= 0) {
 		fyp->pending_complex_key_column = -1;
 		fy_scan_debug(fyp, "pending_complex_key_column -> %d",
@@ -1867,7 +2191,7 @@ int fy_parse_flow_pop(struct fy_parser *fyp)
 {
 	struct fy_flow *fyf;
 
-	fyf = fy_flow_list_pop(&fyp->flow_stack);
+	fyf = fy_flow_stack_pop(&fyp->flow_stack);
 	fy_error_check(fyp, fyf, err_out,
 			"no flow to pop");
 
@@ -1875,8 +2199,6 @@ int fy_parse_flow_pop(struct fy_parser *fyp)
 	fyp->pending_complex_key_column = fyf->pending_complex_key_column;
 	fyp->pending_complex_key_mark = fyf->pending_complex_key_mark;
 
-	fy_parse_flow_recycle(fyp, fyf);
-
 	fy_scan_debug(fyp, "flow_pop: flow=%d pending_complex_key_column=%d",
 			(int)fyp->flow,
 			fyp->pending_complex_key_column);
@@ -2436,6 +2758,8 @@ int fy_fetch_flow_collection_mark_start(struct fy_parser *fyp, int c)
 
 	/* increase flow level */
 	fyp->flow_level++;
+	if (fyp->collect_stats && (unsigned int)fyp->flow_level > fyp->stats.flow_level_max)
+		fyp->stats.flow_level_max = fyp->flow_level;
 	fy_error_check(fyp, fyp->flow_level, err_out,
 			"overflow for the flow level counter");
 
@@ -2542,7 +2866,7 @@ int fy_fetch_flow_collection_mark_end(struct fy_parser *fyp, int c)
 
 		/* if we did purge and the the list is now empty, we're hosed */
 		FY_ERROR_CHECK(fyp, NULL, &ec, FYEM_SCAN,
-				!did_purge || !fy_simple_key_list_empty(&fyp->simple_keys),
+				!did_purge || !fy_simple_key_stack_empty(&fyp->simple_keys),
 				err_multiline_key);
 	}
 
@@ -2629,19 +2953,19 @@ int fy_fetch_flow_collection_entry(struct fy_parser *fyp, int c)
 		if (fyt_last)
 			fyt = fyt_last;
 
-		rc = fy_scan_comment(fyp, &fyt->comment[fycp_right], true);
+		rc = fy_scan_token_comment(fyp, fyt, fycp_right, true);
 		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_scan_comment() failed");
+				"fy_scan_token_comment() failed");
 	}
 
 	return 0;
 err_out:
 	rc = -1;
 err_out_rc:
-	fy_error_report(fyp, &ec, "invalid comment after comma");
 	return rc;
 
 err_bad_comment:
+	fy_error_report(fyp, &ec, "invalid comment after comma");
 	goto err_out;
 
 err_wrongly_indented_flow:
@@ -2820,9 +3144,9 @@ int fy_fetch_key(struct fy_parser *fyp, int c)
 
 	/* comment? */
 	if (c == '#') {
-		rc = fy_scan_comment(fyp, &fyt->comment[fycp_right], false);
+		rc = fy_scan_token_comment(fyp, fyt, fycp_right, false);
 		fy_error_check(fyp, !rc, err_out_rc,
-				"fy_scan_comment() failed");
+				"fy_scan_token_comment() failed");
 	}
 
 	return 0;
@@ -2844,7 +3168,7 @@ err_wrongly_indented_flow:
 int fy_fetch_value(struct fy_parser *fyp, int c)
 {
 	struct fy_token_list sk_tl;
-	struct fy_simple_key *fysk = NULL;
+	struct fy_simple_key *fysk = NULL, sk;
 	struct fy_mark mark, mark_insert, mark_end_insert;
 	struct fy_token *fyt_insert, *fyt;
 	struct fy_atom handle;
@@ -2870,10 +3194,12 @@ int fy_fetch_value(struct fy_parser *fyp, int c)
 			"fy_purge_stale_simple_keys() failed");
 
 	/* get the simple key (if available) for the value */
-	fysk = fy_simple_key_list_head(&fyp->simple_keys);
-	if (fysk && fysk->flow_level == fyp->flow_level)
-		fy_simple_key_list_del(&fyp->simple_keys, fysk);
-	else
+	fysk = fy_simple_key_stack_top(&fyp->simple_keys);
+	if (fysk && fysk->flow_level == fyp->flow_level) {
+		/* popped items are only valid until a push; keep a copy */
+		sk = *fy_simple_key_stack_pop(&fyp->simple_keys);
+		fysk = &sk;
+	} else
 		fysk = NULL;
 
 	if (!fysk) {
@@ -2974,9 +3300,6 @@ int fy_fetch_value(struct fy_parser *fyp, int c)
 	fyp->simple_key_allowed = target_simple_key_allowed;
 	fy_scan_debug(fyp, "simple_key_allowed -> %s\n", fyp->simple_key_allowed ? "true" : "false");
 
-	if (fysk)
-		fy_parse_simple_key_recycle(fyp, fysk);
-
 	if (final_complex_key) {
 		fyp->pending_complex_key_column = -1;
 		fy_scan_debug(fyp, "pending_complex_key_column -> %d",
@@ -2990,9 +3313,9 @@ int fy_fetch_value(struct fy_parser *fyp, int c)
 
 		/* comment? */
 		if (c == '#') {
-			rc = fy_scan_comment(fyp, &fyt_insert->comment[fycp_right], false);
+			rc = fy_scan_token_comment(fyp, fyt_insert, fycp_right, false);
 			fy_error_check(fyp, !rc, err_out_rc,
-					"fy_scan_comment() failed");
+					"fy_scan_token_comment() failed");
 		}
 	}
 
@@ -3001,7 +3324,6 @@ int fy_fetch_value(struct fy_parser *fyp, int c)
 err_out:
 	rc = -1;
 err_out_rc:
-	fy_parse_simple_key_recycle(fyp, fysk);
 	return rc;
 
 err_wrongly_indented_flow:
@@ -3400,8 +3722,9 @@ int fy_fetch_block_scalar(struct fy_parser *fyp, bool is_literal, int c)
 			fy_is_breakz(c),
 			err_no_lb_found);
 
-	/* advance */
-	fy_advance(fyp, c);
+	/* advance (unless at the end of input) */
+	if (c >= 0)
+		fy_advance(fyp, c);
 
 	fy_fill_atom_start(fyp, &handle);
 
@@ -3699,6 +4022,8 @@ int fy_fetch_flow_scalar(struct fy_parser *fyp, int c)
 	struct fy_token *fyt;
 	char escbuf[2];
 	const char *ep;
+	const void *p;
+	size_t left, n;
 #ifdef ATOM_SIZE_CHECK
 	size_t tlength;
 #endif
@@ -3878,6 +4203,17 @@ int fy_fetch_flow_scalar(struct fy_parser *fyp, int c)
 				continue;
 			}
 
+			/* run of regular characters */
+			p = fy_ptr(fyp, &left);
+			n = p ? fy_span_quoted_safe(p, left) : 0;
+			if (n > 1) {
+				lastc = ((const uint8_t *)p)[n - 1];
+				fy_advance_ascii(fyp, n);
+				length += n;
+				break_run = 0;
+				continue;
+			}
+
 			lastc = c;
 
 			/* regular character */
@@ -4073,6 +4409,8 @@ int fy_fetch_plain_scalar(struct fy_parser *fyp, int c)
 	int rc = -1, indent, run, nextc, i, breaks_found, blanks_found;
 	bool has_leading_blanks, had_breaks;
 	const char *last_ptr;
+	const void *p;
+	size_t left, n;
 	struct fy_mark mark, last_mark;
 	bool target_simple_key_allowed, is_multiline, is_complex, has_lb, has_ws;
 	struct fy_simple_key_mark skm;
@@ -4160,6 +4498,17 @@ int fy_fetch_plain_scalar(struct fy_parser *fyp, int c)
 				blanks_found = 0;
 			}
 
+			/* skip over a run of octets that can't terminate */
+			p = fy_ptr(fyp, &left);
+			n = p ? fy_span_plain_safe(p, left) : 0;
+			if (n > 1) {
+				fy_advance_ascii(fyp, n);
+				run += n;
+				length += n;
+				c = fy_parse_peek(fyp);
+				continue;
+			}
+
 			fy_advance(fyp, c);
 			run++;
 
@@ -4324,6 +4673,20 @@ err_invalid_tab_indentation:
 	goto err_out;
 }
 
+/* call a fetch method, timing it when collecting statistics */
+#define fy_fetch_timed(_fyp, _which, _call) \
+	({ \
+		struct fy_parser *__fyp = (_fyp); \
+		uint64_t __start = __fyp->collect_stats ? fy_parse_stats_clock() : 0; \
+		int __rc = (_call); \
+		\
+		if (__fyp->collect_stats) { \
+			__fyp->stats.fetch_count[(_which)]++; \
+			__fyp->stats.fetch_time[(_which)] += fy_parse_stats_clock() - __start; \
+		} \
+		__rc; \
+	})
+
 int fy_fetch_tokens(struct fy_parser *fyp)
 {
 	struct fy_error_ctx ec;
@@ -4335,7 +4698,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 			"fy_parse_get_next_input() failed");
 
 		if (rc > 0) {
-			rc = fy_fetch_stream_start(fyp);
+			rc = fy_fetch_timed(fyp, FYPSF_STREAM_START, fy_fetch_stream_start(fyp));
 			fy_error_check(fyp, !rc, err_out_rc,
 					"fy_fetch_stream_start() failed");
 		}
@@ -4343,6 +4706,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 	}
 
 	fy_scan_debug(fyp, "-------------------------------------------------");
+	fyp->fetch_input_pos = fyp->current_input_pos;
 	rc = fy_scan_to_next_token(fyp);
 	fy_error_check(fyp, !rc, err_out_rc,
 			"fy_scan_to_next_token() failed");
@@ -4355,7 +4719,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 	if (c < 0 || c == '\0') {
 		if (c >= 0)
 			fy_advance(fyp, c);
-		rc = fy_fetch_stream_end(fyp);
+		rc = fy_fetch_timed(fyp, FYPSF_STREAM_END, fy_fetch_stream_end(fyp));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_stream_end() failed");
 		return 0;
@@ -4368,7 +4732,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 				err_illegal_directive_in_bare_doc_mode);
 
 		fy_advance(fyp, c);
-		rc = fy_fetch_directive(fyp);
+		rc = fy_fetch_timed(fyp, FYPSF_DIRECTIVE, fy_fetch_directive(fyp));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_directive() failed");
 		return 0;
@@ -4383,9 +4747,10 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 				!fyp->bare_document_only,
 				err_illegal_doc_ind_in_bare_doc_mode);
 
-		rc = fy_fetch_document_indicator(fyp,
-				c == '-' ? FYTT_DOCUMENT_START :
-					FYTT_DOCUMENT_END);
+		rc = fy_fetch_timed(fyp, FYPSF_DOCUMENT_INDICATOR,
+				fy_fetch_document_indicator(fyp,
+					c == '-' ? FYTT_DOCUMENT_START :
+						FYTT_DOCUMENT_END));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_document_indicator() failed");
 
@@ -4405,7 +4770,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == '[' || c == '{') {
 
-		rc = fy_fetch_flow_collection_mark_start(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_FLOW_COLLECTION_START, fy_fetch_flow_collection_mark_start(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_flow_collection_mark_start() failed");
 		return 0;
@@ -4413,7 +4778,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == ']' || c == '}') {
 
-		rc = fy_fetch_flow_collection_mark_end(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_FLOW_COLLECTION_END, fy_fetch_flow_collection_mark_end(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_flow_collection_mark_end() failed");
 		return 0;
@@ -4422,7 +4787,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == ',') {
 
-		rc = fy_fetch_flow_collection_entry(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_FLOW_ENTRY, fy_fetch_flow_collection_entry(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_flow_collection_entry() failed");
 		return 0;
@@ -4430,7 +4795,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == '-' && fy_is_blankz_at_offset(fyp, 1)) {
 
-		rc = fy_fetch_block_entry(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_BLOCK_ENTRY, fy_fetch_block_entry(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_block_entry() failed");
 		return 0;
@@ -4438,7 +4803,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == '?' && (fyp->flow_level || fy_is_blankz_at_offset(fyp, 1))) {
 
-		rc = fy_fetch_key(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_KEY, fy_fetch_key(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_key() failed");
 		return 0;
@@ -4446,7 +4811,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == ':' && ((fyp->flow_level && !fyp->simple_key_allowed) || fy_is_blankz_at_offset(fyp, 1))) {
 
-		rc = fy_fetch_value(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_VALUE, fy_fetch_value(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_value() failed");
 		return 0;
@@ -4454,7 +4819,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == '*' || c == '&') {
 
-		rc = fy_fetch_anchor_or_alias(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_ANCHOR_OR_ALIAS, fy_fetch_anchor_or_alias(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_anchor_or_alias() failed");
 		return 0;
@@ -4462,7 +4827,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == '!') {
 
-		rc = fy_fetch_tag(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_TAG, fy_fetch_tag(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_tag() failed");
 		return 0;
@@ -4470,7 +4835,7 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (!fyp->flow_level && (c == '|' || c == '>')) {
 
-		rc = fy_fetch_block_scalar(fyp, c == '|', c);
+		rc = fy_fetch_timed(fyp, FYPSF_BLOCK_SCALAR, fy_fetch_block_scalar(fyp, c == '|', c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_block_scalar() failed");
 		return 0;
@@ -4478,13 +4843,13 @@ int fy_fetch_tokens(struct fy_parser *fyp)
 
 	if (c == '\'' || c == '"') {
 
-		rc = fy_fetch_flow_scalar(fyp, c);
+		rc = fy_fetch_timed(fyp, FYPSF_FLOW_SCALAR, fy_fetch_flow_scalar(fyp, c));
 		fy_error_check(fyp, !rc, err_out_rc,
 				"fy_fetch_flow_scalar() failed");
 		return 0;
 	}
 
-	rc = fy_fetch_plain_scalar(fyp, c);
+	rc = fy_fetch_timed(fyp, FYPSF_PLAIN_SCALAR, fy_fetch_plain_scalar(fyp, c));
 	fy_error_check(fyp, !rc, err_out_rc,
 			"fy_fetch_plain_scalar() failed");
 	return 0;
@@ -4543,7 +4908,7 @@ struct fy_token *fy_scan_peek(struct fy_parser *fyp)
 	/* we loop until we have a token and the simple key list is empty */
 	for (;;) {
 		fyt = fy_token_list_head(&fyp->queued_tokens);
-		have_simple_keys = !fy_simple_key_list_empty(&fyp->simple_keys);
+		have_simple_keys = !fy_simple_key_stack_empty(&fyp->simple_keys);
 
 		/* we can produce a token when:
 		* a) one exists
@@ -4625,11 +4990,10 @@ int fy_parse_state_push(struct fy_parser *fyp, enum fy_parser_state state)
 {
 	struct fy_parse_state_log *fypsl;
 
-	fypsl = fy_parse_parse_state_log_alloc(fyp);
+	fypsl = fy_parse_state_log_stack_push(&fyp->state_stack);
 	fy_error_check(fyp, fypsl != NULL, err_out,
-			"fy_parse_state_log_alloc() failed!");
+			"fy_parse_state_log_stack_push() failed!");
 	fypsl->state = state;
-	fy_parse_state_log_list_push(&fyp->state_stack, fypsl);
 
 	return 0;
 err_out:
@@ -4639,17 +5003,12 @@ err_out:
 enum fy_parser_state fy_parse_state_pop(struct fy_parser *fyp)
 {
 	struct fy_parse_state_log *fypsl;
-	enum fy_parser_state state;
 
-	fypsl = fy_parse_state_log_list_pop(&fyp->state_stack);
+	fypsl = fy_parse_state_log_stack_pop(&fyp->state_stack);
 	if (!fypsl)
 		return FYPS_NONE;
 
-	state = fypsl->state;
-
-	fy_parse_parse_state_log_recycle(fyp, fypsl);
-
-	return state;
+	return fypsl->state;
 }
 
 void fy_parse_state_set(struct fy_parser *fyp, enum fy_parser_state state)
@@ -4858,10 +5217,10 @@ int fy_parse_stream_start(struct fy_parser *fyp)
 	fyp->flow = FYFT_NONE;
 	fyp->pending_complex_key_column = -1;
 
-	fy_parse_indent_list_recycle_all(fyp, &fyp->indent_stack);
-	fy_parse_simple_key_list_recycle_all(fyp, &fyp->simple_keys);
-	fy_parse_parse_state_log_list_recycle_all(fyp, &fyp->state_stack);
-	fy_parse_flow_list_recycle_all(fyp, &fyp->flow_stack);
+	fy_indent_stack_reset(&fyp->indent_stack);
+	fy_simple_key_stack_reset(&fyp->simple_keys);
+	fy_parse_state_log_stack_reset(&fyp->state_stack);
+	fy_flow_stack_reset(&fyp->flow_stack);
 
 	fy_token_unref(fyp->stream_end_token);
 	fyp->stream_end_token = NULL;
@@ -5569,11 +5928,99 @@ const char *fy_event_type_txt[] = {
 	[FYET_ALIAS]		= "=ALI",
 };
 
+#ifdef FY_PARSER_FEED_SUSPEND
+static void fy_parser_feed_entry(unsigned int lo, unsigned int hi)
+{
+	struct fy_parser_feed *feed;
+
+	struct fy_eventp *fyep;
+	unsigned int count;
+
+	feed = (void *)(((uintptr_t)hi << 16 << 16) | lo);
+
+	/* never returns; the stack is freed while suspended */
+	for (;;) {
+		feed->running = true;
+		count = 0;
+		while (count++ < FY_PARSER_FEED_BATCH &&
+		       (fyep = fy_parse_internal(feed->fyp)) != NULL)
+			fy_eventp_list_add_tail(&feed->queued, fyep);
+		feed->running = false;
+		swapcontext(&feed->ctx, &feed->caller);
+	}
+}
+#endif
+
+static struct fy_eventp *fy_parser_feed_parse(struct fy_parser *fyp)
+{
+	struct fy_parser_feed *feed = fyp->feed;
+#ifdef FY_PARSER_FEED_SUSPEND
+	struct fy_eventp *fyep;
+	uintptr_t ptr;
+	int rc;
+#endif
+
+	feed->need_input = false;
+
+#ifdef FY_PARSER_FEED_SUSPEND
+	/* what's been parsed ahead goes first */
+	fyep = fy_eventp_list_pop(&feed->queued);
+	if (fyep)
+		return fyep;
+
+	/* with everything in there's no waiting, no need to switch */
+	if (!feed->suspended && feed->fyi->callback.eof)
+		return fy_parse_internal(fyp);
+
+	if (!feed->stack) {
+		feed->stack = malloc(FY_PARSER_FEED_STACK);
+		fy_error_check(fyp, feed->stack, err_out,
+				"malloc() failed");
+
+		rc = getcontext(&feed->ctx);
+		fy_error_check(fyp, !rc, err_out,
+				"getcontext() failed");
+
+		feed->ctx.uc_stack.ss_sp = feed->stack;
+		feed->ctx.uc_stack.ss_size = FY_PARSER_FEED_STACK;
+		feed->ctx.uc_link = NULL;
+		ptr = (uintptr_t)feed;
+		makecontext(&feed->ctx, (void (*)(void))fy_parser_feed_entry, 2,
+				(unsigned int)ptr, (unsigned int)(ptr >> 16 >> 16));
+	}
+
+	rc = swapcontext(&feed->caller, &feed->ctx);
+	fy_error_check(fyp, !rc, err_out,
+			"swapcontext() failed");
+
+	/* events parsed before running out are still good */
+	fyep = fy_eventp_list_pop(&feed->queued);
+	if (fyep)
+		feed->need_input = false;
+
+	return fyep;
+
+err_out:
+	return NULL;
+#else
+	/* can't suspend, so wait until everything is in */
+	if (!feed->fyi->callback.eof) {
+		feed->need_input = true;
+		return NULL;
+	}
+
+	return fy_parse_internal(fyp);
+#endif
+}
+
 struct fy_eventp *fy_parse_private(struct fy_parser *fyp)
 {
 	struct fy_eventp *fyep = NULL;
 
-	fyep = fy_parse_internal(fyp);
+	if (fyp->feed)
+		fyep = fy_parser_feed_parse(fyp);
+	else
+		fyep = fy_parse_internal(fyp);
 	fy_parse_debug(fyp, "> %s", fyep ? fy_event_type_txt[fyep->e.type] : "NULL");
 
 	return fyep;
@@ -5581,6 +6028,9 @@ struct fy_eventp *fy_parse_private(struct fy_parser *fyp)
 
 void *fy_parse_alloc(struct fy_parser *fyp, size_t size)
 {
+	if (fyp->collect_stats)
+		fyp->stats.talloc_bytes += size;
+
 	return fy_talloc(&fyp->tallocs, size);
 }
 
@@ -5634,6 +6084,93 @@ void fy_parser_destroy(struct fy_parser *fyp)
 	free(fyp);
 }
 
+int fy_parser_reset(struct fy_parser *fyp)
+{
+	struct fy_input *fyi, *fyin;
+	int rc;
+
+	if (!fyp)
+		return -1;
+
+	/* everything in flight goes back to the recycling lists */
+	fy_indent_stack_reset(&fyp->indent_stack);
+	fy_simple_key_stack_reset(&fyp->simple_keys);
+	fy_token_list_unref_all(&fyp->queued_tokens);
+	fy_parse_state_log_stack_reset(&fyp->state_stack);
+	fy_flow_stack_reset(&fyp->flow_stack);
+
+	fy_token_unref(fyp->stream_end_token);
+	fyp->stream_end_token = NULL;
+
+	fy_parser_feed_free(fyp);
+	fy_parser_key_check_free(fyp);
+
+	/* the documents using the inputs must be gone by now */
+	for (fyi = fy_input_list_head(&fyp->queued_inputs); fyi; fyi = fyin) {
+		fyin = fy_input_next(&fyp->queued_inputs, fyi);
+		fy_input_list_del(&fyp->queued_inputs, fyi);
+		fyi->on_list = NULL;
+		fy_input_unref(fyi);
+	}
+
+	for (fyi = fy_input_list_head(&fyp->parsed_inputs); fyi; fyi = fyin) {
+		fyin = fy_input_next(&fyp->parsed_inputs, fyi);
+		fy_input_list_del(&fyp->parsed_inputs, fyi);
+		fyi->on_list = NULL;
+		fy_input_unref(fyi);
+	}
+
+	fy_input_unref(fyp->current_input);
+	fyp->current_input = NULL;
+
+	fyp->current_pos = 0;
+	fyp->current_input_pos = 0;
+	fyp->fetch_input_pos = 0;
+	fyp->current_ptr = NULL;
+	fyp->current_c = 0;
+	fyp->current_w = 0;
+	fyp->current_left = 0;
+	fyp->line = 0;
+	fyp->column = 0;
+
+	fyp->stream_start_produced = false;
+	fyp->stream_end_produced = false;
+	fyp->simple_key_allowed = false;
+	fyp->stream_error = false;
+	fyp->error_mark_set = false;
+	fyp->generated_block_map = false;
+	fyp->document_has_content = false;
+	fyp->document_first_content_token = false;
+
+	fyp->flow_level = 0;
+	fyp->flow = FYFT_NONE;
+	fyp->pending_complex_key_column = -1;
+	memset(&fyp->pending_complex_key_mark, 0, sizeof(fyp->pending_complex_key_mark));
+	fyp->last_block_mapping_key_line = -1;
+	fyp->token_activity_counter = 0;
+	memset(&fyp->last_comment, 0, sizeof(fyp->last_comment));
+
+	fyp->indent = -2;
+	fyp->parent_indent = 0;
+	fyp->state = FYPS_NONE;
+
+	/* discard the diagnostics of the previous stream */
+	if (fyp->errfp) {
+		rewind(fyp->errfp);
+		fflush(fyp->errfp);
+	}
+
+	/* always a fresh one, even if it's externally managed later */
+	rc = fy_set_default_document_state(fyp, -1, -1, NULL);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_set_default_document_state() failed");
+
+	return 0;
+
+err_out:
+	return -1;
+}
+
 int fy_parser_set_input_file(struct fy_parser *fyp, const char *file)
 {
 	struct fy_input_cfg *fyic;
@@ -5701,6 +6238,9 @@ int fy_parser_set_string(struct fy_parser *fyp, const char *str, size_t len)
 	fy_error_check(fyp, !rc, err_out_rc,
 			"fy_parse_input_append() failed");
 
+	/* the input keeps a copy; don't let a reused parser pile them up */
+	fy_parse_free(fyp, fyic);
+
 	return 0;
 err_out:
 	rc = -1;
@@ -5733,6 +6273,9 @@ int fy_parser_set_input_fp(struct fy_parser *fyp, const char *name, FILE *fp)
 	fy_error_check(fyp, !rc, err_out_rc,
 			"fy_parse_input_append() failed");
 
+	/* the input keeps a copy; don't let a reused parser pile them up */
+	fy_parse_free(fyp, fyic);
+
 	return 0;
 err_out:
 	rc = -1;
@@ -5740,6 +6283,93 @@ err_out_rc:
 	return -1;
 }
 
+int fy_parser_feed(struct fy_parser *fyp, const void *buf, size_t len, bool last)
+{
+	struct fy_parser_feed *feed;
+	struct fy_input_cfg fyic;
+	struct fy_input *fyi;
+	size_t space, size;
+	void *p;
+	int rc;
+
+	if (!fyp || (!buf && len))
+		return -1;
+
+	feed = fyp->feed;
+	if (!feed) {
+		rc = fy_parse_input_reset(fyp);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_input_reset() failed");
+
+		memset(&fyic, 0, sizeof(fyic));
+		fyic.type = fyit_callback;
+		fyic.callback.name = "<feed>";
+
+		rc = fy_parse_input_append(fyp, &fyic);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_parse_input_append() failed");
+
+		feed = malloc(sizeof(*feed));
+		fy_error_check(fyp, feed, err_out,
+				"malloc() failed");
+		memset(feed, 0, sizeof(*feed));
+
+		feed->fyp = fyp;
+#ifdef FY_PARSER_FEED_SUSPEND
+		fy_eventp_list_init(&feed->queued);
+#endif
+		feed->fyi = fy_input_ref(fy_input_list_tail(&fyp->queued_inputs));
+		feed->fyi->chunk = sysconf(_SC_PAGESIZE);
+		fyp->feed = feed;
+	}
+	fyi = feed->fyi;
+
+	fy_error_check(fyp, !fyi->callback.eof, err_out,
+			"input fed after the last chunk");
+
+	space = fyi->allocated - (fyi->read - fyi->discarded);
+
+	/* the parser is suspended in a pull, the same as a stream read */
+	if (len > space && fyi->window && fyp->current_input == fyi) {
+		fy_input_window_compact(fyp, fyi);
+		space = fyi->allocated - (fyi->read - fyi->discarded);
+	}
+
+	if (len > space) {
+		/* align size to chunk */
+		size = fyi->allocated + len - space + fyi->chunk - 1;
+		size = size - size % fyi->chunk;
+
+		p = realloc(fyi->buffer, size);
+		fy_error_check(fyp, p, err_out,
+				"realloc() failed");
+
+		fyi->buffer = p;
+		fyi->allocated = size;
+	}
+
+	if (len) {
+		memcpy(fyi->buffer + (fyi->read - fyi->discarded), buf, len);
+		fyi->read += len;
+
+		if (fyp->collect_stats)
+			fyp->stats.input_read_bytes += len;
+	}
+
+	if (last)
+		fyi->callback.eof = true;
+
+	return 0;
+
+err_out:
+	return -1;
+}
+
+bool fy_parser_need_input(struct fy_parser *fyp)
+{
+	return fyp && fyp->feed && fyp->feed->need_input;
+}
+
 void *fy_parser_alloc(struct fy_parser *fyp, size_t size)
 {
 	if (!fyp)
@@ -5770,6 +6400,62 @@ struct fy_event *fy_parser_parse(struct fy_parser *fyp)
 	return &fyep->e;
 }
 
+int fy_parser_validate(struct fy_parser *fyp, struct fy_mark *markp)
+{
+	struct fy_eventp *fyep;
+	struct fy_key_check_dup dup;
+	int rc;
+
+	if (!fyp)
+		return -1;
+
+	/* kept across calls in push mode */
+	if (!fyp->key_check) {
+		fyp->key_check = malloc(sizeof(*fyp->key_check));
+		fy_error_check(fyp, fyp->key_check, err_out,
+				"malloc() failed");
+		fy_key_check_setup(fyp->key_check);
+	}
+
+	/*
+	 * Nothing is handed out or built; each event goes straight back
+	 * for recycling, so the same few events and tokens are reused
+	 * for the whole stream. Only the keys are kept, for the duplicate
+	 * checks the document builder would do.
+	 */
+	while ((fyep = fy_parse_private(fyp)) != NULL) {
+		rc = fy_key_check_event(fyp->key_check, &fyep->e, &dup);
+		fy_parse_eventp_recycle(fyp, fyep);
+		fy_error_check(fyp, rc >= 0, err_out,
+				"fy_key_check_event() failed");
+		if (rc) {
+			fy_key_check_report(fyp, &dup);
+			break;
+		}
+	}
+
+	if (fyp->stream_error) {
+		fy_parser_key_check_free(fyp);
+		if (markp) {
+			if (fyp->error_mark_set)
+				*markp = fyp->error_mark;
+			else
+				fy_get_mark(fyp, markp);
+		}
+		return -1;
+	}
+
+	/* push mode, call again when more is fed */
+	if (fy_parser_need_input(fyp))
+		return 1;
+
+	return 0;
+
+err_out:
+	fy_parser_key_check_free(fyp);
+	return -1;
+}
+
 void fy_parser_event_free(struct fy_parser *fyp, struct fy_event *fye)
 {
 	struct fy_eventp *fyep;
@@ -5784,6 +6470,121 @@ void fy_parser_event_free(struct fy_parser *fyp, struct fy_event *fye)
 	fy_parse_eventp_recycle(fyep->fyp, fyep);
 }
 
+void fy_parser_event_release(struct fy_parser *fyp, struct fy_event *fye)
+{
+	if (!fyp || !fye)
+		return;
+
+	fy_event_clean(fye);
+}
+
+int fy_parser_parse_into(struct fy_parser *fyp, struct fy_event *fye)
+{
+	struct fy_eventp *fyep;
+
+	if (!fyp || !fye)
+		return -1;
+
+	/* whatever was in the slot is consumed by now */
+	fy_event_clean(fye);
+
+	fyep = fy_parse_private(fyp);
+	if (!fyep)
+		return fyp->stream_error ? -1 : 0;
+
+	/* move the references to the slot, the empty shell is recycled */
+	*fye = fyep->e;
+	fyep->e.type = FYET_NONE;
+	fy_parse_eventp_recycle(fyp, fyep);
+
+	return 1;
+}
+
+int fy_parser_parse_batch(struct fy_parser *fyp, struct fy_event *fyes, int count)
+{
+	int i, rc;
+
+	if (!fyp || !fyes || count <= 0)
+		return -1;
+
+	for (i = 0; i < count; i++) {
+		rc = fy_parser_parse_into(fyp, &fyes[i]);
+		if (rc < 0)
+			return -1;
+		if (!rc)
+			break;
+	}
+
+	/* release the slots left over from a previous batch */
+	fy_parser_events_release(fyp, fyes + i, count - i);
+
+	return i;
+}
+
+void fy_parser_events_release(struct fy_parser *fyp, struct fy_event *fyes, int count)
+{
+	int i;
+
+	if (!fyp || !fyes)
+		return;
+
+	for (i = 0; i < count; i++)
+		fy_event_clean(&fyes[i]);
+}
+
+int fy_parser_parse_callback(struct fy_parser *fyp, fy_parser_event_fn fn, void *user)
+{
+	struct fy_eventp *fyep;
+	int rc;
+
+	if (!fyp || !fn)
+		return -1;
+
+	while ((fyep = fy_parse_private(fyp)) != NULL) {
+		rc = fn(fyp, &fyep->e, user);
+		fy_parse_eventp_recycle(fyp, fyep);
+		if (rc)
+			return rc;
+	}
+
+	return fyp->stream_error ? -1 : 0;
+}
+
+int fy_parser_get_stats(struct fy_parser *fyp, struct fy_parser_stats *stats)
+{
+	if (!fyp || !stats || !fyp->collect_stats)
+		return -1;
+
+	*stats = fyp->stats;
+	return 0;
+}
+
+const char *fy_parser_stats_fetch_name(enum fy_parser_stats_fetch fetch)
+{
+	static const char *names[FYPSF_COUNT] = {
+		[FYPSF_STREAM_START]		= "stream-start",
+		[FYPSF_STREAM_END]		= "stream-end",
+		[FYPSF_DIRECTIVE]		= "directive",
+		[FYPSF_DOCUMENT_INDICATOR]	= "document-indicator",
+		[FYPSF_FLOW_COLLECTION_START]	= "flow-collection-start",
+		[FYPSF_FLOW_COLLECTION_END]	= "flow-collection-end",
+		[FYPSF_FLOW_ENTRY]		= "flow-entry",
+		[FYPSF_BLOCK_ENTRY]		= "block-entry",
+		[FYPSF_KEY]			= "key",
+		[FYPSF_VALUE]			= "value",
+		[FYPSF_ANCHOR_OR_ALIAS]		= "anchor-or-alias",
+		[FYPSF_TAG]			= "tag",
+		[FYPSF_BLOCK_SCALAR]		= "block-scalar",
+		[FYPSF_FLOW_SCALAR]		= "flow-scalar",
+		[FYPSF_PLAIN_SCALAR]		= "plain-scalar",
+	};
+
+	if ((unsigned int)fetch >= FYPSF_COUNT)
+		return NULL;
+
+	return names[fetch];
+}
+
 bool fy_parser_get_stream_error(struct fy_parser *fyp)
 {
 	if (!fyp)
@@ -5865,7 +6666,11 @@ void fy_error_vreport(struct fy_parser *fyp, struct fy_error_ctx *fyec, const ch
 			name = "<stdin>";
 		else
 			name = fyi->cfg.stream.name;
-	} else
+	} else if (fyi->cfg.type == fyit_callback)
+		name = fyi->cfg.callback.name;
+	else if (fyi->cfg.type == fyit_memory)
+		name = fyi->cfg.memory.name;
+	else
 		name = NULL;
 
 	if (do_color)
@@ -5883,11 +6688,15 @@ void fy_error_vreport(struct fy_parser *fyp, struct fy_error_ctx *fyec, const ch
 	vfprintf(fp, fmt, ap);
 	fprintf(fp, "\n");
 
+	/* the context is no longer available in sliding window mode */
+	if (fyec->start_mark.input_pos < fyi->discarded)
+		goto out;
+
 	s = fy_input_start(fyi);
 	e = s + fy_input_size(fyi);
 
-	rp = s + fyec->start_mark.input_pos;
-	rpe = s + fyec->end_mark.input_pos;
+	rp = s + (fyec->start_mark.input_pos - fyi->discarded);
+	rpe = s + (fyec->end_mark.input_pos - fyi->discarded);
 	rs = rp;
 	re = fy_find_lb(rp, e - rp);
 	if (!re)
@@ -5923,9 +6732,15 @@ void fy_error_vreport(struct fy_parser *fyp, struct fy_error_ctx *fyec, const ch
 	if (do_color)
 		fprintf(fp, "\x1b[0m");	/* reset */
 	fprintf(fp, "\n");
-
+out:
 	if (fyp && !fyp->stream_error)
 		fyp->stream_error = true;
+
+	/* keep where the first error was for fy_parser_validate() */
+	if (fyp && !fyp->error_mark_set) {
+		fyp->error_mark = fyec->start_mark;
+		fyp->error_mark_set = true;
+	}
 }
 
 void fy_error_report(struct fy_parser *fyp, struct fy_error_ctx *fyec, const char *fmt, ...)
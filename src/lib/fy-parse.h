@@ -15,6 +15,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <libfyaml.h>
 
@@ -35,6 +36,9 @@
 struct fy_parser;
 struct fy_input;
 
+/* the scanner and parser stacks start inplace up to this depth */
+#define FY_PARSE_STACK_INPLACE	16
+
 enum fy_flow_type {
 	FYFT_NONE,
 	FYFT_MAP,
@@ -42,25 +46,22 @@ enum fy_flow_type {
 };
 
 struct fy_flow {
-	struct list_head node;
 	enum fy_flow_type flow;
 	int pending_complex_key_column;
 	struct fy_mark pending_complex_key_mark;
 	int parent_indent;
 };
-FY_PARSE_TYPE_DECL(flow);
+FY_PARSE_STACK_DECL(flow, FY_PARSE_STACK_INPLACE);
 
 struct fy_indent {
-	struct list_head node;
 	int indent;
 	bool generated_block_map : 1;
 };
-FY_PARSE_TYPE_DECL(indent);
+FY_PARSE_STACK_DECL(indent, FY_PARSE_STACK_INPLACE);
 
 struct fy_token;
 
 struct fy_simple_key {
-	struct list_head node;
 	struct fy_mark mark;
 	struct fy_mark end_mark;
 	struct fy_token *token;	/* associated token */
@@ -69,7 +70,7 @@ struct fy_simple_key {
 	bool possible : 1;
 	bool empty : 1;
 };
-FY_PARSE_TYPE_DECL(simple_key);
+FY_PARSE_STACK_DECL(simple_key, FY_PARSE_STACK_INPLACE);
 
 enum fy_input_type {
 	fyit_file,
@@ -93,9 +94,12 @@ struct fy_input_cfg {
 		struct {
 			const void *data;
 			size_t size;
+			const char *name;	/* for diagnostics, may be NULL */
+			int line;		/* line number of the first line */
 		} memory;
 		struct {
-		} callback;
+			const char *name;
+		} callback;		/* push mode, fed by fy_parser_feed() */
 	};
 };
 
@@ -119,6 +123,10 @@ struct fy_input {
 	size_t allocated;
 	size_t read;
 	size_t chunk;
+	size_t window;		/* sliding window block size (0 when disabled) */
+	size_t discarded;	/* stream octets released before the buffer start */
+	unsigned int *pins;	/* live tokens starting in each window block */
+	size_t pins_count;
 	FILE *fp;
 	int refs;
 	union {
@@ -129,6 +137,9 @@ struct fy_input {
 		} file;
 		struct {
 		} stream;
+		struct {
+			bool eof;		/* the last chunk was fed */
+		} callback;
 	};
 };
 FY_PARSE_TYPE_DECL(input);
@@ -146,6 +157,7 @@ static inline const void *fy_input_start(const struct fy_input *fyi)
 		/* fall-through */
 
 	case fyit_stream:
+	case fyit_callback:
 		ptr = fyi->buffer;
 		break;
 
@@ -173,7 +185,8 @@ static inline size_t fy_input_size(const struct fy_input *fyi)
 		/* fall-through */
 
 	case fyit_stream:
-		size = fyi->read;
+	case fyit_callback:
+		size = fyi->read - fyi->discarded;
 		break;
 
 	case fyit_memory:
@@ -200,15 +213,22 @@ static inline enum fy_input_state fy_input_get_state(struct fy_input *fyi)
 struct fy_input *fy_parse_input_from_data(struct fy_parser *fyp,
 		const char *data, size_t size, struct fy_atom *handle,
 		bool simple);
+struct fy_input *fy_parse_input_from_buffer(struct fy_parser *fyp,
+		const void *data, size_t size, bool owned);
 const void *fy_parse_input_try_pull(struct fy_parser *fyp, struct fy_input *fyi,
 				    size_t pull, size_t *leftp);
 
+/* sliding window mode; keep the window block of pos while referenced */
+int fy_input_window_pin(struct fy_input *fyi, size_t pos);
+void fy_input_window_unpin(struct fy_input *fyi, size_t pos);
+
 static inline const char *fy_atom_data(const struct fy_atom *atom)
 {
 	if (!atom)
 		return NULL;
 
-	return fy_input_start(atom->fyi) + atom->start_mark.input_pos;
+	return fy_input_start(atom->fyi) +
+	       (atom->start_mark.input_pos - atom->fyi->discarded);
 }
 
 static inline size_t fy_atom_size(const struct fy_atom *atom)
@@ -283,10 +303,12 @@ enum fy_parser_state {
 };
 
 struct fy_parse_state_log {
-	struct list_head node;
 	enum fy_parser_state state;
 };
-FY_PARSE_TYPE_DECL(parse_state_log);
+FY_PARSE_STACK_DECL(parse_state_log, FY_PARSE_STACK_INPLACE);
+
+struct fy_parser_feed;
+struct fy_key_check;
 
 struct fy_parser {
 	struct fy_parse_cfg cfg;
@@ -296,8 +318,11 @@ struct fy_parser {
 	struct fy_input_list queued_inputs;	/* all the inputs queued */
 	struct fy_input_list parsed_inputs;
 	struct fy_input *current_input;
+	struct fy_parser_feed *feed;	/* push mode state (NULL if not used) */
+	struct fy_key_check *key_check;	/* fy_parser_validate() keys (NULL if not used) */
 	size_t current_pos;		/* from start of stream */
 	size_t current_input_pos;	/* from start of input */
+	size_t fetch_input_pos;		/* input pos the current token fetch started */
 	const void *current_ptr;	/* current pointer into the buffer */
 	int current_c;			/* current utf8 character at current_ptr (-1 if not cached) */
 	int current_w;			/* current utf8 character width */
@@ -311,15 +336,18 @@ struct fy_parser {
 	bool stream_end_produced : 1;
 	bool simple_key_allowed : 1;
 	bool stream_error : 1;
+	bool error_mark_set : 1;		/* error_mark is of the first error */
 	bool generated_block_map : 1;
 	bool document_has_content : 1;
 	bool document_first_content_token : 1;
 	bool bare_document_only : 1;		/* no document start indicators allowed, no directives */
 	bool external_document_state : 1;	/* no not generate a document state, use one provided */
+	bool collect_stats : 1;			/* FYPCF_COLLECT_STATS */
 	int flow_level;
 	int pending_complex_key_column;
 	struct fy_mark pending_complex_key_mark;
 	int last_block_mapping_key_line;
+	struct fy_mark error_mark;
 
 	/* copy of stream_end token */
 	struct fy_token *stream_end_token;
@@ -332,43 +360,61 @@ struct fy_parser {
 	struct fy_atom last_comment;
 
 	/* indent stack */
-	struct fy_indent_list indent_stack;
+	struct fy_indent_stack indent_stack;
 	int indent;
 	int parent_indent;
 	/* simple key stack */
-	struct fy_simple_key_list simple_keys;
+	struct fy_simple_key_stack simple_keys;
 	/* state stack */
 	enum fy_parser_state state;
-	struct fy_parse_state_log_list state_stack;
+	struct fy_parse_state_log_stack state_stack;
 
 	/* current parse document */
 	struct fy_document_state *current_document_state;
 
 	/* flow stack */
 	enum fy_flow_type flow;
-	struct fy_flow_list flow_stack;
+	struct fy_flow_stack flow_stack;
 
 	/* recycling lists */
-	struct fy_indent_list recycled_indent;
-	struct fy_simple_key_list recycled_simple_key;
 	struct fy_token_list recycled_token;
 	struct fy_input_list recycled_input;
-	struct fy_parse_state_log_list recycled_parse_state_log;
 	struct fy_eventp_list recycled_eventp;
-	struct fy_flow_list recycled_flow;
 	struct fy_document_state_list recycled_document_state;
 
 	FILE *errfp;
 	char *errbuf;
 	size_t errsz;
+
+	/* only updated when collect_stats is set */
+	struct fy_parser_stats stats;
 };
 
+/* nanoseconds of the monotonic clock, for the statistics */
+static inline uint64_t fy_parse_stats_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void fy_parse_stats_alloc(struct fy_parser *fyp, bool recycled, size_t size)
+{
+	if (recycled)
+		fyp->stats.recycled++;
+	else
+		fyp->stats.talloc_bytes += size;
+}
+
 int fy_parse_setup(struct fy_parser *fyp, const struct fy_parse_cfg *cfg);
 void fy_parse_cleanup(struct fy_parser *fyp);
 
 int fy_parse_input_append(struct fy_parser *fyp, const struct fy_input_cfg *fyic);
+int fy_parse_get_next_input(struct fy_parser *fyp);
 
 struct fy_token *fy_scan(struct fy_parser *fyp);
+struct fy_token *fy_scan_peek(struct fy_parser *fyp);
 
 const void *fy_ptr_slow_path(struct fy_parser *fyp, size_t *leftp);
 const void *fy_ensure_lookahead_slow_path(struct fy_parser *fyp, size_t size, size_t *leftp);
@@ -425,6 +471,7 @@ static inline void fy_advance_octets(struct fy_parser *fyp, size_t advance)
 		/* fall-through */
 
 	case fyit_stream:
+	case fyit_callback:
 		left = fyi->read - fyp->current_input_pos;
 		break;
 
@@ -552,6 +599,13 @@ static inline void fy_advance(struct fy_parser *fyp, int c)
 		fyp->column++;
 }
 
+/* advance over a run of printable ascii octets (no line breaks) */
+static inline void fy_advance_ascii(struct fy_parser *fyp, size_t advance)
+{
+	fy_advance_octets(fyp, advance);
+	fyp->column += advance;
+}
+
 static inline int fy_parse_get(struct fy_parser *fyp)
 {
 	int value;
@@ -0,0 +1,898 @@
+/*
+ * fy-snapshot.c - binary document snapshots
+ *
+ * Copyright (c) 2019 Pantelis Antoniou <pantelis.antoniou@konsulko.com>
+ *
+ * SPDX-License-Identifier: MIT
+ */
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <libfyaml.h>
+
+#include "fy-parse.h"
+#include "fy-doc.h"
+
+/*
+ * A snapshot is a header followed by flat arrays of fixed size records
+ * and a text area holding all the strings. Records refer to each other
+ * by index and to the text by offset, so the snapshot can be used in
+ * place wherever it is mapped.
+ *
+ * Nodes are stored in pre-order; the items (node indices) of a sequence
+ * and the pairs of a mapping are contiguous, so every child has a larger
+ * index than its parent.
+ */
+
+#define FY_SNAPSHOT_MAGIC	"FYSNAP\r\n"
+#define FY_SNAPSHOT_VERSION	1
+#define FY_SNAPSHOT_BYTE_ORDER	0x01020304
+#define FY_SNAPSHOT_NONE	((uint32_t)-1)
+#define FY_SNAPSHOT_ALIGN	8
+
+/* document state flags */
+#define FYSF_VERSION_EXPLICIT	FY_BIT(0)
+#define FYSF_TAGS_EXPLICIT	FY_BIT(1)
+#define FYSF_START_IMPLICIT	FY_BIT(2)
+#define FYSF_END_IMPLICIT	FY_BIT(3)
+
+/* node flags */
+#define FYSNF_DIRECT_OUTPUT	FY_BIT(0)	/* the text can be output as is in any style */
+#define FYSNF_ESCAPED		FY_BIT(1)	/* the text is stored double quote escaped */
+
+struct fy_snapshot_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t size;			/* of the whole snapshot */
+	uint32_t root;			/* node index, or NONE */
+	uint32_t version_major;		/* of the document */
+	uint32_t version_minor;
+	uint32_t flags;			/* FYSF_* */
+	uint32_t node_count;
+	uint32_t nodes;
+	uint32_t item_count;
+	uint32_t items;
+	uint32_t pair_count;
+	uint32_t pairs;
+	uint32_t anchor_count;
+	uint32_t anchors;
+	uint32_t tag_directive_count;
+	uint32_t tag_directives;
+	uint32_t text_size;
+	uint32_t text;
+};
+
+struct fy_snapshot_node {
+	uint8_t type;			/* enum fy_node_type */
+	uint8_t style;			/* enum fy_node_style */
+	uint16_t flags;			/* FYSNF_* */
+	uint32_t aflags;		/* FYACF_* of the scalar text */
+	uint32_t columns;		/* of the scalar text */
+	uint32_t tag;			/* text offset, or NONE */
+	uint32_t tag_len;
+	uint32_t start;			/* scalar text offset, or first item/pair */
+	uint32_t count;			/* scalar text length, or number of items/pairs */
+};
+
+struct fy_snapshot_pair {
+	uint32_t key;			/* node index, or NONE */
+	uint32_t value;
+};
+
+struct fy_snapshot_anchor {
+	uint32_t node;
+	uint32_t text;
+	uint32_t len;
+};
+
+/* the strings are zero terminated */
+struct fy_snapshot_tag_directive {
+	uint32_t handle;
+	uint32_t prefix;
+};
+
+struct fy_snapshot_array {
+	void *data;
+	size_t size;			/* of a record */
+	size_t count;
+	size_t alloc;
+};
+
+struct fy_snapshot_builder {
+	struct fy_document *fyd;
+	struct fy_snapshot_array nodes;
+	struct fy_snapshot_array items;
+	struct fy_snapshot_array pairs;
+	struct fy_snapshot_array anchors;
+	struct fy_snapshot_array tag_directives;
+	struct fy_snapshot_array text;
+};
+
+static void fy_snapshot_array_init(struct fy_snapshot_array *fysa, size_t size)
+{
+	memset(fysa, 0, sizeof(*fysa));
+	fysa->size = size;
+}
+
+/* reserve count records at the end, returns the index of the first */
+static long fy_snapshot_array_reserve(struct fy_snapshot_array *fysa, size_t count)
+{
+	size_t alloc;
+	void *data;
+	long idx;
+
+	/* everything must be addressable with 32 bits */
+	if (fysa->count + count >= FY_SNAPSHOT_NONE / fysa->size)
+		return -1;
+
+	/* nothing to clear, and the data may not even be there yet */
+	if (!count)
+		return (long)fysa->count;
+
+	if (fysa->count + count > fysa->alloc) {
+		alloc = fysa->alloc ? fysa->alloc * 2 : 64;
+		while (alloc < fysa->count + count)
+			alloc *= 2;
+		data = realloc(fysa->data, alloc * fysa->size);
+		if (!data)
+			return -1;
+		fysa->data = data;
+		fysa->alloc = alloc;
+	}
+
+	idx = (long)fysa->count;
+	memset((char *)fysa->data + fysa->count * fysa->size, 0, count * fysa->size);
+	fysa->count += count;
+
+	return idx;
+}
+
+static inline void *fy_snapshot_array_at(struct fy_snapshot_array *fysa, size_t idx)
+{
+	return (char *)fysa->data + idx * fysa->size;
+}
+
+static long fy_snapshot_add_text(struct fy_snapshot_builder *fysb, const char *str,
+				 size_t len, bool zero)
+{
+	long off;
+
+	off = fy_snapshot_array_reserve(&fysb->text, len + (zero ? 1 : 0));
+	if (off < 0)
+		return -1;
+	if (len)
+		memcpy(fy_snapshot_array_at(&fysb->text, off), str, len);
+	return off;
+}
+
+static long fy_snapshot_add_escaped_text(struct fy_snapshot_builder *fysb,
+					 const char *str, size_t len, size_t *lenp)
+{
+	long off;
+
+	off = fy_snapshot_array_reserve(&fysb->text, FY_ATOM_CONTENT_ESCAPE_MAX(len));
+	if (off < 0)
+		return -1;
+
+	*lenp = fy_atom_content_escape(str, len, fy_snapshot_array_at(&fysb->text, off));
+	fysb->text.count = off + *lenp;
+
+	return off;
+}
+
+static long fy_snapshot_add_node(struct fy_snapshot_builder *fysb, struct fy_node *fyn)
+{
+	struct fy_snapshot_node *fysn;
+	struct fy_snapshot_pair *fysp;
+	struct fy_snapshot_anchor *fysan;
+	struct fy_anchor *fya;
+	struct fy_node *fyni;
+	struct fy_node_pair *fynp;
+	const char *text = NULL, *str;
+	size_t len = 0, tlen;
+	bool escaped = false;
+	long idx, first, off, child, ai;
+	int count, i;
+	void *iter;
+
+	idx = fy_snapshot_array_reserve(&fysb->nodes, 1);
+	if (idx < 0)
+		return -1;
+
+	/* the record may move as the array grows; fill it in at the end */
+	first = 0;
+	count = 0;
+	switch (fyn->type) {
+	case FYNT_SCALAR:
+		text = fy_token_get_text(fyn->scalar, &len);
+		if (!text)
+			return -1;
+		escaped = fyn->style != FYNS_ALIAS && fy_atom_content_needs_escape(text, len);
+		tlen = len;
+		if (escaped)
+			off = fy_snapshot_add_escaped_text(fysb, text, len, &tlen);
+		else
+			off = fy_snapshot_add_text(fysb, text, len, false);
+		if (off < 0 || tlen > INT_MAX)
+			return -1;
+		first = off;
+		count = (int)tlen;
+		break;
+
+	case FYNT_SEQUENCE:
+		count = fy_node_sequence_item_count(fyn);
+		if (count < 0)
+			return -1;
+		first = fy_snapshot_array_reserve(&fysb->items, count);
+		if (first < 0)
+			return -1;
+		iter = NULL;
+		for (i = 0; (fyni = fy_node_sequence_iterate(fyn, &iter)) != NULL; i++) {
+			child = fy_snapshot_add_node(fysb, fyni);
+			if (child < 0 || i >= count)
+				return -1;
+			*(uint32_t *)fy_snapshot_array_at(&fysb->items, first + i) = (uint32_t)child;
+		}
+		break;
+
+	case FYNT_MAPPING:
+		count = fy_node_mapping_item_count(fyn);
+		if (count < 0)
+			return -1;
+		first = fy_snapshot_array_reserve(&fysb->pairs, count);
+		if (first < 0)
+			return -1;
+		iter = NULL;
+		for (i = 0; (fynp = fy_node_mapping_iterate(fyn, &iter)) != NULL; i++) {
+			if (i >= count)
+				return -1;
+			/* a NULL key or value is kept as such */
+			child = fynp->key ? fy_snapshot_add_node(fysb, fynp->key) : FY_SNAPSHOT_NONE;
+			if (child < 0)
+				return -1;
+			fysp = fy_snapshot_array_at(&fysb->pairs, first + i);
+			fysp->key = (uint32_t)child;
+			child = fynp->value ? fy_snapshot_add_node(fysb, fynp->value) : FY_SNAPSHOT_NONE;
+			if (child < 0)
+				return -1;
+			fysp = fy_snapshot_array_at(&fysb->pairs, first + i);
+			fysp->value = (uint32_t)child;
+		}
+		break;
+	}
+
+	fysn = fy_snapshot_array_at(&fysb->nodes, idx);
+	fysn->type = (uint8_t)fyn->type;
+	fysn->style = (uint8_t)fyn->style;
+	fysn->start = (uint32_t)first;
+	fysn->count = (uint32_t)count;
+	fysn->tag = FY_SNAPSHOT_NONE;
+
+	if (fyn->type == FYNT_SCALAR) {
+		/* analyze now, so that loading doesn't have to */
+		fysn->aflags = fy_analyze_scalar_content(text, len);
+		fysn->columns = (uint32_t)fy_utf8_count(fy_snapshot_array_at(&fysb->text, first),
+							count);
+		if (escaped)
+			fysn->flags |= FYSNF_ESCAPED;
+
+		/* nothing that would have to be escaped when quoted */
+		if (fyn->style == FYNS_ALIAS ||
+		    fy_atom_content_is_direct(text, len, fysn->aflags))
+			fysn->flags |= FYSNF_DIRECT_OUTPUT;
+	}
+
+	/* the tag in the form it was given, it is resolved again on load */
+	if (fyn->tag) {
+		str = fy_atom_data(&fyn->tag->handle);
+		len = fy_atom_size(&fyn->tag->handle);
+		off = fy_snapshot_add_text(fysb, str, len, false);
+		if (off < 0)
+			return -1;
+		fysn = fy_snapshot_array_at(&fysb->nodes, idx);
+		fysn->tag = (uint32_t)off;
+		fysn->tag_len = (uint32_t)len;
+	}
+
+	fya = fy_document_lookup_anchor_by_node(fysb->fyd, fyn);
+	if (fya) {
+		str = fy_anchor_get_text(fya, &len);
+		if (!str)
+			return -1;
+		off = fy_snapshot_add_text(fysb, str, len, false);
+		if (off < 0)
+			return -1;
+		ai = fy_snapshot_array_reserve(&fysb->anchors, 1);
+		if (ai < 0)
+			return -1;
+		fysan = fy_snapshot_array_at(&fysb->anchors, ai);
+		fysan->node = (uint32_t)idx;
+		fysan->text = (uint32_t)off;
+		fysan->len = (uint32_t)len;
+	}
+
+	return idx;
+}
+
+static int fy_snapshot_add_tag_directives(struct fy_snapshot_builder *fysb)
+{
+	struct fy_snapshot_tag_directive *fystd;
+	struct fy_token *fyt;
+	const char *handle, *prefix;
+	size_t handle_size, prefix_size;
+	long idx, hoff, poff;
+	void *iter;
+
+	iter = NULL;
+	while ((fyt = fy_document_tag_directive_iterate(fysb->fyd, &iter)) != NULL) {
+		handle = fy_tag_directive_token_handle(fyt, &handle_size);
+		prefix = fy_tag_directive_token_prefix(fyt, &prefix_size);
+		if (!handle || !prefix)
+			return -1;
+
+		/* the defaults are always there */
+		if (fy_tag_is_default(handle, handle_size, prefix, prefix_size))
+			continue;
+
+		hoff = fy_snapshot_add_text(fysb, handle, handle_size, true);
+		poff = fy_snapshot_add_text(fysb, prefix, prefix_size, true);
+		idx = fy_snapshot_array_reserve(&fysb->tag_directives, 1);
+		if (hoff < 0 || poff < 0 || idx < 0)
+			return -1;
+		fystd = fy_snapshot_array_at(&fysb->tag_directives, idx);
+		fystd->handle = (uint32_t)hoff;
+		fystd->prefix = (uint32_t)poff;
+	}
+
+	return 0;
+}
+
+static size_t fy_snapshot_align(size_t size)
+{
+	return (size + FY_SNAPSHOT_ALIGN - 1) & ~(size_t)(FY_SNAPSHOT_ALIGN - 1);
+}
+
+static int fy_snapshot_write(FILE *fp, const void *data, size_t size, size_t *posp)
+{
+	static const char zeroes[FY_SNAPSHOT_ALIGN];
+	size_t pad;
+
+	if (size && fwrite(data, 1, size, fp) != size)
+		return -1;
+	*posp += size;
+
+	pad = fy_snapshot_align(*posp) - *posp;
+	if (pad && fwrite(zeroes, 1, pad, fp) != pad)
+		return -1;
+	*posp += pad;
+
+	return 0;
+}
+
+int fy_document_save_snapshot(struct fy_document *fyd, const char *file)
+{
+	struct fy_snapshot_builder fysb;
+	struct fy_snapshot_header fysh;
+	struct fy_document_state *fyds;
+	struct fy_snapshot_array *arrays[6];
+	uint32_t *offsets[6];
+	size_t pos;
+	long root;
+	FILE *fp = NULL;
+	int i, rc = -1;
+
+	if (!fyd || !file || !fyd->fyds)
+		return -1;
+
+	memset(&fysb, 0, sizeof(fysb));
+	fysb.fyd = fyd;
+	fy_snapshot_array_init(&fysb.nodes, sizeof(struct fy_snapshot_node));
+	fy_snapshot_array_init(&fysb.items, sizeof(uint32_t));
+	fy_snapshot_array_init(&fysb.pairs, sizeof(struct fy_snapshot_pair));
+	fy_snapshot_array_init(&fysb.anchors, sizeof(struct fy_snapshot_anchor));
+	fy_snapshot_array_init(&fysb.tag_directives, sizeof(struct fy_snapshot_tag_directive));
+	fy_snapshot_array_init(&fysb.text, 1);
+
+	root = fyd->root ? fy_snapshot_add_node(&fysb, fyd->root) : FY_SNAPSHOT_NONE;
+	if (root < 0)
+		goto out;
+
+	if (fy_snapshot_add_tag_directives(&fysb))
+		goto out;
+
+	fyds = fyd->fyds;
+
+	memset(&fysh, 0, sizeof(fysh));
+	memcpy(fysh.magic, FY_SNAPSHOT_MAGIC, sizeof(fysh.magic));
+	fysh.version = FY_SNAPSHOT_VERSION;
+	fysh.byte_order = FY_SNAPSHOT_BYTE_ORDER;
+	fysh.root = (uint32_t)root;
+	fysh.version_major = (uint32_t)fyds->version.major;
+	fysh.version_minor = (uint32_t)fyds->version.minor;
+	fysh.flags = (fyds->version_explicit ? FYSF_VERSION_EXPLICIT : 0) |
+		     (fyds->tags_explicit ? FYSF_TAGS_EXPLICIT : 0) |
+		     (fyds->start_implicit ? FYSF_START_IMPLICIT : 0) |
+		     (fyds->end_implicit ? FYSF_END_IMPLICIT : 0);
+	fysh.node_count = (uint32_t)fysb.nodes.count;
+	fysh.item_count = (uint32_t)fysb.items.count;
+	fysh.pair_count = (uint32_t)fysb.pairs.count;
+	fysh.anchor_count = (uint32_t)fysb.anchors.count;
+	fysh.tag_directive_count = (uint32_t)fysb.tag_directives.count;
+	fysh.text_size = (uint32_t)fysb.text.count;
+
+	/* lay out the arrays one after the other */
+	arrays[0] = &fysb.nodes;		offsets[0] = &fysh.nodes;
+	arrays[1] = &fysb.items;		offsets[1] = &fysh.items;
+	arrays[2] = &fysb.pairs;		offsets[2] = &fysh.pairs;
+	arrays[3] = &fysb.anchors;		offsets[3] = &fysh.anchors;
+	arrays[4] = &fysb.tag_directives;	offsets[4] = &fysh.tag_directives;
+	arrays[5] = &fysb.text;			offsets[5] = &fysh.text;
+
+	pos = fy_snapshot_align(sizeof(fysh));
+	for (i = 0; i < 6; i++) {
+		*offsets[i] = (uint32_t)pos;
+		pos = fy_snapshot_align(pos + arrays[i]->count * arrays[i]->size);
+		if (pos >= FY_SNAPSHOT_NONE)
+			goto out;
+	}
+	fysh.size = (uint32_t)pos;
+
+	fp = fopen(file, "wb");
+	if (!fp)
+		goto out;
+
+	pos = 0;
+	if (fy_snapshot_write(fp, &fysh, sizeof(fysh), &pos))
+		goto out;
+	for (i = 0; i < 6; i++) {
+		if (fy_snapshot_write(fp, arrays[i]->data,
+				      arrays[i]->count * arrays[i]->size, &pos))
+			goto out;
+	}
+
+	rc = 0;
+out:
+	if (fp && fclose(fp))
+		rc = -1;
+	if (rc && fp)
+		unlink(file);
+
+	free(fysb.nodes.data);
+	free(fysb.items.data);
+	free(fysb.pairs.data);
+	free(fysb.anchors.data);
+	free(fysb.tag_directives.data);
+	free(fysb.text.data);
+
+	return rc;
+}
+
+/* an array must be completely inside the snapshot */
+static bool fy_snapshot_array_valid(const struct fy_snapshot_header *fysh,
+				    uint32_t offset, uint32_t count, size_t size)
+{
+	return !(offset % FY_SNAPSHOT_ALIGN) && offset >= sizeof(*fysh) &&
+	       offset <= fysh->size &&
+	       (uint64_t)count * size <= (uint64_t)(fysh->size - offset);
+}
+
+static bool fy_snapshot_text_valid(const struct fy_snapshot_header *fysh,
+				   uint32_t offset, uint32_t len)
+{
+	return offset <= fysh->text_size && len <= fysh->text_size - offset;
+}
+
+static bool fy_snapshot_header_valid(const struct fy_snapshot_header *fysh, size_t size)
+{
+	return size >= sizeof(*fysh) &&
+	       !memcmp(fysh->magic, FY_SNAPSHOT_MAGIC, sizeof(fysh->magic)) &&
+	       fysh->version == FY_SNAPSHOT_VERSION &&
+	       fysh->byte_order == FY_SNAPSHOT_BYTE_ORDER &&
+	       fysh->size <= size &&
+	       (fysh->root == FY_SNAPSHOT_NONE || fysh->root < fysh->node_count) &&
+	       fy_snapshot_array_valid(fysh, fysh->nodes, fysh->node_count,
+				       sizeof(struct fy_snapshot_node)) &&
+	       fy_snapshot_array_valid(fysh, fysh->items, fysh->item_count,
+				       sizeof(uint32_t)) &&
+	       fy_snapshot_array_valid(fysh, fysh->pairs, fysh->pair_count,
+				       sizeof(struct fy_snapshot_pair)) &&
+	       fy_snapshot_array_valid(fysh, fysh->anchors, fysh->anchor_count,
+				       sizeof(struct fy_snapshot_anchor)) &&
+	       fy_snapshot_array_valid(fysh, fysh->tag_directives, fysh->tag_directive_count,
+				       sizeof(struct fy_snapshot_tag_directive)) &&
+	       fy_snapshot_array_valid(fysh, fysh->text, fysh->text_size, 1);
+}
+
+/* a zero terminated string of the text */
+static const char *fy_snapshot_text_str(const struct fy_snapshot_header *fysh,
+					const char *text, uint32_t offset)
+{
+	if (offset >= fysh->text_size ||
+	    !memchr(text + offset, '\0', fysh->text_size - offset))
+		return NULL;
+	return text + offset;
+}
+
+/*
+ * The input holding the snapshot; the scalar tokens keep a reference
+ * to it, so it lives on as long as any copy of them does. For the same
+ * reason it can't have a name that the parser owns.
+ */
+static struct fy_input *fy_snapshot_input(struct fy_parser *fyp,
+					  void *addr, size_t length, void *buffer)
+{
+	struct fy_input *fyi;
+
+	fyi = fy_input_alloc();
+	if (!fyi)
+		return NULL;
+
+	fyi->cfg.type = fyit_file;
+	fyi->file.fd = -1;
+	fyi->file.addr = addr;
+	fyi->file.length = length;
+	fyi->buffer = buffer;
+	fyi->allocated = buffer ? length : 0;
+
+	fyi->state = FYIS_PARSED;
+	fyi->on_list = &fyp->parsed_inputs;
+	fy_input_list_add_tail(fyi->on_list, fyi);
+
+	return fyi;
+}
+
+/*
+ * Tags and anchors are set from the snapshot text, which they point
+ * to and not own; make them refer to (and keep alive) the snapshot
+ * input instead, as they may be shared by copies in other documents.
+ */
+static void fy_snapshot_token_keep(struct fy_token *fyt, struct fy_input *fyi, size_t pos)
+{
+	struct fy_atom *atom = &fyt->handle;
+
+	atom->end_mark.input_pos = pos + (atom->end_mark.input_pos - atom->start_mark.input_pos);
+	atom->start_mark.input_pos = pos;
+	atom->fyi = fy_input_ref(fyi);
+	fyt->input_ref = true;
+}
+
+static enum fy_scalar_style fy_snapshot_scalar_style(enum fy_node_style style,
+						     unsigned int aflags)
+{
+	switch (style) {
+	case FYNS_PLAIN:
+		return FYSS_PLAIN;
+	case FYNS_SINGLE_QUOTED:
+		return FYSS_SINGLE_QUOTED;
+	case FYNS_DOUBLE_QUOTED:
+		return FYSS_DOUBLE_QUOTED;
+	case FYNS_LITERAL:
+		return FYSS_LITERAL;
+	case FYNS_FOLDED:
+		return FYSS_FOLDED;
+	default:
+		break;
+	}
+	return (aflags & FYACF_FLOW_PLAIN) ? FYSS_PLAIN : FYSS_DOUBLE_QUOTED;
+}
+
+static struct fy_document *
+fy_snapshot_build(const struct fy_parse_cfg *cfg, void *addr, size_t length, void *buffer)
+{
+	const char *base = addr ? addr : buffer;
+	const struct fy_snapshot_header *fysh = (const void *)base;
+	const struct fy_snapshot_node *fysns, *fysn;
+	const struct fy_snapshot_pair *fysps, *fysp;
+	const struct fy_snapshot_anchor *fysans;
+	const struct fy_snapshot_tag_directive *fystds;
+	const uint32_t *items;
+	const char *text, *handle, *prefix;
+	struct fy_document *fyd;
+	struct fy_parser *fyp;
+	struct fy_input *fyi;
+	struct fy_node **fyns = NULL, *fyn, *fyni;
+	struct fy_node_pair *fynp;
+	struct fy_anchor *fya;
+	struct fy_token *fyt;
+	uint32_t i, j, child;
+	size_t size;
+	int rc;
+
+	if (!fy_snapshot_header_valid(fysh, length)) {
+		if (addr)
+			munmap(addr, length);
+		free(buffer);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	fyd = fy_document_create(cfg);
+	if (!fyd) {
+		if (addr)
+			munmap(addr, length);
+		free(buffer);
+		return NULL;
+	}
+	fyp = fyd->fyp;
+
+	/* from now on the mapping belongs to the parser */
+	fyi = fy_snapshot_input(fyp, addr, length, buffer);
+	fy_error_check(fyp, fyi, err_out_unmap,
+			"fy_snapshot_input() failed");
+
+	fysns = (const void *)(base + fysh->nodes);
+	items = (const void *)(base + fysh->items);
+	fysps = (const void *)(base + fysh->pairs);
+	fysans = (const void *)(base + fysh->anchors);
+	fystds = (const void *)(base + fysh->tag_directives);
+	text = base + fysh->text;
+
+	fyd->fyds->version.major = (int)fysh->version_major;
+	fyd->fyds->version.minor = (int)fysh->version_minor;
+	fyd->fyds->version_explicit = !!(fysh->flags & FYSF_VERSION_EXPLICIT);
+	fyd->fyds->start_implicit = !!(fysh->flags & FYSF_START_IMPLICIT);
+	fyd->fyds->end_implicit = !!(fysh->flags & FYSF_END_IMPLICIT);
+
+	for (i = 0; i < fysh->tag_directive_count; i++) {
+		handle = fy_snapshot_text_str(fysh, text, fystds[i].handle);
+		prefix = fy_snapshot_text_str(fysh, text, fystds[i].prefix);
+		fy_error_check(fyp, handle && prefix, err_out,
+				"bad snapshot tag directive");
+		/* a default handle may be overridden, just like when parsing */
+		if (fy_tag_handle_is_default(handle, (size_t)-1))
+			fy_document_tag_directive_remove(fyd, handle);
+		rc = fy_document_tag_directive_add(fyd, handle, prefix);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_document_tag_directive_add() failed");
+	}
+	fyd->fyds->tags_explicit = !!(fysh->flags & FYSF_TAGS_EXPLICIT);
+
+	if (fysh->root == FY_SNAPSHOT_NONE)
+		return fyd;
+
+	/*
+	 * All the nodes and pairs in a single block; not the tokens though,
+	 * copies in other documents may hold on to them.
+	 */
+	size = (size_t)fysh->node_count * fy_snapshot_align(sizeof(struct fy_node)) +
+	       (size_t)fysh->pair_count * fy_snapshot_align(sizeof(struct fy_node_pair));
+	if (!fyd->use_arena || size > fyd->arena.block_size) {
+		fyd->use_arena = true;
+		fy_arena_init(&fyd->arena, size);
+	}
+
+	fyns = calloc(fysh->node_count, sizeof(*fyns));
+	fy_error_check(fyp, fyns, err_out,
+			"calloc() failed");
+
+	for (i = 0; i < fysh->node_count; i++) {
+		fysn = &fysns[i];
+
+		fy_error_check(fyp, fysn->type <= FYNT_MAPPING && fysn->style <= FYNS_ALIAS,
+				err_out, "bad snapshot node #%u", i);
+
+		fyn = fy_node_alloc(fyd, fysn->type);
+		fy_error_check(fyp, fyn, err_out,
+				"fy_node_alloc() failed");
+		fyns[i] = fyn;
+		fyn->style = fysn->style;
+
+		switch (fyn->type) {
+		case FYNT_SCALAR:
+			fy_error_check(fyp, fy_snapshot_text_valid(fysh, fysn->start, fysn->count),
+					err_out, "bad snapshot scalar #%u", i);
+
+			fyt = fy_token_alloc(fyd->fyds);
+			fy_error_check(fyp, fyt, err_out,
+					"fy_token_alloc() failed");
+			fyn->scalar = fyt;
+
+			fy_atom_content_setup(&fyt->handle, fyi,
+					      fysh->text + fysn->start, fysn->count,
+					      fysn->columns, fysn->aflags,
+					      !!(fysn->flags & FYSNF_DIRECT_OUTPUT),
+					      !!(fysn->flags & FYSNF_ESCAPED));
+			fy_input_ref(fyi);
+			fyt->input_ref = true;
+			if (fyn->style == FYNS_ALIAS)
+				fyt->type = FYTT_ALIAS;
+			else {
+				fyt->type = FYTT_SCALAR;
+				fyt->scalar.style = fy_snapshot_scalar_style(fyn->style, fysn->aflags);
+			}
+
+			/* the text is right there, unless it has to be unescaped */
+			if (!(fysn->flags & FYSNF_ESCAPED)) {
+				fyt->text = text + fysn->start;
+				fyt->text_len = fysn->count;
+			}
+			break;
+
+		case FYNT_SEQUENCE:
+		case FYNT_MAPPING:
+			/* the item vectors are built when first needed */
+			fyn->items_count = -1;
+			break;
+		}
+
+		if (fysn->tag != FY_SNAPSHOT_NONE) {
+			fy_error_check(fyp, fy_snapshot_text_valid(fysh, fysn->tag, fysn->tag_len),
+					err_out, "bad snapshot tag #%u", i);
+			rc = fy_node_set_tag(fyn, text + fysn->tag, fysn->tag_len);
+			fy_error_check(fyp, !rc, err_out,
+					"fy_node_set_tag() failed");
+
+			fy_snapshot_token_keep(fyn->tag, fyi, fysh->text + fysn->tag);
+		}
+	}
+
+	/* link up; children always come after their parent */
+	for (i = 0; i < fysh->node_count; i++) {
+		fysn = &fysns[i];
+		fyn = fyns[i];
+
+		if (fyn->type == FYNT_SCALAR)
+			continue;
+
+		if (fyn->type == FYNT_SEQUENCE) {
+			fy_error_check(fyp, fysn->start <= fysh->item_count &&
+					    fysn->count <= fysh->item_count - fysn->start,
+					err_out, "bad snapshot sequence #%u", i);
+
+			for (j = 0; j < fysn->count; j++) {
+				child = items[fysn->start + j];
+				fy_error_check(fyp, child > i && child < fysh->node_count &&
+						    !fyns[child]->parent,
+						err_out, "bad snapshot sequence item #%u", i);
+				fyni = fyns[child];
+				fyni->parent = fyn;
+				fy_node_list_add_tail(&fyn->sequence, fyni);
+			}
+			continue;
+		}
+
+		fy_error_check(fyp, fysn->start <= fysh->pair_count &&
+				    fysn->count <= fysh->pair_count - fysn->start,
+				err_out, "bad snapshot mapping #%u", i);
+
+		for (j = 0; j < fysn->count; j++) {
+			fysp = &fysps[fysn->start + j];
+			fy_error_check(fyp, (fysp->key == FY_SNAPSHOT_NONE ||
+					     (fysp->key > i && fysp->key < fysh->node_count &&
+					      !fyns[fysp->key]->parent)) &&
+					    (fysp->value == FY_SNAPSHOT_NONE ||
+					     (fysp->value > i && fysp->value < fysh->node_count &&
+					      !fyns[fysp->value]->parent)) &&
+					    (fysp->key == FY_SNAPSHOT_NONE || fysp->key != fysp->value),
+					err_out, "bad snapshot mapping pair #%u", i);
+
+			fynp = fy_node_pair_alloc(fyd);
+			fy_error_check(fyp, fynp, err_out,
+					"fy_node_pair_alloc() failed");
+
+			/* the parent of the key is always NULL, mark it as used though */
+			if (fysp->key != FY_SNAPSHOT_NONE) {
+				fynp->key = fyns[fysp->key];
+				fynp->key->parent = fyn;
+			}
+			if (fysp->value != FY_SNAPSHOT_NONE) {
+				fynp->value = fyns[fysp->value];
+				fynp->value->parent = fyn;
+			}
+			fynp->parent = fyn;
+			fy_node_pair_list_add_tail(&fyn->mapping, fynp);
+		}
+	}
+
+	/* every node but the root must have been linked exactly once */
+	for (i = 0; i < fysh->node_count; i++)
+		fy_error_check(fyp, (i == fysh->root) == !fyns[i]->parent, err_out,
+				"bad snapshot node link #%u", i);
+	fyd->root = fyns[fysh->root];
+
+	/* fix up the key parents */
+	for (i = 0; i < fysh->pair_count; i++) {
+		if (fysps[i].key == FY_SNAPSHOT_NONE)
+			continue;
+		fy_error_check(fyp, fysps[i].key < fysh->node_count, err_out,
+				"bad snapshot pair #%u", i);
+		fyns[fysps[i].key]->parent = NULL;
+	}
+
+	for (i = 0; i < fysh->anchor_count; i++) {
+		fy_error_check(fyp, fysans[i].node < fysh->node_count &&
+				    fy_snapshot_text_valid(fysh, fysans[i].text, fysans[i].len),
+				err_out, "bad snapshot anchor #%u", i);
+		rc = fy_document_set_anchor(fyd, fyns[fysans[i].node],
+					    text + fysans[i].text, fysans[i].len);
+		fy_error_check(fyp, !rc, err_out,
+				"fy_document_set_anchor() failed");
+		fya = fy_document_lookup_anchor_by_node(fyd, fyns[fysans[i].node]);
+		fy_error_check(fyp, fya, err_out,
+				"fy_document_lookup_anchor_by_node() failed");
+		fy_snapshot_token_keep(fya->anchor, fyi, fysh->text + fysans[i].text);
+	}
+
+	free(fyns);
+
+	return fyd;
+
+err_out:
+	/* the unlinked nodes release everything below them */
+	if (fyns && !fyd->root) {
+		for (i = 0; i < fysh->node_count && fyns[i]; i++) {
+			if (!fyns[i]->parent)
+				fy_node_free(fyns[i]);
+		}
+	}
+	free(fyns);
+	fy_document_destroy(fyd);
+	return NULL;
+
+err_out_unmap:
+	if (addr)
+		munmap(addr, length);
+	free(buffer);
+	fy_document_destroy(fyd);
+	return NULL;
+}
+
+struct fy_document *fy_document_load_snapshot(const struct fy_parse_cfg *cfg, const char *file)
+{
+	struct stat sb;
+	void *addr = NULL, *buffer = NULL;
+	size_t length, pos;
+	ssize_t nread;
+	int fd;
+
+	if (!file)
+		return NULL;
+
+	fd = open(file, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	if (fstat(fd, &sb) == -1 || sb.st_size <= 0)
+		goto err_out;
+
+	length = (size_t)sb.st_size;
+	if (!cfg || !(cfg->flags & FYPCF_DISABLE_MMAP_OPT)) {
+		addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (addr == MAP_FAILED)
+			addr = NULL;
+	}
+
+	/* can't map; read it all */
+	if (!addr) {
+		buffer = malloc(length);
+		if (!buffer)
+			goto err_out;
+		for (pos = 0; pos < length; pos += (size_t)nread) {
+			nread = read(fd, (char *)buffer + pos, length - pos);
+			if (nread <= 0)
+				goto err_out;
+		}
+	}
+
+	close(fd);
+
+	return fy_snapshot_build(cfg, addr, length, buffer);
+
+err_out:
+	free(buffer);
+	close(fd);
+	return NULL;
+}
@@ -18,6 +18,9 @@
 #include <errno.h>
 #include <stdarg.h>
 #include <alloca.h>
+#include <ctype.h>
+#include <math.h>
+#include <locale.h>
 
 #include <libfyaml.h>
 
@@ -28,10 +31,11 @@
 
 #include "fy-token.h"
 
+#include "fy-utils.h"
+
 struct fy_token *fy_token_alloc(struct fy_document_state *fyds)
 {
 	struct fy_token *fyt;
-	unsigned int i;
 
 	if (!fyds)
 		return NULL;
@@ -48,8 +52,7 @@ struct fy_token *fy_token_alloc(struct fy_document_state *fyds)
 	fyt->text = NULL;
 	fyt->text0 = NULL;
 	fyt->handle.fyi = NULL;
-	for (i = 0; i < sizeof(fyt->comment)/sizeof(fyt->comment[0]); i++)
-		fyt->comment[i].fyi = NULL;
+	fyt->comment = NULL;
 
 	fyt->refs = 1;
 
@@ -73,6 +76,21 @@ void fy_token_free(struct fy_token *fyt)
 
 	if (fyt->text0)
 		free(fyt->text0);
+	if (fyt->istr)
+		fy_intern_unref(fyt->istr->fyin);
+
+	/* the input may be gone already when nothing was pinned */
+	if (fyt->handle_pinned)
+		fy_input_window_unpin(fyt->handle.fyi, fyt->handle.start_mark.input_pos);
+	if (fyt->comment_pinned)
+		fy_input_window_unpin(fyt->comment[fycp_top].fyi,
+				      fyt->comment[fycp_top].start_mark.input_pos);
+
+	if (fyt->comment)
+		free(fyt->comment);
+
+	if (fyt->input_ref)
+		fy_input_unref(fyt->handle.fyi);
 
 	free(fyt);
 }
@@ -151,6 +169,9 @@ struct fy_token *fy_parse_token_new(struct fy_parser *fyp, enum fy_token_type ty
 		return fyt;
 	fyt->type = type;
 
+	if (fyp->collect_stats)
+		fyp->stats.tokens++;
+
 	/* fy_notice(NULL, "%s: %p #%d", __func__, fyt, fyt->refs); */
 
 	return fyt;
@@ -346,6 +367,7 @@ struct fy_token *fy_token_vcreate(struct fy_parser *fyp, enum fy_token_type type
 	struct fy_token *fyt = NULL;
 	struct fy_atom *handle;
 	struct fy_token *fyt_td;
+	int rc;
 
 	if (!fyp)
 		return NULL;
@@ -360,7 +382,13 @@ struct fy_token *fy_token_vcreate(struct fy_parser *fyp, enum fy_token_type type
 	handle = va_arg(ap, struct fy_atom *);
 	fy_error_check(fyp, handle != NULL, err_out,
 			"illegal handle argument");
+
+	/* the input keeps the data of live tokens in sliding window mode */
+	rc = fy_input_window_pin(handle->fyi, handle->start_mark.input_pos);
+	fy_error_check(fyp, !rc, err_out,
+			"fy_input_window_pin() failed");
 	fyt->handle = *handle;
+	fyt->handle_pinned = handle->fyi && handle->fyi->window;
 
 	switch (fyt->type) {
 	case FYTT_TAG_DIRECTIVE:
@@ -369,6 +397,7 @@ struct fy_token *fy_token_vcreate(struct fy_parser *fyp, enum fy_token_type type
 		break;
 	case FYTT_SCALAR:
 		fyt->scalar.style = va_arg(ap, enum fy_scalar_style);
+		fyt->scalar.type = FYTST_UNRESOLVED;
 		fy_error_check(fyp, (unsigned int)fyt->scalar.style < FYSS_MAX, err_out,
 					"illegal scalar style argument");
 		break;
@@ -533,6 +562,21 @@ struct fy_atom *fy_token_atom(struct fy_token *fyt)
 	return fyt ? &fyt->handle : NULL;
 }
 
+/* comments are rare; the atoms are kept out of line, and allocated on first use */
+struct fy_atom *fy_token_comment_alloc(struct fy_token *fyt, enum fy_comment_placement placement)
+{
+	if (!fyt || (unsigned int)placement >= fycp_max)
+		return NULL;
+
+	if (!fyt->comment) {
+		fyt->comment = calloc(fycp_max, sizeof(*fyt->comment));
+		if (!fyt->comment)
+			return NULL;
+	}
+
+	return &fyt->comment[placement];
+}
+
 const struct fy_mark *fy_token_start_mark(struct fy_token *fyt)
 {
 	const struct fy_atom *atom;
@@ -759,8 +803,9 @@ const char *fy_token_get_text(struct fy_token *fyt, size_t *lenp)
 		return fyt->text;
 	}
 
-	/* try direct output first */
-	fyt->text = fy_token_get_direct_output(fyt, &fyt->text_len);
+	/* try direct output first; the input moves in sliding window mode */
+	if (!fyt->handle.fyi || !fyt->handle.fyi->window)
+		fyt->text = fy_token_get_direct_output(fyt, &fyt->text_len);
 	if (!fyt->text)
 		fy_token_prepare_text(fyt);
 
@@ -774,6 +819,9 @@ const char *fy_token_get_text0(struct fy_token *fyt)
 	if (!fyt)
 		return "";
 
+	if (fyt->istr)
+		return fyt->istr->str;
+
 	/* created text is always zero terminated */
 	if (!fyt->text0)
 		fy_token_prepare_text(fyt);
@@ -781,6 +829,57 @@ const char *fy_token_get_text0(struct fy_token *fyt)
 	return fyt->text0;
 }
 
+int fy_token_intern(struct fy_token *fyt, struct fy_intern *fyin)
+{
+	const struct fy_intern_str *fyis;
+	const char *text;
+	size_t len;
+
+	if (!fyt || !fyin || fyt->type != FYTT_SCALAR || fyt->istr)
+		return 0;
+
+	text = fy_token_get_text(fyt, &len);
+	if (!text)
+		return -1;
+
+	fyis = fy_intern_get(fyin, text, len, fy_hash_data(text, len));
+	if (!fyis)
+		return -1;
+
+	/* the shared copy replaces any text of our own */
+	if (fyt->text0) {
+		free(fyt->text0);
+		fyt->text0 = NULL;
+	}
+	fyt->text = fyis->str;
+	fyt->text_len = fyis->len;
+	fyt->istr = fyis;
+	fy_intern_ref(fyin);
+
+	return 0;
+}
+
+int fy_token_freeze(struct fy_token *fyt)
+{
+	size_t len;
+
+	if (!fyt)
+		return 0;
+
+	fy_token_text_analyze(fyt);
+	if (!(fyt->analyze_flags & FYTTAF_TEXT_TOKEN))
+		return 0;
+
+	if (fy_token_format_text_length(fyt) < 0 ||
+	    !fy_token_get_text0(fyt) || !fy_token_get_text(fyt, &len))
+		return -1;
+
+	if (fyt->type == FYTT_SCALAR)
+		fy_token_scalar_resolve(fyt);
+
+	return 0;
+}
+
 size_t fy_token_get_text_length(struct fy_token *fyt)
 {
 	return fy_token_format_text_length(fyt);
@@ -1299,3 +1398,339 @@ int fy_token_iter_utf8_peek(struct fy_token_iter *iter)
 
 	return fy_token_iter_utf8_unget(iter, c);
 }
+
+int fy_token_text_foreach_chunk(struct fy_token *fyt,
+				int (*fn)(const char *str, size_t len, void *user),
+				void *user)
+{
+	struct fy_token_iter iter;
+	const struct fy_iter_chunk *ic;
+	int ret, err = 0;
+
+	if (!fyt || !fn)
+		return -1;
+
+	/* already prepared, single chunk */
+	if (fyt->text)
+		return fyt->text_len ? fn(fyt->text, fyt->text_len, user) : 0;
+
+	memset(&iter, 0, sizeof(iter));
+	fy_token_iter_start(fyt, &iter);
+	ret = 0;
+	ic = NULL;
+	while ((ic = fy_token_iter_chunk_next(&iter, ic, &err)) != NULL) {
+		ret = fn(ic->str, ic->len, user);
+		if (ret)
+			break;
+	}
+	fy_token_iter_finish(&iter);
+
+	return !ic && err ? -1 : ret;
+}
+
+struct fy_token_text_cmp_ctx {
+	const char *str;
+	size_t len;
+	int ret;
+};
+
+static int fy_token_text_cmp_chunk(const char *str, size_t len, void *user)
+{
+	struct fy_token_text_cmp_ctx *ctx = user;
+	size_t n;
+	int ret;
+
+	n = len > ctx->len ? ctx->len : len;
+	ret = memcmp(str, ctx->str, n);
+	if (!ret && len > ctx->len)
+		ret = 1;
+	if (ret) {
+		ctx->ret = ret;
+		return 1;
+	}
+	ctx->str += n;
+	ctx->len -= n;
+	return 0;
+}
+
+int fy_token_text_cmp(struct fy_token *fyt, const char *str, size_t len)
+{
+	struct fy_token_text_cmp_ctx ctx;
+	int rc;
+
+	if (len == (size_t)-1)
+		len = str ? strlen(str) : 0;
+
+	/* the NULL token is the empty string */
+	if (!fyt)
+		return len ? -1 : 0;
+
+	ctx.str = str;
+	ctx.len = len;
+	ctx.ret = 0;
+	rc = fy_token_text_foreach_chunk(fyt, fy_token_text_cmp_chunk, &ctx);
+	if (rc < 0)
+		return -1;
+	if (ctx.ret)
+		return ctx.ret;
+
+	/* token text is a prefix of str */
+	return ctx.len ? -1 : 0;
+}
+
+static int fy_token_text_hash_chunk(const char *str, size_t len, void *user)
+{
+	uint32_t *hashp = user;
+
+	*hashp = fy_hash_update(*hashp, str, len);
+	return 0;
+}
+
+uint32_t fy_token_text_hash(struct fy_token *fyt)
+{
+	uint32_t hash = FY_HASH_INIT;
+
+	if (fyt && fyt->istr)
+		return fyt->istr->hash;
+
+	if (fyt)
+		fy_token_text_foreach_chunk(fyt, fy_token_text_hash_chunk, &hash);
+	return hash;
+}
+
+struct fy_token_text_copy_ctx {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+static int fy_token_text_copy_chunk(const char *str, size_t len, void *user)
+{
+	struct fy_token_text_copy_ctx *ctx = user;
+
+	/* keep space for the terminating '\0' */
+	if (ctx->len + len >= ctx->size)
+		return 1;
+	memcpy(ctx->buf + ctx->len, str, len);
+	ctx->len += len;
+	return 0;
+}
+
+/* copy the text of a token to a small buffer, -1 if it doesn't fit */
+static int fy_token_text_copy_small(struct fy_token *fyt, char *buf, size_t size)
+{
+	struct fy_token_text_copy_ctx ctx;
+
+	if (!fyt)
+		return -1;
+
+	ctx.buf = buf;
+	ctx.size = size;
+	ctx.len = 0;
+	if (fy_token_text_foreach_chunk(fyt, fy_token_text_copy_chunk, &ctx))
+		return -1;
+	buf[ctx.len] = '\0';
+	return (int)ctx.len;
+}
+
+static bool fy_str_all(const char *s, bool (*isfn)(int))
+{
+	if (!*s)
+		return false;
+	while (*s && isfn((unsigned char)*s))
+		s++;
+	return !*s;
+}
+
+static bool fy_isodigit(int c)
+{
+	return c >= '0' && c <= '7';
+}
+
+static int fy_digit_value(int c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	return c - 'A' + 10;
+}
+
+/* YAML 1.2 core schema, 0o octal, 0x hex, or decimal */
+static int fy_text_to_int64(const char *buf, int64_t *valp)
+{
+	const char *s;
+	uint64_t v, max;
+	bool neg;
+	int base, d;
+
+	/* classified and converted by hand; the C library is locale dependent */
+	s = buf;
+	neg = false;
+	if (s[0] == '0' && s[1] == 'o') {
+		s += 2;
+		base = 8;
+		if (!fy_str_all(s, fy_isodigit))
+			return -1;
+	} else if (s[0] == '0' && s[1] == 'x') {
+		s += 2;
+		base = 16;
+		if (!fy_str_all(s, fy_is_hex))
+			return -1;
+	} else {
+		base = 10;
+		neg = *s == '-';
+		if (*s == '-' || *s == '+')
+			s++;
+		if (!fy_str_all(s, fy_is_num))
+			return -1;
+	}
+
+	max = neg ? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+	for (v = 0; *s; s++) {
+		d = fy_digit_value((unsigned char)*s);
+		if (v > (max - d) / base)
+			return -1;
+		v = v * base + d;
+	}
+
+	*valp = neg ? (int64_t)(0 - v) : (int64_t)v;
+	return 0;
+}
+
+static int fy_text_to_double(const char *buf, double *valp)
+{
+	const char *s, *dot, *dp;
+	char tmp[80], *end;
+	size_t pos, dplen, len;
+	bool neg, digits;
+	double v;
+
+	s = buf;
+	neg = *s == '-';
+	if (*s == '-' || *s == '+')
+		s++;
+
+	/* the special values */
+	if (!strcmp(s, ".inf") || !strcmp(s, ".Inf") || !strcmp(s, ".INF")) {
+		*valp = neg ? -INFINITY : INFINITY;
+		return 0;
+	}
+	if (s == buf && (!strcmp(s, ".nan") || !strcmp(s, ".NaN") || !strcmp(s, ".NAN"))) {
+		*valp = NAN;
+		return 0;
+	}
+
+	/* [0-9]*(\.[0-9]*)?([eE][-+]?[0-9]+)? with at least one digit */
+	digits = false;
+	dot = NULL;
+	while (fy_is_num(*s)) {
+		s++;
+		digits = true;
+	}
+	if (*s == '.') {
+		dot = s++;
+		while (fy_is_num(*s)) {
+			s++;
+			digits = true;
+		}
+	}
+	if (!digits)
+		return -1;
+	if (*s == 'e' || *s == 'E') {
+		s++;
+		if (*s == '-' || *s == '+')
+			s++;
+		if (!fy_str_all(s, fy_is_num))
+			return -1;
+	} else if (*s)
+		return -1;
+
+	/* strtod() expects the decimal point of the current locale */
+	dp = localeconv()->decimal_point;
+	if (dot && dp && strcmp(dp, ".")) {
+		pos = (size_t)(dot - buf);
+		dplen = strlen(dp);
+		len = strlen(dot + 1);
+		if (pos + dplen + len >= sizeof(tmp))
+			return -1;
+		memcpy(tmp, buf, pos);
+		memcpy(tmp + pos, dp, dplen);
+		memcpy(tmp + pos + dplen, dot + 1, len + 1);
+		buf = tmp;
+	}
+
+	/* out of range is an infinity, like the core schema float it is */
+	v = strtod(buf, &end);
+	if (*end)
+		return -1;
+
+	*valp = v;
+	return 0;
+}
+
+int fy_token_text_to_int64(struct fy_token *fyt, int64_t *valp)
+{
+	char buf[72];
+
+	if (!valp || fy_token_text_copy_small(fyt, buf, sizeof(buf)) <= 0)
+		return -1;
+
+	return fy_text_to_int64(buf, valp);
+}
+
+int fy_token_text_to_double(struct fy_token *fyt, double *valp)
+{
+	char buf[72];
+
+	if (!valp || fy_token_text_copy_small(fyt, buf, sizeof(buf)) <= 0)
+		return -1;
+
+	return fy_text_to_double(buf, valp);
+}
+
+static bool fy_text_in(const char *buf, const char * const *strs)
+{
+	for (; *strs; strs++) {
+		if (!strcmp(buf, *strs))
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Resolve the text of a scalar token with the YAML 1.2 core schema,
+ * as if it were plain; the result is cached on the token.
+ */
+enum fy_token_scalar_type fy_token_scalar_resolve(struct fy_token *fyt)
+{
+	static const char * const null_strs[] = { "~", "null", "Null", "NULL", NULL };
+	static const char * const true_strs[] = { "true", "True", "TRUE", NULL };
+	static const char * const false_strs[] = { "false", "False", "FALSE", NULL };
+	char buf[72];
+	int len;
+
+	if (!fyt || fyt->type != FYTT_SCALAR)
+		return FYTST_STR;
+
+	if (fyt->scalar.type != FYTST_UNRESOLVED)
+		return fyt->scalar.type;
+
+	/* text too long for the buffer is left a string */
+	len = fy_token_text_copy_small(fyt, buf, sizeof(buf));
+	if (len < 0)
+		fyt->scalar.type = FYTST_STR;
+	else if (!len || fy_text_in(buf, null_strs))
+		fyt->scalar.type = FYTST_NULL;
+	else if (fy_text_in(buf, true_strs) || fy_text_in(buf, false_strs)) {
+		fyt->scalar.type = FYTST_BOOL;
+		fyt->scalar.bval = buf[0] == 't' || buf[0] == 'T';
+	} else if (!fy_text_to_int64(buf, &fyt->scalar.ival))
+		fyt->scalar.type = FYTST_INT;
+	else if (!fy_text_to_double(buf, &fyt->scalar.dval))
+		fyt->scalar.type = FYTST_FLOAT;
+	else
+		fyt->scalar.type = FYTST_STR;
+
+	return fyt->scalar.type;
+}
@@ -19,6 +19,8 @@
 
 #include <libfyaml.h>
 
+#include "fy-intern.h"
+
 struct fy_parser;
 struct fy_token;
 struct fy_document;
@@ -75,6 +77,16 @@ static inline bool fy_token_type_is_content(enum fy_token_type type)
 #define FYACF_TRAILING_LB	0x10000	/* ends with trailing lb > 1 */
 #define FYACF_SIZE0		0x20000 /* contains absolutely nothing */
 
+/* a scalar resolved with the YAML 1.2 core schema */
+enum fy_token_scalar_type {
+	FYTST_UNRESOLVED,	/* not resolved yet */
+	FYTST_STR,
+	FYTST_NULL,
+	FYTST_BOOL,
+	FYTST_INT,
+	FYTST_FLOAT,
+};
+
 enum fy_comment_placement {
 	fycp_top,
 	fycp_right,
@@ -90,8 +102,12 @@ struct fy_token {
 	size_t text_len;
 	const char *text;
 	char *text0;		/* this is allocated */
+	const struct fy_intern_str *istr;	/* interned text, holds a table ref */
+	bool handle_pinned : 1;	/* the handle & top comment are pinned */
+	bool comment_pinned : 1;	/* on a sliding window input */
+	bool input_ref : 1;	/* holds a reference to its input (snapshots) */
 	struct fy_atom handle;
-	struct fy_atom comment[fycp_max];
+	struct fy_atom *comment;	/* fycp_max atoms, only allocated when comments are parsed */
 	union  {
 		struct {
 			unsigned int tag_length;	/* from start */
@@ -99,6 +115,12 @@ struct fy_token {
 		} tag_directive;
 		struct {
 			enum fy_scalar_style style;
+			enum fy_token_scalar_type type;	/* cache of the resolution */
+			union {
+				bool bval;
+				int64_t ival;
+				double dval;
+			};
 		} scalar;
 		struct {
 			unsigned int skip;
@@ -116,6 +138,12 @@ struct fy_token *fy_token_ref(struct fy_token *fyt);
 void fy_token_unref(struct fy_token *fyt);
 void fy_token_list_unref_all(struct fy_token_list *fytl);
 
+/* share the text of the token via the intern table */
+int fy_token_intern(struct fy_token *fyt, struct fy_intern *fyin);
+
+/* compute everything the read accessors would cache on the token */
+int fy_token_freeze(struct fy_token *fyt);
+
 struct fy_token *fy_parse_token_alloc(struct fy_parser *fyp);
 struct fy_token *fy_parse_token_new(struct fy_parser *fyp, enum fy_token_type type);
 void fy_parse_token_free(struct fy_parser *fyp, struct fy_token *fyt);
@@ -137,6 +165,17 @@ const char *fy_token_format_text(struct fy_token *fyt, char *buf, size_t maxsz);
 
 /* non-parser token methods */
 struct fy_atom *fy_token_atom(struct fy_token *fyt);
+struct fy_atom *fy_token_comment_alloc(struct fy_token *fyt, enum fy_comment_placement placement);
+enum fy_token_scalar_type fy_token_scalar_resolve(struct fy_token *fyt);
+
+static inline struct fy_atom *
+fy_token_comment(struct fy_token *fyt, enum fy_comment_placement placement)
+{
+	if (!fyt || !fyt->comment || (unsigned int)placement >= fycp_max)
+		return NULL;
+
+	return &fyt->comment[placement];
+}
 const struct fy_mark *fy_token_start_mark(struct fy_token *fyt);
 const struct fy_mark *fy_token_end_mark(struct fy_token *fyt);
 
@@ -26,12 +26,6 @@
 
 #include "fy-parse.h"
 
-/* parse only types */
-FY_PARSE_TYPE_DEFINE_SIMPLE(indent);
-FY_PARSE_TYPE_DEFINE_SIMPLE(simple_key);
-FY_PARSE_TYPE_DEFINE_SIMPLE(parse_state_log);
-FY_PARSE_TYPE_DEFINE_SIMPLE(flow);
-
 FY_TALLOC_TYPE_DEFINE(token);
 FY_PARSE_TYPE_DEFINE(token);
 
@@ -43,14 +37,8 @@ struct fy_eventp *fy_parse_eventp_alloc(struct fy_parser *fyp)
 	return fy_parse_eventp_alloc_simple(fyp);
 }
 
-void fy_parse_eventp_recycle(struct fy_parser *fyp, struct fy_eventp *fyep)
+void fy_event_clean(struct fy_event *fye)
 {
-	struct fy_event *fye;
-
-	if (!fyp || !fyep)
-		return;
-
-	fye = &fyep->e;
 	switch (fye->type) {
 	case FYET_NONE:
 		break;
@@ -93,6 +81,15 @@ void fy_parse_eventp_recycle(struct fy_parser *fyp, struct fy_eventp *fyep)
 		break;
 	}
 
+	fye->type = FYET_NONE;
+}
+
+void fy_parse_eventp_recycle(struct fy_parser *fyp, struct fy_eventp *fyep)
+{
+	if (!fyp || !fyep)
+		return;
+
+	fy_event_clean(&fyep->e);
 	fy_parse_eventp_recycle_simple(fyp, fyep);
 }
 
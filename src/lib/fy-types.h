@@ -15,6 +15,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include <libfyaml.h>
 
@@ -97,6 +99,10 @@ struct __useless_struct_to_allow_semicolon
 \
 struct fy_ ## _type *fy_parse_ ## _type ## _alloc_simple(struct fy_parser *fyp) \
 { \
+	if (fyp->collect_stats) \
+		fy_parse_stats_alloc(fyp, \
+			!fy_ ## _type ## _list_empty(&fyp->recycled_ ## _type), \
+			sizeof(struct fy_ ## _type)); \
 	return fy_ ## _type ## _alloc_simple_internal(&fyp->recycled_ ## _type, \
 			&fyp->tallocs); \
 } \
@@ -143,4 +149,78 @@ FY_PARSE_TYPE_DEFINE_ALLOC_SIMPLE(_type); \
 \
 struct __useless_struct_to_allow_semicolon
 
+/*
+ * Contiguous stack of _type items, using the inplace storage until it
+ * grows deeper than that. Pointers to items are valid until the next push.
+ */
+#define FY_PARSE_STACK_DECL(_type, _inplace) \
+struct fy_ ## _type ## _stack { \
+	struct fy_ ## _type *items; \
+	unsigned int top; \
+	unsigned int alloc; \
+	struct fy_ ## _type inplace[_inplace]; \
+}; \
+\
+static inline void fy_ ## _type ## _stack_init(struct fy_ ## _type ## _stack *_s) \
+{ \
+	_s->items = _s->inplace; \
+	_s->top = 0; \
+	_s->alloc = sizeof(_s->inplace) / sizeof(_s->inplace[0]); \
+} \
+\
+static inline void fy_ ## _type ## _stack_cleanup(struct fy_ ## _type ## _stack *_s) \
+{ \
+	if (_s->items != _s->inplace) \
+		free(_s->items); \
+	fy_ ## _type ## _stack_init(_s); \
+} \
+\
+static inline bool fy_ ## _type ## _stack_empty(const struct fy_ ## _type ## _stack *_s) \
+{ \
+	return !_s->top; \
+} \
+\
+static inline void fy_ ## _type ## _stack_reset(struct fy_ ## _type ## _stack *_s) \
+{ \
+	_s->top = 0; \
+} \
+\
+static inline struct fy_ ## _type *fy_ ## _type ## _stack_top(struct fy_ ## _type ## _stack *_s) \
+{ \
+	return _s->top ? &_s->items[_s->top - 1] : NULL; \
+} \
+\
+/* the item under the top (i.e. the next one after a pop) */ \
+static inline struct fy_ ## _type *fy_ ## _type ## _stack_below(struct fy_ ## _type ## _stack *_s, \
+		struct fy_ ## _type *_n) \
+{ \
+	return _n && _n > _s->items ? _n - 1 : NULL; \
+} \
+\
+/* room for a new top item, NULL on allocation failure */ \
+static inline struct fy_ ## _type *fy_ ## _type ## _stack_push(struct fy_ ## _type ## _stack *_s) \
+{ \
+	struct fy_ ## _type *_items; \
+	\
+	if (_s->top >= _s->alloc) { \
+		_items = realloc(_s->items == _s->inplace ? NULL : _s->items, \
+				sizeof(*_items) * _s->alloc * 2); \
+		if (!_items) \
+			return NULL; \
+		if (_s->items == _s->inplace) \
+			memcpy(_items, _s->inplace, sizeof(*_items) * _s->top); \
+		_s->items = _items; \
+		_s->alloc *= 2; \
+	} \
+	return &_s->items[_s->top++]; \
+} \
+\
+/* the popped item remains valid until the next push */ \
+static inline struct fy_ ## _type *fy_ ## _type ## _stack_pop(struct fy_ ## _type ## _stack *_s) \
+{ \
+	return _s->top ? &_s->items[--_s->top] : NULL; \
+} \
+\
+struct __useless_struct_to_allow_semicolon
+
 #endif
@@ -21,6 +21,9 @@ int fy_utf8_get_generic(const void *ptr, int left, int *widthp)
 	const uint8_t *p = ptr;
 	int i, width, value;
 
+	/* don't leave a stale width behind for a partial character */
+	*widthp = 0;
+
 	if (left < 1)
 		return -1;
 
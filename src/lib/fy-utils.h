@@ -14,9 +14,30 @@
 #endif
 
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
 
 #if defined(__APPLE__) && (_POSIX_C_SOURCE < 200809L)
 FILE *open_memstream(char **ptr, size_t *sizeloc);
 #endif
 
+/* FNV-1a; short keys, no need for anything fancier */
+#define FY_HASH_INIT	2166136261U
+
+static inline uint32_t fy_hash_update(uint32_t hash, const void *data, size_t len)
+{
+	const uint8_t *s = data, *e = s + len;
+
+	while (s < e) {
+		hash ^= *s++;
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+static inline uint32_t fy_hash_data(const void *data, size_t len)
+{
+	return fy_hash_update(FY_HASH_INIT, data, len);
+}
+
 #endif
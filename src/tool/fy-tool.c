@@ -18,6 +18,10 @@
 #include <ctype.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <libfyaml.h>
 
 #include "fy-valgrind.h"
@@ -41,17 +45,23 @@
 #define STRIP_TAGS_DEFAULT		false
 #define STRIP_DOC_DEFAULT		false
 #define STREAMING_DEFAULT		false
+#define STATS_DEFAULT			false
+#define JOBS_DEFAULT			1
 
 #define OPT_DUMP			1000
 #define OPT_TESTSUITE			1001
 #define OPT_FILTER			1002
 #define OPT_JOIN			1003
 #define OPT_TOOL			1004
+#define OPT_SNAPSHOT			1005
+#define OPT_CHECK			1006
 
 #define OPT_STRIP_LABELS		2000
 #define OPT_STRIP_TAGS			2001
 #define OPT_STRIP_DOC			2002
 #define OPT_STREAMING			2003
+#define OPT_STATS			2004
+#define OPT_JOBS			2005
 
 static struct option lopts[] = {
 	{"include",		required_argument,	0,	'I' },
@@ -71,10 +81,14 @@ static struct option lopts[] = {
 	{"testsuite",		no_argument,		0,	OPT_TESTSUITE },
 	{"filter",		no_argument,		0,	OPT_FILTER },
 	{"join",		no_argument,		0,	OPT_JOIN },
+	{"snapshot",		no_argument,		0,	OPT_SNAPSHOT },
+	{"check",		no_argument,		0,	OPT_CHECK },
 	{"strip-labels",	no_argument,		0,	OPT_STRIP_LABELS },
 	{"strip-tags",		no_argument,		0,	OPT_STRIP_TAGS },
 	{"strip-doc",		no_argument,		0,	OPT_STRIP_DOC },
 	{"streaming",		no_argument,		0,	OPT_STREAMING },
+	{"stats",		no_argument,		0,	OPT_STATS },
+	{"jobs",		required_argument,	0,	OPT_JOBS },
 	{"to",			required_argument,	0,	'T' },
 	{"from",		required_argument,	0,	'F' },
 	{"quiet",		no_argument,		0,	'q' },
@@ -120,13 +134,16 @@ static void display_usage(FILE *fp, char *progname, int tool_mode)
 	fprintf(fp, "\t--strip-doc              : Strip document headers and indicators when emitting"
 						" (default %s)\n",
 						STRIP_DOC_DEFAULT ? "true" : "false");
+	fprintf(fp, "\t--stats                  : Output parser statistics to stderr when done"
+						" (default %s)\n",
+						STATS_DEFAULT ? "true" : "false");
 	fprintf(fp, "\t--quiet, -q              : Quiet operation, do not "
 						"output messages (default %s)\n",
 						QUIET_DEFAULT ? "true" : "false");
 	fprintf(fp, "\t--version, -v            : Display libfyaml version\n");
 	fprintf(fp, "\t--help, -h               : Display  help message\n");
 
-	if (tool_mode == OPT_TOOL || tool_mode != OPT_TESTSUITE) {
+	if (tool_mode == OPT_TOOL || (tool_mode != OPT_TESTSUITE && tool_mode != OPT_CHECK)) {
 		fprintf(fp, "\t--sort, -s               : Perform mapping key sort (valid for dump)"
 							" (default %s)\n",
 							SORT_DEFAULT ? "true" : "false");
@@ -136,13 +153,18 @@ static void display_usage(FILE *fp, char *progname, int tool_mode)
 		fprintf(fp, "\t--mode, -m <mode>        : Output mode can be one of original, block, flow, flow-oneline, json, json-tp, json-oneline"
 							" (default %s)\n",
 							MODE_DEFAULT);
-		if (tool_mode == OPT_TOOL || tool_mode == OPT_DUMP)
+		if (tool_mode == OPT_TOOL || tool_mode == OPT_DUMP || tool_mode == OPT_FILTER)
 			fprintf(fp, "\t--streaming              : Use streaming output mode"
 								" (default %s)\n",
 								STREAMING_DEFAULT ? "true" : "false");
+		if (tool_mode == OPT_TOOL || tool_mode == OPT_DUMP)
+			fprintf(fp, "\t--jobs <n>               : Dump the files with <n> parallel jobs, 0 for all CPUs"
+								" (default %d)\n",
+								JOBS_DEFAULT);
 	}
 
-	if (tool_mode == OPT_TOOL || (tool_mode != OPT_DUMP && tool_mode != OPT_TESTSUITE)) {
+	if (tool_mode == OPT_TOOL || (tool_mode != OPT_DUMP && tool_mode != OPT_TESTSUITE &&
+				      tool_mode != OPT_CHECK)) {
 		fprintf(fp, "\t--file, -f <file>        : Use given file instead of <stdin>\n"
 		            "\t                           Note that using a string with a leading '>' is equivalent to a file with the trailing content\n"
 			    "\t                           --file \">foo: bar\" is as --file file.yaml with file.yaml \"foo: bar\"\n");
@@ -162,6 +184,8 @@ static void display_usage(FILE *fp, char *progname, int tool_mode)
 		fprintf(fp, "\t--testsuite              : Testsuite mode, [arguments] are <file>s to output parse events\n");
 		fprintf(fp, "\t--filter                 : Filter mode, <stdin> is input, [arguments] are <path>s, outputs to stdout\n");
 		fprintf(fp, "\t--join                   : Join mode, [arguments] are <path>s, outputs to stdout\n");
+		fprintf(fp, "\t--snapshot               : Snapshot mode, [arguments] are <file> and the <snapshot> to save\n");
+		fprintf(fp, "\t--check                  : Check mode, [arguments] are <file>s to check for well-formedness\n");
 	}
 
 	fprintf(fp, "\n");
@@ -200,6 +224,9 @@ static void display_usage(FILE *fp, char *progname, int tool_mode)
 		fprintf(fp, "\tParse and filter YAML document in stdin (note how the key may be complex)\n");
 		fprintf(fp, "\t$ echo \"{ foo: bar }: baz\" | %s \"/{foo: bar}/\"\n", progname);
 		fprintf(fp, "\tbaz\n");
+		fprintf(fp, "\n");
+		fprintf(fp, "\tFilter a single path out of a large stream, only building the matching node (using streaming mode)\n");
+		fprintf(fp, "\t$ %s --streaming --file huge.yaml /items/0\n\t...\n", progname);
 		break;
 	case OPT_JOIN:
 		fprintf(fp, "\tParse and join two YAML files\n");
@@ -214,6 +241,17 @@ static void display_usage(FILE *fp, char *progname, int tool_mode)
 		fprintf(fp, "\t- foo\n\t- bar\n");
 		fprintf(fp, "\n");
 		break;
+	case OPT_SNAPSHOT:
+		fprintf(fp, "\tParse, resolve and save a snapshot of a YAML document for fast loading\n");
+		fprintf(fp, "\t$ %s --snapshot -r input.yaml input.snap\n", progname);
+		fprintf(fp, "\n");
+		break;
+	case OPT_CHECK:
+		fprintf(fp, "\tCheck that the input is well formed, reporting only the first error\n");
+		fprintf(fp, "\t$ echo \"foo: [ bar\" | %s --check -\n", progname);
+		fprintf(fp, "\t<stdin>:2:1: error: flow sequence without a closing bracket\n");
+		fprintf(fp, "\n");
+		break;
 	}
 }
 
@@ -316,6 +354,9 @@ struct dump_userdata {
 	FILE *fp;
 	bool colorize;
 	bool visible;
+	bool leading;		/* nothing output yet for this document */
+	bool leading_dsm;	/* output started with a document start marker */
+	bool ended;		/* output so far ends with a document end marker */
 };
 
 static inline int
@@ -337,6 +378,20 @@ static int do_output(struct fy_emitter *fye, enum fy_emitter_write_type type, co
 
 	s = str;
 	e = str + len;
+
+	/* track the document markers for ordering parallel dumps */
+	if (type != fyewt_terminating_zero) {
+		if (du->leading) {
+			du->leading = false;
+			du->leading_dsm = type == fyewt_document_indicator &&
+					  len == 3 && !memcmp(str, "---", 3);
+		}
+		if (type == fyewt_document_indicator)
+			du->ended = len == 3 && !memcmp(str, "...", 3);
+		else if (type != fyewt_linebreak)
+			du->ended = false;
+	}
+
 	if (du->colorize) {
 		switch (type) {
 		case fyewt_document_indicator:
@@ -621,6 +676,42 @@ void dump_testsuite_event(struct fy_parser *fyp, struct fy_event *fye, bool colo
 	fputs("\n", stdout);
 }
 
+static void dump_stats(FILE *fp, const struct fy_parser_stats *stats)
+{
+	unsigned int i;
+
+	fprintf(fp, "input pulls             : %llu\n", (unsigned long long)stats->input_pulls);
+	fprintf(fp, "input bytes read        : %llu\n", (unsigned long long)stats->input_read_bytes);
+	fprintf(fp, "tokens                  : %llu\n", (unsigned long long)stats->tokens);
+	fprintf(fp, "recycled objects        : %llu\n", (unsigned long long)stats->recycled);
+	fprintf(fp, "talloc bytes            : %llu\n", (unsigned long long)stats->talloc_bytes);
+	fprintf(fp, "max simple key depth    : %u\n", stats->simple_key_depth_max);
+	fprintf(fp, "max indent depth        : %u\n", stats->indent_depth_max);
+	fprintf(fp, "max flow level          : %u\n", stats->flow_level_max);
+	fprintf(fp, "documents               : %llu\n", (unsigned long long)stats->documents);
+	fprintf(fp, "nodes                   : %llu\n", (unsigned long long)stats->nodes);
+	fprintf(fp, "document load time      : %.3f ms\n", stats->document_load_time / 1e6);
+	fprintf(fp, "%-24s: %10s %12s\n", "fetch", "calls", "time (ms)");
+	for (i = 0; i < FYPSF_COUNT; i++) {
+		if (!stats->fetch_count[i])
+			continue;
+		fprintf(fp, "  %-22s: %10llu %12.3f\n",
+			fy_parser_stats_fetch_name(i),
+			(unsigned long long)stats->fetch_count[i],
+			stats->fetch_time[i] / 1e6);
+	}
+}
+
+static void dump_parser_stats(FILE *fp, struct fy_parser *fyp)
+{
+	struct fy_parser_stats stats;
+
+	if (fy_parser_get_stats(fyp, &stats))
+		return;
+
+	dump_stats(fp, &stats);
+}
+
 static int set_parser_input(struct fy_parser *fyp, const char *what,
 		bool default_string)
 {
@@ -638,6 +729,292 @@ static int set_parser_input(struct fy_parser *fyp, const char *what,
 	return rc;
 }
 
+#ifdef HAVE_PTHREAD
+
+/*
+ * Parallel dump; every file is parsed and emitted by a worker into
+ * a buffer of its own, and the buffers are written out in argument
+ * order. The emitter's output of a file depends on what preceded it
+ * only at its first document; a document start marker is forced when
+ * an earlier document was output without an end marker. So the first
+ * document is emitted a second time, by an emitter primed that way,
+ * unless it already started with a marker.
+ */
+struct dump_job {
+	const char *what;
+	char *buf;		/* output as if first in the stream */
+	size_t size;
+	size_t lead_size;	/* size of the first document in buf */
+	char *cont_buf;		/* first document after unterminated output */
+	size_t cont_size;
+	size_t cont_skip;	/* priming output to skip in cont_buf */
+	int docs;
+	bool ended;
+	bool done;
+	bool failed;
+};
+
+struct dump_jobs {
+	const struct fy_parse_cfg *cfg;
+	const struct fy_emitter_cfg *emit_cfg;
+	const struct dump_userdata *du;
+	struct dump_job *jobs;
+	int count;
+	pthread_mutex_t lock;
+	int next;
+	int failed;		/* index of the first failed job */
+	bool stats;
+	struct fy_parser_stats sum;
+};
+
+static void add_parser_stats(struct fy_parser_stats *sum,
+			     const struct fy_parser_stats *stats)
+{
+	unsigned int i;
+
+	sum->input_pulls += stats->input_pulls;
+	sum->input_read_bytes += stats->input_read_bytes;
+	sum->tokens += stats->tokens;
+	sum->recycled += stats->recycled;
+	sum->talloc_bytes += stats->talloc_bytes;
+	if (stats->simple_key_depth_max > sum->simple_key_depth_max)
+		sum->simple_key_depth_max = stats->simple_key_depth_max;
+	if (stats->indent_depth_max > sum->indent_depth_max)
+		sum->indent_depth_max = stats->indent_depth_max;
+	if (stats->flow_level_max > sum->flow_level_max)
+		sum->flow_level_max = stats->flow_level_max;
+	sum->documents += stats->documents;
+	sum->nodes += stats->nodes;
+	sum->document_load_time += stats->document_load_time;
+	for (i = 0; i < FYPSF_COUNT; i++) {
+		sum->fetch_count[i] += stats->fetch_count[i];
+		sum->fetch_time[i] += stats->fetch_time[i];
+	}
+}
+
+static int dump_job_lead_cont(const struct dump_jobs *dj, struct dump_job *job,
+			      struct fy_document *fyd)
+{
+	struct fy_emitter_cfg emit_cfg = *dj->emit_cfg;
+	struct dump_userdata du = *dj->du;
+	struct fy_emitter *fye = NULL;
+	struct fy_document *fyd_prime = NULL;
+	int rc = -1;
+
+	du.fp = open_memstream(&job->cont_buf, &job->cont_size);
+	if (!du.fp)
+		return -1;
+	emit_cfg.userdata = &du;
+
+	fye = fy_emitter_create(&emit_cfg);
+	fyd_prime = fy_document_build_from_string(NULL, "~", FY_NT);
+	if (!fye || !fyd_prime)
+		goto out;
+
+	/* leave the emitter as after an implicitly ended document */
+	rc = fy_emit_document(fye, fyd_prime);
+	if (rc)
+		goto out;
+	fflush(du.fp);
+	job->cont_skip = job->cont_size;
+
+	rc = fy_emit_document(fye, fyd);
+out:
+	if (fyd_prime)
+		fy_document_destroy(fyd_prime);
+	if (fye)
+		fy_emitter_destroy(fye);
+	fclose(du.fp);
+	return rc;
+}
+
+static int dump_job_run(const struct dump_jobs *dj, struct dump_job *job,
+			struct fy_parser *fyp)
+{
+	struct fy_emitter_cfg emit_cfg = *dj->emit_cfg;
+	struct dump_userdata du = *dj->du;
+	struct fy_emitter *fye;
+	struct fy_document *fyd;
+	int rc;
+
+	du.fp = open_memstream(&job->buf, &job->size);
+	if (!du.fp)
+		return -1;
+	emit_cfg.userdata = &du;
+
+	fye = fy_emitter_create(&emit_cfg);
+	if (!fye) {
+		fclose(du.fp);
+		return -1;
+	}
+
+	rc = set_parser_input(fyp, job->what, false);
+	if (rc) {
+		fprintf(stderr, "failed to set parser input to '%s' for dump\n", job->what);
+		goto out;
+	}
+
+	while ((fyd = fy_parse_load_document(fyp)) != NULL) {
+
+		du.leading = true;
+		rc = fy_emit_document(fye, fyd);
+		if (!rc && !job->docs) {
+			fflush(du.fp);
+			job->lead_size = job->size;
+			if (!du.leading_dsm)
+				rc = dump_job_lead_cont(dj, job, fyd);
+		}
+
+		fy_parse_document_destroy(fyp, fyd);
+		if (rc)
+			goto out;
+
+		job->docs++;
+	}
+
+	rc = fy_parser_get_stream_error(fyp) ? -1 : 0;
+out:
+	job->ended = du.ended;
+	fy_emitter_destroy(fye);
+	fclose(du.fp);
+	return rc;
+}
+
+static void *dump_worker(void *arg)
+{
+	struct dump_jobs *dj = arg;
+	struct fy_parser_stats stats;
+	struct fy_parser *fyp;
+	struct dump_job *job;
+	int i, rc;
+
+	fyp = fy_parser_create(dj->cfg);
+	if (!fyp)
+		return NULL;
+
+	for (;;) {
+		pthread_mutex_lock(&dj->lock);
+		i = dj->next;
+		/* nothing after a failure gets output */
+		if (i < dj->count && i < dj->failed)
+			dj->next++;
+		else
+			i = -1;
+		pthread_mutex_unlock(&dj->lock);
+
+		if (i < 0)
+			break;
+
+		job = &dj->jobs[i];
+		rc = dump_job_run(dj, job, fyp);
+
+		pthread_mutex_lock(&dj->lock);
+		job->done = true;
+		if (rc) {
+			job->failed = true;
+			if (i < dj->failed)
+				dj->failed = i;
+		}
+		pthread_mutex_unlock(&dj->lock);
+	}
+
+	if (dj->stats && !fy_parser_get_stats(fyp, &stats)) {
+		pthread_mutex_lock(&dj->lock);
+		add_parser_stats(&dj->sum, &stats);
+		pthread_mutex_unlock(&dj->lock);
+	}
+
+	fy_parser_destroy(fyp);
+
+	return NULL;
+}
+
+/* dump the files with a pool of workers; the output matches a serial dump */
+static int dump_parallel(const struct fy_parse_cfg *cfg,
+			 const struct fy_emitter_cfg *emit_cfg,
+			 const struct dump_userdata *du,
+			 char **files, int count, int jobs, bool stats)
+{
+	struct dump_jobs dj;
+	struct dump_job *job;
+	pthread_t *threads;
+	int i, nthreads, created = 0, rc = 0;
+	bool pending = false;
+
+	if (jobs <= 0) {
+		jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+		if (jobs <= 0)
+			jobs = 1;
+	}
+	nthreads = jobs < count ? jobs : count;
+
+	memset(&dj, 0, sizeof(dj));
+	dj.cfg = cfg;
+	dj.emit_cfg = emit_cfg;
+	dj.du = du;
+	dj.count = count;
+	dj.failed = count;
+	dj.stats = stats;
+
+	dj.jobs = calloc(count, sizeof(*dj.jobs));
+	threads = calloc(nthreads, sizeof(*threads));
+	if (!dj.jobs || !threads) {
+		free(dj.jobs);
+		free(threads);
+		return -1;
+	}
+	for (i = 0; i < count; i++)
+		dj.jobs[i].what = files[i];
+
+	pthread_mutex_init(&dj.lock, NULL);
+
+	/* the calling thread is a worker too */
+	for (i = 1; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, dump_worker, &dj))
+			break;
+		created++;
+	}
+	dump_worker(&dj);
+	for (i = 1; i <= created; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&dj.lock);
+
+	for (i = 0; i < count; i++) {
+		job = &dj.jobs[i];
+
+		if (rc || !job->done) {
+			rc = -1;
+		} else {
+			if (job->docs && pending && job->cont_buf) {
+				fwrite(job->cont_buf + job->cont_skip, 1,
+				       job->cont_size - job->cont_skip, du->fp);
+				fwrite(job->buf + job->lead_size, 1,
+				       job->size - job->lead_size, du->fp);
+			} else
+				fwrite(job->buf, 1, job->size, du->fp);
+
+			if (job->docs)
+				pending = !job->ended;
+			if (job->failed)
+				rc = -1;
+		}
+
+		free(job->buf);
+		free(job->cont_buf);
+	}
+
+	if (stats)
+		dump_stats(stderr, &dj.sum);
+
+	free(dj.jobs);
+	free(threads);
+
+	return rc;
+}
+
+#endif
+
 int main(int argc, char *argv[])
 {
 	struct fy_parse_cfg cfg = {
@@ -672,6 +1049,9 @@ int main(int argc, char *argv[])
 	bool join_resolve = RESOLVE_DEFAULT;
 	struct fy_token_iter *iter;
 	bool streaming = STREAMING_DEFAULT;
+	bool stats = STATS_DEFAULT;
+	int jobs = JOBS_DEFAULT;
+	bool use_path_load;
 
 	fy_valgrind_check(&argc, &argv);
 
@@ -814,6 +1194,8 @@ int main(int argc, char *argv[])
 		case OPT_FILTER:
 		case OPT_DUMP:
 		case OPT_JOIN:
+		case OPT_SNAPSHOT:
+		case OPT_CHECK:
 		case OPT_TOOL:
 			tool_mode = opt;
 			break;
@@ -829,6 +1211,18 @@ int main(int argc, char *argv[])
 		case OPT_STREAMING:
 			streaming = true;
 			break;
+		case OPT_STATS:
+			stats = true;
+			cfg.flags |= FYPCF_COLLECT_STATS;
+			break;
+		case OPT_JOBS:
+			jobs = atoi(optarg);
+			if (jobs < 0) {
+				fprintf(stderr, "bad jobs option %s\n", optarg);
+				display_usage(stderr, progname, tool_mode);
+				return EXIT_FAILURE;
+			}
+			break;
 		case 'h' :
 		default:
 			if (opt != 'h')
@@ -873,7 +1267,7 @@ int main(int argc, char *argv[])
 		du.colorize = false;
 	du.visible = visible;
 
-	if (tool_mode != OPT_TESTSUITE) {
+	if (tool_mode != OPT_TESTSUITE && tool_mode != OPT_CHECK) {
 
 		memset(&emit_cfg, 0, sizeof(emit_cfg));
 		emit_cfg.flags = emit_flags |
@@ -921,6 +1315,18 @@ int main(int argc, char *argv[])
 			goto cleanup;
 		}
 
+#ifdef HAVE_PTHREAD
+		if (!streaming && jobs != 1 && argc - optind > 1) {
+			rc = dump_parallel(&cfg, &emit_cfg, &du, argv + optind,
+					   argc - optind, jobs, stats);
+			/* the statistics were summed over the workers */
+			stats = false;
+			if (rc)
+				goto cleanup;
+			break;
+		}
+#endif
+
 		count = 0;
 		for (i = optind; i < argc; i++) {
 			rc = set_parser_input(fyp, argv[i], false);
@@ -972,13 +1378,21 @@ int main(int argc, char *argv[])
 			goto cleanup;
 		}
 
+		/* a single path can be filtered without loading whole documents */
+		use_path_load = streaming && argc - optind == 1 && !follow;
+
 		count = 0;
-		while ((fyd = fy_parse_load_document(fyp)) != NULL) {
+		while ((fyd = use_path_load ?
+				fy_parse_load_document_path(fyp, argv[optind], FY_NT) :
+				fy_parse_load_document(fyp)) != NULL) {
 
 			for (i = optind, j = 0; i < argc; i += step, j++) {
 
-				fyn = fy_node_by_path(fy_document_root(fyd), argv[i], FY_NT,
-						      follow ? FYNWF_FOLLOW : FYNWF_DONT_FOLLOW);
+				if (use_path_load)
+					fyn = fy_document_root(fyd);
+				else
+					fyn = fy_node_by_path(fy_document_root(fyd), argv[i], FY_NT,
+							      follow ? FYNWF_FOLLOW : FYNWF_DONT_FOLLOW);
 
 				/* ignore not found paths */
 				if (!fyn) {
@@ -1096,6 +1510,47 @@ int main(int argc, char *argv[])
 			goto cleanup;
 
 		break;
+
+	case OPT_SNAPSHOT:
+		if (argc - optind != 2) {
+			fprintf(stderr, "snapshot needs a yaml file and a snapshot file\n");
+			goto cleanup;
+		}
+
+		rc = set_parser_input(fyp, argv[optind], false);
+		if (rc) {
+			fprintf(stderr, "failed to set parser input to '%s' for snapshot\n", argv[optind]);
+			goto cleanup;
+		}
+
+		fyd = fy_parse_load_document(fyp);
+		if (!fyd) {
+			fprintf(stderr, "no document to snapshot in '%s'\n", argv[optind]);
+			goto cleanup;
+		}
+
+		rc = fy_document_save_snapshot(fyd, argv[optind + 1]);
+		fy_parse_document_destroy(fyp, fyd);
+		if (rc) {
+			fprintf(stderr, "failed to save snapshot to '%s'\n", argv[optind + 1]);
+			goto cleanup;
+		}
+		break;
+
+	case OPT_CHECK:
+		/* the parser reports the error; stop at the first bad input */
+		for (i = optind; i < argc || i == optind; i++) {
+			rc = set_parser_input(fyp, i < argc ? argv[i] : "-", false);
+			if (rc) {
+				fprintf(stderr, "failed to set parser input to '%s' for check\n",
+						i < argc ? argv[i] : "-");
+				goto cleanup;
+			}
+
+			if (fy_parser_validate(fyp, NULL))
+				goto cleanup;
+		}
+		break;
 	}
 	exitcode = EXIT_SUCCESS;
 
@@ -1111,8 +1566,11 @@ cleanup:
 	if (fye)
 		fy_emitter_destroy(fye);
 
-	if (fyp)
+	if (fyp) {
+		if (stats)
+			dump_parser_stats(stderr, fyp);
 		fy_parser_destroy(fyp);
+	}
 
 	return exitcode;
 }
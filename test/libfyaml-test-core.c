@@ -17,6 +17,8 @@
 #include <getopt.h>
 #include <unistd.h>
 #include <limits.h>
+#include <locale.h>
+#include <pthread.h>
 
 #include <check.h>
 
@@ -621,6 +623,1504 @@ START_TEST(doc_insert_remove_map)
 }
 END_TEST
 
+START_TEST(doc_large_mapping)
+{
+	struct fy_parse_cfg cfg = {
+		.flags = FYPCF_QUIET,
+	};
+	struct fy_document *fyd;
+	struct fy_node *fyn, *fyn_root, *fyn_key;
+	char buf[16384], key[32], val[32];
+	int i, ret, pos;
+
+	/* large enough for the key index to kick in */
+	pos = snprintf(buf, sizeof(buf), "{ ");
+	for (i = 0; i < 500; i++)
+		pos += snprintf(buf + pos, sizeof(buf) - pos, "k%d: %d, ", i, i);
+	snprintf(buf + pos, sizeof(buf) - pos, "}");
+
+	fyd = fy_document_build_from_string(NULL, buf, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyn_root = fy_document_root(fyd);
+	ck_assert_int_eq(fy_node_mapping_item_count(fyn_root), 500);
+
+	for (i = 0; i < 500; i++) {
+		snprintf(key, sizeof(key), "/k%d", i);
+		snprintf(val, sizeof(val), "%d", i);
+		fyn = fy_node_by_path(fyn_root, key, FY_NT, FYNWF_DONT_FOLLOW);
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fyn), val);
+	}
+
+	/* duplicate keys must still be rejected */
+	fyn_key = fy_node_build_from_string(fyd, "k123", FY_NT);
+	ck_assert_ptr_ne(fyn_key, NULL);
+	fyn = fy_node_build_from_string(fyd, "dup", FY_NT);
+	ck_assert_ptr_ne(fyn, NULL);
+	ret = fy_node_mapping_append(fyn_root, fyn_key, fyn);
+	ck_assert_int_ne(ret, 0);
+	fy_node_free(fyn_key);
+	fy_node_free(fyn);
+
+	ret = fy_node_mapping_prepend(fyn_root,
+			fy_node_build_from_string(fyd, "new", FY_NT),
+			fy_node_build_from_string(fyd, "value", FY_NT));
+	ck_assert_int_eq(ret, 0);
+
+	fyn = fy_node_by_path(fyn_root, "/new", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "value");
+
+	fyn = fy_node_mapping_remove_by_key(fyn_root,
+			fy_node_build_from_string(fyd, "k42", FY_NT));
+	ck_assert_ptr_ne(fyn, NULL);
+	fy_node_free(fyn);
+
+	fyn = fy_node_by_path(fyn_root, "/k42", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_eq(fyn, NULL);
+
+	fyn = fy_node_by_path(fyn_root, "/k43", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "43");
+
+	fy_document_destroy(fyd);
+
+	/* duplicate key in a large mapping must fail the load */
+	pos = snprintf(buf, sizeof(buf), "{ ");
+	for (i = 0; i < 100; i++)
+		pos += snprintf(buf + pos, sizeof(buf) - pos, "k%d: %d, ", i, i);
+	snprintf(buf + pos, sizeof(buf) - pos, "k77: again }");
+
+	fyd = fy_document_build_from_string(&cfg, buf, FY_NT);
+	ck_assert_ptr_eq(fyd, NULL);
+}
+END_TEST
+
+START_TEST(doc_arena)
+{
+	struct fy_parse_cfg cfg = {
+		.flags = FYPCF_QUIET | FYPCF_DOCUMENT_ARENA,
+	};
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	char *buf;
+	int ret;
+
+	fyd = fy_document_build_from_string(&cfg,
+			"{ a: &x [ 1, 2, 3 ], b: *x, c: { d: e } }", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	ret = fy_document_resolve(fyd);
+	ck_assert_int_eq(ret, 0);
+
+	ret = fy_node_mapping_append(fy_document_root(fyd),
+			fy_node_build_from_string(fyd, "f", FY_NT),
+			fy_node_build_from_string(fyd, "[ g, h ]", FY_NT));
+	ck_assert_int_eq(ret, 0);
+
+	fyn = fy_node_mapping_remove_by_key(fy_document_root(fyd),
+			fy_node_build_from_string(fyd, "c", FY_NT));
+	ck_assert_ptr_ne(fyn, NULL);
+	fy_node_free(fyn);
+
+	buf = fy_emit_node_to_string(fy_document_root(fyd), FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: [1, 2, 3], b: [1, 2, 3], f: [g, h]}");
+	free(buf);
+
+	fy_document_destroy(fyd);
+
+	/* and for an empty document */
+	fyd = fy_document_create(&cfg);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyn = fy_node_build_from_string(fyd, "{ x: y }", FY_NT);
+	ck_assert_ptr_ne(fyn, NULL);
+	fy_document_set_root(fyd, fyn);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_indexed_access)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn, *fyn_seq, *fyn_map;
+	struct fy_node_pair *fynp;
+	char buf[8192], val[32];
+	int i, ret, pos;
+
+	pos = snprintf(buf, sizeof(buf), "{ seq: [ ");
+	for (i = 0; i < 1000; i++)
+		pos += snprintf(buf + pos, sizeof(buf) - pos, "%d, ", i);
+	snprintf(buf + pos, sizeof(buf) - pos, "], map: { c: 3, a: 1, b: 2 } }");
+
+	fyd = fy_document_build_from_string(NULL, buf, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyn_seq = fy_node_by_path(fy_document_root(fyd), "/seq", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn_seq, NULL);
+	ck_assert_int_eq(fy_node_sequence_item_count(fyn_seq), 1000);
+
+	for (i = 0; i < 1000; i++) {
+		snprintf(val, sizeof(val), "%d", i);
+		fyn = fy_node_sequence_get_by_index(fyn_seq, i);
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fyn), val);
+	}
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_sequence_get_by_index(fyn_seq, -1)), "999");
+	ck_assert_ptr_eq(fy_node_sequence_get_by_index(fyn_seq, 1000), NULL);
+	ck_assert_ptr_eq(fy_node_sequence_get_by_index(fyn_seq, -1001), NULL);
+
+	fyn = fy_node_by_path(fy_document_root(fyd), "/seq/765", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "765");
+
+	/* the index must follow modifications */
+	ret = fy_node_sequence_prepend(fyn_seq, fy_node_build_from_string(fyd, "first", FY_NT));
+	ck_assert_int_eq(ret, 0);
+	ret = fy_node_sequence_append(fyn_seq, fy_node_build_from_string(fyd, "last", FY_NT));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(fy_node_sequence_item_count(fyn_seq), 1002);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_sequence_get_by_index(fyn_seq, 0)), "first");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_sequence_get_by_index(fyn_seq, 1)), "0");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_sequence_get_by_index(fyn_seq, 1001)), "last");
+
+	fyn = fy_node_sequence_remove(fyn_seq, fy_node_sequence_get_by_index(fyn_seq, 1));
+	ck_assert_ptr_ne(fyn, NULL);
+	fy_node_free(fyn);
+	ck_assert_int_eq(fy_node_sequence_item_count(fyn_seq), 1001);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_sequence_get_by_index(fyn_seq, 1)), "1");
+
+	fyn_map = fy_node_by_path(fy_document_root(fyd), "/map", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn_map, NULL);
+	ck_assert_int_eq(fy_node_mapping_item_count(fyn_map), 3);
+
+	fynp = fy_node_mapping_get_by_index(fyn_map, 0);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "c");
+	ck_assert_int_eq(fy_node_mapping_get_pair_index(fyn_map, fynp), 0);
+
+	ret = fy_node_sort(fyn_map, NULL, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	fynp = fy_node_mapping_get_by_index(fyn_map, 0);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "a");
+	ck_assert_int_eq(fy_node_mapping_get_pair_index(fyn_map, fynp), 0);
+
+	fynp = fy_node_mapping_get_by_index(fyn_map, -1);
+	ck_assert_ptr_ne(fynp, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fynp)), "c");
+	ck_assert_int_eq(fy_node_mapping_get_pair_index(fyn_map, fynp), 2);
+
+	ret = fy_node_mapping_prepend(fyn_map,
+			fy_node_build_from_string(fyd, "z", FY_NT),
+			fy_node_build_from_string(fyd, "26", FY_NT));
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(fy_node_mapping_get_pair_index(fyn_map, fynp), 3);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+static struct fy_token *doc_scalar_token(struct fy_document *fyd, const char *path)
+{
+	return fy_node_get_scalar_token(fy_node_by_path(fy_document_root(fyd), path, FY_NT, FYNWF_DONT_FOLLOW));
+}
+
+START_TEST(doc_scalar_zero_copy)
+{
+	struct fy_document *fyd;
+	struct fy_token *fyt_plain, *fyt_dq, *fyt_folded;
+	int64_t ival;
+	double dval;
+
+	fyd = fy_document_build_from_string(NULL,
+		"plain: foo bar baz\n"
+		"dq: \"foo\\x20bar\\u0020baz\"\n"
+		"folded: >-\n"
+		"  foo\n"
+		"  bar baz\n"
+		"hex: 0x1F\n"
+		"oct: 0o17\n"
+		"neg: -42\n"
+		"big: 9223372036854775808\n"
+		"float: 1.5e3\n"
+		"inf: -.inf\n"
+		"text: abc\n", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyt_plain = doc_scalar_token(fyd, "/plain");
+	fyt_dq = doc_scalar_token(fyd, "/dq");
+	fyt_folded = doc_scalar_token(fyd, "/folded");
+	ck_assert_ptr_ne(fyt_plain, NULL);
+	ck_assert_ptr_ne(fyt_dq, NULL);
+	ck_assert_ptr_ne(fyt_folded, NULL);
+
+	/* all three have the same text */
+	ck_assert_int_eq(fy_token_text_cmp(fyt_plain, "foo bar baz", FY_NT), 0);
+	ck_assert_int_eq(fy_token_text_cmp(fyt_dq, "foo bar baz", FY_NT), 0);
+	ck_assert_int_eq(fy_token_text_cmp(fyt_folded, "foo bar baz", FY_NT), 0);
+	ck_assert_int_lt(fy_token_text_cmp(fyt_dq, "foo bar bazz", FY_NT), 0);
+	ck_assert_int_gt(fy_token_text_cmp(fyt_dq, "foo bar ba", FY_NT), 0);
+	ck_assert_int_gt(fy_token_text_cmp(fyt_folded, "foo bar bay", FY_NT), 0);
+
+	ck_assert_uint_eq(fy_token_text_hash(fyt_plain), fy_token_text_hash(fyt_dq));
+	ck_assert_uint_eq(fy_token_text_hash(fyt_plain), fy_token_text_hash(fyt_folded));
+
+	/* the text representation, once created, hashes the same */
+	ck_assert_str_eq(fy_token_get_text0(fyt_dq), "foo bar baz");
+	ck_assert_uint_eq(fy_token_text_hash(fyt_plain), fy_token_text_hash(fyt_dq));
+
+	/* numbers */
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/hex"), &ival), 0);
+	ck_assert_int_eq(ival, 31);
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/oct"), &ival), 0);
+	ck_assert_int_eq(ival, 15);
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/neg"), &ival), 0);
+	ck_assert_int_eq(ival, -42);
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/big"), &ival), -1);
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/float"), &ival), -1);
+	ck_assert_int_eq(fy_token_text_to_int64(fyt_plain, &ival), -1);
+
+	ck_assert_int_eq(fy_token_text_to_double(doc_scalar_token(fyd, "/float"), &dval), 0);
+	ck_assert(dval == 1500.0);
+	ck_assert_int_eq(fy_token_text_to_double(doc_scalar_token(fyd, "/neg"), &dval), 0);
+	ck_assert(dval == -42.0);
+	ck_assert_int_eq(fy_token_text_to_double(doc_scalar_token(fyd, "/inf"), &dval), 0);
+	ck_assert(dval < 0 && dval * 0.5 == dval);
+	ck_assert_int_eq(fy_token_text_to_double(doc_scalar_token(fyd, "/text"), &dval), -1);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_scalar_numbers_locale)
+{
+	static const char * const locales[] = {
+		"de_DE.UTF-8", "de_DE.utf8", "de_DE", "fr_FR.UTF-8", "fr_FR.utf8", "fr_FR",
+	};
+	struct fy_document *fyd;
+	char *old_locale;
+	int64_t ival;
+	double dval;
+	unsigned int i;
+
+	fyd = fy_document_build_from_string(NULL,
+		"float: 1.5\n"
+		"comma: 1,5\n"
+		"min: -9223372036854775808\n"
+		"max: 9223372036854775807\n"
+		"over: -9223372036854775809\n", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/min"), &ival), 0);
+	ck_assert(ival == INT64_MIN);
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/max"), &ival), 0);
+	ck_assert(ival == INT64_MAX);
+	ck_assert_int_eq(fy_token_text_to_int64(doc_scalar_token(fyd, "/over"), &ival), -1);
+
+	/* the conversions follow YAML, not the locale of the program */
+	old_locale = strdup(setlocale(LC_NUMERIC, NULL));
+	ck_assert_ptr_ne(old_locale, NULL);
+	for (i = 0; i < sizeof(locales)/sizeof(locales[0]); i++) {
+		if (setlocale(LC_NUMERIC, locales[i]))
+			break;
+	}
+
+	ck_assert_int_eq(fy_token_text_to_double(doc_scalar_token(fyd, "/float"), &dval), 0);
+	ck_assert(dval == 1.5);
+	ck_assert_int_eq(fy_token_text_to_double(doc_scalar_token(fyd, "/comma"), &dval), -1);
+
+	setlocale(LC_NUMERIC, old_locale);
+	free(old_locale);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(node_typed_scalars)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn_root, *fyn;
+	void *iter;
+	int64_t ival, sum;
+	double dval;
+	bool bval;
+	int i;
+
+	fyd = fy_document_build_from_string(NULL,
+		"int: 0x1F\n"
+		"neg: -42\n"
+		"big: 9223372036854775808\n"
+		"float: 1.5e3\n"
+		"nan: .NaN\n"
+		"huge: 1e400\n"
+		"neg-huge: -1e400\n"
+		"yes: True\n"
+		"no: FALSE\n"
+		"null: ~\n"
+		"empty:\n"
+		"quoted: \"12\"\n"
+		"tagged: !!int \"12\"\n"
+		"tagged-float: !!float 3\n"
+		"bad-tag: !!int abc\n"
+		"str-tag: !!str 12\n"
+		"other-tag: !foo 12\n"
+		"text: 12 monkeys\n"
+		"seq: [1, 2, 3, 4]\n", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn_root = fy_document_root(fyd);
+
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/int", FY_NT, 0), &ival), 0);
+	ck_assert_int_eq(ival, 31);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/neg", FY_NT, 0), &ival), 0);
+	ck_assert_int_eq(ival, -42);
+
+	/* too big for an integer, but fine as a float */
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/big", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_double(fy_node_by_path(fyn_root, "/big", FY_NT, 0), &dval), 0);
+	ck_assert(dval == 9223372036854775808.0);
+
+	ck_assert_int_eq(fy_node_get_double(fy_node_by_path(fyn_root, "/float", FY_NT, 0), &dval), 0);
+	ck_assert(dval == 1500.0);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/float", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_double(fy_node_by_path(fyn_root, "/nan", FY_NT, 0), &dval), 0);
+	ck_assert(dval != dval);
+	ck_assert_int_eq(fy_node_get_double(fy_node_by_path(fyn_root, "/neg", FY_NT, 0), &dval), 0);
+	ck_assert(dval == -42.0);
+
+	/* out of range floats are infinities */
+	ck_assert_int_eq(fy_node_get_double(fy_node_by_path(fyn_root, "/huge", FY_NT, 0), &dval), 0);
+	ck_assert(dval > 0 && dval * 0.5 == dval);
+	ck_assert_int_eq(fy_node_get_double(fy_node_by_path(fyn_root, "/neg-huge", FY_NT, 0), &dval), 0);
+	ck_assert(dval < 0 && dval * 0.5 == dval);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/huge", FY_NT, 0), &ival), -1);
+
+	ck_assert_int_eq(fy_node_get_bool(fy_node_by_path(fyn_root, "/yes", FY_NT, 0), &bval), 0);
+	ck_assert(bval);
+	ck_assert_int_eq(fy_node_get_bool(fy_node_by_path(fyn_root, "/no", FY_NT, 0), &bval), 0);
+	ck_assert(!bval);
+	ck_assert_int_eq(fy_node_get_bool(fy_node_by_path(fyn_root, "/int", FY_NT, 0), &bval), -1);
+
+	ck_assert(fy_node_is_null(fy_node_by_path(fyn_root, "/null", FY_NT, 0)));
+	ck_assert(fy_node_is_null(fy_node_by_path(fyn_root, "/empty", FY_NT, 0)));
+	ck_assert(!fy_node_is_null(fy_node_by_path(fyn_root, "/int", FY_NT, 0)));
+	ck_assert(!fy_node_is_null(fy_node_by_path(fyn_root, "/seq", FY_NT, 0)));
+
+	/* quoted scalars are strings, unless tagged */
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/quoted", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/tagged", FY_NT, 0), &ival), 0);
+	ck_assert_int_eq(ival, 12);
+	ck_assert_int_eq(fy_node_get_double(fy_node_by_path(fyn_root, "/tagged-float", FY_NT, 0), &dval), 0);
+	ck_assert(dval == 3.0);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/tagged-float", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/bad-tag", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/str-tag", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/other-tag", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/text", FY_NT, 0), &ival), -1);
+	ck_assert_int_eq(fy_node_get_int64(fy_node_by_path(fyn_root, "/seq", FY_NT, 0), &ival), -1);
+
+	/* resolved once, cached from then on */
+	for (i = 0; i < 2; i++) {
+		sum = 0;
+		iter = NULL;
+		while ((fyn = fy_node_sequence_iterate(fy_node_by_path(fyn_root, "/seq", FY_NT, 0), &iter)) != NULL) {
+			ck_assert_int_eq(fy_node_get_int64(fyn, &ival), 0);
+			sum += ival;
+		}
+		ck_assert_int_eq(sum, 10);
+	}
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_build_direct)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn_root, *fyn_seq, *fyn;
+	struct fy_node *items[64];
+	char key[16], *big, *buf;
+	const char *value;
+	size_t len;
+	int i;
+
+	fyd = fy_document_create(NULL);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	/* copied keys and values, the buffer gets reused */
+	for (i = 0; i < 20; i++) {
+		snprintf(key, sizeof(key), "k%d", i);
+		items[i * 2] = fy_node_create_scalar_direct(fyd, key, FY_NT, FYSS_ANY, FYNBD_COPY);
+		ck_assert_ptr_ne(items[i * 2], NULL);
+		snprintf(key, sizeof(key), "%d", i * 10);
+		items[i * 2 + 1] = fy_node_create_scalar_direct(fyd, key, FY_NT, FYSS_ANY, FYNBD_COPY);
+		ck_assert_ptr_ne(items[i * 2 + 1], NULL);
+	}
+
+	fyn_root = fy_node_create_mapping(fyd);
+	ck_assert_ptr_ne(fyn_root, NULL);
+	fy_document_set_root(fyd, fyn_root);
+	ck_assert_int_eq(fy_node_mapping_append_pairs(fyn_root, items, 20), 0);
+	ck_assert_int_eq(fy_node_mapping_item_count(fyn_root), 20);
+
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root, "/k7", FY_NT, 0)), "70");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root, "/k19", FY_NT, 0)), "190");
+
+	/* a duplicate key fails, leaving the pairs before it in */
+	items[0] = fy_node_create_scalar_direct(fyd, "new", FY_NT, FYSS_ANY, FYNBD_REFERENCE);
+	items[1] = fy_node_create_scalar_direct(fyd, "value", FY_NT, FYSS_ANY, FYNBD_REFERENCE);
+	items[2] = fy_node_create_scalar_direct(fyd, "k3", FY_NT, FYSS_ANY, FYNBD_REFERENCE);
+	items[3] = fy_node_create_scalar_direct(fyd, "dup", FY_NT, FYSS_ANY, FYNBD_REFERENCE);
+	ck_assert_int_eq(fy_node_mapping_append_pairs(fyn_root, items, 2), -1);
+	ck_assert_int_eq(fy_node_mapping_item_count(fyn_root), 21);
+	fy_node_free(items[2]);
+	fy_node_free(items[3]);
+
+	/* large copies, taken over buffers and explicit styles */
+	big = malloc(10000);
+	ck_assert_ptr_ne(big, NULL);
+	memset(big, 'x', 9999);
+	big[9999] = '\0';
+	items[0] = fy_node_create_scalar_direct(fyd, big, FY_NT, FYSS_ANY, FYNBD_COPY);
+	memset(big, 'y', 9999);
+	items[1] = fy_node_create_scalar_direct(fyd, big, FY_NT, FYSS_ANY, FYNBD_TAKE);
+	items[2] = fy_node_create_scalar_direct(fyd, "two\nlines", FY_NT, FYSS_ANY, FYNBD_COPY);
+	items[3] = fy_node_create_scalar_direct(fyd, "quoted", FY_NT, FYSS_SINGLE_QUOTED, FYNBD_COPY);
+	items[4] = fy_node_create_scalar_direct(fyd, "- not plain", FY_NT, FYSS_PLAIN, FYNBD_COPY);
+	items[5] = fy_node_create_scalar_direct(fyd, NULL, 0, FYSS_ANY, FYNBD_COPY);
+	for (i = 0; i < 6; i++)
+		ck_assert_ptr_ne(items[i], NULL);
+
+	fyn_seq = fy_node_create_sequence(fyd);
+	ck_assert_ptr_ne(fyn_seq, NULL);
+	ck_assert_int_eq(fy_node_sequence_append_items(fyn_seq, items, 6), 0);
+	ck_assert_int_eq(fy_node_mapping_append(fyn_root,
+				fy_node_create_scalar_direct(fyd, "seq", FY_NT, FYSS_ANY, FYNBD_COPY),
+				fyn_seq), 0);
+
+	value = fy_node_get_scalar(fy_node_sequence_get_by_index(fyn_seq, 0), &len);
+	ck_assert_int_eq(len, 9999);
+	ck_assert(value[0] == 'x' && value[9998] == 'x');
+	value = fy_node_get_scalar(fy_node_sequence_get_by_index(fyn_seq, 1), &len);
+	ck_assert_int_eq(len, 9999);
+	ck_assert(value[0] == 'y' && value[9998] == 'y');
+
+	fyn = fy_node_sequence_get_by_index(fyn_seq, 2);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "two\nlines");
+	ck_assert_ptr_eq(fy_node_get_parent(fyn), fyn_seq);
+
+	fy_node_free(fy_node_sequence_remove(fyn_seq, fy_node_sequence_get_by_index(fyn_seq, 0)));
+	fy_node_free(fy_node_sequence_remove(fyn_seq, fy_node_sequence_get_by_index(fyn_seq, 0)));
+
+	buf = fy_emit_node_to_string(fyn_seq, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "[\"two\\nlines\", 'quoted', \"- not plain\", \"\"]");
+	free(buf);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_build_direct_block_styles)
+{
+	static const char * const texts[] = {
+		"a ", "\n", "\n\n", "a\n", "a\n\n\n", "a \nb", "x\n  y\n",
+		"\n\t\n", "\n \n", "a\n \nb", "a\n\n b", "\n a\n",
+	};
+	static const enum fy_scalar_style styles[] = {
+		FYSS_ANY, FYSS_DOUBLE_QUOTED, FYSS_LITERAL, FYSS_FOLDED,
+	};
+	char file[] = "/tmp/libfyaml-direct-XXXXXX";
+	struct fy_document *fyd, *fyd_rt;
+	char *buf;
+	unsigned int i, j;
+	int fd;
+
+	fd = mkstemp(file);
+	ck_assert_int_ne(fd, -1);
+	close(fd);
+
+	/* the text survives the trip whether the style is kept or not */
+	for (j = 0; j < sizeof(styles) / sizeof(styles[0]); j++) {
+		for (i = 0; i < sizeof(texts) / sizeof(texts[0]); i++) {
+			fyd = fy_document_create(NULL);
+			ck_assert_ptr_ne(fyd, NULL);
+			fy_document_set_root(fyd,
+				fy_node_create_scalar_direct(fyd, texts[i], FY_NT,
+							     styles[j], FYNBD_COPY));
+			ck_assert_ptr_ne(fy_document_root(fyd), NULL);
+			ck_assert_str_eq(fy_node_get_scalar0(fy_document_root(fyd)), texts[i]);
+
+			buf = fy_emit_document_to_string(fyd, 0);
+			ck_assert_ptr_ne(buf, NULL);
+
+			fyd_rt = fy_document_build_from_string(NULL, buf, FY_NT);
+			ck_assert_ptr_ne(fyd_rt, NULL);
+			ck_assert_str_eq(fy_node_get_scalar0(fy_document_root(fyd_rt)), texts[i]);
+
+			/* and through a snapshot */
+			ck_assert_int_eq(fy_document_save_snapshot(fyd_rt, file), 0);
+			fy_document_destroy(fyd_rt);
+			fyd_rt = fy_document_load_snapshot(NULL, file);
+			ck_assert_ptr_ne(fyd_rt, NULL);
+			ck_assert_str_eq(fy_node_get_scalar0(fy_document_root(fyd_rt)), texts[i]);
+
+			fy_document_destroy(fyd_rt);
+			free(buf);
+			fy_document_destroy(fyd);
+		}
+	}
+
+	unlink(file);
+}
+END_TEST
+
+START_TEST(doc_intern_keys)
+{
+	struct fy_intern *fyin;
+	struct fy_parse_cfg cfg;
+	struct fy_document *fyd1, *fyd2;
+	struct fy_node *fyn_root1, *fyn_root2, *fyn_key1, *fyn_key2;
+	int i;
+
+	fyin = fy_intern_create();
+	ck_assert_ptr_ne(fyin, NULL);
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET;
+	cfg.intern = fyin;
+
+	fyd1 = fy_document_build_from_string(&cfg,
+			"apiVersion: v1\nmetadata: { name: a, \"quoted key\": 1 }\n", FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+	fyd2 = fy_document_build_from_string(&cfg,
+			"apiVersion: v2\nmetadata: { name: b }\n? [ complex ]\n: 3\n", FY_NT);
+	ck_assert_ptr_ne(fyd2, NULL);
+
+	/* keys shared across the documents, values are left alone */
+	ck_assert_int_eq(fy_intern_count(fyin), 4);
+
+	/* the documents keep the table alive */
+	fy_intern_destroy(fyin);
+
+	fyn_root1 = fy_document_root(fyd1);
+	fyn_root2 = fy_document_root(fyd2);
+	fyn_key1 = fy_node_pair_key(fy_node_mapping_get_by_index(fyn_root1, 0));
+	fyn_key2 = fy_node_pair_key(fy_node_mapping_get_by_index(fyn_root2, 0));
+	ck_assert_ptr_eq(fy_node_get_scalar0(fyn_key1), fy_node_get_scalar0(fyn_key2));
+	ck_assert(fy_node_compare(fyn_key1, fyn_key2));
+	ck_assert(!fy_node_compare(fyn_key1,
+			fy_node_pair_key(fy_node_mapping_get_by_index(fyn_root1, 1))));
+
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root1, "/metadata/name", FY_NT, 0)), "a");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root2, "/metadata/name", FY_NT, 0)), "b");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root1, "/metadata/quoted key", FY_NT, 0)), "1");
+	ck_assert_ptr_eq(fy_node_by_path(fyn_root1, "/metadata/missing", FY_NT, 0), NULL);
+	ck_assert_ptr_eq(fy_node_mapping_lookup_by_string(fyn_root1, "v1", FY_NT), NULL);
+
+	/* keys added later are interned too, also past the index threshold */
+	for (i = 0; i < 40; i++) {
+		char key[16];
+
+		snprintf(key, sizeof(key), "k%d", i);
+		ck_assert_int_eq(fy_node_mapping_append(fyn_root1,
+					fy_node_create_scalar_direct(fyd1, key, FY_NT,
+						FYSS_ANY, FYNBD_COPY),
+					fy_node_create_scalar_direct(fyd1, key, FY_NT,
+						FYSS_ANY, FYNBD_COPY)), 0);
+	}
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root1, "/k33", FY_NT, 0)), "k33");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fyn_root1, "/apiVersion", FY_NT, 0)), "v1");
+	ck_assert_ptr_eq(fy_node_by_path(fyn_root1, "/k40", FY_NT, 0), NULL);
+	ck_assert_ptr_eq(fy_node_pair_value(fy_node_mapping_lookup_pair(fyn_root1, fyn_key2)),
+			 fy_node_by_path(fyn_root1, "/apiVersion", FY_NT, 0));
+
+	/* a key copied into a document without a table still matches */
+	fy_document_destroy(fyd2);
+	fyd2 = fy_document_build_from_string(NULL, "{ apiVersion: v3 }", FY_NT);
+	ck_assert_ptr_ne(fyd2, NULL);
+	fyn_key2 = fy_node_copy(fyd2, fyn_key1);
+	ck_assert_ptr_ne(fyn_key2, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn_key2), "apiVersion");
+	ck_assert_ptr_ne(fy_node_mapping_lookup_pair(fy_document_root(fyd2), fyn_key2), NULL);
+	fy_node_free(fyn_key2);
+	fy_document_destroy(fyd2);
+	fy_document_destroy(fyd1);
+}
+END_TEST
+
+struct doc_freeze_ctx {
+	struct fy_node *fyn_root;
+	struct fy_node *fyn_copy;
+	struct fy_node *fyn_plain;	/* root of a frozen document without anchors */
+	int failures;
+};
+
+static void *doc_freeze_reader(void *arg)
+{
+	struct doc_freeze_ctx *ctx = arg;
+	struct fy_node *fyn_root = ctx->fyn_root, *fyn;
+	struct fy_document *fyd;
+	struct fy_node_pair *fynp;
+	void *iter;
+	size_t len;
+	char path[16], value[16];
+	const char *text;
+	int i, j, count;
+
+	for (i = 0; i < 200; i++) {
+		j = i % 20;
+		snprintf(path, sizeof(path), "/map/k%d", j);
+		snprintf(value, sizeof(value), "v%d", j);
+		text = fy_node_get_scalar0(fy_node_by_path(fyn_root, path, FY_NT, 0));
+		if (!text || strcmp(text, value))
+			ctx->failures++;
+
+		text = fy_node_get_scalar0(fy_node_by_path(fyn_root, "/quoted", FY_NT, 0));
+		if (!text || strcmp(text, "a\tb"))
+			ctx->failures++;
+
+		fyn = fy_node_resolve_alias(fy_node_by_path(fyn_root, "/ref", FY_NT, 0));
+		if (fyn != fy_node_by_path(fyn_root, "/base", FY_NT, 0))
+			ctx->failures++;
+
+		if (fy_node_get_scalar_length(fy_node_sequence_get_by_index(
+				fy_node_by_path(fyn_root, "/seq", FY_NT, 0), 1)) != 5)
+			ctx->failures++;
+
+		if (!fy_node_compare(ctx->fyn_copy, fy_node_by_path(fyn_root, "/base", FY_NT, 0)) ||
+		    fy_node_hash(ctx->fyn_copy) != fy_node_hash(fy_node_by_path(fyn_root, "/base", FY_NT, 0)))
+			ctx->failures++;
+
+		if (!fy_node_mapping_lookup_by_string(fyn_root, "{ complex: key }", FY_NT))
+			ctx->failures++;
+
+		count = 0;
+		iter = NULL;
+		while ((fynp = fy_node_mapping_iterate(fy_node_by_path(fyn_root, "/map", FY_NT, 0), &iter)) != NULL)
+			count++;
+		if (count != 20)
+			ctx->failures++;
+
+		/* copies into documents of their own */
+		fyd = fy_document_create(NULL);
+		fyn = fy_node_copy(fyd, ctx->fyn_plain);
+		if (!fyn || !fy_node_compare(fyn, ctx->fyn_plain))
+			ctx->failures++;
+		fy_document_set_root(fyd, fyn);
+		text = fy_node_get_tag(fy_node_by_path(fyn, "/point", FY_NT, 0), &len);
+		if (!text || len != strlen("tag:example.com,2019:point") ||
+		    memcmp(text, "tag:example.com,2019:point", len))
+			ctx->failures++;
+		text = fy_node_get_scalar0(fy_node_by_path(fyn, "/seq/1", FY_NT, 0));
+		if (!text || strcmp(text, "two"))
+			ctx->failures++;
+		fy_document_destroy(fyd);
+	}
+
+	return NULL;
+}
+
+START_TEST(doc_freeze)
+{
+	struct fy_parse_cfg cfg;
+	struct fy_document *fyd, *fyd_plain;
+	struct fy_node *fyn_root;
+	struct doc_freeze_ctx ctx[4];
+	pthread_t threads[4];
+	char yaml[1024];
+	size_t len;
+	int i;
+
+	len = snprintf(yaml, sizeof(yaml),
+			"base: &b { x: [ 1, 2 ], y: !!str 3 }\n"
+			"ref: *b\n"
+			"quoted: \"a\\tb\"\n"
+			"seq: [ one, three ]\n"
+			"? { complex: key }\n"
+			": value\n"
+			"map:\n");
+	for (i = 0; i < 20; i++)
+		len += snprintf(yaml + len, sizeof(yaml) - len, "  k%d: v%d\n", i, i);
+	ck_assert_int_lt(len, sizeof(yaml));
+
+	/* lazily loaded contents and a copy on write are expanded */
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYPCF_QUIET | FYPCF_LAZY_DOCUMENT;
+	cfg.intern = fy_intern_create();
+	ck_assert_ptr_ne(cfg.intern, NULL);
+	fyd = fy_document_build_from_string(&cfg, yaml, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	fy_intern_destroy(cfg.intern);
+	fyn_root = fy_document_root(fyd);
+
+	ck_assert_int_eq(fy_document_freeze(fyd), 0);
+	ck_assert(fy_document_is_frozen(fyd));
+
+	/* a change thaws it */
+	ck_assert_int_eq(fy_node_mapping_append(fyn_root,
+			fy_node_build_from_string(fyd, "copy", FY_NT),
+			fy_node_copy(fyd, fy_node_by_path(fyn_root, "/base", FY_NT, 0))), 0);
+	ck_assert(!fy_document_is_frozen(fyd));
+	ck_assert_int_eq(fy_document_freeze(fyd), 0);
+	ck_assert(fy_document_is_frozen(fyd));
+
+	/* copies of one without anchors would share it, if it weren't frozen */
+	fyd_plain = fy_document_build_from_string(NULL,
+			"%TAG !e! tag:example.com,2019:\n"
+			"---\n"
+			"map: { a: 1, b: [ 2, 3 ] }\n"
+			"seq: [ one, !!str two, ! three ]\n"
+			"point: !e!point { x: 1 }\n", FY_NT);
+	ck_assert_ptr_ne(fyd_plain, NULL);
+	ck_assert_int_eq(fy_document_freeze(fyd_plain), 0);
+
+	for (i = 0; i < 4; i++) {
+		ctx[i].fyn_root = fyn_root;
+		ctx[i].fyn_plain = fy_document_root(fyd_plain);
+		ctx[i].fyn_copy = fy_node_by_path(fyn_root, "/copy", FY_NT, 0);
+		ctx[i].failures = 0;
+		ck_assert_ptr_ne(ctx[i].fyn_copy, NULL);
+		ck_assert_int_eq(pthread_create(&threads[i], NULL, doc_freeze_reader, &ctx[i]), 0);
+	}
+	for (i = 0; i < 4; i++) {
+		ck_assert_int_eq(pthread_join(threads[i], NULL), 0);
+		ck_assert_int_eq(ctx[i].failures, 0);
+	}
+
+	/* reading did not thaw it */
+	ck_assert(fy_document_is_frozen(fyd));
+	ck_assert(fy_document_is_frozen(fyd_plain));
+
+	fy_document_destroy(fyd_plain);
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_load_path)
+{
+	static const char yaml[] =
+		"skip: { a: [1, 2, 3], b: *x }\n"
+		"items: [ first, { name: second }, third ]\n"
+		"\"quoted key\": 1\n"
+		"{ complex: key }: found\n"
+		"items: duplicate\n"
+		"---\n"
+		"items: [ other ]\n"
+		"---\n"
+		"nothing: here\n";
+	static const struct {
+		const char *path;
+		const char *value;	/* in the first document */
+	} paths[] = {
+		{ "/items/1/name",		"second" },
+		{ "/items/[2]",			"third" },
+		{ "/\"quoted key\"",		"1" },
+		{ "/{ complex: key }",		"found" },
+		{ "/items/3",			NULL },
+		{ "/items/-1",			"third" },
+		{ "/items/[-2]/name",		"second" },
+		{ "/items/-3",			"first" },
+		{ "/items/-4",			NULL },
+		{ "/items/-1/name",		NULL },
+		{ "/skip/a/-1",			"3" },
+		{ "/missing",			NULL },
+	};
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	const char *value;
+	size_t len;
+	unsigned int i;
+
+	for (i = 0; i < sizeof(paths)/sizeof(paths[0]); i++) {
+		fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+		ck_assert_ptr_ne(fyp, NULL);
+		ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+
+		fyd = fy_parse_load_document_path(fyp, paths[i].path, FY_NT);
+		ck_assert_ptr_ne(fyd, NULL);
+		fyn = fy_document_root(fyd);
+		if (!paths[i].value) {
+			ck_assert_ptr_eq(fyn, NULL);
+		} else {
+			value = fy_node_get_scalar(fyn, &len);
+			ck_assert_ptr_ne(value, NULL);
+			ck_assert_int_eq(len, strlen(paths[i].value));
+			ck_assert(!memcmp(value, paths[i].value, len));
+		}
+		fy_parse_document_destroy(fyp, fyd);
+
+		fy_parser_destroy(fyp);
+	}
+
+	/* every document of a stream is filtered in turn */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+
+	fyd = fy_parse_load_document_path(fyp, "/items/0", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_document_root(fyd)), "first");
+	fy_parse_document_destroy(fyp, fyd);
+
+	fyd = fy_parse_load_document_path(fyp, "/items/0", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_document_root(fyd)), "other");
+	fy_parse_document_destroy(fyp, fyd);
+
+	fyd = fy_parse_load_document_path(fyp, "/items/0", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_ptr_eq(fy_document_root(fyd), NULL);
+	fy_parse_document_destroy(fyp, fyd);
+
+	ck_assert_ptr_eq(fy_parse_load_document_path(fyp, "/items/0", FY_NT), NULL);
+	ck_assert(!fy_parser_get_stream_error(fyp));
+
+	/* the whole document */
+	ck_assert_int_eq(fy_parser_set_string(fyp, "[ a, b ]", FY_NT), 0);
+	fyd = fy_parse_load_document_path(fyp, "/", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert(fy_node_is_sequence(fy_document_root(fyd)));
+	ck_assert_int_eq(fy_node_sequence_item_count(fy_document_root(fyd)), 2);
+	ck_assert_ptr_eq(fy_node_get_parent(fy_node_sequence_get_by_index(fy_document_root(fyd), 1)),
+			 fy_document_root(fyd));
+	fy_parse_document_destroy(fyp, fyd);
+
+	fy_parser_destroy(fyp);
+}
+END_TEST
+
+/* the parallel build must produce the serial documents in the same order */
+static void check_build_all(const char *yaml, size_t len, int expected_count)
+{
+	struct fy_parser *fyp;
+	struct fy_document *fyd, **fyds;
+	char *serial[8], *buf;
+	int i, count, jobs;
+
+	/* load serially first */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, len), 0);
+
+	count = 0;
+	while ((fyd = fy_parse_load_document(fyp)) != NULL) {
+		ck_assert_int_lt(count, 8);
+		serial[count] = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+		ck_assert_ptr_ne(serial[count], NULL);
+		count++;
+		fy_parse_document_destroy(fyp, fyd);
+	}
+	fy_parser_destroy(fyp);
+	ck_assert_int_eq(count, expected_count);
+
+	for (jobs = 1; jobs <= 4; jobs += 3) {
+		fyds = fy_document_build_all_from_string(NULL, yaml, len, jobs);
+		ck_assert_ptr_ne(fyds, NULL);
+
+		for (i = 0; fyds[i]; i++) {
+			ck_assert_int_lt(i, count);
+			buf = fy_emit_document_to_string(fyds[i], FYECF_MODE_FLOW_ONELINE);
+			ck_assert_ptr_ne(buf, NULL);
+			ck_assert_str_eq(buf, serial[i]);
+			free(buf);
+			fy_document_destroy(fyds[i]);
+		}
+		ck_assert_int_eq(i, count);
+		free(fyds);
+	}
+
+	for (i = 0; i < count; i++)
+		free(serial[i]);
+}
+
+START_TEST(doc_build_all_parallel)
+{
+	static const char yaml[] =
+		"# leading comment\n"
+		"%TAG !e! tag:example.com,2000:\n"
+		"--- !e!foo\n"
+		"a: 1\n"
+		"--- [1, 2, 3]\n"
+		"...\n"
+		"implicit: doc\n"
+		"...\n"
+		"%YAML 1.1\n"
+		"---\n"
+		"b: \"multi\n"
+		"  line\"\n"
+		"--- |\n"
+		"  literal\n"
+		"  text\n"
+		"# trailing comment\n";
+	static const char nul[] = "--- a\n...\n--- b\n\0\n--- c\n";
+	struct fy_document **fyds;
+
+	check_build_all(yaml, FY_NT, 5);
+
+	/* all kinds of line breaks */
+	check_build_all("- a\r--- b\r...\rc: d\r", FY_NT, 3);
+	check_build_all("a\r\n--- b\xc2\x85--- c\xe2\x80\xa8...\xe2\x80\xa9" "d\n", FY_NT, 4);
+
+	/* a BOM is fine at the start of the stream, but masks a later marker */
+	check_build_all("\xef\xbb\xbf--- a\n--- b\n", FY_NT, 2);
+	fyds = fy_document_build_all_from_string(NULL, "a: 1\n\xef\xbb\xbf--- b\n", FY_NT, 2);
+	ck_assert_ptr_eq(fyds, NULL);
+
+	/* the stream ends at a NUL */
+	check_build_all(nul, sizeof(nul) - 1, 2);
+
+	/* an error in any document fails the whole stream */
+	fyds = fy_document_build_all_from_string(NULL, "--- a\n--- [b\n--- c\n", FY_NT, 2);
+	ck_assert_ptr_eq(fyds, NULL);
+}
+END_TEST
+
+static void event_append(char *buf, size_t size, struct fy_event *fye)
+{
+	size_t len = strlen(buf);
+
+	snprintf(buf + len, size - len, "%d%s%s;", fye->type,
+		 fye->type == FYET_SCALAR ? ":" : "",
+		 fye->type == FYET_SCALAR ? fy_token_get_text0(fye->scalar.value) : "");
+}
+
+static int event_collect(struct fy_parser *fyp, struct fy_event *fye, void *user)
+{
+	event_append(user, 1024, fye);
+	return 0;
+}
+
+static int event_stop_at_scalar(struct fy_parser *fyp, struct fy_event *fye, void *user)
+{
+	return fye->type == FYET_SCALAR ? 42 : 0;
+}
+
+START_TEST(parse_caller_events)
+{
+	static const char yaml[] =
+		"a: [ 1, 2, 3 ]\n"
+		"b: { c: d }\n"
+		"--- e\n";
+	struct fy_parser *fyp;
+	struct fy_event *fye, slots[3];
+	char expected[1024], buf[1024];
+	int i, rc;
+
+	/* the regular way */
+	expected[0] = '\0';
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+	while ((fye = fy_parser_parse(fyp)) != NULL) {
+		event_append(expected, sizeof(expected), fye);
+		fy_parser_event_free(fyp, fye);
+	}
+	fy_parser_destroy(fyp);
+
+	/* a small set of slots reused for the whole stream */
+	buf[0] = '\0';
+	memset(slots, 0, sizeof(slots));
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+	while ((rc = fy_parser_parse_batch(fyp, slots, 3)) > 0) {
+		for (i = 0; i < rc; i++)
+			event_append(buf, sizeof(buf), &slots[i]);
+	}
+	ck_assert_int_eq(rc, 0);
+	fy_parser_events_release(fyp, slots, 3);
+	for (i = 0; i < 3; i++)
+		ck_assert_int_eq(slots[i].type, FYET_NONE);
+	fy_parser_destroy(fyp);
+	ck_assert_str_eq(buf, expected);
+
+	/* push mode */
+	buf[0] = '\0';
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+	rc = fy_parser_parse_callback(fyp, event_collect, buf);
+	ck_assert_int_eq(rc, 0);
+	fy_parser_destroy(fyp);
+	ck_assert_str_eq(buf, expected);
+
+	/* the callback can stop the parse */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+	rc = fy_parser_parse_callback(fyp, event_stop_at_scalar, NULL);
+	ck_assert_int_eq(rc, 42);
+	fy_parser_destroy(fyp);
+
+	/* errors are reported */
+	memset(slots, 0, sizeof(slots));
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, "[ a, b", FY_NT), 0);
+	while ((rc = fy_parser_parse_into(fyp, &slots[0])) > 0)
+		;
+	ck_assert_int_eq(rc, -1);
+	fy_parser_event_release(fyp, &slots[0]);
+	fy_parser_destroy(fyp);
+}
+END_TEST
+
+START_TEST(parse_feed)
+{
+	static const char yaml[] =
+		"# comment\n"
+		"a: &x [ 1, \"two\\tthree\", 'four''s' ]\n"
+		"b: |\n"
+		"  literal\n"
+		"  text\n"
+		"c: { d: *x, e: plain multi\n"
+		"    line }\n"
+		"--- >-\n"
+		"  folded\n"
+		"  ü\n"
+		"...\n";
+	static const size_t chunks[] = { 1, 7, sizeof(yaml) };
+	struct fy_parser *fyp;
+	struct fy_event *fye;
+	char expected[1024], buf[1024];
+	size_t i, pos, len, window;
+	int needs;
+
+	expected[0] = '\0';
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+	while ((fye = fy_parser_parse(fyp)) != NULL) {
+		event_append(expected, sizeof(expected), fye);
+		fy_parser_event_free(fyp, fye);
+	}
+	fy_parser_destroy(fyp);
+
+	for (window = 0; window <= 16; window += 16) {
+		for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+			buf[0] = '\0';
+			fyp = fy_parser_create(&(struct fy_parse_cfg){
+					.flags = FYPCF_QUIET,
+					.stream_window = window });
+			ck_assert_ptr_ne(fyp, NULL);
+
+			/* an empty chunk is enough to switch to push mode */
+			ck_assert_int_eq(fy_parser_feed(fyp, NULL, 0, false), 0);
+
+			pos = 0;
+			needs = 0;
+			for (;;) {
+				fye = fy_parser_parse(fyp);
+				if (fye) {
+					event_append(buf, sizeof(buf), fye);
+					fy_parser_event_free(fyp, fye);
+					continue;
+				}
+				if (!fy_parser_need_input(fyp))
+					break;
+				needs++;
+				len = sizeof(yaml) - 1 - pos;
+				if (len > chunks[i])
+					len = chunks[i];
+				ck_assert_int_eq(fy_parser_feed(fyp, yaml + pos, len,
+							pos + len == sizeof(yaml) - 1), 0);
+				pos += len;
+			}
+			ck_assert_int_eq(pos, sizeof(yaml) - 1);
+			ck_assert(needs > 0);
+			ck_assert_str_eq(buf, expected);
+
+			/* nothing goes after the last chunk */
+			ck_assert_int_ne(fy_parser_feed(fyp, "a", 1, true), 0);
+			fy_parser_destroy(fyp);
+		}
+	}
+
+	/* a parser suspended mid token can still be destroyed */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_feed(fyp, "key: \"unterm", 12, false), 0);
+	while ((fye = fy_parser_parse(fyp)) != NULL)
+		fy_parser_event_free(fyp, fye);
+	ck_assert(fy_parser_need_input(fyp));
+	fy_parser_destroy(fyp);
+}
+END_TEST
+
+START_TEST(parse_feed_ahead)
+{
+	struct fy_parser *fyp;
+	struct fy_event *fye;
+	char *buf, *p;
+	size_t half;
+	int i, count;
+
+	/* many more events than are parsed ahead at a time */
+	buf = malloc(16384);
+	ck_assert_ptr_ne(buf, NULL);
+	p = buf;
+	for (i = 0; i < 500; i++)
+		p += sprintf(p, "k%d: [ %d ]\n", i, i);
+	half = (p - buf) / 2;
+
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_feed(fyp, buf, half, false), 0);
+	count = 0;
+	while ((fye = fy_parser_parse(fyp)) != NULL) {
+		count++;
+		fy_parser_event_free(fyp, fye);
+	}
+	ck_assert(fy_parser_need_input(fyp));
+	ck_assert_int_eq(fy_parser_feed(fyp, buf + half, strlen(buf + half), true), 0);
+	while ((fye = fy_parser_parse(fyp)) != NULL) {
+		count++;
+		fy_parser_event_free(fyp, fye);
+	}
+	ck_assert(!fy_parser_need_input(fyp));
+	ck_assert(!fy_parser_get_stream_error(fyp));
+	/* stream, document, mapping, and 4 per entry */
+	ck_assert_int_eq(count, 6 + 500 * 4);
+	fy_parser_destroy(fyp);
+
+	/* events parsed ahead but not taken go away with the parser */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_feed(fyp, buf, half, false), 0);
+	fye = fy_parser_parse(fyp);
+	ck_assert_ptr_ne(fye, NULL);
+	fy_parser_event_free(fyp, fye);
+	fy_parser_destroy(fyp);
+
+	free(buf);
+}
+END_TEST
+
+START_TEST(parse_validate)
+{
+	struct fy_parser *fyp;
+	struct fy_mark mark;
+
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+
+	/* well formed */
+	ck_assert_int_eq(fy_parser_set_string(fyp, "a: [ 1, 2 ]\n--- { b: c }\n", FY_NT), 0);
+	ck_assert_int_eq(fy_parser_validate(fyp, &mark), 0);
+
+	/* the first error, with its position */
+	ck_assert_int_eq(fy_parser_reset(fyp), 0);
+	ck_assert_int_eq(fy_parser_set_string(fyp, "a: b\nc: [ d\ne: f\n", FY_NT), 0);
+	ck_assert_int_eq(fy_parser_validate(fyp, &mark), -1);
+	ck_assert_int_eq(mark.line, 3);
+	ck_assert_int_eq(mark.column, 0);
+	fy_parser_destroy(fyp);
+
+	/* push mode asks for more */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_feed(fyp, "a: [ 1,", 7, false), 0);
+	ck_assert_int_eq(fy_parser_validate(fyp, NULL), 1);
+	ck_assert_int_eq(fy_parser_feed(fyp, " 2 ]\n", 5, true), 0);
+	ck_assert_int_eq(fy_parser_validate(fyp, NULL), 0);
+	fy_parser_destroy(fyp);
+}
+END_TEST
+
+START_TEST(parse_validate_duplicate_keys)
+{
+	static const char * const bad[] = {
+		"{ a: 1, a: 2 }",
+		"a: { b: [ { c: 1, 'c': 2 } ] }",
+		"- &x a\n- { *x : 1, *x : 2 }",
+		"{ ? : 1, '': 2 }",
+		"{ [ a, b ]: 1, [ a, b ]: 2 }",
+		"{ { a: 1, b: 2 }: x, { b: 2, a: 1 }: y }",
+		"{ { a: [ 1 ] }: x }: 1\n{ { a: [ 1 ] }: x }: 2\n",
+	};
+	static const char * const good[] = {
+		"a: { b: 1 }\nc: { b: 1 }",
+		"- &x a\n- { *x : 1, x : 2 }",
+		"{ [ a, b ]: 1, [ b, a ]: 2, [ a ]: 3, a: 4 }",
+		"{ { a: 1 }: x, { a: 2 }: y, { a: [ 1 ] }: z }",
+		"a: 1\n---\na: 2\n",
+	};
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	struct fy_mark mark;
+	unsigned int i;
+
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+
+	/* refused just like the document builder refuses them */
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		ck_assert_int_eq(fy_parser_reset(fyp), 0);
+		ck_assert_int_eq(fy_parser_set_string(fyp, bad[i], FY_NT), 0);
+		ck_assert_int_eq(fy_parser_validate(fyp, NULL), -1);
+		fyd = fy_document_build_from_string(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET },
+						    bad[i], FY_NT);
+		ck_assert_ptr_eq(fyd, NULL);
+	}
+
+	for (i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+		ck_assert_int_eq(fy_parser_reset(fyp), 0);
+		ck_assert_int_eq(fy_parser_set_string(fyp, good[i], FY_NT), 0);
+		ck_assert_int_eq(fy_parser_validate(fyp, NULL), 0);
+	}
+
+	/* pointing at the duplicate */
+	ck_assert_int_eq(fy_parser_reset(fyp), 0);
+	ck_assert_int_eq(fy_parser_set_string(fyp, "a: 1\nb: 2\na: 3\n", FY_NT), 0);
+	ck_assert_int_eq(fy_parser_validate(fyp, &mark), -1);
+	ck_assert_int_eq(mark.line, 2);
+	ck_assert_int_eq(mark.column, 0);
+	fy_parser_destroy(fyp);
+
+	/* the keys are kept while waiting for more input */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_feed(fyp, "a: 1\nb: 2\n", 10, false), 0);
+	ck_assert_int_eq(fy_parser_validate(fyp, NULL), 1);
+	ck_assert_int_eq(fy_parser_feed(fyp, "a: 3\n", 5, true), 0);
+	ck_assert_int_eq(fy_parser_validate(fyp, NULL), -1);
+	fy_parser_destroy(fyp);
+}
+END_TEST
+
+START_TEST(parse_stats)
+{
+	static const char yaml[] =
+		"a: [ 1, [ 2, 3 ] ]\n"
+		"b: &x { c: \"d\" }\n"
+		"e: *x\n";
+	struct fy_parse_cfg cfg = {
+		.flags = FYPCF_QUIET | FYPCF_COLLECT_STATS,
+	};
+	struct fy_parser_stats stats;
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	unsigned int i;
+
+	/* nothing is collected unless asked for */
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_get_stats(fyp, &stats), -1);
+	fy_parser_destroy(fyp);
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+	ck_assert_int_eq(fy_parser_set_string(fyp, yaml, FY_NT), 0);
+	while ((fyd = fy_parse_load_document(fyp)) != NULL)
+		fy_parse_document_destroy(fyp, fyd);
+	ck_assert(!fy_parser_get_stream_error(fyp));
+
+	ck_assert_int_eq(fy_parser_get_stats(fyp, &stats), 0);
+	ck_assert(stats.input_pulls > 0);
+	ck_assert(stats.tokens > 0);
+	ck_assert(stats.talloc_bytes > 0);
+	ck_assert_int_eq(stats.documents, 1);
+	ck_assert_int_eq(stats.nodes, 13);
+	ck_assert_int_eq(stats.flow_level_max, 2);
+	ck_assert(stats.simple_key_depth_max >= 1);
+	ck_assert(stats.indent_depth_max >= 1);
+
+	ck_assert_int_eq(stats.fetch_count[FYPSF_STREAM_START], 1);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_STREAM_END], 1);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_FLOW_COLLECTION_START], 3);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_FLOW_COLLECTION_END], 3);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_FLOW_ENTRY], 2);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_VALUE], 4);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_ANCHOR_OR_ALIAS], 2);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_FLOW_SCALAR], 1);
+	ck_assert_int_eq(stats.fetch_count[FYPSF_PLAIN_SCALAR], 7);
+	fy_parser_destroy(fyp);
+
+	for (i = 0; i < FYPSF_COUNT; i++)
+		ck_assert_ptr_ne(fy_parser_stats_fetch_name(i), NULL);
+	ck_assert_ptr_eq(fy_parser_stats_fetch_name(FYPSF_COUNT), NULL);
+}
+END_TEST
+
+START_TEST(parse_reset)
+{
+	struct fy_parser *fyp;
+	struct fy_document *fyd;
+	char buf[64], value[16];
+	int i, ret;
+
+	fyp = fy_parser_create(&(struct fy_parse_cfg){ .flags = FYPCF_QUIET });
+	ck_assert_ptr_ne(fyp, NULL);
+
+	/* many small documents through the same parser */
+	for (i = 0; i < 1000; i++) {
+		snprintf(buf, sizeof(buf), "{ key: %d, list: [ a, b ] }", i);
+		fyd = fy_document_build_from_string_with_parser(fyp, buf, FY_NT);
+		ck_assert_ptr_ne(fyd, NULL);
+		ck_assert_int_eq(fy_node_mapping_item_count(fy_document_root(fyd)), 2);
+		snprintf(value, sizeof(value), "%d", i);
+		ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fy_document_root(fyd), "/key", FY_NT, FYNWF_DONT_FOLLOW)), value);
+		fy_document_destroy(fyd);
+	}
+
+	/* an error does not stick */
+	fyd = fy_document_build_from_string_with_parser(fyp, "[ a, b", FY_NT);
+	ck_assert_ptr_eq(fyd, NULL);
+	fyd = fy_document_build_from_string_with_parser(fyp, "[ a, b ]", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_int_eq(fy_node_sequence_item_count(fy_document_root(fyd)), 2);
+	fy_document_destroy(fyd);
+
+	/* reset in the middle of a stream */
+	ret = fy_parser_set_string(fyp, "--- a\n--- b\n", FY_NT);
+	ck_assert_int_eq(ret, 0);
+	fyd = fy_parse_load_document(fyp);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_document_root(fyd)), "a");
+	fy_parse_document_destroy(fyp, fyd);
+
+	ret = fy_parser_reset(fyp);
+	ck_assert_int_eq(ret, 0);
+	ret = fy_parser_set_string(fyp, "%YAML 1.1\n--- c\n", FY_NT);
+	ck_assert_int_eq(ret, 0);
+	fyd = fy_parse_load_document(fyp);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_document_root(fyd)), "c");
+	fy_parse_document_destroy(fyp, fyd);
+	ck_assert_ptr_eq(fy_parse_load_document(fyp), NULL);
+	ck_assert(!fy_parser_get_stream_error(fyp));
+
+	fy_parser_destroy(fyp);
+}
+END_TEST
+
+/* apply an edit to the source and the document, checking against a full parse */
+static char *doc_reparse_edit(struct fy_document *fyd, char *text, const char *at,
+			      size_t old_len, const char *repl, int *retp)
+{
+	struct fy_document *fyd_full;
+	char *new_text;
+	size_t start, len, repl_len;
+	int ret;
+
+	start = strstr(text, at) - text;
+	len = strlen(text);
+	repl_len = strlen(repl);
+
+	new_text = malloc(len - old_len + repl_len + 1);
+	ck_assert_ptr_ne(new_text, NULL);
+	memcpy(new_text, text, start);
+	memcpy(new_text + start, repl, repl_len);
+	strcpy(new_text + start + repl_len, text + start + old_len);
+
+	ret = fy_document_reparse(fyd, new_text, FY_NT, start, old_len, repl_len);
+	*retp = ret;
+	if (ret) {
+		free(new_text);
+		return text;
+	}
+
+	fyd_full = fy_document_build_from_string(NULL, new_text, FY_NT);
+	ck_assert_ptr_ne(fyd_full, NULL);
+	ck_assert(fy_node_compare(fy_document_root(fyd), fy_document_root(fyd_full)));
+	fy_document_destroy(fyd_full);
+
+	/* the previous source is no longer used */
+	free(text);
+	return new_text;
+}
+
+START_TEST(doc_reparse)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	char *text, *buf;
+	int ret;
+
+	text = strdup("a: 1\n"
+		      "b:\n"
+		      "  c: 2\n"
+		      "  d: [x, y]\n"
+		      "e:\n"
+		      "  - f: g\n"
+		      "  - h\n");
+	ck_assert_ptr_ne(text, NULL);
+
+	fyd = fy_document_build_from_string(NULL, text, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	/* inside a flow sequence */
+	text = doc_reparse_edit(fyd, text, "x,", 1, "xx", &ret);
+	ck_assert_int_eq(ret, 0);
+	fyn = fy_node_by_path(fy_document_root(fyd), "/b/d/0", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "xx");
+
+	/* after the previous edit; the marks must have moved */
+	text = doc_reparse_edit(fyd, text, "g\n", 1, "gg", &ret);
+	ck_assert_int_eq(ret, 0);
+	fyn = fy_node_by_path(fy_document_root(fyd), "/e/0/f", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "gg");
+
+	/* a new line in a block mapping */
+	text = doc_reparse_edit(fyd, text, "  d:", 0, "  z: [3,\n    4]\n", &ret);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_eq(fy_node_mapping_item_count(fy_node_by_path(fy_document_root(fyd), "/b",
+				FY_NT, FYNWF_DONT_FOLLOW)), 3);
+
+	/* on the top level there's nothing to do but to parse it all */
+	text = doc_reparse_edit(fyd, text, "1\n", 1, "2", &ret);
+	ck_assert_int_eq(ret, -1);
+
+	/* changing the indentation of the enclosing collection */
+	text = doc_reparse_edit(fyd, text, "  - h", 2, "", &ret);
+	ck_assert_int_eq(ret, -1);
+
+	/* an unfinished edit fails and leaves the document alone */
+	text = doc_reparse_edit(fyd, text, "y]", 2, "y", &ret);
+	ck_assert_int_eq(ret, -1);
+
+	buf = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: 1, b: {c: 2, z: [3, 4], d: [xx, y]}, e: [{f: gg}, h]}\n");
+	free(buf);
+
+	fy_document_destroy(fyd);
+	free(text);
+
+	/* anchors are never re-parsed */
+	text = strdup("a:\n  b: &x [1, 2]\nc: *x\n");
+	ck_assert_ptr_ne(text, NULL);
+	fyd = fy_document_build_from_string(NULL, text, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	text = doc_reparse_edit(fyd, text, "2]", 1, "3", &ret);
+	ck_assert_int_eq(ret, -1);
+	fy_document_destroy(fyd);
+	free(text);
+
+	/* the document markers are kept, and emitted as before */
+	text = strdup("---\na:\n  b: [1, 2]\n...\n");
+	ck_assert_ptr_ne(text, NULL);
+	fyd = fy_document_build_from_string(NULL, text, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	text = doc_reparse_edit(fyd, text, "2]", 1, "3", &ret);
+	ck_assert_int_eq(ret, 0);
+	ck_assert(fy_document_has_explicit_document_start(fyd));
+	ck_assert(fy_document_has_explicit_document_end(fyd));
+	buf = fy_emit_document_to_string(fyd, FYECF_MODE_BLOCK);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "---\na:\n  b:\n  - 1\n  - 3\n...\n");
+	free(buf);
+	fy_document_destroy(fyd);
+	free(text);
+}
+END_TEST
+
 START_TEST(doc_sort)
 {
 	struct fy_document *fyd;
@@ -675,6 +2175,99 @@ START_TEST(doc_sort)
 }
 END_TEST
 
+START_TEST(doc_sort_large)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn_root, *fyn_map;
+	struct fy_node_pair *fynp;
+	const char *prev, *key;
+	char *buf, *s;
+	size_t size;
+	unsigned int i, j;
+	int ret;
+
+	/* enough keys over enough mappings for the sort to go parallel */
+	size = 64 * 512 * 48 + 64 * 16 + 16;
+	buf = malloc(size);
+	ck_assert_ptr_ne(buf, NULL);
+	s = buf;
+	for (i = 0; i < 64; i++) {
+		s += sprintf(s, "m%02u:\n", i);
+		for (j = 0; j < 512; j++) {
+			/* long keys sharing the prefix need the full comparison */
+			if (j & 1)
+				s += sprintf(s, "  shared-prefix-%05u: %u\n", (j * 7919) % 512, j);
+			else
+				s += sprintf(s, "  k%u: %u\n", (j * 7919) % 512, j);
+		}
+	}
+
+	fyd = fy_document_build_from_string(NULL, buf, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyn_root = fy_document_root(fyd);
+	ret = fy_node_sort(fyn_root, NULL, NULL);
+	ck_assert_int_eq(ret, 0);
+
+	ck_assert_int_eq(fy_node_mapping_item_count(fyn_root), 64);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fy_node_mapping_get_by_index(fyn_root, 0))), "m00");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_key(fy_node_mapping_get_by_index(fyn_root, 63))), "m63");
+
+	for (i = 0; i < 64; i++) {
+		fyn_map = fy_node_pair_value(fy_node_mapping_get_by_index(fyn_root, i));
+		ck_assert_int_eq(fy_node_mapping_item_count(fyn_map), 512);
+
+		prev = NULL;
+		for (j = 0; j < 512; j++) {
+			fynp = fy_node_mapping_get_by_index(fyn_map, j);
+			ck_assert_ptr_ne(fynp, NULL);
+			ck_assert_int_eq(fy_node_mapping_get_pair_index(fyn_map, fynp), j);
+			key = fy_node_get_scalar0(fy_node_pair_key(fynp));
+			ck_assert_ptr_ne(key, NULL);
+			if (prev)
+				ck_assert(strcmp(prev, key) < 0);
+			prev = key;
+		}
+	}
+
+	fy_document_destroy(fyd);
+	free(buf);
+}
+END_TEST
+
+static int sort_reverse_cmp(const struct fy_node_pair *fynp_a,
+			    const struct fy_node_pair *fynp_b,
+			    void *arg)
+{
+	int *calls = arg;
+
+	(*calls)++;
+	return -strcmp(fy_node_get_scalar0(fy_node_pair_key((struct fy_node_pair *)fynp_a)),
+		       fy_node_get_scalar0(fy_node_pair_key((struct fy_node_pair *)fynp_b)));
+}
+
+START_TEST(doc_sort_user)
+{
+	struct fy_document *fyd;
+	char *buf;
+	int ret, calls = 0;
+
+	fyd = fy_document_build_from_string(NULL, "{ b: 2, d: { y: 1, x: 2, z: 3 }, a: 1, c: 3 }", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	ret = fy_node_sort(fy_document_root(fyd), sort_reverse_cmp, &calls);
+	ck_assert_int_eq(ret, 0);
+	ck_assert_int_gt(calls, 0);
+
+	buf = fy_emit_node_to_string(fy_document_root(fyd), FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{d: {z: 3, y: 1, x: 2}, c: 3, b: 2, a: 1}");
+	free(buf);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
 static char *join_docs(const char *tgt_text, const char *tgt_path,
 		       const char *src_text, const char *src_path,
 		       const char *emit_path)
@@ -862,6 +2455,745 @@ START_TEST(doc_join_tags)
 END_TEST
 #endif
 
+START_TEST(doc_anchor_index)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	struct fy_anchor *fya;
+	const char *text;
+	char *buf, *p;
+	size_t len;
+	unsigned int i;
+	int rc;
+
+	/* enough anchors for the index, and a redefined one */
+	buf = malloc(8192);
+	ck_assert_ptr_ne(buf, NULL);
+	p = buf;
+	for (i = 0; i < 40; i++)
+		p += sprintf(p, "a%02u: &a%u v%u\n", i, i, i);
+	p += sprintf(p, "before: *a3\n");
+	p += sprintf(p, "again: &a3 redefined\n");
+	p += sprintf(p, "after: *a3\n");
+
+	fyd = fy_document_build_from_string(NULL, buf, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	/* the most recent definition wins */
+	fya = fy_document_lookup_anchor(fyd, "a3", FY_NT);
+	ck_assert_ptr_ne(fya, NULL);
+	ck_assert_ptr_eq(fy_anchor_node(fya), fy_node_by_path(fy_document_root(fyd), "/again", FY_NT, FYNWF_DONT_FOLLOW));
+
+	fyn = fy_node_by_path(fy_document_root(fyd), "/a05", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	fya = fy_node_get_anchor(fyn);
+	ck_assert_ptr_ne(fya, NULL);
+	text = fy_anchor_get_text(fya, &len);
+	ck_assert(len == 2 && !memcmp(text, "a5", 2));
+
+	/* removal updates both lookups */
+	rc = fy_node_remove_anchor(fyn);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_ptr_eq(fy_node_get_anchor(fyn), NULL);
+	ck_assert_ptr_eq(fy_document_lookup_anchor(fyd, "a5", FY_NT), NULL);
+	ck_assert_ptr_ne(fy_document_lookup_anchor(fyd, "a6", FY_NT), NULL);
+
+	rc = fy_node_set_anchor(fyn, "fresh", FY_NT);
+	ck_assert_int_eq(rc, 0);
+	fya = fy_document_lookup_anchor(fyd, "fresh", FY_NT);
+	ck_assert_ptr_ne(fya, NULL);
+	ck_assert_ptr_eq(fy_anchor_node(fya), fyn);
+	ck_assert_ptr_eq(fy_node_get_anchor(fyn), fya);
+
+	/* aliases resolve to the definition preceding them */
+	rc = fy_document_resolve(fyd);
+	ck_assert_int_eq(rc, 0);
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fy_document_root(fyd), "/before", FY_NT, FYNWF_DONT_FOLLOW)), "v3");
+	ck_assert_str_eq(fy_node_get_scalar0(fy_node_by_path(fy_document_root(fyd), "/after", FY_NT, FYNWF_DONT_FOLLOW)), "redefined");
+
+	fy_document_destroy(fyd);
+	free(buf);
+}
+END_TEST
+
+START_TEST(doc_node_hash)
+{
+	struct fy_document *fyd1, *fyd2, *fydk;
+	struct fy_node *fyn, *fyn_key;
+	struct fy_node_pair *fynp;
+	char *buf, *p;
+	uint32_t hash;
+	unsigned int i;
+	int rc;
+
+	fyd1 = fy_document_build_from_string(NULL, "{ a: [ 1, 2 ], b: { c: d }, \"\": }", FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+	fyd2 = fy_document_build_from_string(NULL, "{ '': , b: { 'c': \"d\" }, a: [ 1, 2 ] }", FY_NT);
+	ck_assert_ptr_ne(fyd2, NULL);
+
+	/* pair order and scalar style do not matter */
+	ck_assert(fy_node_compare(fy_document_root(fyd1), fy_document_root(fyd2)));
+	hash = fy_node_hash(fy_document_root(fyd1));
+	ck_assert_int_eq(hash, fy_node_hash(fy_document_root(fyd2)));
+
+	/* sequence order does */
+	fy_document_destroy(fyd2);
+	fyd2 = fy_document_build_from_string(NULL, "{ '': , b: { c: d }, a: [ 2, 1 ] }", FY_NT);
+	ck_assert_ptr_ne(fyd2, NULL);
+	ck_assert(!fy_node_compare(fy_document_root(fyd1), fy_document_root(fyd2)));
+	ck_assert(fy_node_hash(fy_document_root(fyd1)) != fy_node_hash(fy_document_root(fyd2)));
+
+	/* a change is reflected in the hash */
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/a", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	rc = fy_node_sequence_append(fyn, fy_node_build_from_string(fyd1, "3", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	ck_assert(fy_node_hash(fy_document_root(fyd1)) != hash);
+
+	fy_document_destroy(fyd2);
+	fy_document_destroy(fyd1);
+
+	/* a large mapping of complex keys */
+	buf = malloc(8192);
+	ck_assert_ptr_ne(buf, NULL);
+	p = buf;
+	p += sprintf(p, "{ ");
+	for (i = 0; i < 64; i++)
+		p += sprintf(p, "[ key, %u ]: %u, ", i, i);
+	p += sprintf(p, "{ x: y }: last }");
+
+	fyd1 = fy_document_build_from_string(NULL, buf, FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+
+	fydk = fy_document_build_from_string(NULL, "[ key, 42 ]", FY_NT);
+	ck_assert_ptr_ne(fydk, NULL);
+	fyn_key = fy_document_root(fydk);
+
+	for (i = 0; i < 2; i++) {
+		fynp = fy_node_mapping_lookup_pair(fy_document_root(fyd1), fyn_key);
+		ck_assert_ptr_ne(fynp, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fy_node_pair_value(fynp)), "42");
+	}
+
+	fyd2 = fy_document_build_from_string(NULL, buf, FY_NT);
+	ck_assert_ptr_ne(fyd2, NULL);
+	ck_assert(fy_node_compare(fy_document_root(fyd1), fy_document_root(fyd2)));
+	fy_document_destroy(fyd2);
+
+	/* a key changed in place is found by its new content */
+	fynp = fy_node_mapping_lookup_pair(fy_document_root(fyd1), fyn_key);
+	ck_assert_ptr_ne(fynp, NULL);
+	rc = fy_node_sequence_append(fy_node_pair_key(fynp),
+				     fy_node_build_from_string(fyd1, "more", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	ck_assert_ptr_eq(fy_node_mapping_lookup_pair(fy_document_root(fyd1), fyn_key), NULL);
+	fy_document_destroy(fydk);
+
+	fydk = fy_document_build_from_string(NULL, "[ key, 42, more ]", FY_NT);
+	ck_assert_ptr_ne(fydk, NULL);
+	ck_assert_ptr_eq(fy_node_mapping_lookup_pair(fy_document_root(fyd1), fy_document_root(fydk)),
+			 fynp);
+	fy_document_destroy(fydk);
+	fy_document_destroy(fyd1);
+
+	/* duplicate complex keys are still caught */
+	fyd1 = fy_document_build_from_string(NULL, "{ [ a ]: 1, [ a ]: 2 }", FY_NT);
+	ck_assert_ptr_eq(fyd1, NULL);
+
+	free(buf);
+}
+END_TEST
+
+START_TEST(doc_copy_on_write)
+{
+	struct fy_document *fyd1, *fyd2;
+	struct fy_node *fyn, *fyn_copy;
+	char *buf;
+	int rc;
+
+	/* merge keys share the merged content */
+	fyd1 = fy_document_build_from_string(NULL,
+			"{ base: &b { x: [ 1, 2 ], y: { z: 1 } }, d: { <<: *b, w: 3 } }", FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+	rc = fy_document_resolve(fyd1);
+	ck_assert_int_eq(rc, 0);
+
+	buf = fy_emit_node_to_string(fy_document_root(fyd1), FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{base: {x: [1, 2], y: {z: 1}}, d: {y: {z: 1}, x: [1, 2], w: 3}}");
+	free(buf);
+
+	/* changing the source leaves the merged copy alone */
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/base/x", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	rc = fy_node_sequence_append(fyn, fy_node_build_from_string(fyd1, "3", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/base/y/z", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	fyn_copy = fy_node_build_from_string(fyd1, "changed", FY_NT);
+	ck_assert_ptr_ne(fyn_copy, NULL);
+	rc = fy_node_insert(fyn, fyn_copy);
+	ck_assert_int_eq(rc, 0);
+	fy_node_free(fyn_copy);
+
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/d", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert(fy_node_compare_string(fyn, "{ x: [ 1, 2 ], y: { z: 1 }, w: 3 }", FY_NT));
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/base", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert(fy_node_compare_string(fyn, "{ x: [ 1, 2, 3 ], y: { z: changed } }", FY_NT));
+
+	/* and changing the copy leaves the source alone */
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/d/x", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	rc = fy_node_sequence_append(fyn, fy_node_build_from_string(fyd1, "4", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/base/x", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert(fy_node_compare_string(fyn, "[ 1, 2, 3 ]", FY_NT));
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/d/x", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert(fy_node_compare_string(fyn, "[ 1, 2, 4 ]", FY_NT));
+
+	fy_document_destroy(fyd1);
+
+	/* copies keep their content when the source changes */
+	fyd1 = fy_document_build_from_string(NULL, "{ a: { b: [ 1, 2 ] }, c: 3 }", FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+	fyd2 = fy_document_build_from_string(NULL, "{ a: { d: 4 }, e: [ 5 ] }", FY_NT);
+	ck_assert_ptr_ne(fyd2, NULL);
+
+	fyn_copy = fy_node_copy(fyd2, fy_document_root(fyd1));
+	ck_assert_ptr_ne(fyn_copy, NULL);
+	ck_assert(fy_node_compare(fyn_copy, fy_document_root(fyd1)));
+
+	/* overlay on top of the source */
+	rc = fy_node_insert(fy_document_root(fyd1), fy_document_root(fyd2));
+	ck_assert_int_eq(rc, 0);
+	ck_assert(fy_node_compare_string(fy_document_root(fyd1),
+				"{ a: { d: 4 }, c: 3, e: [ 5 ] }", FY_NT));
+
+	ck_assert(fy_node_compare_string(fyn_copy, "{ a: { b: [ 1, 2 ] }, c: 3 }", FY_NT));
+	fy_node_free(fyn_copy);
+
+	fy_document_destroy(fyd2);
+	fy_document_destroy(fyd1);
+
+	/* inserting a node of the same document */
+	fyd1 = fy_document_build_from_string(NULL, "{ a: [ 1 ] }", FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+	rc = fy_document_insert_at(fyd1, "/", FY_NT,
+			fy_node_build_from_string(fyd1, "{ b: { c: [ 2, 3 ] } }", FY_NT));
+	ck_assert_int_eq(rc, 0);
+
+	buf = fy_emit_document_to_string(fyd1, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{a: [1], b: {c: [2, 3]}}\n");
+	free(buf);
+
+	fy_document_destroy(fyd1);
+
+	/* changing keys, or what was put in place of a value, leaves the copies alone */
+	fyd1 = fy_document_build_from_string(NULL, "{ a: 1, [ k ]: 2, b: 3 }", FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+	fyd2 = fy_document_build_from_string(NULL, "[ ]", FY_NT);
+	ck_assert_ptr_ne(fyd2, NULL);
+
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/a", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	fyn_copy = fy_node_build_from_string(fyd1, "[ x ]", FY_NT);
+	ck_assert_ptr_ne(fyn_copy, NULL);
+	rc = fy_node_insert(fyn, fyn_copy);
+	ck_assert_int_eq(rc, 0);
+	fy_node_free(fyn_copy);
+	fy_node_pair_set_value(fy_node_mapping_get_by_index(fy_document_root(fyd1), 2),
+			       fy_node_build_from_string(fyd1, "[ y ]", FY_NT));
+
+	fyn_copy = fy_node_copy(fyd2, fy_document_root(fyd1));
+	ck_assert_ptr_ne(fyn_copy, NULL);
+	rc = fy_node_sequence_append(fy_document_root(fyd2), fyn_copy);
+	ck_assert_int_eq(rc, 0);
+
+	rc = fy_node_set_tag(fy_node_pair_key(fy_node_mapping_get_by_index(fy_document_root(fyd1), 0)),
+			     "!t", FY_NT);
+	ck_assert_int_eq(rc, 0);
+	fyn = fy_node_pair_key(fy_node_mapping_get_by_index(fy_document_root(fyd1), 1));
+	rc = fy_node_sequence_append(fyn, fy_node_build_from_string(fyd1, "l", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/a", FY_NT, FYNWF_DONT_FOLLOW);
+	rc = fy_node_sequence_append(fyn, fy_node_build_from_string(fyd1, "xx", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/b", FY_NT, FYNWF_DONT_FOLLOW);
+	rc = fy_node_sequence_append(fyn, fy_node_build_from_string(fyd1, "yy", FY_NT));
+	ck_assert_int_eq(rc, 0);
+
+	buf = fy_emit_document_to_string(fyd2, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "[{a: [x], ? [k] : 2, b: [y]}]\n");
+	free(buf);
+	buf = fy_emit_document_to_string(fyd1, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{!t a: [x, xx], ? [k, l] : 2, b: [y, yy]}\n");
+	free(buf);
+
+	fy_document_destroy(fyd2);
+	fy_document_destroy(fyd1);
+
+	/* inserting an ancestor copies what it was */
+	fyd1 = fy_document_build_from_string(NULL, "{ s: 0, t: 1 }", FY_NT);
+	ck_assert_ptr_ne(fyd1, NULL);
+	fyn = fy_node_by_path(fy_document_root(fyd1), "/s", FY_NT, FYNWF_DONT_FOLLOW);
+	rc = fy_node_insert(fyn, fy_document_root(fyd1));
+	ck_assert_int_eq(rc, 0);
+	buf = fy_emit_document_to_string(fyd1, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, "{s: {s: 0, t: 1}, t: 1}\n");
+	free(buf);
+	fy_document_destroy(fyd1);
+}
+END_TEST
+
+struct emit_bulk_state {
+	char *buf;
+	size_t size;
+	size_t alloc;
+	int calls;
+};
+
+static int emit_bulk_output(struct fy_emitter *emit, const struct iovec *iov, int iovcnt, void *userdata)
+{
+	struct emit_bulk_state *state = userdata;
+	int i, total = 0;
+
+	state->calls++;
+	for (i = 0; i < iovcnt; i++) {
+		if (state->size + iov[i].iov_len + 1 > state->alloc) {
+			state->alloc = (state->size + iov[i].iov_len + 1) * 2;
+			state->buf = realloc(state->buf, state->alloc);
+			ck_assert_ptr_ne(state->buf, NULL);
+		}
+		memcpy(state->buf + state->size, iov[i].iov_base, iov[i].iov_len);
+		state->size += iov[i].iov_len;
+		total += iov[i].iov_len;
+	}
+	state->buf[state->size] = '\0';
+
+	return total;
+}
+
+START_TEST(doc_emit_bulk_output)
+{
+	struct fy_document *fyd;
+	struct fy_node *fyn_seq;
+	struct fy_emitter_cfg cfg;
+	struct fy_emitter *emit;
+	struct emit_bulk_state state;
+	char *buf;
+	int i, rc;
+
+	fyd = fy_document_build_from_string(NULL,
+			"# a comment\n"
+			"foo: \"quoted\"\n"
+			"bar: &anchor 'single'\n"
+			"baz: *anchor\n"
+			"seq: [ ]\n", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fyn_seq = fy_node_by_path(fy_document_root(fyd), "/seq", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn_seq, NULL);
+	for (i = 0; i < 1000; i++) {
+		rc = fy_node_sequence_append(fyn_seq,
+				fy_node_buildf(fyd, "item-%d", i));
+		ck_assert_int_eq(rc, 0);
+	}
+
+	buf = fy_emit_document_to_string(fyd, FYECF_DEFAULT);
+	ck_assert_ptr_ne(buf, NULL);
+
+	memset(&state, 0, sizeof(state));
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.flags = FYECF_DEFAULT;
+	cfg.output_bulk = emit_bulk_output;
+	cfg.output_buffer_size = 256;
+	cfg.userdata = &state;
+
+	emit = fy_emitter_create(&cfg);
+	ck_assert_ptr_ne(emit, NULL);
+	rc = fy_emit_document(emit, fyd);
+	ck_assert_int_eq(rc, 0);
+	fy_emitter_destroy(emit);
+
+	/* same output, handed over in a few large chunks */
+	ck_assert_ptr_ne(state.buf, NULL);
+	ck_assert_str_eq(state.buf, buf);
+	ck_assert_int_le(state.calls, (int)(state.size / 256) + 2);
+
+	free(state.buf);
+	free(buf);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_emit_original_passthrough)
+{
+	static const char *src =
+		"a: |\n"
+		"  line1\n"
+		"\n"
+		"   more\n"
+		"  end\n"
+		"b: 'it''s'\n"
+		"c: \"multi\n"
+		"  line \\t q\"\n"
+		"d: plain\n"
+		"  multi\n"
+		"e: >\n"
+		"  folded\n"
+		"\n"
+		"  para\n";
+	struct fy_document *fyd;
+	char *buf;
+
+	fyd = fy_document_build_from_string(NULL, src, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	/* unmodified scalars are output as in the source */
+	buf = fy_emit_document_to_string(fyd, FYECF_DEFAULT);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_str_eq(buf, src);
+	free(buf);
+
+	/* but not when the mode is not the original */
+	buf = fy_emit_document_to_string(fyd, FYECF_MODE_BLOCK);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_ptr_ne(strstr(buf, "d: plain multi\n"), NULL);
+	free(buf);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_path_query)
+{
+	static const char *paths[] = {
+		"/",
+		"",
+		"/foo",
+		"/foo/bar/[2]/baz",
+		"/foo/bar/1",
+		"/foo/bar/-1/baz",
+		"/foo/bar/9",
+		"/foo/\"quoted key\"",
+		"/{ complex: key }",
+		"/derived/x",
+		"/derived/y",
+		"/seq/[1]/[0]",
+		"/seq/[1][1]",
+		"/seq/1/1",
+		"/ali/bar/0",
+		"*f/bar/0",
+		"*f",
+		"*</foo/bar/1>",
+		"*nope/bar",
+		"/nope",
+		"/foo/nope",
+	};
+	static const enum fy_node_walk_flags walk_flags[] = {
+		FYNWF_DONT_FOLLOW,
+		FYNWF_FOLLOW,
+	};
+	const int count = sizeof(paths) / sizeof(paths[0]);
+	struct fy_path_query *fypqs[sizeof(paths) / sizeof(paths[0])];
+	struct fy_node *fyns[sizeof(paths) / sizeof(paths[0])];
+	struct fy_document *fyd;
+	struct fy_node *fyn;
+	unsigned int f;
+	int i, rc;
+
+	fyd = fy_document_build_from_string(NULL,
+			"foo: &f\n"
+			"  bar: [ 1, 2, { baz: 3 } ]\n"
+			"  \"quoted key\": q\n"
+			"{ complex: key }: complex\n"
+			"base: &b { x: 10 }\n"
+			"derived:\n"
+			"  <<: *b\n"
+			"  y: 20\n"
+			"seq: [ a, [ b, c ] ]\n"
+			"ali: *f\n", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	for (f = 0; f < sizeof(walk_flags) / sizeof(walk_flags[0]); f++) {
+
+		/* same results as the uncompiled lookups */
+		for (i = 0; i < count; i++) {
+			fypqs[i] = fy_path_query_create(paths[i], FY_NT, walk_flags[f]);
+			ck_assert_ptr_ne(fypqs[i], NULL);
+
+			fyn = fy_node_by_path(fy_document_root(fyd), paths[i], FY_NT, walk_flags[f]);
+			ck_assert_ptr_eq(fy_path_query_exec(fypqs[i], fy_document_root(fyd)), fyn);
+			/* twice, nothing cached by the first execution */
+			ck_assert_ptr_eq(fy_path_query_exec(fypqs[i], fy_document_root(fyd)), fyn);
+		}
+
+		/* and in a batch, sharing the prefixes */
+		rc = fy_path_query_exec_batch(fypqs, count, fy_document_root(fyd), fyns);
+		ck_assert_int_eq(rc, 0);
+		for (i = 0; i < count; i++)
+			ck_assert_ptr_eq(fyns[i], fy_node_by_path(fy_document_root(fyd),
+						paths[i], FY_NT, walk_flags[f]));
+
+		for (i = 0; i < count; i++)
+			fy_path_query_destroy(fypqs[i]);
+	}
+
+	/* a few spot checks */
+	fypqs[0] = fy_path_query_create("/foo/bar/[2]/baz", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fypqs[0], NULL);
+	fyn = fy_path_query_exec(fypqs[0], fy_document_root(fyd));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "3");
+	fy_path_query_destroy(fypqs[0]);
+
+	fypqs[0] = fy_path_query_create("/derived/x", FY_NT, FYNWF_FOLLOW);
+	ck_assert_ptr_ne(fypqs[0], NULL);
+	fyn = fy_path_query_exec(fypqs[0], fy_document_root(fyd));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "10");
+	fy_path_query_destroy(fypqs[0]);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_scanf_program)
+{
+	struct fy_document *fyd;
+	struct fy_scanf_program *fysp;
+	int i, ivar, ivar2, rc;
+	long lvar;
+	unsigned int uvar, xvar;
+	short hvar;
+	long long llvar;
+	double dvar;
+	float fvar;
+	char svar[16], svar2[16];
+
+	fyd = fy_document_build_from_string(NULL,
+			"{ count: 42, big: -9223372036854775807, neg: -7, hex: 0x1f, "
+			"mask: ff, oct: '010', ratio: 0.25, scale: 1.5e3, name: frob, "
+			"nested: { list: [ 1, 2, 3 ] }, text: 12abc, huge: 99999999999999999999 }",
+			FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	fysp = fy_scanf_compile("/count %d /big %lld /neg %hd /hex %i /mask %x "
+				"/oct %i /ratio %lf /scale %f /name %15s /nested/list/[2] %u");
+	ck_assert_ptr_ne(fysp, NULL);
+
+	/* run it a few times, the program is reusable */
+	for (i = 0; i < 3; i++) {
+		ivar = -1;
+		rc = fy_scanf_program_exec(fysp, fy_document_root(fyd),
+				&ivar, &llvar, &hvar, &ivar2, &xvar, &lvar, &dvar, &fvar, svar, &uvar);
+		ck_assert_int_eq(rc, 10);
+		ck_assert_int_eq(ivar, 42);
+		ck_assert(llvar == -9223372036854775807LL);
+		ck_assert_int_eq(hvar, -7);
+		ck_assert_int_eq(ivar2, 31);
+		ck_assert_int_eq(xvar, 255);
+		ck_assert_int_eq(dvar == 0.25, 1);
+		ck_assert_int_eq(fvar == 1500.0f, 1);
+		ck_assert_str_eq(svar, "frob");
+		ck_assert_int_eq(uvar, 3);
+	}
+	fy_scanf_program_destroy(fysp);
+
+	/* %li is a long, the octal prefix is honoured */
+	fysp = fy_scanf_compile("/oct %li");
+	ck_assert_ptr_ne(fysp, NULL);
+	rc = fy_scanf_program_exec(fysp, fy_document_root(fyd), &lvar);
+	ck_assert_int_eq(rc, 1);
+	ck_assert_int_eq(lvar, 8);
+	fy_scanf_program_destroy(fysp);
+
+	/* partial matches and overflow behave exactly like sscanf */
+	fysp = fy_scanf_compile("/text %d /huge %d");
+	ck_assert_ptr_ne(fysp, NULL);
+	rc = fy_scanf_program_exec(fysp, fy_document_root(fyd), &ivar, &ivar2);
+	ck_assert_int_eq(rc, 2);
+	ck_assert_int_eq(ivar, 12);
+	sscanf("99999999999999999999", "%d", &i);
+	ck_assert_int_eq(ivar2, i);
+	fy_scanf_program_destroy(fysp);
+
+	/* stops at the first path that doesn't match */
+	fysp = fy_scanf_compile("/count %d /missing %d /neg %d");
+	ck_assert_ptr_ne(fysp, NULL);
+	rc = fy_scanf_program_exec(fysp, fy_document_root(fyd), &ivar, &ivar2, &i);
+	ck_assert_int_eq(rc, 1);
+	fy_scanf_program_destroy(fysp);
+
+	/* and a collection is not a scalar */
+	fysp = fy_scanf_compile("/nested %15s");
+	ck_assert_ptr_ne(fysp, NULL);
+	rc = fy_scanf_program_exec(fysp, fy_document_root(fyd), svar2);
+	ck_assert_int_eq(rc, 0);
+	fy_scanf_program_destroy(fysp);
+
+	/* a format without a specifier is invalid */
+	fysp = fy_scanf_compile("/count");
+	ck_assert_ptr_eq(fysp, NULL);
+
+	/* the plain interface gives the same results */
+	rc = fy_document_scanf(fyd, "/count %d /nested/list/[1] %u /name %15s",
+			       &ivar, &uvar, svar2);
+	ck_assert_int_eq(rc, 3);
+	ck_assert_int_eq(ivar, 42);
+	ck_assert_int_eq(uvar, 2);
+	ck_assert_str_eq(svar2, "frob");
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(doc_snapshot)
+{
+	static const char *yaml =
+		"%TAG !e! tag:example.com,2019:\n"
+		"---\n"
+		"base: &base { x: 1, y: 'two' }\n"
+		"derived:\n"
+		"  <<: *base\n"
+		"  z: !e!point [ 1, 2 ]\n"
+		"text: |\n"
+		"  line one\n"
+		"  line two\n"
+		"quoted: \"tab\\there\"\n"
+		"spaces: \"a\\r\\nb\\n  \"\n"
+		"blank: ' '\n"
+		"trailing: 'a '\n"
+		"typed: !!str 42\n"
+		"empty:\n"
+		"list:\n"
+		"- a\n"
+		"- { b: c }\n"
+		"- []\n";
+	struct fy_parse_cfg cfg = {
+		.flags = FYPCF_QUIET | FYPCF_RESOLVE_DOCUMENT,
+	};
+	const struct fy_parse_cfg *cfgs[2] = { NULL, &cfg };
+	char file[] = "/tmp/libfyaml-snapshot-XXXXXX";
+	struct fy_document *fyd, *fyds;
+	struct fy_node *fyn;
+	const char *tag;
+	char *buf1, *buf2;
+	size_t len;
+	FILE *fp;
+	int fd, i;
+
+	fd = mkstemp(file);
+	ck_assert_int_ne(fd, -1);
+	close(fd);
+
+	/* both unresolved (with aliases) and resolved */
+	for (i = 0; i < 2; i++) {
+		fyd = fy_document_build_from_string(cfgs[i], yaml, FY_NT);
+		ck_assert_ptr_ne(fyd, NULL);
+
+		ck_assert_int_eq(fy_document_save_snapshot(fyd, file), 0);
+
+		fyds = fy_document_load_snapshot(NULL, file);
+		ck_assert_ptr_ne(fyds, NULL);
+
+		ck_assert(fy_node_compare(fy_document_root(fyd), fy_document_root(fyds)));
+
+		buf1 = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+		buf2 = fy_emit_document_to_string(fyds, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+		ck_assert_ptr_ne(buf1, NULL);
+		ck_assert_ptr_ne(buf2, NULL);
+		ck_assert_str_eq(buf1, buf2);
+		free(buf1);
+		free(buf2);
+
+		/* the accessors work as usual */
+		fyn = fy_node_by_path(fy_document_root(fyds), "/list/1/b", FY_NT, FYNWF_DONT_FOLLOW);
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fyn), "c");
+		fyn = fy_node_by_path(fy_document_root(fyds), "/text", FY_NT, FYNWF_DONT_FOLLOW);
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fyn), "line one\nline two\n");
+		fyn = fy_node_by_path(fy_document_root(fyds), "/blank", FY_NT, FYNWF_DONT_FOLLOW);
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fyn), " ");
+		fyn = fy_node_by_path(fy_document_root(fyds), "/trailing", FY_NT, FYNWF_DONT_FOLLOW);
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fyn), "a ");
+		fyn = fy_node_by_path(fy_document_root(fyds), "/typed", FY_NT, FYNWF_DONT_FOLLOW);
+		ck_assert_ptr_ne(fyn, NULL);
+		tag = fy_node_get_tag(fyn, &len);
+		ck_assert_ptr_ne(tag, NULL);
+		ck_assert(len == strlen("tag:yaml.org,2002:str") && !memcmp(tag, "tag:yaml.org,2002:str", len));
+		ck_assert_ptr_ne(fy_node_get_anchor(fy_node_by_path(fy_document_root(fyds),
+					"/base", FY_NT, FYNWF_DONT_FOLLOW)), NULL);
+
+		/* and it can be modified */
+		ck_assert_int_eq(fy_node_mapping_append(fy_document_root(fyds),
+					fy_node_build_from_string(fyds, "new", FY_NT),
+					fy_node_build_from_string(fyds, "value", FY_NT)), 0);
+		fyn = fy_node_by_path(fy_document_root(fyds), "/new", FY_NT, FYNWF_DONT_FOLLOW);
+		ck_assert_ptr_ne(fyn, NULL);
+		ck_assert_str_eq(fy_node_get_scalar0(fyn), "value");
+
+		fy_document_destroy(fyds);
+		fy_document_destroy(fyd);
+	}
+
+	/* the non-specific tag and an overridden '!' handle */
+	fyd = fy_document_build_from_string(NULL,
+			"%TAG ! tag:example.com,2019:\n"
+			"--- !shape\n"
+			"- ! a\n"
+			"- !circle { r: &r 7 }\n"
+			"- *r\n", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_int_eq(fy_document_save_snapshot(fyd, file), 0);
+	fyds = fy_document_load_snapshot(NULL, file);
+	ck_assert_ptr_ne(fyds, NULL);
+	buf1 = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	buf2 = fy_emit_document_to_string(fyds, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf1, NULL);
+	ck_assert_ptr_ne(buf2, NULL);
+	ck_assert_str_eq(buf1, buf2);
+	free(buf2);
+	fyn = fy_node_by_path(fy_document_root(fyds), "/1", FY_NT, FYNWF_DONT_FOLLOW);
+	tag = fy_node_get_tag(fyn, &len);
+	ck_assert_ptr_ne(tag, NULL);
+	ck_assert(len == strlen("tag:example.com,2019:circle") &&
+		  !memcmp(tag, "tag:example.com,2019:circle", len));
+
+	/* a copy in another document outlives the snapshot */
+	fy_document_destroy(fyd);
+	fyd = fy_document_build_from_string(NULL, "[ ]", FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn = fy_node_copy(fyd, fy_document_root(fyds));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_int_eq(fy_node_sequence_append(fy_document_root(fyd), fyn), 0);
+	fy_document_destroy(fyds);
+	buf2 = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE | FYECF_WIDTH_INF);
+	ck_assert_ptr_ne(buf2, NULL);
+	ck_assert_str_eq(buf2, "[!shape [! a, !circle {r: &r 7}, *r]]\n");
+	free(buf1);
+	free(buf2);
+	fy_document_destroy(fyd);
+
+	/* a bad snapshot is refused */
+	fp = fopen(file, "wb");
+	ck_assert_ptr_ne(fp, NULL);
+	fputs(yaml, fp);
+	fclose(fp);
+	ck_assert_ptr_eq(fy_document_load_snapshot(NULL, file), NULL);
+
+	unlink(file);
+}
+END_TEST
+
 TCase *libfyaml_case_core(void)
 {
 	TCase *tc;
@@ -876,6 +3208,9 @@ TCase *libfyaml_case_core(void)
 
 	tcase_add_test(tc, doc_path_access);
 	tcase_add_test(tc, doc_path_node);
+	tcase_add_test(tc, doc_path_query);
+	tcase_add_test(tc, doc_scanf_program);
+	tcase_add_test(tc, doc_snapshot);
 
 	tcase_add_test(tc, doc_create_empty_seq1);
 	tcase_add_test(tc, doc_create_empty_seq2);
@@ -887,8 +3222,35 @@ TCase *libfyaml_case_core(void)
 
 	tcase_add_test(tc, doc_insert_remove_seq);
 	tcase_add_test(tc, doc_insert_remove_map);
+	tcase_add_test(tc, doc_large_mapping);
+	tcase_add_test(tc, doc_arena);
+	tcase_add_test(tc, doc_indexed_access);
+	tcase_add_test(tc, doc_build_all_parallel);
+	tcase_add_test(tc, parse_caller_events);
+	tcase_add_test(tc, parse_feed);
+	tcase_add_test(tc, parse_feed_ahead);
+	tcase_add_test(tc, parse_validate);
+	tcase_add_test(tc, parse_validate_duplicate_keys);
+	tcase_add_test(tc, parse_stats);
+	tcase_add_test(tc, parse_reset);
+	tcase_add_test(tc, doc_reparse);
+	tcase_add_test(tc, doc_scalar_zero_copy);
+	tcase_add_test(tc, doc_scalar_numbers_locale);
+	tcase_add_test(tc, node_typed_scalars);
+	tcase_add_test(tc, doc_load_path);
+	tcase_add_test(tc, doc_build_direct);
+	tcase_add_test(tc, doc_build_direct_block_styles);
+	tcase_add_test(tc, doc_intern_keys);
+	tcase_add_test(tc, doc_freeze);
+	tcase_add_test(tc, doc_anchor_index);
+	tcase_add_test(tc, doc_node_hash);
+	tcase_add_test(tc, doc_copy_on_write);
+	tcase_add_test(tc, doc_emit_bulk_output);
+	tcase_add_test(tc, doc_emit_original_passthrough);
 
 	tcase_add_test(tc, doc_sort);
+	tcase_add_test(tc, doc_sort_large);
+	tcase_add_test(tc, doc_sort_user);
 
 	tcase_add_test(tc, doc_join_scalar_to_scalar);
 	tcase_add_test(tc, doc_join_scalar_to_map);
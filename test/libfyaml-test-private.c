@@ -92,6 +92,147 @@ START_TEST(scan_simple)
 }
 END_TEST
 
+START_TEST(lazy_document)
+{
+	static const struct fy_parse_cfg cfg = {
+		.search_path = "",
+		.flags = FYPCF_QUIET | FYPCF_LAZY_DOCUMENT,
+	};
+	static const char yaml[] =
+		"a: { b: [ 1, 2, 3 ], c: { d: e } }\n"
+		"f:\n"
+		"  - &x { g: h }\n"
+		"  - *x\n"
+		"i: [ j, k ]\n";
+	struct fy_document *fyd, *fyd_eager;
+	struct fy_node *fyn_root, *fyn_a, *fyn_c, *fyn_i, *fyn;
+	char *buf, *buf_eager;
+	int rc;
+
+	fyd = fy_document_build_from_string(&cfg, yaml, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+
+	/* the root contains an anchor, so it was built */
+	fyn_root = fy_document_root(fyd);
+	ck_assert_ptr_ne(fyn_root, NULL);
+	ck_assert(!fyn_root->lazy);
+
+	fyn_a = fy_node_by_path(fyn_root, "/a", FY_NT, FYNWF_DONT_FOLLOW);
+	fyn_i = fy_node_by_path(fyn_root, "/i", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn_a, NULL);
+	ck_assert_ptr_ne(fyn_i, NULL);
+	ck_assert(fyn_a->lazy);
+	ck_assert(fyn_i->lazy);
+
+	/* the anchored mapping is registered but its contents are not built */
+	fyn = fy_anchor_node(fy_document_lookup_anchor(fyd, "x", FY_NT));
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert(fyn->lazy);
+
+	/* a lookup only builds the path to the node */
+	fyn = fy_node_by_path(fyn_root, "/a/b/1", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "2");
+	ck_assert(!fyn_a->lazy);
+	ck_assert_ptr_eq(fyn->parent->parent, fyn_a);
+	fyn_c = fy_node_by_path(fyn_a, "/c", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn_c, NULL);
+	ck_assert(fyn_c->lazy);
+	ck_assert(fyn_i->lazy);
+
+	/* item counts work as usual */
+	ck_assert_int_eq(fy_node_sequence_item_count(fyn_i), 2);
+	ck_assert(!fyn_i->lazy);
+
+	/* the emitted document is the same as the fully built one */
+	fyd_eager = fy_document_build_from_string(NULL, yaml, FY_NT);
+	ck_assert_ptr_ne(fyd_eager, NULL);
+
+	buf = fy_emit_document_to_string(fyd, FYECF_MODE_FLOW_ONELINE);
+	buf_eager = fy_emit_document_to_string(fyd_eager, FYECF_MODE_FLOW_ONELINE);
+	ck_assert_ptr_ne(buf, NULL);
+	ck_assert_ptr_ne(buf_eager, NULL);
+	ck_assert_str_eq(buf, buf_eager);
+	free(buf);
+	free(buf_eager);
+
+	ck_assert(fy_node_compare(fyn_root, fy_document_root(fyd_eager)));
+
+	/* resolution builds everything */
+	rc = fy_document_resolve(fyd);
+	ck_assert_int_eq(rc, 0);
+	fyn = fy_node_by_path(fyn_root, "/f/1/g", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_str_eq(fy_node_get_scalar0(fyn), "h");
+
+	fy_document_destroy(fyd_eager);
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(lazy_document_duplicate_keys)
+{
+	static const struct fy_parse_cfg cfg = {
+		.search_path = "",
+		.flags = FYPCF_QUIET | FYPCF_LAZY_DOCUMENT,
+	};
+	static const char * const bad[] = {
+		"{ a: 1, a: 2 }",
+		"a: { b: [ { c: 1, 'c': 2 } ] }",
+		"- &x a\n- { *x : 1, *x : 2 }",
+		"{ ? : 1, '': 2 }",
+		"a: { b: { [ c ]: 1, [ c ]: 2 } }",
+		"- { { a: 1, b: 2 }: x, { b: 2, a: 1 }: y }",
+	};
+	static const char * const good[] = {
+		"a: { b: 1 }\nc: { b: 1 }",
+		"- &x a\n- { *x : 1, x : 2 }",
+		"a: { b: { [ c ]: 1, [ d ]: 2, c: 3 } }",
+		"- { { a: 1 }: x, { a: 2 }: y, [ a ]: z }",
+	};
+	struct fy_document *fyd;
+	char *buf, *p;
+	unsigned int i;
+
+	/* refused at once, just like the eager builder does */
+	for (i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+		fyd = fy_document_build_from_string(&cfg, bad[i], FY_NT);
+		ck_assert_ptr_eq(fyd, NULL);
+		fyd = fy_document_build_from_string(NULL, bad[i], FY_NT);
+		ck_assert_ptr_eq(fyd, NULL);
+	}
+
+	for (i = 0; i < sizeof(good) / sizeof(good[0]); i++) {
+		fyd = fy_document_build_from_string(&cfg, good[i], FY_NT);
+		ck_assert_ptr_ne(fyd, NULL);
+		ck_assert_int_eq(fy_document_resolve(fyd), 0);
+		fy_document_destroy(fyd);
+	}
+
+	/* a large mapping, checked through its key index */
+	buf = malloc(16384);
+	ck_assert_ptr_ne(buf, NULL);
+	p = buf;
+	p += sprintf(p, "{ nested: { ");
+	for (i = 0; i < 500; i++)
+		p += sprintf(p, "k%u: %u, ", i, i);
+	p += sprintf(p, "k%u: again } }", 123);
+
+	fyd = fy_document_build_from_string(&cfg, buf, FY_NT);
+	ck_assert_ptr_eq(fyd, NULL);
+
+	/* without the duplicate it's fine */
+	strcpy(strrchr(buf, 'k'), "last: once } }");
+	fyd = fy_document_build_from_string(&cfg, buf, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	ck_assert_int_eq(fy_node_mapping_item_count(fy_node_by_path(fy_document_root(fyd),
+					"/nested", FY_NT, FYNWF_DONT_FOLLOW)), 501);
+	fy_document_destroy(fyd);
+
+	free(buf);
+}
+END_TEST
+
 START_TEST(parse_simple)
 {
 	struct fy_parser ctx, *fyp = &ctx;
@@ -152,6 +293,348 @@ START_TEST(parse_simple)
 }
 END_TEST
 
+START_TEST(scan_long_scalars)
+{
+	struct fy_parser ctx, *fyp = &ctx;
+	const struct fy_parse_cfg *cfg = &default_parse_cfg;
+	static const char yaml[] =
+		"plain-scalar-that-is-much-longer-than-a-block: value:with:colons-and-more-text-here\n"
+		"'single quoted ''text'' that spans more than sixteen octets': "
+			"\"double \\\"quoted\\\" value\\twith escapes and more\"\n";
+	static const struct fy_input_cfg fyic = {
+		.type		= fyit_memory,
+		.memory.data	= yaml,
+		.memory.size	= sizeof(yaml) - 1,
+	};
+	static const struct {
+		const char *text;
+		int line, column;
+	} expected[] = {
+		{ "plain-scalar-that-is-much-longer-than-a-block", 0, 45 },
+		{ "value:with:colons-and-more-text-here", 0, 83 },
+		{ "single quoted 'text' that spans more than sixteen octets", 1, 59 },
+		{ "double \"quoted\" value\twith escapes and more", 1, 109 },
+	};
+	struct fy_token *fyt;
+	unsigned int count;
+	int rc;
+
+	/* setup */
+	rc = fy_parse_setup(fyp, cfg);
+	ck_assert_int_eq(rc, 0);
+
+	/* add the input */
+	rc = fy_parse_input_append(fyp, &fyic);
+	ck_assert_int_eq(rc, 0);
+
+	/* all scalars must match, with correct end marks */
+	count = 0;
+	while ((fyt = fy_scan(fyp)) != NULL) {
+		if (fyt->type == FYTT_SCALAR) {
+			ck_assert(count < sizeof(expected)/sizeof(expected[0]));
+			ck_assert_str_eq(fy_token_get_text0(fyt), expected[count].text);
+			ck_assert_int_eq(fyt->handle.end_mark.line, expected[count].line);
+			ck_assert_int_eq(fyt->handle.end_mark.column, expected[count].column);
+			count++;
+		}
+		fy_parse_token_recycle(fyp, fyt);
+	}
+	ck_assert_uint_eq(count, sizeof(expected)/sizeof(expected[0]));
+
+	/* cleanup */
+	fy_parse_cleanup(fyp);
+}
+END_TEST
+
+START_TEST(scan_comments_and_spaces)
+{
+	struct fy_parser ctx, *fyp = &ctx;
+	static const struct fy_parse_cfg cfg = {
+		.search_path = "",
+		.flags = FYPCF_QUIET | FYPCF_DEBUG_DEFAULT | FYPCF_DEBUG_LEVEL_WARNING |
+			 FYPCF_PARSE_COMMENTS,
+	};
+	static const char yaml[] =
+		"key:                      value   # a long comment\tthat goes past the block size\n"
+		"                                  # with a continuation\n"
+		"other:\t\t    x\n";
+	static const struct fy_input_cfg fyic = {
+		.type		= fyit_memory,
+		.memory.data	= yaml,
+		.memory.size	= sizeof(yaml) - 1,
+	};
+	static const struct {
+		const char *text;
+		int line, column;
+	} expected[] = {
+		{ "key", 0, 0 },
+		{ "value", 0, 26 },
+		{ "other", 2, 0 },
+		{ "x", 2, 12 },
+	};
+	struct fy_token *fyt;
+	unsigned int count;
+	int rc;
+
+	/* setup */
+	rc = fy_parse_setup(fyp, &cfg);
+	ck_assert_int_eq(rc, 0);
+
+	/* add the input */
+	rc = fy_parse_input_append(fyp, &fyic);
+	ck_assert_int_eq(rc, 0);
+
+	/* start marks must be correct after skipping spaces and comments */
+	count = 0;
+	while ((fyt = fy_scan(fyp)) != NULL) {
+		if (fyt->type == FYTT_SCALAR) {
+			ck_assert(count < sizeof(expected)/sizeof(expected[0]));
+			ck_assert_str_eq(fy_token_get_text0(fyt), expected[count].text);
+			ck_assert_int_eq(fyt->handle.start_mark.line, expected[count].line);
+			ck_assert_int_eq(fyt->handle.start_mark.column, expected[count].column);
+
+			if (count == 1) {
+				ck_assert(fy_atom_is_set(fy_token_comment(fyt, fycp_right)));
+				ck_assert(fy_token_comment(fyt, fycp_right)->has_ws);
+				ck_assert_int_eq(fy_token_comment(fyt, fycp_right)->end_mark.line, 1);
+			} else {
+				/* no storage for comments that are not there */
+				ck_assert_ptr_eq(fy_token_comment(fyt, fycp_right), NULL);
+			}
+			count++;
+		}
+		fy_parse_token_recycle(fyp, fyt);
+	}
+	ck_assert_uint_eq(count, sizeof(expected)/sizeof(expected[0]));
+
+	/* cleanup */
+	fy_parse_cleanup(fyp);
+}
+END_TEST
+
+START_TEST(stream_window)
+{
+	struct fy_parse_cfg cfg = {
+		.search_path = "",
+		.flags = FYPCF_QUIET | FYPCF_DEBUG_DEFAULT | FYPCF_DEBUG_LEVEL_WARNING |
+			 FYPCF_PARSE_COMMENTS,
+		.stream_window = 4096,
+	};
+	struct fy_parser *fyp;
+	struct fy_event *fye, *fye_prev = NULL;
+	char buf[64], prev[64] = "";
+	const char *text;
+	size_t len, max_allocated = 0;
+	unsigned int i, count, literal_len = 0;
+	FILE *fp;
+	int rc;
+
+	/* a stream much larger than the window, with a literal spanning blocks */
+	fp = tmpfile();
+	ck_assert_ptr_ne(fp, NULL);
+	for (i = 0; i < 20000; i++) {
+		fprintf(fp, "- key%u: \"value %u\"\t# comment %u\n", i, i, i);
+		if (i != 10000)
+			continue;
+		fprintf(fp, "- |\n");
+		for (count = 0; count < 400; count++)
+			fprintf(fp, "  literal line %03u\n", count);
+	}
+	rewind(fp);
+
+	fyp = fy_parser_create(&cfg);
+	ck_assert_ptr_ne(fyp, NULL);
+
+	rc = fy_parser_set_input_fp(fyp, "stream", fp);
+	ck_assert_int_eq(rc, 0);
+
+	count = 0;
+	while ((fye = fy_parser_parse(fyp)) != NULL) {
+		if (fyp->current_input && fyp->current_input->allocated > max_allocated)
+			max_allocated = fyp->current_input->allocated;
+
+		/* the previous scalar is still intact */
+		if (fye_prev) {
+			text = fy_token_get_text(fye_prev->scalar.value, &len);
+			ck_assert(len == strlen(prev) && !memcmp(text, prev, len));
+			fy_parser_event_free(fyp, fye_prev);
+			fye_prev = NULL;
+		}
+
+		if (fye->type != FYET_SCALAR) {
+			fy_parser_event_free(fyp, fye);
+			continue;
+		}
+
+		text = fy_token_get_text(fye->scalar.value, &len);
+		if (len > 64) {
+			/* the literal block */
+			ck_assert(!memcmp(text, "literal line 000\n", 17));
+			literal_len = len;
+			fy_parser_event_free(fyp, fye);
+			continue;
+		}
+
+		i = count / 2;
+		snprintf(buf, sizeof(buf), (count & 1) ? "value %u" : "key%u", i);
+		ck_assert(len == strlen(buf) && !memcmp(text, buf, len));
+		count++;
+
+		strcpy(prev, buf);
+		fye_prev = fye;
+	}
+	fy_parser_event_free(fyp, fye_prev);
+
+	ck_assert(!fy_parser_get_stream_error(fyp));
+	ck_assert_int_eq(count, 40000);
+	ck_assert_int_eq(literal_len, 400 * 17);
+
+	/* the stream is over a megabyte, but the buffer stays small */
+	ck_assert(max_allocated < 8 * 4096);
+
+	fy_parser_destroy(fyp);
+	fclose(fp);
+}
+END_TEST
+
+START_TEST(node_hash_cache)
+{
+	static const struct fy_parse_cfg lazy_cfg = {
+		.search_path = "",
+		.flags = FYPCF_QUIET | FYPCF_LAZY_DOCUMENT,
+	};
+	static const char yaml[] =
+		"a: { b: [ 1, *c, 3 ], c: { d: e, f: ~ } }\n"
+		"? [ k, l ]\n"
+		": [ m, n ]\n"
+		"? [ k, x ]\n"
+		": y\n"
+		"o: [ p, { ? { q: r } : s } ]\n";
+	struct fy_document *fyd, *fyd_lazy, *fyd_edit;
+	struct fy_node *fyn_root, *fyn_a, *fyn_o, *fyn_key, *fyn;
+	struct fy_node_pair *fynp;
+	uint32_t hash;
+	int rc;
+
+	fyd = fy_document_build_from_string(&default_parse_cfg, yaml, FY_NT);
+	ck_assert_ptr_ne(fyd, NULL);
+	fyn_root = fy_document_root(fyd);
+
+	/* the complex key hashed by the duplicate check is still cached */
+	fynp = fy_node_mapping_get_by_index(fyn_root, 1);
+	ck_assert_ptr_ne(fynp, NULL);
+	fyn_key = fy_node_pair_key(fynp);
+	ck_assert(fyn_key->hash_valid);
+
+	/* hashing the lazy document builds nothing, and agrees */
+	fyd_lazy = fy_document_build_from_string(&lazy_cfg, yaml, FY_NT);
+	ck_assert_ptr_ne(fyd_lazy, NULL);
+	ck_assert(fy_document_root(fyd_lazy)->lazy);
+	hash = fy_node_hash(fyn_root);
+	ck_assert_uint_eq(fy_node_hash(fy_document_root(fyd_lazy)), hash);
+	ck_assert(fy_document_root(fyd_lazy)->lazy);
+
+	/* and building it keeps the hash */
+	fyn = fy_node_by_path(fy_document_root(fyd_lazy), "/o/1", FY_NT, FYNWF_DONT_FOLLOW);
+	ck_assert_ptr_ne(fyn, NULL);
+	ck_assert_uint_eq(fy_node_hash(fy_document_root(fyd_lazy)), hash);
+	fy_document_destroy(fyd_lazy);
+
+	/* a change only drops the hashes of the path to the changed node */
+	fyn_a = fy_node_by_path(fyn_root, "/a", FY_NT, FYNWF_DONT_FOLLOW);
+	fyn_o = fy_node_by_path(fyn_root, "/o", FY_NT, FYNWF_DONT_FOLLOW);
+	fyn = fy_node_by_path(fyn_root, "/a/b", FY_NT, FYNWF_DONT_FOLLOW);
+	rc = fy_node_sequence_append(fyn, fy_node_build_from_string(fyd, "4", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	ck_assert(!fyn->hash_valid && !fyn_a->hash_valid && !fyn_root->hash_valid);
+	ck_assert(fyn_o->hash_valid && fyn_key->hash_valid);
+	ck_assert(fy_node_by_path(fyn_root, "/a/c", FY_NT, FYNWF_DONT_FOLLOW)->hash_valid);
+
+	fyd_edit = fy_document_build_from_string(&default_parse_cfg,
+		"a: { b: [ 1, *c, 3, 4 ], c: { d: e, f: ~ } }\n"
+		"? [ k, l ]\n"
+		": [ m, n ]\n"
+		"? [ k, x ]\n"
+		": y\n"
+		"o: [ p, { ? { q: r } : s } ]\n", FY_NT);
+	ck_assert_ptr_ne(fyd_edit, NULL);
+	ck_assert_uint_eq(fy_node_hash(fyn_root), fy_node_hash(fy_document_root(fyd_edit)));
+	fy_document_destroy(fyd_edit);
+
+	/* keys have no parent, a change under them still reaches the top */
+	fy_node_hash(fyn_root);
+	fyn = fy_node_by_path(fyn_root, "/o/1", FY_NT, FYNWF_DONT_FOLLOW);
+	fyn_key = fy_node_pair_key(fy_node_mapping_get_by_index(fyn, 0));
+	rc = fy_node_mapping_append(fyn_key, fy_node_build_from_string(fyd, "t", FY_NT),
+				    fy_node_build_from_string(fyd, "u", FY_NT));
+	ck_assert_int_eq(rc, 0);
+	ck_assert(!fyn->hash_valid && !fyn_o->hash_valid && !fyn_root->hash_valid);
+	ck_assert(fyn_a->hash_valid);
+
+	fyd_edit = fy_document_build_from_string(&default_parse_cfg,
+		"a: { b: [ 1, *c, 3, 4 ], c: { d: e, f: ~ } }\n"
+		"? [ k, l ]\n"
+		": [ m, n ]\n"
+		"? [ k, x ]\n"
+		": y\n"
+		"o: [ p, { ? { q: r, t: u } : s } ]\n", FY_NT);
+	ck_assert_ptr_ne(fyd_edit, NULL);
+	ck_assert_uint_eq(fy_node_hash(fyn_root), fy_node_hash(fy_document_root(fyd_edit)));
+	fy_document_destroy(fyd_edit);
+
+	fy_document_destroy(fyd);
+}
+END_TEST
+
+START_TEST(parallel_build_marks)
+{
+	static const char * const streams[] = {
+		"# comment\n--- a\n--- [ b,\n  c ]\n...\n%YAML 1.2\n---\nd: e\n",
+		"- a\r\r--- b\r...\r\rc: d\r",
+		"--- a\n\n--- b\n\0\n--- c\n",
+	};
+	static const size_t lengths[] = {
+		FY_NT, FY_NT, sizeof("--- a\n\n--- b\n\0\n--- c\n") - 1,
+	};
+	struct fy_parser *fyp;
+	struct fy_document *fyd, **fyds;
+	struct fy_mark start[8], end[8];
+	unsigned int i;
+	int j, count;
+
+	for (i = 0; i < sizeof(streams) / sizeof(streams[0]); i++) {
+		fyp = fy_parser_create(&default_parse_cfg);
+		ck_assert_ptr_ne(fyp, NULL);
+		ck_assert_int_eq(fy_parser_set_string(fyp, streams[i], lengths[i]), 0);
+
+		count = 0;
+		while ((fyd = fy_parse_load_document(fyp)) != NULL) {
+			ck_assert_int_lt(count, 8);
+			start[count] = fyd->fyds->start_mark;
+			end[count] = fyd->fyds->end_mark;
+			count++;
+			fy_parse_document_destroy(fyp, fyd);
+		}
+		fy_parser_destroy(fyp);
+		ck_assert_int_gt(count, 1);
+
+		/* the segments report the positions in the whole stream */
+		fyds = fy_document_build_all_from_string(&default_parse_cfg,
+							 streams[i], lengths[i], 2);
+		ck_assert_ptr_ne(fyds, NULL);
+		for (j = 0; fyds[j]; j++) {
+			ck_assert_int_lt(j, count);
+			ck_assert_int_eq(fyds[j]->fyds->start_mark.line, start[j].line);
+			ck_assert_int_eq(fyds[j]->fyds->start_mark.column, start[j].column);
+			ck_assert_int_eq(fyds[j]->fyds->end_mark.line, end[j].line);
+			fy_document_destroy(fyds[j]);
+		}
+		ck_assert_int_eq(j, count);
+		free(fyds);
+	}
+}
+END_TEST
+
 TCase *libfyaml_case_private(void)
 {
 	TCase *tc;
@@ -160,7 +643,14 @@ TCase *libfyaml_case_private(void)
 
 	tcase_add_test(tc, parser_setup);
 	tcase_add_test(tc, scan_simple);
+	tcase_add_test(tc, scan_long_scalars);
+	tcase_add_test(tc, scan_comments_and_spaces);
 	tcase_add_test(tc, parse_simple);
+	tcase_add_test(tc, lazy_document);
+	tcase_add_test(tc, lazy_document_duplicate_keys);
+	tcase_add_test(tc, stream_window);
+	tcase_add_test(tc, node_hash_cache);
+	tcase_add_test(tc, parallel_build_marks);
 
 	return tc;
 }